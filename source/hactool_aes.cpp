@@ -0,0 +1,612 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_aes.hpp"
+
+#if defined(ATMOSPHERE_ARCH_X64)
+#include <immintrin.h>
+#include <cpuid.h>
+#elif defined(ATMOSPHERE_ARCH_ARM64)
+#include <arm_neon.h>
+#if defined(ATMOSPHERE_OS_LINUX)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr size_t BlockSize      = 0x10;
+        constexpr size_t RoundCount     = 10;
+        constexpr size_t ParallelBlocks = 8;
+
+        constexpr const u8 Sbox[0x100] = {
+            0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+            0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+            0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+            0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+            0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+            0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+            0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+            0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+            0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+            0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+            0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+            0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+            0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+            0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+            0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+            0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
+        };
+
+        constexpr u8 GfMultiply(u8 a, u8 b) {
+            u8 res = 0;
+            while (b != 0) {
+                if (b & 1) {
+                    res ^= a;
+                }
+                a = static_cast<u8>((a << 1) ^ ((a & 0x80) ? 0x1B : 0x00));
+                b >>= 1;
+            }
+            return res;
+        }
+
+        u64 LoadBigEndian64(const u8 *src) {
+            u64 v = 0;
+            for (size_t i = 0; i < sizeof(u64); ++i) {
+                v = (v << 8) | src[i];
+            }
+            return v;
+        }
+
+        void StoreBigEndian64(u8 *dst, u64 v) {
+            for (size_t i = 0; i < sizeof(u64); ++i) {
+                dst[sizeof(u64) - 1 - i] = static_cast<u8>(v >> (8 * i));
+            }
+        }
+
+        u64 LoadLittleEndian64(const u8 *src) {
+            u64 v = 0;
+            for (size_t i = 0; i < sizeof(u64); ++i) {
+                v |= static_cast<u64>(src[i]) << (8 * i);
+            }
+            return v;
+        }
+
+        void StoreLittleEndian64(u8 *dst, u64 v) {
+            for (size_t i = 0; i < sizeof(u64); ++i) {
+                dst[i] = static_cast<u8>(v >> (8 * i));
+            }
+        }
+
+        void XorBlock(u8 *dst, const u8 *lhs, const u8 *rhs) {
+            for (size_t i = 0; i < BlockSize; ++i) {
+                dst[i] = lhs[i] ^ rhs[i];
+            }
+        }
+
+        /* Round keys are stored both for the forward cipher and for the equivalent inverse cipher, */
+        /* which is the layout consumed by both the x86 and arm decryption instructions. */
+        struct RoundKeys {
+            alignas(BlockSize) u8 encrypt[RoundCount + 1][BlockSize];
+            alignas(BlockSize) u8 decrypt[RoundCount + 1][BlockSize];
+            u8 key[BlockSize];
+        };
+
+        void ExpandKey(RoundKeys *out, const void *key) {
+            std::memcpy(out->key, key, BlockSize);
+            std::memcpy(out->encrypt[0], key, BlockSize);
+
+            /* Generate the forward schedule. */
+            u8 rcon = 0x01;
+            for (size_t r = 1; r <= RoundCount; ++r) {
+                const u8 *prev = out->encrypt[r - 1];
+                u8 *cur = out->encrypt[r];
+
+                cur[0] = prev[0] ^ Sbox[prev[13]] ^ rcon;
+                cur[1] = prev[1] ^ Sbox[prev[14]];
+                cur[2] = prev[2] ^ Sbox[prev[15]];
+                cur[3] = prev[3] ^ Sbox[prev[12]];
+                for (size_t i = 4; i < BlockSize; ++i) {
+                    cur[i] = prev[i] ^ cur[i - 4];
+                }
+
+                rcon = GfMultiply(rcon, 0x02);
+            }
+
+            /* Generate the inverse schedule, applying InvMixColumns to the inner round keys. */
+            std::memcpy(out->decrypt[0], out->encrypt[RoundCount], BlockSize);
+            std::memcpy(out->decrypt[RoundCount], out->encrypt[0], BlockSize);
+            for (size_t r = 1; r < RoundCount; ++r) {
+                const u8 *src = out->encrypt[RoundCount - r];
+                u8 *dst = out->decrypt[r];
+
+                for (size_t c = 0; c < BlockSize; c += 4) {
+                    const u8 a0 = src[c + 0], a1 = src[c + 1], a2 = src[c + 2], a3 = src[c + 3];
+                    dst[c + 0] = GfMultiply(a0, 14) ^ GfMultiply(a1, 11) ^ GfMultiply(a2, 13) ^ GfMultiply(a3,  9);
+                    dst[c + 1] = GfMultiply(a0,  9) ^ GfMultiply(a1, 14) ^ GfMultiply(a2, 11) ^ GfMultiply(a3, 13);
+                    dst[c + 2] = GfMultiply(a0, 13) ^ GfMultiply(a1,  9) ^ GfMultiply(a2, 14) ^ GfMultiply(a3, 11);
+                    dst[c + 3] = GfMultiply(a0, 11) ^ GfMultiply(a1, 13) ^ GfMultiply(a2,  9) ^ GfMultiply(a3, 14);
+                }
+            }
+        }
+
+        /* The counter is kept as a native 128-bit big-endian value split into halves. */
+        struct Counter {
+            u64 hi;
+            u64 lo;
+
+            ALWAYS_INLINE void Increment() {
+                if ((++lo) == 0) {
+                    ++hi;
+                }
+            }
+        };
+
+        struct AesKernels {
+            const char *name;
+            void (*compute_ctr)(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys, Counter &ctr);
+            void (*encrypt_blocks)(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys);
+            void (*decrypt_blocks)(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys);
+        };
+
+        /* Generic kernels, which use the library's block cipher. */
+        void ComputeCtrGeneric(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys, Counter &ctr) {
+            crypto::AesEncryptor128 aes;
+            aes.Initialize(keys.key, BlockSize);
+
+            u8 keystream[BlockSize];
+            for (size_t i = 0; i < num_blocks; ++i) {
+                StoreBigEndian64(keystream + 0, ctr.hi);
+                StoreBigEndian64(keystream + 8, ctr.lo);
+                ctr.Increment();
+
+                aes.EncryptBlock(keystream, BlockSize, keystream, BlockSize);
+                XorBlock(dst + i * BlockSize, src + i * BlockSize, keystream);
+            }
+        }
+
+        void EncryptBlocksGeneric(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys) {
+            crypto::AesEncryptor128 aes;
+            aes.Initialize(keys.key, BlockSize);
+
+            for (size_t i = 0; i < num_blocks; ++i) {
+                aes.EncryptBlock(dst + i * BlockSize, BlockSize, src + i * BlockSize, BlockSize);
+            }
+        }
+
+        void DecryptBlocksGeneric(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys) {
+            crypto::AesDecryptor128 aes;
+            aes.Initialize(keys.key, BlockSize);
+
+            for (size_t i = 0; i < num_blocks; ++i) {
+                aes.DecryptBlock(dst + i * BlockSize, BlockSize, src + i * BlockSize, BlockSize);
+            }
+        }
+
+        constexpr AesKernels GenericKernels = { "generic", ComputeCtrGeneric, EncryptBlocksGeneric, DecryptBlocksGeneric };
+
+        #if defined(ATMOSPHERE_ARCH_X64)
+
+        #define HACTOOL_AESNI_TARGET __attribute__((target("aes,sse4.1")))
+        #define HACTOOL_VAES_TARGET  __attribute__((target("aes,sse4.1,avx2,vaes")))
+
+        ALWAYS_INLINE __m128i MakeCounterBlock(Counter &ctr) {
+            const __m128i block = _mm_set_epi64x(static_cast<s64>(__builtin_bswap64(ctr.lo)), static_cast<s64>(__builtin_bswap64(ctr.hi)));
+            ctr.Increment();
+            return block;
+        }
+
+        HACTOOL_AESNI_TARGET void ComputeCtrAesNi(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys, Counter &ctr) {
+            __m128i rk[RoundCount + 1];
+            for (size_t r = 0; r <= RoundCount; ++r) {
+                rk[r] = _mm_load_si128(reinterpret_cast<const __m128i *>(keys.encrypt[r]));
+            }
+
+            /* Keep eight independent blocks in flight to hide the latency of aesenc. */
+            while (num_blocks >= ParallelBlocks) {
+                __m128i b[ParallelBlocks];
+                #pragma GCC unroll 8
+                for (size_t j = 0; j < ParallelBlocks; ++j) {
+                    b[j] = _mm_xor_si128(MakeCounterBlock(ctr), rk[0]);
+                }
+                for (size_t r = 1; r < RoundCount; ++r) {
+                    #pragma GCC unroll 8
+                    for (size_t j = 0; j < ParallelBlocks; ++j) {
+                        b[j] = _mm_aesenc_si128(b[j], rk[r]);
+                    }
+                }
+                #pragma GCC unroll 8
+                for (size_t j = 0; j < ParallelBlocks; ++j) {
+                    b[j] = _mm_aesenclast_si128(b[j], rk[RoundCount]);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst) + j, _mm_xor_si128(b[j], _mm_loadu_si128(reinterpret_cast<const __m128i *>(src) + j)));
+                }
+
+                dst += ParallelBlocks * BlockSize;
+                src += ParallelBlocks * BlockSize;
+                num_blocks -= ParallelBlocks;
+            }
+
+            for (/* ... */; num_blocks > 0; --num_blocks, dst += BlockSize, src += BlockSize) {
+                __m128i b = _mm_xor_si128(MakeCounterBlock(ctr), rk[0]);
+                for (size_t r = 1; r < RoundCount; ++r) {
+                    b = _mm_aesenc_si128(b, rk[r]);
+                }
+                b = _mm_aesenclast_si128(b, rk[RoundCount]);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_xor_si128(b, _mm_loadu_si128(reinterpret_cast<const __m128i *>(src))));
+            }
+        }
+
+        HACTOOL_VAES_TARGET void ComputeCtrVaes(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys, Counter &ctr) {
+            __m256i rk[RoundCount + 1];
+            for (size_t r = 0; r <= RoundCount; ++r) {
+                rk[r] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(keys.encrypt[r])));
+            }
+
+            /* Each register holds two blocks, so sixteen blocks are in flight per iteration. */
+            constexpr size_t Lanes = 8;
+            constexpr size_t BlocksPerIteration = Lanes * 2;
+            while (num_blocks >= BlocksPerIteration) {
+                __m256i b[Lanes];
+                #pragma GCC unroll 8
+                for (size_t j = 0; j < Lanes; ++j) {
+                    const __m128i lo = MakeCounterBlock(ctr);
+                    const __m128i hi = MakeCounterBlock(ctr);
+                    b[j] = _mm256_xor_si256(_mm256_set_m128i(hi, lo), rk[0]);
+                }
+                for (size_t r = 1; r < RoundCount; ++r) {
+                    #pragma GCC unroll 8
+                    for (size_t j = 0; j < Lanes; ++j) {
+                        b[j] = _mm256_aesenc_epi128(b[j], rk[r]);
+                    }
+                }
+                #pragma GCC unroll 8
+                for (size_t j = 0; j < Lanes; ++j) {
+                    b[j] = _mm256_aesenclast_epi128(b[j], rk[RoundCount]);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst) + j, _mm256_xor_si256(b[j], _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src) + j)));
+                }
+
+                dst += BlocksPerIteration * BlockSize;
+                src += BlocksPerIteration * BlockSize;
+                num_blocks -= BlocksPerIteration;
+            }
+
+            /* Finish with the 128-bit kernel. */
+            ComputeCtrAesNi(dst, src, num_blocks, keys, ctr);
+        }
+
+        HACTOOL_AESNI_TARGET void EncryptBlocksAesNi(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys) {
+            __m128i rk[RoundCount + 1];
+            for (size_t r = 0; r <= RoundCount; ++r) {
+                rk[r] = _mm_load_si128(reinterpret_cast<const __m128i *>(keys.encrypt[r]));
+            }
+
+            while (num_blocks > 0) {
+                const size_t cur = std::min(num_blocks, ParallelBlocks);
+
+                __m128i b[ParallelBlocks];
+                for (size_t j = 0; j < cur; ++j) {
+                    b[j] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src) + j), rk[0]);
+                }
+                for (size_t r = 1; r < RoundCount; ++r) {
+                    for (size_t j = 0; j < cur; ++j) {
+                        b[j] = _mm_aesenc_si128(b[j], rk[r]);
+                    }
+                }
+                for (size_t j = 0; j < cur; ++j) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst) + j, _mm_aesenclast_si128(b[j], rk[RoundCount]));
+                }
+
+                dst += cur * BlockSize;
+                src += cur * BlockSize;
+                num_blocks -= cur;
+            }
+        }
+
+        HACTOOL_AESNI_TARGET void DecryptBlocksAesNi(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys) {
+            __m128i rk[RoundCount + 1];
+            for (size_t r = 0; r <= RoundCount; ++r) {
+                rk[r] = _mm_load_si128(reinterpret_cast<const __m128i *>(keys.decrypt[r]));
+            }
+
+            while (num_blocks > 0) {
+                const size_t cur = std::min(num_blocks, ParallelBlocks);
+
+                __m128i b[ParallelBlocks];
+                for (size_t j = 0; j < cur; ++j) {
+                    b[j] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src) + j), rk[0]);
+                }
+                for (size_t r = 1; r < RoundCount; ++r) {
+                    for (size_t j = 0; j < cur; ++j) {
+                        b[j] = _mm_aesdec_si128(b[j], rk[r]);
+                    }
+                }
+                for (size_t j = 0; j < cur; ++j) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst) + j, _mm_aesdeclast_si128(b[j], rk[RoundCount]));
+                }
+
+                dst += cur * BlockSize;
+                src += cur * BlockSize;
+                num_blocks -= cur;
+            }
+        }
+
+        constexpr AesKernels AesNiKernels = { "aes-ni", ComputeCtrAesNi, EncryptBlocksAesNi, DecryptBlocksAesNi };
+        constexpr AesKernels VaesKernels  = { "vaes",   ComputeCtrVaes,  EncryptBlocksAesNi, DecryptBlocksAesNi };
+
+        const AesKernels &SelectKernels() {
+            unsigned int eax, ebx, ecx, edx;
+            if (!__get_cpuid(1, std::addressof(eax), std::addressof(ebx), std::addressof(ecx), std::addressof(edx)) || (ecx & bit_AES) == 0 || (ecx & bit_SSE4_1) == 0) {
+                return GenericKernels;
+            }
+
+            /* VAES additionally requires the OS to save ymm state. */
+            const bool has_avx = (ecx & bit_OSXSAVE) != 0 && (ecx & bit_AVX) != 0;
+            if (has_avx) {
+                u32 xcr0_lo, xcr0_hi;
+                __asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+                AMS_UNUSED(xcr0_hi);
+
+                if ((xcr0_lo & 0x6) == 0x6 && __get_cpuid_count(7, 0, std::addressof(eax), std::addressof(ebx), std::addressof(ecx), std::addressof(edx)) && (ebx & bit_AVX2) != 0 && (ecx & (1u << 9)) != 0) {
+                    return VaesKernels;
+                }
+            }
+
+            return AesNiKernels;
+        }
+
+        #elif defined(ATMOSPHERE_ARCH_ARM64)
+
+        #if defined(__clang__)
+        #define HACTOOL_ARM_CRYPTO_TARGET __attribute__((target("aes")))
+        #else
+        #define HACTOOL_ARM_CRYPTO_TARGET __attribute__((target("+crypto")))
+        #endif
+
+        ALWAYS_INLINE uint8x16_t MakeCounterBlock(Counter &ctr) {
+            const uint8x16_t block = vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(__builtin_bswap64(ctr.hi)), vcreate_u64(__builtin_bswap64(ctr.lo))));
+            ctr.Increment();
+            return block;
+        }
+
+        HACTOOL_ARM_CRYPTO_TARGET void ComputeCtrArmCrypto(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys, Counter &ctr) {
+            uint8x16_t rk[RoundCount + 1];
+            for (size_t r = 0; r <= RoundCount; ++r) {
+                rk[r] = vld1q_u8(keys.encrypt[r]);
+            }
+
+            /* Keep eight independent blocks in flight; aese/aesmc pairs are fused on most cores. */
+            while (num_blocks >= ParallelBlocks) {
+                uint8x16_t b[ParallelBlocks];
+                #pragma GCC unroll 8
+                for (size_t j = 0; j < ParallelBlocks; ++j) {
+                    b[j] = MakeCounterBlock(ctr);
+                }
+                for (size_t r = 0; r < RoundCount - 1; ++r) {
+                    #pragma GCC unroll 8
+                    for (size_t j = 0; j < ParallelBlocks; ++j) {
+                        b[j] = vaesmcq_u8(vaeseq_u8(b[j], rk[r]));
+                    }
+                }
+                #pragma GCC unroll 8
+                for (size_t j = 0; j < ParallelBlocks; ++j) {
+                    b[j] = veorq_u8(vaeseq_u8(b[j], rk[RoundCount - 1]), rk[RoundCount]);
+                    vst1q_u8(dst + j * BlockSize, veorq_u8(b[j], vld1q_u8(src + j * BlockSize)));
+                }
+
+                dst += ParallelBlocks * BlockSize;
+                src += ParallelBlocks * BlockSize;
+                num_blocks -= ParallelBlocks;
+            }
+
+            for (/* ... */; num_blocks > 0; --num_blocks, dst += BlockSize, src += BlockSize) {
+                uint8x16_t b = MakeCounterBlock(ctr);
+                for (size_t r = 0; r < RoundCount - 1; ++r) {
+                    b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+                }
+                b = veorq_u8(vaeseq_u8(b, rk[RoundCount - 1]), rk[RoundCount]);
+                vst1q_u8(dst, veorq_u8(b, vld1q_u8(src)));
+            }
+        }
+
+        HACTOOL_ARM_CRYPTO_TARGET void EncryptBlocksArmCrypto(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys) {
+            uint8x16_t rk[RoundCount + 1];
+            for (size_t r = 0; r <= RoundCount; ++r) {
+                rk[r] = vld1q_u8(keys.encrypt[r]);
+            }
+
+            while (num_blocks > 0) {
+                const size_t cur = std::min(num_blocks, ParallelBlocks);
+
+                uint8x16_t b[ParallelBlocks];
+                for (size_t j = 0; j < cur; ++j) {
+                    b[j] = vld1q_u8(src + j * BlockSize);
+                }
+                for (size_t r = 0; r < RoundCount - 1; ++r) {
+                    for (size_t j = 0; j < cur; ++j) {
+                        b[j] = vaesmcq_u8(vaeseq_u8(b[j], rk[r]));
+                    }
+                }
+                for (size_t j = 0; j < cur; ++j) {
+                    vst1q_u8(dst + j * BlockSize, veorq_u8(vaeseq_u8(b[j], rk[RoundCount - 1]), rk[RoundCount]));
+                }
+
+                dst += cur * BlockSize;
+                src += cur * BlockSize;
+                num_blocks -= cur;
+            }
+        }
+
+        HACTOOL_ARM_CRYPTO_TARGET void DecryptBlocksArmCrypto(u8 *dst, const u8 *src, size_t num_blocks, const RoundKeys &keys) {
+            uint8x16_t rk[RoundCount + 1];
+            for (size_t r = 0; r <= RoundCount; ++r) {
+                rk[r] = vld1q_u8(keys.decrypt[r]);
+            }
+
+            while (num_blocks > 0) {
+                const size_t cur = std::min(num_blocks, ParallelBlocks);
+
+                uint8x16_t b[ParallelBlocks];
+                for (size_t j = 0; j < cur; ++j) {
+                    b[j] = vld1q_u8(src + j * BlockSize);
+                }
+                for (size_t r = 0; r < RoundCount - 1; ++r) {
+                    for (size_t j = 0; j < cur; ++j) {
+                        b[j] = vaesimcq_u8(vaesdq_u8(b[j], rk[r]));
+                    }
+                }
+                for (size_t j = 0; j < cur; ++j) {
+                    vst1q_u8(dst + j * BlockSize, veorq_u8(vaesdq_u8(b[j], rk[RoundCount - 1]), rk[RoundCount]));
+                }
+
+                dst += cur * BlockSize;
+                src += cur * BlockSize;
+                num_blocks -= cur;
+            }
+        }
+
+        constexpr AesKernels ArmCryptoKernels = { "armv8-ce", ComputeCtrArmCrypto, EncryptBlocksArmCrypto, DecryptBlocksArmCrypto };
+
+        const AesKernels &SelectKernels() {
+            #if defined(ATMOSPHERE_OS_LINUX)
+            if ((::getauxval(AT_HWCAP) & HWCAP_AES) == 0) {
+                return GenericKernels;
+            }
+            #endif
+
+            /* Every arm64 macOS host implements the crypto extensions. */
+            return ArmCryptoKernels;
+        }
+
+        #else
+
+        const AesKernels &SelectKernels() {
+            return GenericKernels;
+        }
+
+        #endif
+
+        const AesKernels &GetKernels() {
+            static const AesKernels &s_kernels = SelectKernels();
+            return s_kernels;
+        }
+
+        void MultiplyTweak(u8 *tweak) {
+            /* Multiply by x in GF(2^128), with the little-endian convention of XTS. */
+            const u64 lo = LoadLittleEndian64(tweak + 0);
+            const u64 hi = LoadLittleEndian64(tweak + 8);
+
+            StoreLittleEndian64(tweak + 0, (lo << 1) ^ ((hi >> 63) * 0x87));
+            StoreLittleEndian64(tweak + 8, (hi << 1) | (lo >> 63));
+        }
+
+        void ComputeAes128Xts(bool encrypt, void *dst, const void *src, size_t size, const void *key1, const void *key2, size_t sector, size_t sector_size) {
+            AMS_ASSERT(util::IsAligned(size, BlockSize));
+            AMS_ASSERT(util::IsAligned(sector_size, BlockSize) && sector_size > 0);
+
+            const auto &kernels = GetKernels();
+            const auto crypt_blocks = encrypt ? kernels.encrypt_blocks : kernels.decrypt_blocks;
+
+            RoundKeys data_keys, tweak_keys;
+            ExpandKey(std::addressof(data_keys), key1);
+            ExpandKey(std::addressof(tweak_keys), key2);
+
+            u8 *dst8 = static_cast<u8 *>(dst);
+            const u8 *src8 = static_cast<const u8 *>(src);
+
+            alignas(BlockSize) u8 tweaks[ParallelBlocks][BlockSize];
+            alignas(BlockSize) u8 work[ParallelBlocks][BlockSize];
+
+            while (size > 0) {
+                /* Generate the tweak for the sector. */
+                alignas(BlockSize) u8 tweak[BlockSize] = {};
+                StoreBigEndian64(tweak + 8, static_cast<u64>(sector));
+                kernels.encrypt_blocks(tweak, tweak, 1, tweak_keys);
+
+                /* Process the sector, a batch of blocks at a time. */
+                size_t remaining = std::min(size, sector_size);
+                size -= remaining;
+
+                while (remaining > 0) {
+                    const size_t cur_blocks = std::min(remaining / BlockSize, ParallelBlocks);
+
+                    for (size_t j = 0; j < cur_blocks; ++j) {
+                        std::memcpy(tweaks[j], tweak, BlockSize);
+                        XorBlock(work[j], src8 + j * BlockSize, tweak);
+                        MultiplyTweak(tweak);
+                    }
+
+                    crypt_blocks(work[0], work[0], cur_blocks, data_keys);
+
+                    for (size_t j = 0; j < cur_blocks; ++j) {
+                        XorBlock(dst8 + j * BlockSize, work[j], tweaks[j]);
+                    }
+
+                    dst8 += cur_blocks * BlockSize;
+                    src8 += cur_blocks * BlockSize;
+                    remaining -= cur_blocks * BlockSize;
+                }
+
+                ++sector;
+            }
+        }
+
+    }
+
+    const char *GetAesImplementationName() {
+        return GetKernels().name;
+    }
+
+    void ComputeAes128Ctr(void *dst, const void *src, size_t size, const void *key, const void *iv) {
+        RoundKeys keys;
+        ExpandKey(std::addressof(keys), key);
+
+        Counter ctr = { LoadBigEndian64(static_cast<const u8 *>(iv) + 0), LoadBigEndian64(static_cast<const u8 *>(iv) + 8) };
+
+        /* Process all whole blocks. */
+        const auto &kernels = GetKernels();
+        const size_t num_blocks = size / BlockSize;
+        kernels.compute_ctr(static_cast<u8 *>(dst), static_cast<const u8 *>(src), num_blocks, keys, ctr);
+
+        /* Process a trailing partial block. */
+        if (const size_t rem = size % BlockSize; rem != 0) {
+            u8 tmp[BlockSize] = {};
+            std::memcpy(tmp, static_cast<const u8 *>(src) + num_blocks * BlockSize, rem);
+            kernels.compute_ctr(tmp, tmp, 1, keys, ctr);
+            std::memcpy(static_cast<u8 *>(dst) + num_blocks * BlockSize, tmp, rem);
+        }
+    }
+
+    void DecryptAes128CtrForPreparedKey(void *dst, size_t dst_size, u8 key_index, u8 key_generation, const void *key, size_t key_size, const void *iv, size_t iv_size, const void *src, size_t src_size) {
+        AMS_ASSERT(key_size == BlockSize);
+        AMS_ASSERT(iv_size == BlockSize);
+        AMS_ASSERT(dst_size >= src_size);
+        AMS_UNUSED(dst_size, key_index, key_generation, key_size, iv_size);
+
+        ComputeAes128Ctr(dst, src, src_size, key, iv);
+    }
+
+    void EncryptAes128Xts(void *dst, const void *src, size_t size, const void *key1, const void *key2, size_t sector, size_t sector_size) {
+        ComputeAes128Xts(true, dst, src, size, key1, key2, sector, sector_size);
+    }
+
+    void DecryptAes128Xts(void *dst, const void *src, size_t size, const void *key1, const void *key2, size_t sector, size_t sector_size) {
+        ComputeAes128Xts(false, dst, src, size, key1, key2, sector, sector_size);
+    }
+
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* AES-128 kernels which keep many blocks in flight per iteration. */
+    /* The implementation (AES-NI, VAES, ARMv8 crypto extensions, or a generic fallback) is selected at runtime. */
+    const char *GetAesImplementationName();
+
+    /* Transforms data with AES-128-CTR; iv is the big-endian counter of the first block of src. src and dst may alias. */
+    void ComputeAes128Ctr(void *dst, const void *src, size_t size, const void *key, const void *iv);
+
+    /* ComputeAes128Ctr in the shape of an nca crypto configuration's decryption functions, for keys which are already decrypted. */
+    void DecryptAes128CtrForPreparedKey(void *dst, size_t dst_size, u8 key_index, u8 key_generation, const void *key, size_t key_size, const void *iv, size_t iv_size, const void *src, size_t src_size);
+
+    /* AES-128-XTS as used by the console, whose sector tweaks are big-endian sector indices. */
+    /* size and sector_size must be multiples of the block size. src and dst may alias. */
+    void EncryptAes128Xts(void *dst, const void *src, size_t size, const void *key1, const void *key2, size_t sector, size_t sector_size);
+    void DecryptAes128Xts(void *dst, const void *src, size_t size, const void *key1, const void *key2, size_t sector, size_t sector_size);
+
+}
@@ -15,6 +15,7 @@
  */
 #pragma once
 #include <stratosphere.hpp>
+#include "hactool_memory_accounting.hpp"
 
 namespace ams::hactool {
 
@@ -99,12 +100,14 @@ namespace ams::hactool {
                         auto *entry = std::addressof(*it);
                         it = m_tree.erase(it);
                         delete entry;
+                        NoteFree(sizeof(*entry), AllocationSite_TreeNode);
                     }
                 }
             }
 
             ApplicationContentTreeEntry<T> *Insert(ncm::ApplicationId id, u32 v, u8 o, ncm::ContentType t, ncm::ContentMetaType m) {
                 auto *entry = new ApplicationContentTreeEntry<T>(id, v, o, t, m);
+                NoteAllocation(sizeof(*entry), AllocationSite_TreeNode);
                 m_tree.insert(*entry);
                 return entry;
             }
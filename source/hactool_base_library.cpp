@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_base_library.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        /* One line per meta ("M\t<size>\t<path>"), each followed by one line per program it lists ("P\t<program id>\t<version>\t<path>"), */
+        /* then one line per ticket ("T\t<size>\t<path>"), followed by its key ("K\t<rights id>\t<titlekey>") if it's a usable common ticket. */
+        constexpr const char IndexHeader[] = "# hactool base library index v2";
+
+        void AppendHex(std::string &dst, const void *data, size_t size) {
+            constexpr const char Digits[] = "0123456789abcdef";
+
+            const u8 *src = static_cast<const u8 *>(data);
+            for (size_t i = 0; i < size; ++i) {
+                dst += Digits[src[i] >> 4];
+                dst += Digits[src[i] & 0xF];
+            }
+        }
+
+        /* Parses exactly size bytes of hex, returning a pointer past them or nullptr. */
+        const char *ParseHex(void *out, size_t size, const char *str) {
+            auto ParseDigit = [] (char c) -> int {
+                if ('0' <= c && c <= '9') { return c - '0'; }
+                if ('a' <= c && c <= 'f') { return c - 'a' + 10; }
+                if ('A' <= c && c <= 'F') { return c - 'A' + 10; }
+                return -1;
+            };
+
+            u8 *dst = static_cast<u8 *>(out);
+            for (size_t i = 0; i < size; ++i) {
+                const int hi = ParseDigit(str[2 * i + 0]);
+                if (hi < 0) {
+                    return nullptr;
+                }
+                const int lo = ParseDigit(str[2 * i + 1]);
+                if (lo < 0) {
+                    return nullptr;
+                }
+                dst[i] = static_cast<u8>((hi << 4) | lo);
+            }
+
+            return str + 2 * size;
+        }
+
+        template<typename Map>
+        bool RemoveEntriesExcept(Map &map, const std::set<std::string> &paths) {
+            bool removed = false;
+            for (auto it = map.begin(); it != map.end(); /* ... */) {
+                if (paths.find(it->first) == paths.end()) {
+                    it = map.erase(it);
+                    removed = true;
+                } else {
+                    ++it;
+                }
+            }
+            return removed;
+        }
+
+    }
+
+    void BaseLibraryIndex::Load(const char *data, size_t size) {
+        m_metas.clear();
+        m_tickets.clear();
+
+        std::string line;
+        MetaEntry *cur_meta = nullptr;
+        TicketEntry *cur_ticket = nullptr;
+        bool has_header = false;
+        for (size_t pos = 0; pos < size; /* ... */) {
+            /* Get the next line. */
+            const char *line_end = static_cast<const char *>(std::memchr(data + pos, '\n', size - pos));
+            const size_t line_len = (line_end != nullptr ? static_cast<size_t>(line_end - (data + pos)) : size - pos);
+            line.assign(data + pos, line_len);
+            pos += line_len + 1;
+
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+
+            /* Refuse indices written by another version. */
+            if (!has_header) {
+                if (line != IndexHeader) {
+                    return;
+                }
+                has_header = true;
+                continue;
+            }
+
+            if (line.size() > 2 && line[0] == 'M' && line[1] == '\t') {
+                cur_ticket = nullptr;
+
+                char *end = nullptr;
+                const s64 meta_size = std::strtoll(line.c_str() + 2, std::addressof(end), 10);
+                if (end == nullptr || *end != '\t') {
+                    cur_meta = nullptr;
+                    continue;
+                }
+
+                auto &meta = m_metas[std::string(end + 1)];
+                meta.size = meta_size;
+                meta.programs.clear();
+                cur_meta = std::addressof(meta);
+            } else if (line.size() > 2 && line[0] == 'P' && line[1] == '\t' && cur_meta != nullptr) {
+                char *end = nullptr;
+                const u64 program_id = std::strtoull(line.c_str() + 2, std::addressof(end), 16);
+                if (end == nullptr || *end != '\t') {
+                    continue;
+                }
+
+                const u32 version = static_cast<u32>(std::strtoul(end + 1, std::addressof(end), 10));
+                if (end == nullptr || *end != '\t') {
+                    continue;
+                }
+
+                cur_meta->programs.push_back(ProgramEntry{ program_id, version, std::string(end + 1) });
+            } else if (line.size() > 2 && line[0] == 'T' && line[1] == '\t') {
+                cur_meta = nullptr;
+
+                char *end = nullptr;
+                const s64 ticket_size = std::strtoll(line.c_str() + 2, std::addressof(end), 10);
+                if (end == nullptr || *end != '\t') {
+                    cur_ticket = nullptr;
+                    continue;
+                }
+
+                auto &ticket = m_tickets[std::string(end + 1)];
+                ticket = {};
+                ticket.size = ticket_size;
+                cur_ticket = std::addressof(ticket);
+            } else if (line.size() > 2 && line[0] == 'K' && line[1] == '\t' && cur_ticket != nullptr) {
+                const char *cur = ParseHex(std::addressof(cur_ticket->rights_id), sizeof(cur_ticket->rights_id), line.c_str() + 2);
+                if (cur == nullptr || *cur != '\t') {
+                    continue;
+                }
+
+                cur = ParseHex(std::addressof(cur_ticket->access_key), sizeof(cur_ticket->access_key), cur + 1);
+                if (cur == nullptr || *cur != '\0') {
+                    continue;
+                }
+
+                cur_ticket->has_key = true;
+            }
+        }
+    }
+
+    std::string BaseLibraryIndex::Serialize() const {
+        std::string out = IndexHeader;
+        out += '\n';
+
+        char line[0x40];
+        for (const auto &[path, meta] : m_metas) {
+            util::TSNPrintf(line, sizeof(line), "M\t%" PRId64 "\t", meta.size);
+            out += line;
+            out += path;
+            out += '\n';
+
+            for (const auto &program : meta.programs) {
+                util::TSNPrintf(line, sizeof(line), "P\t%016" PRIx64 "\t%" PRIu32 "\t", program.program_id, program.version);
+                out += line;
+                out += program.path;
+                out += '\n';
+            }
+        }
+
+        for (const auto &[path, ticket] : m_tickets) {
+            util::TSNPrintf(line, sizeof(line), "T\t%" PRId64 "\t", ticket.size);
+            out += line;
+            out += path;
+            out += '\n';
+
+            if (ticket.has_key) {
+                out += "K\t";
+                AppendHex(out, std::addressof(ticket.rights_id), sizeof(ticket.rights_id));
+                out += '\t';
+                AppendHex(out, std::addressof(ticket.access_key), sizeof(ticket.access_key));
+                out += '\n';
+            }
+        }
+
+        return out;
+    }
+
+    bool BaseLibraryIndex::HasMeta(const std::string &path, s64 size) const {
+        const auto it = m_metas.find(path);
+        return it != m_metas.end() && it->second.size == size;
+    }
+
+    void BaseLibraryIndex::SetMeta(const std::string &path, MetaEntry entry) {
+        m_metas[path] = std::move(entry);
+        m_dirty = true;
+    }
+
+    bool BaseLibraryIndex::HasTicket(const std::string &path, s64 size) const {
+        const auto it = m_tickets.find(path);
+        return it != m_tickets.end() && it->second.size == size;
+    }
+
+    void BaseLibraryIndex::SetTicket(const std::string &path, const TicketEntry &entry) {
+        m_tickets[path] = entry;
+        m_dirty = true;
+    }
+
+    void BaseLibraryIndex::RemoveMetasExcept(const std::set<std::string> &paths) {
+        if (RemoveEntriesExcept(m_metas, paths)) {
+            m_dirty = true;
+        }
+    }
+
+    void BaseLibraryIndex::RemoveTicketsExcept(const std::set<std::string> &paths) {
+        if (RemoveEntriesExcept(m_tickets, paths)) {
+            m_dirty = true;
+        }
+    }
+
+    void BaseLibraryIndex::Finalize() {
+        m_latest_programs.clear();
+
+        for (const auto &[path, meta] : m_metas) {
+            for (const auto &program : meta.programs) {
+                auto &latest = m_latest_programs[program.program_id];
+                if (latest == nullptr || latest->version < program.version) {
+                    latest = std::addressof(program);
+                }
+            }
+        }
+    }
+
+    const BaseLibraryIndex::ProgramEntry *BaseLibraryIndex::FindLatestProgram(u64 program_id) const {
+        const auto it = m_latest_programs.find(program_id);
+        return it != m_latest_programs.end() ? it->second : nullptr;
+    }
+
+}
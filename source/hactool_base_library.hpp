@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* Maps program ids to the base program ncas of a library directory, keyed by the meta nca which lists them, */
+    /* and holds the titlekeys of the library's tickets. Files are only parsed when new or changed, so the index is kept on disk between runs. */
+    class BaseLibraryIndex {
+        NON_COPYABLE(BaseLibraryIndex);
+        NON_MOVEABLE(BaseLibraryIndex);
+        public:
+            struct ProgramEntry {
+                u64 program_id;
+                u32 version;
+                std::string path;
+            };
+
+            struct MetaEntry {
+                s64 size;
+                std::vector<ProgramEntry> programs;
+            };
+
+            struct TicketEntry {
+                s64 size;
+                bool has_key;
+                fs::RightsId rights_id;
+                spl::AccessKey access_key;
+            };
+        private:
+            std::map<std::string, MetaEntry> m_metas;
+            std::map<std::string, TicketEntry> m_tickets;
+            std::unordered_map<u64, const ProgramEntry *> m_latest_programs;
+            bool m_dirty;
+        public:
+            BaseLibraryIndex() : m_metas(), m_tickets(), m_latest_programs(), m_dirty(false) { /* ... */ }
+
+            /* Malformed lines are skipped, and the files they describe will simply be parsed again. */
+            void Load(const char *data, size_t size);
+            std::string Serialize() const;
+
+            bool IsDirty() const { return m_dirty; }
+
+            bool HasMeta(const std::string &path, s64 size) const;
+            void SetMeta(const std::string &path, MetaEntry entry);
+
+            bool HasTicket(const std::string &path, s64 size) const;
+            void SetTicket(const std::string &path, const TicketEntry &entry);
+
+            /* Forgets metas and tickets which are no longer in the library. */
+            void RemoveMetasExcept(const std::set<std::string> &paths);
+            void RemoveTicketsExcept(const std::set<std::string> &paths);
+
+            const std::map<std::string, TicketEntry> &GetTickets() const { return m_tickets; }
+
+            /* Builds the program lookup; must be called after the last change. */
+            void Finalize();
+
+            const ProgramEntry *FindLatestProgram(u64 program_id) const;
+    };
+
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_concatenated_storage.hpp"
+
+namespace ams::hactool {
+
+    Result ConcatenatedStorage::AddPart(std::shared_ptr<fs::IStorage> storage) {
+        R_UNLESS(storage != nullptr, fs::ResultNullptrArgument());
+
+        s64 size = 0;
+        R_TRY(storage->GetSize(std::addressof(size)));
+
+        /* Empty parts can't hold any data, and would confuse the lookup. */
+        if (size > 0) {
+            m_parts.push_back(Part{ std::move(storage), m_size, size });
+            m_size += size;
+        }
+
+        R_SUCCEED();
+    }
+
+    size_t ConcatenatedStorage::FindPartIndex(s64 offset) const {
+        /* Find the last part beginning at or before the offset. */
+        const auto it = std::upper_bound(m_parts.begin(), m_parts.end(), offset, [](s64 ofs, const Part &part) { return ofs < part.offset; });
+        AMS_ASSERT(it != m_parts.begin());
+
+        return static_cast<size_t>(std::distance(m_parts.begin(), it)) - 1;
+    }
+
+    Result ConcatenatedStorage::Read(s64 offset, void *buffer, size_t size) {
+        /* Succeed immediately on zero-sized read. */
+        R_SUCCEED_IF(size == 0);
+
+        /* Validate arguments. */
+        R_UNLESS(buffer != nullptr, fs::ResultNullptrArgument());
+        R_UNLESS(offset >= 0,       fs::ResultOutOfRange());
+        R_UNLESS(offset <= m_size && static_cast<s64>(size) <= m_size - offset, fs::ResultOutOfRange());
+
+        /* Read from each part the range touches. */
+        u8 *dst = static_cast<u8 *>(buffer);
+        for (size_t i = this->FindPartIndex(offset); size > 0; ++i) {
+            const auto &part = m_parts[i];
+
+            const s64 offset_in_part = offset - part.offset;
+            const size_t cur_size    = static_cast<size_t>(std::min<s64>(part.size - offset_in_part, static_cast<s64>(size)));
+
+            R_TRY(part.storage->Read(offset_in_part, dst, cur_size));
+
+            dst    += cur_size;
+            offset += cur_size;
+            size   -= cur_size;
+        }
+
+        R_SUCCEED();
+    }
+
+    Result ConcatenatedStorage::OperateRange(void *dst, size_t dst_size, fs::OperationId op_id, s64 offset, s64 size, const void *src, size_t src_size) {
+        switch (op_id) {
+            case fs::OperationId::Invalidate:
+                {
+                    for (auto &part : m_parts) {
+                        R_TRY(part.storage->OperateRange(fs::OperationId::Invalidate, 0, part.size));
+                    }
+
+                    R_SUCCEED();
+                }
+            case fs::OperationId::QueryRange:
+                {
+                    R_UNLESS(dst != nullptr,                         fs::ResultNullptrArgument());
+                    R_UNLESS(dst_size == sizeof(fs::QueryRangeInfo), fs::ResultInvalidSize());
+                    R_UNLESS(offset >= 0 && size >= 0,               fs::ResultOutOfRange());
+                    R_UNLESS(offset <= m_size && size <= m_size - offset, fs::ResultOutOfRange());
+
+                    /* Merge the information for each part the range touches. */
+                    fs::QueryRangeInfo merged;
+                    merged.Clear();
+
+                    if (size > 0) {
+                        for (size_t i = this->FindPartIndex(offset); size > 0; ++i) {
+                            const auto &part = m_parts[i];
+
+                            const s64 offset_in_part = offset - part.offset;
+                            const s64 cur_size       = std::min<s64>(part.size - offset_in_part, size);
+
+                            fs::QueryRangeInfo cur_info;
+                            R_TRY(part.storage->OperateRange(std::addressof(cur_info), sizeof(cur_info), op_id, offset_in_part, cur_size, src, src_size));
+                            merged.Merge(cur_info);
+
+                            offset += cur_size;
+                            size   -= cur_size;
+                        }
+                    }
+
+                    *static_cast<fs::QueryRangeInfo *>(dst) = merged;
+                    R_SUCCEED();
+                }
+            default:
+                R_THROW(fs::ResultUnsupportedOperation());
+        }
+    }
+
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* Read-only view of several storages laid end to end, as produced by FAT32-friendly split dumps. */
+    /* Reads are served straight into the caller's buffer, one sub-read per part the range touches. */
+    class ConcatenatedStorage : public ::ams::fs::IStorage, public ::ams::fs::impl::Newable {
+        NON_COPYABLE(ConcatenatedStorage);
+        NON_MOVEABLE(ConcatenatedStorage);
+        private:
+            struct Part {
+                std::shared_ptr<fs::IStorage> storage;
+                s64 offset;
+                s64 size;
+            };
+        private:
+            std::vector<Part> m_parts;
+            s64 m_size;
+        public:
+            ConcatenatedStorage() : m_parts(), m_size(0) { /* ... */ }
+
+            Result AddPart(std::shared_ptr<fs::IStorage> storage);
+
+            s32 GetPartCount() const { return static_cast<s32>(m_parts.size()); }
+
+            virtual Result Read(s64 offset, void *buffer, size_t size) override;
+            virtual Result OperateRange(void *dst, size_t dst_size, fs::OperationId op_id, s64 offset, s64 size, const void *src, size_t src_size) override;
+
+            virtual Result GetSize(s64 *out) override {
+                *out = m_size;
+                R_SUCCEED();
+            }
+
+            virtual Result Flush() override {
+                R_SUCCEED();
+            }
+
+            virtual Result Write(s64 offset, const void *buffer, size_t size) override {
+                AMS_UNUSED(offset, buffer, size);
+                R_THROW(fs::ResultUnsupportedOperation());
+            }
+
+            virtual Result SetSize(s64 size) override {
+                AMS_UNUSED(size);
+                R_THROW(fs::ResultUnsupportedOperation());
+            }
+        private:
+            size_t FindPartIndex(s64 offset) const;
+    };
+
+}
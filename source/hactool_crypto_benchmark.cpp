@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_crypto_benchmark.hpp"
+#include "hactool_aes.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr size_t BenchmarkBufferSize = 16_MB;
+        constexpr int BenchmarkIterations    = 16;
+
+        constexpr size_t XtsSectorSize = 0x200;
+
+        /* Sections are read in chunks the size of an output writer buffer. */
+        constexpr size_t SectionReadSize = 4_MB;
+
+        template<typename F>
+        void Measure(const char *name, F f) {
+            /* Warm up caches and the dispatcher. */
+            f();
+
+            const auto start = os::GetSystemTick();
+            for (int i = 0; i < BenchmarkIterations; ++i) {
+                f();
+            }
+            const auto ns = (os::GetSystemTick() - start).ToTimeSpan().GetNanoSeconds();
+
+            printf("    %-28s %8.3f GB/s\n", name, static_cast<double>(BenchmarkBufferSize) * BenchmarkIterations / static_cast<double>(std::max<s64>(ns, 1)));
+        }
+
+    }
+
+    void RunCryptoBenchmark() {
+        /* Allocate buffers. */
+        auto src = std::make_unique<u8[]>(BenchmarkBufferSize);
+        auto dst = std::make_unique<u8[]>(BenchmarkBufferSize);
+        auto ref = std::make_unique<u8[]>(BenchmarkBufferSize);
+        if (src == nullptr || dst == nullptr || ref == nullptr) {
+            fprintf(stderr, "[Warning]: Failed to allocate crypto benchmark buffers!\n");
+            return;
+        }
+
+        for (size_t i = 0; i < BenchmarkBufferSize; ++i) {
+            src[i] = static_cast<u8>(i * 0x9D + (i >> 8));
+        }
+
+        const u8 key1[0x10] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF };
+        const u8 key2[0x10] = { 0xFF, 0xEE, 0xDD, 0xCC, 0xBB, 0xAA, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00 };
+        const u8 iv[0x10]   = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+
+        printf("Crypto benchmark (%zu MB x %d, single core):\n", BenchmarkBufferSize / 1_MB, BenchmarkIterations);
+        printf("    Tool AES implementation:     %s\n", GetAesImplementationName());
+
+        /* Check that our kernels agree with the library before timing them. */
+        crypto::DecryptAes128Ctr(ref.get(), BenchmarkBufferSize, key1, sizeof(key1), iv, sizeof(iv), src.get(), BenchmarkBufferSize);
+        ComputeAes128Ctr(dst.get(), src.get(), BenchmarkBufferSize, key1, iv);
+        if (std::memcmp(dst.get(), ref.get(), BenchmarkBufferSize) != 0) {
+            fprintf(stderr, "[Warning]: AES-128-CTR output does not match the library!\n");
+        }
+
+        Measure("AES-128-CTR (library)", [&] { crypto::DecryptAes128Ctr(dst.get(), BenchmarkBufferSize, key1, sizeof(key1), iv, sizeof(iv), src.get(), BenchmarkBufferSize); });
+        Measure("AES-128-CTR (tool)",    [&] { ComputeAes128Ctr(dst.get(), src.get(), BenchmarkBufferSize, key1, iv); });
+
+        /* The library processes a single data unit per call, so drive it sector by sector as NCA headers are. */
+        auto DecryptXtsWithLibrary = [&] (u8 *out) {
+            for (size_t ofs = 0, sector = 0; ofs < BenchmarkBufferSize; ofs += XtsSectorSize, ++sector) {
+                u8 tweak[0x10] = {};
+                for (size_t i = 0; i < sizeof(u64); ++i) {
+                    tweak[sizeof(tweak) - 1 - i] = static_cast<u8>(sector >> (8 * i));
+                }
+                crypto::DecryptAes128Xts(out + ofs, XtsSectorSize, key1, key2, sizeof(key1), tweak, sizeof(tweak), src.get() + ofs, XtsSectorSize);
+            }
+        };
+
+        DecryptXtsWithLibrary(ref.get());
+        DecryptAes128Xts(dst.get(), src.get(), BenchmarkBufferSize, key1, key2, 0, XtsSectorSize);
+        if (std::memcmp(dst.get(), ref.get(), BenchmarkBufferSize) != 0) {
+            fprintf(stderr, "[Warning]: AES-128-XTS output does not match the library!\n");
+        }
+
+        Measure("AES-128-XTS (library)", [&] { DecryptXtsWithLibrary(dst.get()); });
+        Measure("AES-128-XTS (tool)",    [&] { DecryptAes128Xts(dst.get(), src.get(), BenchmarkBufferSize, key1, key2, 0, XtsSectorSize); });
+
+        /* Read a section through the storages the nca driver builds: the library's software storage, as sections used before, */
+        /* and the external decryption storage, which now calls our kernels through the patched crypto configuration. */
+        auto section_storage = std::make_shared<fs::MemoryStorage>(src.get(), BenchmarkBufferSize);
+        fssystem::AesCtrStorageByPointer library_storage(section_storage.get(), key1, sizeof(key1), iv, sizeof(iv));
+        fssystem::AesCtrStorageExternal tool_storage(section_storage, key1, sizeof(key1), iv, sizeof(iv), DecryptAes128CtrForPreparedKey, -1, -1);
+
+        auto ReadSection = [&] (fs::IStorage &storage, u8 *out) {
+            for (size_t ofs = 0; ofs < BenchmarkBufferSize; ofs += SectionReadSize) {
+                R_ABORT_UNLESS(storage.Read(ofs, out + ofs, std::min(SectionReadSize, BenchmarkBufferSize - ofs)));
+            }
+        };
+
+        ReadSection(library_storage, ref.get());
+        ReadSection(tool_storage, dst.get());
+        if (std::memcmp(dst.get(), ref.get(), BenchmarkBufferSize) != 0) {
+            fprintf(stderr, "[Warning]: Section decryption output does not match the library!\n");
+        }
+
+        Measure("Section read (library)", [&] { ReadSection(library_storage, dst.get()); });
+        Measure("Section read (tool)",    [&] { ReadSection(tool_storage, dst.get()); });
+    }
+
+}
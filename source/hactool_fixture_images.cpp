@@ -0,0 +1,561 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_fixture_images.hpp"
+#include "hactool_sha256.hpp"
+
+#if defined(HACTOOL_BUILD_FIXTURE_GENERATOR)
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr size_t HashSize = crypto::Sha256Generator::HashSize;
+
+        constexpr u32 BucketTreeMagic   = util::FourCC<'B', 'K', 'T', 'R'>::Code;
+        constexpr u32 BucketTreeVersion = 1;
+
+        struct BucketTreeNodeHeader {
+            s32 index;
+            s32 count;
+            s64 offset;
+        };
+        static_assert(sizeof(BucketTreeNodeHeader) == 0x10);
+
+        struct PartitionFileSystemHeader {
+            u32 magic;
+            s32 entry_count;
+            u32 name_table_size;
+            u32 reserved;
+        };
+        static_assert(sizeof(PartitionFileSystemHeader) == 0x10);
+
+        struct PartitionFileSystemEntry {
+            s64 offset;
+            s64 size;
+            u32 name_offset;
+            u32 reserved;
+        };
+        static_assert(sizeof(PartitionFileSystemEntry) == 0x18);
+
+        struct Sha256PartitionFileSystemEntry {
+            s64 offset;
+            s64 size;
+            u32 name_offset;
+            u32 hash_target_size;
+            s64 hash_target_offset;
+            u8 hash[HashSize];
+        };
+        static_assert(sizeof(Sha256PartitionFileSystemEntry) == 0x40);
+
+        constexpr u32 PartitionFileSystemMagic       = util::FourCC<'P', 'F', 'S', '0'>::Code;
+        constexpr u32 Sha256PartitionFileSystemMagic = util::FourCC<'H', 'F', 'S', '0'>::Code;
+
+        constexpr size_t Sha256PartitionAlignment = 0x200;
+
+        struct RomFsHeader {
+            s64 header_size;
+            s64 directory_bucket_offset;
+            s64 directory_bucket_size;
+            s64 directory_entry_offset;
+            s64 directory_entry_size;
+            s64 file_bucket_offset;
+            s64 file_bucket_size;
+            s64 file_entry_offset;
+            s64 file_entry_size;
+            s64 body_offset;
+        };
+        static_assert(sizeof(RomFsHeader) == 0x50);
+
+        struct RomFsDirectoryEntry {
+            u32 parent;
+            u32 sibling;
+            u32 child;
+            u32 file;
+            u32 hash_next;
+            u32 name_size;
+        };
+        static_assert(sizeof(RomFsDirectoryEntry) == 0x18);
+
+        struct RomFsFileEntry {
+            u32 parent;
+            u32 sibling;
+            s64 offset;
+            s64 size;
+            u32 hash_next;
+            u32 name_size;
+        };
+        static_assert(sizeof(RomFsFileEntry) == 0x20);
+
+        constexpr u32 RomFsEntryNone      = 0xFFFFFFFF;
+        constexpr s64 RomFsBodyOffset     = 0x200;
+        constexpr s64 RomFsFileAlignment  = 0x10;
+
+        constexpr u32 IntegrityMetaMagic   = util::FourCC<'I', 'V', 'F', 'C'>::Code;
+        constexpr u32 IntegrityMetaVersion = 0x20000;
+        constexpr s32 IntegrityBlockOrder  = 14;
+        constexpr s64 IntegrityBlockSize   = INT64_C(1) << IntegrityBlockOrder;
+        constexpr s32 IntegrityLevelCount  = 6;
+
+        constexpr s64 HierarchicalSha256DataAlignment = 0x200;
+
+        template<typename T>
+        void AppendPod(std::vector<u8> *out, const T &v) {
+            const u8 *p = reinterpret_cast<const u8 *>(std::addressof(v));
+            out->insert(out->end(), p, p + sizeof(T));
+        }
+
+        void AppendName(std::vector<u8> *out, util::string_view name, size_t alignment) {
+            out->insert(out->end(), name.begin(), name.end());
+            out->resize(util::AlignUp(out->size(), alignment), 0);
+        }
+
+        /* Hashes a contiguous run of blocks; the last block is hashed as-is, or zero-padded to block_size if pad is set. */
+        void HashBlocks(u8 *dst, const u8 *data, size_t size, size_t block_size, bool pad) {
+            const size_t block_count = util::DivideUp(size, block_size);
+
+            std::unique_ptr<u8[]> last_block;
+            std::vector<Sha256Job> jobs(block_count);
+            for (size_t i = 0; i < block_count; ++i) {
+                const size_t offset   = i * block_size;
+                const size_t cur_size = std::min(block_size, size - offset);
+
+                if (pad && cur_size != block_size) {
+                    last_block = std::make_unique<u8[]>(block_size);
+                    std::memset(last_block.get(), 0, block_size);
+                    std::memcpy(last_block.get(), data + offset, cur_size);
+                    jobs[i] = Sha256Job{ last_block.get(), block_size, dst + i * HashSize };
+                } else {
+                    jobs[i] = Sha256Job{ data + offset, cur_size, dst + i * HashSize };
+                }
+            }
+
+            GenerateSha256Batch(jobs.data(), jobs.size());
+        }
+
+        /* Matches the hash used by the library's romfs tables. */
+        u32 CalculateRomFsPathHash(u32 parent, util::string_view name) {
+            u32 hash = parent ^ 123456789;
+            for (const char c : name) {
+                hash = (hash >> 5) | (hash << 27);
+                hash ^= static_cast<u8>(c);
+            }
+            return hash;
+        }
+
+        u32 GetRomFsBucketCount(u32 entry_count) {
+            if (entry_count < 3) {
+                return 3;
+            } else if (entry_count < 19) {
+                return entry_count | 1;
+            }
+
+            u32 count = entry_count;
+            while (count % 2 == 0 || count % 3 == 0 || count % 5 == 0 || count % 7 == 0 || count % 11 == 0 || count % 13 == 0 || count % 17 == 0) {
+                ++count;
+            }
+            return count;
+        }
+
+    }
+
+    void BuildBucketTreeImpl(std::vector<u8> *out, FixtureBucketTreeHeader *out_header, const void *entries, size_t entry_size, const std::vector<s64> &entry_offsets, s64 end_offset) {
+        const s32 entry_count = static_cast<s32>(entry_offsets.size());
+
+        *out_header = { BucketTreeMagic, BucketTreeVersion, entry_count, 0 };
+        out->clear();
+        if (entry_count == 0) {
+            return;
+        }
+
+        const s32 entries_per_set  = static_cast<s32>((FixtureBucketTreeNodeSize - sizeof(BucketTreeNodeHeader)) / entry_size);
+        const s32 offsets_per_node = static_cast<s32>((FixtureBucketTreeNodeSize - sizeof(BucketTreeNodeHeader)) / sizeof(s64));
+        const s32 entry_set_count  = util::DivideUp(entry_count, entries_per_set);
+
+        /* Fixtures never need a second level of offset nodes. */
+        AMS_ABORT_UNLESS(entry_set_count <= offsets_per_node);
+
+        out->resize(FixtureBucketTreeNodeSize * (1 + entry_set_count), 0);
+
+        /* Write the offset node, which holds the starting offset of every entry set. */
+        {
+            const BucketTreeNodeHeader node_header = { 0, entry_set_count, end_offset };
+            std::memcpy(out->data(), std::addressof(node_header), sizeof(node_header));
+
+            for (s32 i = 0; i < entry_set_count; ++i) {
+                const s64 set_offset = entry_offsets[i * entries_per_set];
+                std::memcpy(out->data() + sizeof(node_header) + i * sizeof(s64), std::addressof(set_offset), sizeof(set_offset));
+            }
+        }
+
+        /* Write the entry sets. */
+        for (s32 i = 0; i < entry_set_count; ++i) {
+            u8 *node = out->data() + FixtureBucketTreeNodeSize * (1 + i);
+
+            const s32 first = i * entries_per_set;
+            const s32 count = std::min(entries_per_set, entry_count - first);
+            const s64 set_end = (i + 1 < entry_set_count) ? entry_offsets[first + count] : end_offset;
+
+            const BucketTreeNodeHeader node_header = { i, count, set_end };
+            std::memcpy(node, std::addressof(node_header), sizeof(node_header));
+            std::memcpy(node + sizeof(node_header), static_cast<const u8 *>(entries) + first * entry_size, count * entry_size);
+        }
+    }
+
+    void BuildPartitionFileSystemImage(std::vector<u8> *out, const std::vector<FixtureFile> &files) {
+        /* Build the name table. */
+        std::vector<u8> names;
+        std::vector<u32> name_offsets;
+        for (const auto &file : files) {
+            name_offsets.push_back(static_cast<u32>(names.size()));
+            names.insert(names.end(), file.path.begin(), file.path.end());
+            names.push_back(0);
+        }
+
+        /* Pad the header to an aligned size. */
+        const size_t unpadded = sizeof(PartitionFileSystemHeader) + files.size() * sizeof(PartitionFileSystemEntry) + names.size();
+        names.resize(names.size() + util::AlignUp(unpadded, 0x20) - unpadded, 0);
+
+        out->clear();
+        AppendPod(out, PartitionFileSystemHeader{ PartitionFileSystemMagic, static_cast<s32>(files.size()), static_cast<u32>(names.size()), 0 });
+
+        s64 offset = 0;
+        for (size_t i = 0; i < files.size(); ++i) {
+            AppendPod(out, PartitionFileSystemEntry{ offset, static_cast<s64>(files[i].data.size()), name_offsets[i], 0 });
+            offset += files[i].data.size();
+        }
+        out->insert(out->end(), names.begin(), names.end());
+
+        for (const auto &file : files) {
+            out->insert(out->end(), file.data.begin(), file.data.end());
+        }
+    }
+
+    void BuildSha256PartitionFileSystemImage(std::vector<u8> *out, size_t *out_header_size, const std::vector<FixtureFile> &files) {
+        /* Build the name table. */
+        std::vector<u8> names;
+        std::vector<u32> name_offsets;
+        for (const auto &file : files) {
+            name_offsets.push_back(static_cast<u32>(names.size()));
+            names.insert(names.end(), file.path.begin(), file.path.end());
+            names.push_back(0);
+        }
+
+        /* Game card partitions are page aligned. */
+        const size_t unpadded    = sizeof(PartitionFileSystemHeader) + files.size() * sizeof(Sha256PartitionFileSystemEntry) + names.size();
+        const size_t header_size = util::AlignUp(unpadded, Sha256PartitionAlignment);
+        names.resize(names.size() + header_size - unpadded, 0);
+
+        out->clear();
+        AppendPod(out, PartitionFileSystemHeader{ Sha256PartitionFileSystemMagic, static_cast<s32>(files.size()), static_cast<u32>(names.size()), 0 });
+
+        s64 offset = 0;
+        for (size_t i = 0; i < files.size(); ++i) {
+            const auto &file = files[i];
+
+            Sha256PartitionFileSystemEntry entry = {};
+            entry.offset           = offset;
+            entry.size             = file.data.size();
+            entry.name_offset      = name_offsets[i];
+            entry.hash_target_size = static_cast<u32>(file.hash_target_size != 0 ? file.hash_target_size : std::min(file.data.size(), Sha256PartitionAlignment));
+            crypto::GenerateSha256(entry.hash, sizeof(entry.hash), file.data.data(), entry.hash_target_size);
+            AppendPod(out, entry);
+
+            offset += util::AlignUp(file.data.size(), Sha256PartitionAlignment);
+        }
+        out->insert(out->end(), names.begin(), names.end());
+
+        for (const auto &file : files) {
+            out->insert(out->end(), file.data.begin(), file.data.end());
+            out->resize(util::AlignUp(out->size(), Sha256PartitionAlignment), 0);
+        }
+
+        *out_header_size = header_size;
+    }
+
+    void BuildRomFsImage(std::vector<u8> *out, const std::vector<FixtureFile> &files) {
+        struct DirectoryInfo {
+            std::string name;
+            size_t parent;
+            std::vector<size_t> children;
+            std::vector<size_t> files;
+            u32 entry_offset;
+        };
+
+        /* Build the directory tree; the root is always the first directory. */
+        std::vector<DirectoryInfo> dirs;
+        dirs.push_back(DirectoryInfo{ "", 0, {}, {}, 0 });
+
+        std::map<std::string, size_t> dir_indices;
+        dir_indices[""] = 0;
+
+        for (size_t i = 0; i < files.size(); ++i) {
+            const auto &path = files[i].path;
+            AMS_ABORT_UNLESS(!path.empty() && path[0] == '/');
+
+            size_t parent = 0;
+            size_t start  = 1;
+            for (size_t sep = path.find('/', start); sep != std::string::npos; sep = path.find('/', start)) {
+                const auto dir_path = path.substr(0, sep);
+                auto it = dir_indices.find(dir_path);
+                if (it == dir_indices.end()) {
+                    dirs.push_back(DirectoryInfo{ path.substr(start, sep - start), parent, {}, {}, 0 });
+                    dirs[parent].children.push_back(dirs.size() - 1);
+                    it = dir_indices.emplace(dir_path, dirs.size() - 1).first;
+                }
+
+                parent = it->second;
+                start  = sep + 1;
+            }
+
+            dirs[parent].files.push_back(i);
+        }
+
+        /* Assign entry offsets. Directories are laid out in creation order, and files grouped by directory. */
+        u32 dir_table_size = 0;
+        for (auto &dir : dirs) {
+            dir.entry_offset = dir_table_size;
+            dir_table_size  += sizeof(RomFsDirectoryEntry) + util::AlignUp(dir.name.size(), 4);
+        }
+
+        std::vector<u32> file_entry_offsets(files.size());
+        std::vector<s64> file_data_offsets(files.size());
+        u32 file_table_size = 0;
+        s64 body_size = 0;
+        for (const auto &dir : dirs) {
+            for (const auto file_index : dir.files) {
+                const auto &path = files[file_index].path;
+                const auto name  = path.substr(path.rfind('/') + 1);
+
+                file_entry_offsets[file_index] = file_table_size;
+                file_table_size += sizeof(RomFsFileEntry) + util::AlignUp(name.size(), 4);
+
+                file_data_offsets[file_index] = body_size;
+                body_size = util::AlignUp(body_size + static_cast<s64>(files[file_index].data.size()), RomFsFileAlignment);
+            }
+        }
+
+        /* Build the tables. */
+        const u32 dir_bucket_count  = GetRomFsBucketCount(dirs.size());
+        const u32 file_bucket_count = GetRomFsBucketCount(files.size());
+
+        std::vector<u32> dir_buckets(dir_bucket_count, RomFsEntryNone);
+        std::vector<u32> file_buckets(file_bucket_count, RomFsEntryNone);
+        std::vector<u8> dir_table(dir_table_size, 0);
+        std::vector<u8> file_table(file_table_size, 0);
+
+        for (size_t i = 0; i < dirs.size(); ++i) {
+            const auto &dir = dirs[i];
+
+            RomFsDirectoryEntry entry;
+            entry.parent    = dirs[dir.parent].entry_offset;
+            entry.sibling   = RomFsEntryNone;
+            entry.child     = dir.children.empty() ? RomFsEntryNone : dirs[dir.children.front()].entry_offset;
+            entry.file      = dir.files.empty()    ? RomFsEntryNone : file_entry_offsets[dir.files.front()];
+            entry.name_size = dir.name.size();
+
+            if (i != 0) {
+                const auto &siblings = dirs[dir.parent].children;
+                const auto it = std::find(siblings.begin(), siblings.end(), i);
+                if (it + 1 != siblings.end()) {
+                    entry.sibling = dirs[*(it + 1)].entry_offset;
+                }
+            }
+
+            const u32 bucket = CalculateRomFsPathHash(entry.parent, dir.name) % dir_bucket_count;
+            entry.hash_next     = dir_buckets[bucket];
+            dir_buckets[bucket] = dir.entry_offset;
+
+            std::memcpy(dir_table.data() + dir.entry_offset, std::addressof(entry), sizeof(entry));
+            std::memcpy(dir_table.data() + dir.entry_offset + sizeof(entry), dir.name.data(), dir.name.size());
+        }
+
+        for (const auto &dir : dirs) {
+            for (size_t j = 0; j < dir.files.size(); ++j) {
+                const auto file_index = dir.files[j];
+                const auto &path = files[file_index].path;
+                const auto name  = path.substr(path.rfind('/') + 1);
+
+                RomFsFileEntry entry;
+                entry.parent    = dir.entry_offset;
+                entry.sibling   = (j + 1 < dir.files.size()) ? file_entry_offsets[dir.files[j + 1]] : RomFsEntryNone;
+                entry.offset    = file_data_offsets[file_index];
+                entry.size      = files[file_index].data.size();
+                entry.name_size = name.size();
+
+                const u32 bucket = CalculateRomFsPathHash(entry.parent, name) % file_bucket_count;
+                entry.hash_next      = file_buckets[bucket];
+                file_buckets[bucket] = file_entry_offsets[file_index];
+
+                std::memcpy(file_table.data() + file_entry_offsets[file_index], std::addressof(entry), sizeof(entry));
+                std::memcpy(file_table.data() + file_entry_offsets[file_index] + sizeof(entry), name.data(), name.size());
+            }
+        }
+
+        /* Lay out the image: header, file data, then the tables. */
+        RomFsHeader header = {};
+        header.header_size             = sizeof(RomFsHeader);
+        header.body_offset             = RomFsBodyOffset;
+        header.directory_bucket_offset = util::AlignUp(RomFsBodyOffset + body_size, 4);
+        header.directory_bucket_size   = dir_buckets.size() * sizeof(u32);
+        header.directory_entry_offset  = header.directory_bucket_offset + header.directory_bucket_size;
+        header.directory_entry_size    = dir_table.size();
+        header.file_bucket_offset      = header.directory_entry_offset + header.directory_entry_size;
+        header.file_bucket_size        = file_buckets.size() * sizeof(u32);
+        header.file_entry_offset       = header.file_bucket_offset + header.file_bucket_size;
+        header.file_entry_size         = file_table.size();
+
+        out->assign(header.file_entry_offset + header.file_entry_size, 0);
+        std::memcpy(out->data(), std::addressof(header), sizeof(header));
+        for (size_t i = 0; i < files.size(); ++i) {
+            std::memcpy(out->data() + RomFsBodyOffset + file_data_offsets[i], files[i].data.data(), files[i].data.size());
+        }
+        std::memcpy(out->data() + header.directory_bucket_offset, dir_buckets.data(), header.directory_bucket_size);
+        std::memcpy(out->data() + header.directory_entry_offset, dir_table.data(), header.directory_entry_size);
+        std::memcpy(out->data() + header.file_bucket_offset, file_buckets.data(), header.file_bucket_size);
+        std::memcpy(out->data() + header.file_entry_offset, file_table.data(), header.file_entry_size);
+    }
+
+    void BuildHierarchicalSha256Image(std::vector<u8> *out, fssystem::NcaFsHeader::HashData::HierarchicalSha256Data *out_hash_data, const std::vector<u8> &data, size_t block_size) {
+        const size_t table_size  = util::DivideUp(data.size(), block_size) * HashSize;
+        const size_t data_offset = util::AlignUp(table_size, HierarchicalSha256DataAlignment);
+
+        out->assign(data_offset + data.size(), 0);
+        std::memcpy(out->data() + data_offset, data.data(), data.size());
+        HashBlocks(out->data(), data.data(), data.size(), block_size, false);
+
+        *out_hash_data = {};
+        crypto::GenerateSha256(out_hash_data->fs_data_master_hash.value, sizeof(out_hash_data->fs_data_master_hash.value), out->data(), table_size);
+        out_hash_data->hash_block_size  = block_size;
+        out_hash_data->hash_layer_count = 2;
+        out_hash_data->hash_layer_region[0].offset = 0;
+        out_hash_data->hash_layer_region[0].size   = table_size;
+        out_hash_data->hash_layer_region[1].offset = data_offset;
+        out_hash_data->hash_layer_region[1].size   = data.size();
+    }
+
+    void BuildHierarchicalIntegrityImage(std::vector<u8> *out, fssystem::NcaFsHeader::HashData::IntegrityMetaInfo *out_meta_info, const std::vector<u8> &data) {
+        /* Each level holds the hashes of the blocks of the level after it; the last level is the data. */
+        s64 level_sizes[IntegrityLevelCount];
+        level_sizes[IntegrityLevelCount - 1] = data.size();
+        for (s32 i = IntegrityLevelCount - 2; i >= 0; --i) {
+            level_sizes[i] = util::DivideUp(level_sizes[i + 1], IntegrityBlockSize) * HashSize;
+        }
+
+        s64 level_offsets[IntegrityLevelCount];
+        s64 cur_offset = 0;
+        for (s32 i = 0; i < IntegrityLevelCount; ++i) {
+            level_offsets[i] = cur_offset;
+            cur_offset = util::AlignUp(cur_offset + level_sizes[i], IntegrityBlockSize);
+        }
+
+        out->assign(level_offsets[IntegrityLevelCount - 1] + level_sizes[IntegrityLevelCount - 1], 0);
+        std::memcpy(out->data() + level_offsets[IntegrityLevelCount - 1], data.data(), data.size());
+
+        for (s32 i = IntegrityLevelCount - 2; i >= 0; --i) {
+            HashBlocks(out->data() + level_offsets[i], out->data() + level_offsets[i + 1], level_sizes[i + 1], IntegrityBlockSize, true);
+        }
+
+        /* The master hash covers the (single, padded) block of the first level. */
+        *out_meta_info = {};
+        out_meta_info->magic            = IntegrityMetaMagic;
+        out_meta_info->version          = IntegrityMetaVersion;
+        out_meta_info->master_hash_size = HashSize;
+        HashBlocks(out_meta_info->master_hash.value, out->data() + level_offsets[0], level_sizes[0], IntegrityBlockSize, true);
+
+        auto &level_info = out_meta_info->level_hash_info;
+        level_info.max_layers = IntegrityLevelCount + 1;
+        for (s32 i = 0; i < IntegrityLevelCount; ++i) {
+            level_info.info[i].offset.Set(level_offsets[i]);
+            level_info.info[i].size.Set(level_sizes[i]);
+            level_info.info[i].block_order = IntegrityBlockOrder;
+        }
+    }
+
+    bool CompressLz4Block(std::vector<u8> *out, const void *src, size_t size) {
+        constexpr size_t MinMatchSize     = 4;
+        constexpr size_t LastLiteralsSize = 5;
+        constexpr size_t MatchFindLimit   = 12;
+        constexpr size_t MatchOffsetMax   = 0xFFFF;
+        constexpr size_t HashLog          = 12;
+        constexpr size_t NoPosition       = std::numeric_limits<size_t>::max();
+
+        const u8 *in = static_cast<const u8 *>(src);
+        out->clear();
+
+        auto AppendLength = [&] (size_t len) {
+            for (; len >= 0xFF; len -= 0xFF) {
+                out->push_back(0xFF);
+            }
+            out->push_back(static_cast<u8>(len));
+        };
+
+        /* Emit a sequence of literals followed by a match; the final sequence has no match. */
+        auto AppendSequence = [&] (size_t literal_offset, size_t literal_size, size_t match_offset, size_t match_size) {
+            const size_t match_code = match_size != 0 ? match_size - MinMatchSize : 0;
+
+            out->push_back(static_cast<u8>((std::min<size_t>(literal_size, 0xF) << 4) | std::min<size_t>(match_code, 0xF)));
+            if (literal_size >= 0xF) {
+                AppendLength(literal_size - 0xF);
+            }
+            out->insert(out->end(), in + literal_offset, in + literal_offset + literal_size);
+
+            if (match_size != 0) {
+                out->push_back(static_cast<u8>(match_offset >> 0));
+                out->push_back(static_cast<u8>(match_offset >> 8));
+                if (match_code >= 0xF) {
+                    AppendLength(match_code - 0xF);
+                }
+            }
+        };
+
+        /* Greedily take the most recent match for each position, leaving the tail the format requires as literals. */
+        size_t anchor = 0;
+        if (size > MatchFindLimit) {
+            std::vector<size_t> table(1 << HashLog, NoPosition);
+
+            const size_t match_end_limit = size - LastLiteralsSize;
+            size_t pos = 0;
+            while (pos + MatchFindLimit <= size) {
+                u32 sequence;
+                std::memcpy(std::addressof(sequence), in + pos, sizeof(sequence));
+
+                const size_t hash      = static_cast<u32>(sequence * 2654435761u) >> (32 - HashLog);
+                const size_t candidate = table[hash];
+                table[hash] = pos;
+
+                if (candidate != NoPosition && pos - candidate <= MatchOffsetMax && std::memcmp(in + candidate, in + pos, MinMatchSize) == 0) {
+                    size_t match_size = MinMatchSize;
+                    while (pos + match_size < match_end_limit && in[candidate + match_size] == in[pos + match_size]) {
+                        ++match_size;
+                    }
+
+                    AppendSequence(anchor, pos - anchor, pos - candidate, match_size);
+                    pos   += match_size;
+                    anchor = pos;
+                } else {
+                    ++pos;
+                }
+            }
+        }
+        AppendSequence(anchor, size - anchor, 0, 0);
+
+        return out->size() < size;
+    }
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* Builders for the images written by the fixture generator. All images are built in memory. */
+    struct FixtureFile {
+        std::string path;
+        std::vector<u8> data;
+        size_t hash_target_size = 0; /* For sha256 partitions; zero means the first page of the file. */
+    };
+
+    /* Bucket tree tables, as consumed by the library's storages. */
+    struct FixtureBucketTreeHeader {
+        u32 magic;
+        u32 version;
+        s32 entry_count;
+        s32 reserved;
+    };
+    static_assert(sizeof(FixtureBucketTreeHeader) == 0x10);
+
+    struct FixtureIndirectEntry {
+        u8 virt_offset[sizeof(s64)];
+        u8 phys_offset[sizeof(s64)];
+        s32 storage_index;
+
+        s64 GetOffset() const { s64 v; std::memcpy(std::addressof(v), this->virt_offset, sizeof(v)); return v; }
+    };
+    static_assert(sizeof(FixtureIndirectEntry) == 0x14);
+
+    struct FixtureAesCtrExEntry {
+        u8 offset[sizeof(s64)];
+        u8 encryption_value;
+        u8 reserved[3];
+        s32 generation;
+
+        s64 GetOffset() const { s64 v; std::memcpy(std::addressof(v), this->offset, sizeof(v)); return v; }
+    };
+    static_assert(sizeof(FixtureAesCtrExEntry) == 0x10);
+
+    struct FixtureCompressionEntry {
+        s64 virt_offset;
+        s64 phys_offset;
+        u8 compression_type;
+        s8 compression_level;
+        u16 reserved;
+        u32 phys_size;
+
+        s64 GetOffset() const { return this->virt_offset; }
+    };
+    static_assert(sizeof(FixtureCompressionEntry) == 0x18);
+
+    constexpr inline size_t FixtureBucketTreeNodeSize = 16_KB;
+
+    void BuildBucketTreeImpl(std::vector<u8> *out, FixtureBucketTreeHeader *out_header, const void *entries, size_t entry_size, const std::vector<s64> &entry_offsets, s64 end_offset);
+
+    template<typename Entry>
+    void BuildBucketTree(std::vector<u8> *out, FixtureBucketTreeHeader *out_header, const std::vector<Entry> &entries, s64 end_offset) {
+        std::vector<s64> entry_offsets(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            entry_offsets[i] = entries[i].GetOffset();
+        }
+
+        BuildBucketTreeImpl(out, out_header, entries.data(), sizeof(Entry), entry_offsets, end_offset);
+    }
+
+    /* File system images. */
+    void BuildPartitionFileSystemImage(std::vector<u8> *out, const std::vector<FixtureFile> &files);
+    void BuildSha256PartitionFileSystemImage(std::vector<u8> *out, size_t *out_header_size, const std::vector<FixtureFile> &files);
+    void BuildRomFsImage(std::vector<u8> *out, const std::vector<FixtureFile> &files);
+
+    /* Hash trees over a section's data; the output is the section image with the data inside it. */
+    void BuildHierarchicalSha256Image(std::vector<u8> *out, fssystem::NcaFsHeader::HashData::HierarchicalSha256Data *out_hash_data, const std::vector<u8> &data, size_t block_size);
+    void BuildHierarchicalIntegrityImage(std::vector<u8> *out, fssystem::NcaFsHeader::HashData::IntegrityMetaInfo *out_meta_info, const std::vector<u8> &data);
+
+    /* Compresses a chunk to an lz4 block; returns false if that would not make it smaller. */
+    bool CompressLz4Block(std::vector<u8> *out, const void *src, size_t size);
+
+}
@@ -15,52 +15,270 @@
  */
 #include <stratosphere.hpp>
 #include "hactool_fs_utils.hpp"
+#include "hactool_concatenated_storage.hpp"
+#include "hactool_output_writer.hpp"
+#include "hactool_memory_utils.hpp"
+#include "hactool_memory_accounting.hpp"
+#include "hactool_trace.hpp"
+#include "hactool_progress.hpp"
 
 namespace ams::hactool {
 
     namespace {
 
-        constexpr size_t WorkBufferSize = 4_MB;
+        constexpr size_t WorkBufferSize        = 4_MB;
+        constexpr size_t MinimumWorkBufferSize = 256_KB;
 
-        template<size_t Count, char Full = '=', char Empty = ' '>
-        class ProgressPrinter {
-            NON_COPYABLE(ProgressPrinter);
-            NON_MOVEABLE(ProgressPrinter);
+        /* Entry buffers hold the indirect and counter entries of a single file, so shouldn't shrink too far. */
+        constexpr size_t EntryBufferSize        = 2_MB;
+        constexpr size_t MinimumEntryBufferSize = 256_KB;
+
+        /* Granularity at which zero runs are left unwritten in saved images. */
+        constexpr size_t SparseBlockSize = 64_KB;
+
+        /* Files at most this large may share a single read with their physical neighbors. */
+        constexpr s64 CoalescedFileSizeMax = 1_MB;
+
+        /* Padding between neighboring files is read through (rather than seeked over) if it is at most this large. */
+        constexpr s64 CoalescedGapSizeMax  = 64_KB;
+
+        class RomFsExtractionPlan {
+            NON_COPYABLE(RomFsExtractionPlan);
+            NON_MOVEABLE(RomFsExtractionPlan);
+            public:
+                struct Entry {
+                    s64 offset;
+                    s64 size;
+                    size_t path_offset;
+                };
             private:
-                const char *m_prefix;
-                size_t m_segs;
-                size_t m_current;
-                size_t m_total;
+                std::vector<Entry> m_entries;
+                std::vector<char> m_path_buffer;
             public:
-                ProgressPrinter(const char *p, size_t total) : m_prefix(p), m_segs(0), m_current(0), m_total(total) {
-                    this->Render();
+                RomFsExtractionPlan() : m_entries(), m_path_buffer() { /* ... */ }
+
+                void Add(const fs::Path &path, s64 offset, s64 size) {
+                    const char *str = path.GetString();
+                    const size_t len = std::strlen(str);
+
+                    m_entries.push_back(Entry{ offset, size, m_path_buffer.size() });
+                    m_path_buffer.insert(m_path_buffer.end(), str, str + len + 1);
                 }
 
-                ~ProgressPrinter() {
-                    printf(" Done!\n");
+                void SortByPhysicalOffset() {
+                    std::stable_sort(m_entries.begin(), m_entries.end(), [](const Entry &lhs, const Entry &rhs) {
+                        return lhs.offset < rhs.offset;
+                    });
                 }
 
-                void Update(size_t new_current) {
-                    m_current = new_current;
+                size_t GetCount() const { return m_entries.size(); }
+                const Entry &Get(size_t i) const { return m_entries[i]; }
+                const char *GetPath(const Entry &e) const { return m_path_buffer.data() + e.path_offset; }
 
-                    const size_t unit = m_total / Count;
-                    if (const size_t segs = std::min<size_t>(m_current / unit, Count); segs != m_segs) {
-                        m_segs = segs;
-                        this->Render();
+                size_t GetCoalescedRunEnd(size_t start, size_t max_read_size) const {
+                    /* Large files are always read on their own. */
+                    const auto &first = m_entries[start];
+                    if (first.size > CoalescedFileSizeMax) {
+                        return start + 1;
                     }
-                }
 
-                void Render() {
-                    char prog[Count + 1];
-                    std::memset(prog, Full, m_segs);
-                    std::memset(prog + m_segs, Empty, Count - m_segs);
-                    prog[Count] = 0;
+                    /* Extend the run while the next file is small, near, and fits in the buffer. */
+                    s64 run_end = first.offset + first.size;
+                    size_t end = start + 1;
+                    while (end < m_entries.size()) {
+                        const auto &next = m_entries[end];
+                        if (next.size > CoalescedFileSizeMax || next.offset - run_end > CoalescedGapSizeMax) {
+                            break;
+                        }
+
+                        const s64 next_run_end = std::max(run_end, next.offset + next.size);
+                        if (next_run_end - first.offset > static_cast<s64>(max_read_size)) {
+                            break;
+                        }
 
-                    printf("\r%s [%s]", m_prefix, prog);
-                    fflush(stdout);
+                        run_end = next_run_end;
+                        ++end;
+                    }
+
+                    return end;
                 }
         };
 
+        /* Writes data to a freshly created file, skipping all-zero blocks. */
+        /* Unwritten ranges of a new file read back as zero, and stay unallocated on filesystems supporting sparse files. */
+        Result WriteNonZeroBlocks(fs::fsa::IFile *file, s64 file_offset, const void *data, size_t size) {
+            const u8 *src = static_cast<const u8 *>(data);
+
+            /* Each block is checked once; runs of non-zero blocks are gathered so that they're written together. */
+            size_t run_start = size;
+            for (size_t pos = 0; pos < size; pos += SparseBlockSize) {
+                if (!IsZeroFilled(src + pos, std::min(SparseBlockSize, size - pos))) {
+                    if (run_start == size) {
+                        run_start = pos;
+                    }
+                } else if (run_start != size) {
+                    R_TRY(file->Write(file_offset + run_start, src + run_start, pos - run_start, fs::WriteOption::None));
+                    run_start = size;
+                }
+            }
+
+            if (run_start != size) {
+                R_TRY(file->Write(file_offset + run_start, src + run_start, size - run_start, fs::WriteOption::None));
+            }
+
+            R_SUCCEED();
+        }
+
+        /* Writes a new output file of the given size, whose contents are produced by read_chunk(offset, buffer, size). */
+        template<typename F>
+        Result StreamToOutput(OutputWriter *writer, const char *path, s64 size, F read_chunk) {
+            /* Small files are created, written, and closed in one go. */
+            if (size <= static_cast<s64>(OutputWriter::BufferSize)) {
+                void *buffer = writer->AcquireBuffer();
+                ON_SCOPE_EXIT { writer->ReleaseBuffer(buffer); };
+
+                R_TRY(read_chunk(0, buffer, static_cast<size_t>(size)));
+                R_TRY(writer->WriteFile(path, buffer, buffer, static_cast<size_t>(size)));
+
+                AddProgress(size, 1);
+                R_SUCCEED();
+            }
+
+            /* Larger files are written in chunks, each out of its own buffer, so reads overlap with writes. */
+            OutputWriter::FileHandle handle;
+            R_TRY(writer->OpenFile(std::addressof(handle), path, size));
+            ON_SCOPE_EXIT { writer->CloseFile(handle); };
+
+            for (s64 ofs = 0; ofs < size; /* ... */) {
+                const size_t cur_size = static_cast<size_t>(std::min<s64>(OutputWriter::BufferSize, size - ofs));
+
+                void *buffer = writer->AcquireBuffer();
+                ON_SCOPE_EXIT { writer->ReleaseBuffer(buffer); };
+
+                R_TRY(read_chunk(ofs, buffer, cur_size));
+                R_TRY(writer->Write(handle, ofs, buffer, buffer, cur_size));
+
+                ofs += cur_size;
+                AddProgress(cur_size, 0);
+            }
+
+            AddProgress(0, 1);
+            R_SUCCEED();
+        }
+
+        /* Copies a file from a source filesystem to a new output file. */
+        Result CopyFileToOutput(OutputWriter *writer, fs::fsa::IFileSystem *src_fs, const fs::Path &path, s64 size) {
+            std::unique_ptr<fs::fsa::IFile> src_file;
+            R_TRY(src_fs->OpenFile(std::addressof(src_file), path, fs::OpenMode_Read));
+
+            R_RETURN(StreamToOutput(writer, path.GetString(), size, [&](s64 offset, void *buffer, size_t read_size) -> Result {
+                size_t actual_size = 0;
+                R_TRY(src_file->Read(std::addressof(actual_size), offset, buffer, read_size, fs::ReadOption::None));
+                R_UNLESS(actual_size == read_size, fs::ResultOutOfRange());
+
+                R_SUCCEED();
+            }));
+        }
+
+        /* Copies a directory tree through an output writer, optionally announcing each file as it's saved. */
+        Result ExtractDirectoryImpl(std::shared_ptr<fs::fsa::IFileSystem> &dst_fs, std::shared_ptr<fs::fsa::IFileSystem> &src_fs, const char *prefix, const char *dst_path, const char *src_path, bool print_files) {
+            char job_name[1_KB];
+            util::TSNPrintf(job_name, sizeof(job_name), "Extracting %s%s", prefix, src_path);
+            ScopedProgressJob job(job_name);
+
+            auto extract_impl = [&] () -> Result {
+                /* Create a writer for the destination directory. */
+                std::unique_ptr<OutputWriter> writer;
+                R_TRY(CreateOutputWriter(std::addressof(writer), dst_fs, dst_path));
+
+                /* Set up the source path to point at the target directory. */
+                fs::Path src_fs_path;
+                R_TRY(src_fs_path.SetShallowBuffer(src_path));
+
+                /* Iterate, copying files. */
+                R_TRY(fssystem::IterateDirectoryRecursively(src_fs.get(), src_fs_path,
+                    [&](const fs::Path &path, const fs::DirectoryEntry &) -> Result { /* On Enter Directory */
+                        /* Create the directory. */
+                        R_RETURN(writer->CreateDirectory(path.GetString()));
+                    },
+                    [&](const fs::Path &, const fs::DirectoryEntry &) -> Result { /* On Exit Directory */
+                        R_SUCCEED();
+                    },
+                    [&](const fs::Path &path, const fs::DirectoryEntry &ent) -> Result { /* On File */
+                        /* Copy the file. */
+                        HACTOOL_TRACE_ZONE("ExtractFile", "path", path.GetString());
+                        if (print_files) {
+                            printf("Saving %s%s...\n", prefix, path.GetString());
+                        }
+                        AddProgressTotal(ent.file_size, 1);
+                        R_RETURN(CopyFileToOutput(writer.get(), src_fs.get(), path, ent.file_size));
+                    }
+                ));
+
+                /* Wait for all writes to complete. */
+                R_RETURN(writer->Finalize());
+            };
+
+            const auto res = extract_impl();
+            if (R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: Failed to extract %s%s to %s: 2%03d-%04d\n", prefix, src_path, dst_path, res.GetModule(), res.GetDescription());
+            }
+            R_RETURN(res);
+        }
+
+        bool IsEntryType(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path, fs::DirectoryEntryType type) {
+            fs::Path fs_path;
+            if (R_FAILED(fs_path.SetShallowBuffer(path))) {
+                return false;
+            }
+
+            fs::DirectoryEntryType entry_type;
+            return R_SUCCEEDED(fs->GetEntryType(std::addressof(entry_type), fs_path)) && entry_type == type;
+        }
+
+        /* Split parts are numbered from zero in a fixed-width trailing field. */
+        /* Only the layouts dumpers actually produce are recognized: a game.xc0, game.ns0 or game.nc0 style extension, */
+        /* or parts named purely by number (00, 01...) inside a directory. Anything else, e.g. patch_v0, is opened as-is. */
+        bool GetSplitFileStem(char *dst, size_t dst_size, int *out_width, const char *path) {
+            const size_t len = std::strlen(path);
+
+            size_t width = 0;
+            while (width < len && path[len - 1 - width] == '0') {
+                ++width;
+            }
+
+            const size_t stem_len = len - width;
+            if (width == 0 || stem_len >= dst_size) {
+                return false;
+            }
+
+            auto IsSplitExtension = [&] () {
+                constexpr const char *SplitExtensions[] = { ".xc", ".ns", ".nc" };
+
+                if (stem_len < 3) {
+                    return false;
+                }
+
+                for (const auto *extension : SplitExtensions) {
+                    if (path[stem_len - 3] == extension[0] && std::tolower(static_cast<unsigned char>(path[stem_len - 2])) == extension[1] && std::tolower(static_cast<unsigned char>(path[stem_len - 1])) == extension[2]) {
+                        return true;
+                    }
+                }
+
+                return false;
+            };
+
+            const bool is_numeric_name = stem_len == 0 || path[stem_len - 1] == '/';
+            if (!is_numeric_name && !IsSplitExtension()) {
+                return false;
+            }
+
+            std::memcpy(dst, path, stem_len);
+            dst[stem_len] = 0;
+            *out_width = static_cast<int>(width);
+            return true;
+        }
+
     }
 
     bool PathView::HasPrefix(util::string_view prefix) const {
@@ -89,6 +307,51 @@ namespace ams::hactool {
         R_SUCCEED();
     }
 
+    Result OpenInputStorage(std::shared_ptr<fs::IStorage> *out, std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path) {
+        R_UNLESS(path != nullptr, fs::ResultNullptrArgument());
+
+        /* Determine whether the input is split, and if so how its parts are named. */
+        char stem[1_KB];
+        int width = 0;
+        if (IsEntryType(fs, path, fs::DirectoryEntryType_Directory)) {
+            const size_t len = std::strlen(path);
+            util::TSNPrintf(stem, sizeof(stem), "%s%s", path, (len > 0 && path[len - 1] == '/') ? "" : "/");
+            width = 2;
+        } else {
+            char second_part_path[1_KB];
+            if (!GetSplitFileStem(stem, sizeof(stem), std::addressof(width), path)) {
+                R_RETURN(OpenFileStorage(out, fs, path));
+            }
+
+            util::TSNPrintf(second_part_path, sizeof(second_part_path), "%s%0*d", stem, width, 1);
+            if (!IsEntryType(fs, second_part_path, fs::DirectoryEntryType_File)) {
+                R_RETURN(OpenFileStorage(out, fs, path));
+            }
+        }
+
+        /* Open every part in sequence. */
+        auto storage = fssystem::AllocateShared<ConcatenatedStorage>();
+        R_UNLESS(storage != nullptr, fs::ResultAllocationMemoryFailedAllocateShared());
+
+        for (int i = 0; /* ... */; ++i) {
+            char part_path[1_KB];
+            util::TSNPrintf(part_path, sizeof(part_path), "%s%0*d", stem, width, i);
+            if (!IsEntryType(fs, part_path, fs::DirectoryEntryType_File)) {
+                break;
+            }
+
+            std::shared_ptr<fs::IStorage> part;
+            R_TRY(OpenFileStorage(std::addressof(part), fs, part_path));
+            R_TRY(storage->AddPart(std::move(part)));
+        }
+
+        R_UNLESS(storage->GetPartCount() > 0, fs::ResultPathNotFound());
+
+        /* Set the output. */
+        *out = std::move(storage);
+        R_SUCCEED();
+    }
+
     Result OpenSubDirectoryFileSystem(std::shared_ptr<fs::fsa::IFileSystem> *out, std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path) {
         /* Get the fs path. */
         ams::fs::Path fs_path;
@@ -113,6 +376,45 @@ namespace ams::hactool {
         R_SUCCEED();
     }
 
+    Result ReadContentMetaFile(TrackedUniquePtr<u8> *out, size_t *out_size, std::shared_ptr<fs::fsa::IFileSystem> &fs) {
+        bool found = false;
+        R_RETURN(fssystem::IterateDirectoryRecursively(fs.get(),
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &path, const fs::DirectoryEntry &entry) -> Result {
+                /* If we already found the content meta, finish. */
+                R_SUCCEED_IF(found);
+
+                /* If the path isn't a meta nca, finish. */
+                R_SUCCEED_IF(!ncm::IsContentMetaFileName(entry.name));
+
+                /* Open the file storage. */
+                std::shared_ptr<fs::IStorage> storage;
+                R_TRY(OpenFileStorage(std::addressof(storage), fs, path.GetString()));
+
+                /* Get the meta file size. */
+                s64 size;
+                R_TRY(storage->GetSize(std::addressof(size)));
+
+                /* Allocate buffer. */
+                auto data = MakeTrackedArray<u8>(static_cast<size_t>(size), AllocationSite_FileData);
+                R_UNLESS(data != nullptr, fs::ResultAllocationMemoryFailed());
+
+                /* Read the meta into the buffer. */
+                R_TRY(storage->Read(0, data.get(), size));
+
+                /* Return the output buffer. */
+                *out      = std::move(data);
+                *out_size = static_cast<size_t>(size);
+                found = true;
+
+                R_SUCCEED();
+            }
+        ));
+
+        R_THROW(ncm::ResultContentMetaNotFound());
+    }
+
     Result PrintDirectory(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *prefix, const char *path) {
         /* Get the fs path. */
         ams::fs::Path fs_path;
@@ -147,20 +449,20 @@ namespace ams::hactool {
         R_TRY(fs_path.SetShallowBuffer(path));
 
         /* Allocate a work buffer. */
-        constexpr size_t EntryBufferSize = 2_MB;
-        void *buffer = std::malloc(EntryBufferSize);
+        const size_t entry_buffer_size = GetAdaptiveBufferSize(EntryBufferSize, MinimumEntryBufferSize);
+        void *buffer = AllocateTracked(entry_buffer_size, AllocationSite_EntryBuffer);
         if (buffer == nullptr) {
             fprintf(stderr, "[Warning]: Failed to allocate work buffer to print updated romfs directory (%s%s)!\n", prefix, path);
             R_SUCCEED();
         }
-        ON_SCOPE_EXIT { std::free(buffer); };
+        ON_SCOPE_EXIT { FreeTracked(buffer); };
 
         /* Set up entry buffers. */
         auto *indirect_entries = reinterpret_cast<fssystem::IndirectStorage::Entry *>(reinterpret_cast<uintptr_t>(buffer) + 0);
-        const auto max_indirect_entries = (EntryBufferSize / 2) / sizeof(*indirect_entries);
+        const auto max_indirect_entries = (entry_buffer_size / 2) / sizeof(*indirect_entries);
 
-        auto *aes_ctr_ex_entries = reinterpret_cast<fssystem::AesCtrCounterExtendedStorage::Entry *>(reinterpret_cast<uintptr_t>(buffer) + (EntryBufferSize / 2));
-        const auto max_aes_ctr_ex_entries = (EntryBufferSize / 2) / sizeof(*aes_ctr_ex_entries);
+        auto *aes_ctr_ex_entries = reinterpret_cast<fssystem::AesCtrCounterExtendedStorage::Entry *>(reinterpret_cast<uintptr_t>(buffer) + (entry_buffer_size / 2));
+        const auto max_aes_ctr_ex_entries = (entry_buffer_size / 2) / sizeof(*aes_ctr_ex_entries);
 
         /* Iterate, printing the contents of the directory. */
         const auto iter_result = fssystem::IterateDirectoryRecursively(fs,
@@ -241,156 +543,98 @@ namespace ams::hactool {
     }
 
     Result ExtractDirectory(std::shared_ptr<fs::fsa::IFileSystem> &dst_fs, std::shared_ptr<fs::fsa::IFileSystem> &src_fs, const char *prefix, const char *dst_path, const char *src_path) {
-        /* Allocate a work buffer. */
-        void *buffer = std::malloc(WorkBufferSize);
-        if (buffer == nullptr) {
-            fprintf(stderr, "[Warning]: Failed to allocate work buffer to extract %s%s to %s!\n", prefix, src_path, dst_path);
-            R_SUCCEED();
-        }
-        ON_SCOPE_EXIT { std::free(buffer); };
+        HACTOOL_TRACE_ZONE("ExtractDirectory", "path", dst_path);
+        R_RETURN(ExtractDirectoryImpl(dst_fs, src_fs, prefix, dst_path, src_path, true));
+    }
 
-        auto extract_impl = [&] () -> Result {
-            /* Set up the destination work path to point at the target directory. */
-            fs::Path dst_fs_path;
-            R_TRY(dst_fs_path.SetShallowBuffer(dst_path));
+    Result ExtractDirectoryWithProgress(std::shared_ptr<fs::fsa::IFileSystem> &dst_fs, std::shared_ptr<fs::fsa::IFileSystem> &src_fs, const char *prefix, const char *dst_path, const char *src_path) {
+        HACTOOL_TRACE_ZONE("ExtractDirectoryWithProgress", "path", dst_path);
+        R_RETURN(ExtractDirectoryImpl(dst_fs, src_fs, prefix, dst_path, src_path, false));
+    }
 
-            /* Try to create the destination directory. */
-            dst_fs->CreateDirectory(dst_fs_path);
+    Result ExtractRomFsDirectory(std::shared_ptr<fs::fsa::IFileSystem> &dst_fs, fssystem::RomFsFileSystem *src_fs, fs::IStorage *src_storage, const char *prefix, const char *dst_path, const char *src_path) {
+        HACTOOL_TRACE_ZONE("ExtractRomFsDirectory", "path", dst_path);
 
-            /* Verify that we can open the directory on the base filesystem. */
-            {
-                std::unique_ptr<fs::fsa::IDirectory> sub_dir;
-                R_TRY(dst_fs->OpenDirectory(std::addressof(sub_dir), dst_fs_path, fs::OpenDirectoryMode_Directory));
-            }
+        char job_name[1_KB];
+        util::TSNPrintf(job_name, sizeof(job_name), "Extracting %s%s", prefix, src_path);
+        ScopedProgressJob job(job_name);
 
-            /* Create/Initialize subdirectory filesystem. */
-            fssystem::SubDirectoryFileSystem subdir_fs{dst_fs};
-            R_TRY(subdir_fs.Initialize(dst_fs_path));
+        auto extract_impl = [&] () -> Result {
+            /* Create a writer for the destination directory. */
+            std::unique_ptr<OutputWriter> writer;
+            R_TRY(CreateOutputWriter(std::addressof(writer), dst_fs, dst_path));
 
             /* Set up the source path to point at the target directory. */
             fs::Path src_fs_path;
             R_TRY(src_fs_path.SetShallowBuffer(src_path));
 
-            /* Iterate, copying files. */
-            R_RETURN(fssystem::IterateDirectoryRecursively(src_fs.get(), src_fs_path,
+            /* Create directories in table order, and record where every file lives in the romfs body. */
+            RomFsExtractionPlan plan;
+            R_TRY(fssystem::IterateDirectoryRecursively(src_fs, src_fs_path,
                 [&](const fs::Path &path, const fs::DirectoryEntry &) -> Result { /* On Enter Directory */
                     /* Create the directory. */
-                    R_TRY_CATCH(subdir_fs.CreateDirectory(path)) {
-                        R_CATCH(fs::ResultPathAlreadyExists) { /* ... */ }
-                    } R_END_TRY_CATCH;
-
-                    R_SUCCEED();
+                    R_RETURN(writer->CreateDirectory(path.GetString()));
                 },
                 [&](const fs::Path &, const fs::DirectoryEntry &) -> Result { /* On Exit Directory */
                     R_SUCCEED();
                 },
-                [&](const fs::Path &path, const fs::DirectoryEntry &) -> Result { /* On File */
-                    /* Delete a file, if one already exists. */
-                    subdir_fs.DeleteFile(path);
-
-                    /* Copy the file. */
-                    printf("Saving %s%s...\n", prefix, path.GetString());
-                    R_TRY(fssystem::CopyFile(std::addressof(subdir_fs), src_fs.get(), path, path, buffer, WorkBufferSize));
+                [&](const fs::Path &path, const fs::DirectoryEntry &ent) -> Result { /* On File */
+                    /* Get the file base offset. */
+                    s64 file_offset = 0;
+                    R_TRY(src_fs->GetFileBaseOffset(std::addressof(file_offset), path));
 
+                    plan.Add(path, file_offset, ent.file_size);
+                    AddProgressTotal(ent.file_size, 1);
                     R_SUCCEED();
                 }
             ));
-        };
-
-        const auto res = extract_impl();
-        if (R_FAILED(res)) {
-            fprintf(stderr, "[Warning]: Failed to extract %s%s to %s: 2%03d-%04d\n", prefix, src_path, dst_path, res.GetModule(), res.GetDescription());
-        }
-        R_RETURN(res);
-    }
 
-    Result ExtractDirectoryWithProgress(std::shared_ptr<fs::fsa::IFileSystem> &dst_fs, std::shared_ptr<fs::fsa::IFileSystem> &src_fs, const char *prefix, const char *dst_path, const char *src_path) {
-        /* Allocate a work buffer. */
-        void *buffer = std::malloc(WorkBufferSize);
-        if (buffer == nullptr) {
-            fprintf(stderr, "[Warning]: Failed to allocate work buffer to extract %s%s to %s!\n", prefix, src_path, dst_path);
-            R_SUCCEED();
-        }
-        ON_SCOPE_EXIT { std::free(buffer); };
+            /* Visit files in the order they are laid out on disk. */
+            plan.SortByPhysicalOffset();
+
+            for (size_t i = 0; i < plan.GetCount(); /* ... */) {
+                const size_t run_end = plan.GetCoalescedRunEnd(i, OutputWriter::BufferSize);
+                const auto &first    = plan.Get(i);
+
+                if (run_end == i + 1 && first.size > static_cast<s64>(OutputWriter::BufferSize)) {
+                    /* The file is too large to buffer, so stream it in chunks. */
+                    HACTOOL_TRACE_ZONE("ExtractFile", "path", plan.GetPath(first));
+                    printf("Saving %s%s...\n", prefix, plan.GetPath(first));
+                    R_TRY(StreamToOutput(writer.get(), plan.GetPath(first), first.size, [&](s64 offset, void *buffer, size_t size) -> Result {
+                        R_RETURN(src_storage->Read(first.offset + offset, buffer, size));
+                    }));
+                } else {
+                    /* Get a buffer; the writer recycles it once everything written from it has landed. */
+                    void *buffer = writer->AcquireBuffer();
+                    ON_SCOPE_EXIT { writer->ReleaseBuffer(buffer); };
+
+                    /* Read (and decrypt) the whole run at once. */
+                    s64 read_end = first.offset;
+                    for (size_t j = i; j < run_end; ++j) {
+                        read_end = std::max(read_end, plan.Get(j).offset + plan.Get(j).size);
+                    }
+                    {
+                        HACTOOL_TRACE_ZONE("ReadRomFsRun", "first", plan.GetPath(first));
+                        R_TRY(src_storage->Read(first.offset, buffer, static_cast<size_t>(read_end - first.offset)));
+                    }
 
-        auto extract_impl = [&] () -> Result {
-            /* Set up the destination work path to point at the target directory. */
-            fs::Path dst_fs_path;
-            R_TRY(dst_fs_path.SetShallowBuffer(dst_path));
+                    /* Split the buffer into the individual files. */
+                    for (size_t j = i; j < run_end; ++j) {
+                        const auto &entry = plan.Get(j);
+                        const u8 *data    = static_cast<const u8 *>(buffer) + (entry.offset - first.offset);
 
-            /* Try to create the destination directory. */
-            dst_fs->CreateDirectory(dst_fs_path);
+                        HACTOOL_TRACE_ZONE("ExtractFile", "path", plan.GetPath(entry));
+                        printf("Saving %s%s...\n", prefix, plan.GetPath(entry));
+                        R_TRY(writer->WriteFile(plan.GetPath(entry), buffer, data, static_cast<size_t>(entry.size)));
+                        AddProgress(entry.size, 1);
+                    }
+                }
 
-            /* Verify that we can open the directory on the base filesystem. */
-            {
-                std::unique_ptr<fs::fsa::IDirectory> sub_dir;
-                R_TRY(dst_fs->OpenDirectory(std::addressof(sub_dir), dst_fs_path, fs::OpenDirectoryMode_Directory));
+                i = run_end;
             }
 
-            /* Create/Initialize subdirectory filesystem. */
-            fssystem::SubDirectoryFileSystem subdir_fs{dst_fs};
-            R_TRY(subdir_fs.Initialize(dst_fs_path));
-
-            /* Set up the source path to point at the target directory. */
-            fs::Path src_fs_path;
-            R_TRY(src_fs_path.SetShallowBuffer(src_path));
-
-            /* Iterate, copying files. */
-            R_RETURN(fssystem::IterateDirectoryRecursively(src_fs.get(), src_fs_path,
-                [&](const fs::Path &path, const fs::DirectoryEntry &) -> Result { /* On Enter Directory */
-                    /* Create the directory. */
-                    R_TRY_CATCH(subdir_fs.CreateDirectory(path)) {
-                        R_CATCH(fs::ResultPathAlreadyExists) { /* ... */ }
-                    } R_END_TRY_CATCH;
-
-                    R_SUCCEED();
-                },
-                [&](const fs::Path &, const fs::DirectoryEntry &) -> Result { /* On Exit Directory */
-                    R_SUCCEED();
-                },
-                [&](const fs::Path &path, const fs::DirectoryEntry &) -> Result { /* On File */
-                    /* Delete a file, if one already exists. */
-                    subdir_fs.DeleteFile(path);
-
-                    /* Open the existing file. */
-                    std::shared_ptr<fs::IStorage> storage;
-                    R_TRY(OpenFileStorage(std::addressof(storage), src_fs, path.GetString()));
-
-                    /* Get the file size. */
-                    s64 size;
-                    R_TRY(storage->GetSize(std::addressof(size)));
-
-                    /* Create the file. */
-                    R_TRY(subdir_fs.CreateFile(path, size));
-
-                    /* Open the file. */
-                    std::unique_ptr<fs::fsa::IFile> base_file;
-                    R_TRY(subdir_fs.OpenFile(std::addressof(base_file), path, fs::OpenMode_ReadWrite));
-
-                    /* Set the file size. */
-                    R_TRY(base_file->SetSize(size));
-
-                    /* Create a progress printer. */
-                    char prog_prefix[1_KB];
-                    util::TSNPrintf(prog_prefix, sizeof(prog_prefix), "Saving %s%s... ", prefix, path.GetString());
-                    ProgressPrinter<40> printer{prog_prefix, static_cast<size_t>(size)};
-
-                    /* Write. */
-                    s64 offset = 0;
-                    const s64 end_offset = static_cast<s64>(offset + size);
-                    while (offset < end_offset) {
-                        const s64 cur_write_size = std::min<s64>(WorkBufferSize, end_offset - offset);
-
-                        R_TRY(storage->Read(offset, buffer, cur_write_size));
-                        R_TRY(base_file->Write(offset, buffer, cur_write_size, fs::WriteOption::None));
-
-                        offset += cur_write_size;
-                        printer.Update(static_cast<size_t>(offset));
-                    }
-
-                    R_SUCCEED();
-                }
-            ));
+            /* Wait for all writes to complete. */
+            R_RETURN(writer->Finalize());
         };
 
         const auto res = extract_impl();
@@ -401,73 +645,54 @@ namespace ams::hactool {
     }
 
     Result ExtractUpdatedRomFsDirectory(std::shared_ptr<fs::fsa::IFileSystem> &dst_fs, fssystem::RomFsFileSystem *src_fs, std::shared_ptr<fssystem::IndirectStorage> &indirect, std::shared_ptr<fssystem::AesCtrCounterExtendedStorage> &aes_ctr_ex, s32 min_gen, const char *prefix, const char *dst_path, const char *src_path) {
-        /* Allocate a work buffer. */
-        void *buffer = std::malloc(WorkBufferSize);
-        if (buffer == nullptr) {
-            fprintf(stderr, "[Warning]: Failed to allocate work buffer to extract %s%s to %s!\n", prefix, src_path, dst_path);
-            R_SUCCEED();
-        }
-        ON_SCOPE_EXIT { std::free(buffer); };
+        HACTOOL_TRACE_ZONE("ExtractUpdatedRomFsDirectory", "path", dst_path);
 
         /* Allocate a work buffer. */
-        constexpr size_t EntryBufferSize = 2_MB;
-        void *entry_buffer = std::malloc(EntryBufferSize);
+        const size_t entry_buffer_size = GetAdaptiveBufferSize(EntryBufferSize, MinimumEntryBufferSize);
+        void *entry_buffer = AllocateTracked(entry_buffer_size, AllocationSite_EntryBuffer);
         if (entry_buffer == nullptr) {
             fprintf(stderr, "[Warning]: Failed to allocate work buffer to extract updated romfs directory %s%s to %s!\n", prefix, src_path, dst_path);
-            R_SUCCEED();
+            R_THROW(fs::ResultAllocationMemoryFailed());
         }
-        ON_SCOPE_EXIT { std::free(entry_buffer); };
+        ON_SCOPE_EXIT { FreeTracked(entry_buffer); };
 
         /* Set up entry buffers. */
         auto *indirect_entries = reinterpret_cast<fssystem::IndirectStorage::Entry *>(reinterpret_cast<uintptr_t>(entry_buffer) + 0);
-        const auto max_indirect_entries = (EntryBufferSize / 2) / sizeof(*indirect_entries);
+        const auto max_indirect_entries = (entry_buffer_size / 2) / sizeof(*indirect_entries);
 
-        auto *aes_ctr_ex_entries = reinterpret_cast<fssystem::AesCtrCounterExtendedStorage::Entry *>(reinterpret_cast<uintptr_t>(entry_buffer) + (EntryBufferSize / 2));
-        const auto max_aes_ctr_ex_entries = (EntryBufferSize / 2) / sizeof(*aes_ctr_ex_entries);
+        auto *aes_ctr_ex_entries = reinterpret_cast<fssystem::AesCtrCounterExtendedStorage::Entry *>(reinterpret_cast<uintptr_t>(entry_buffer) + (entry_buffer_size / 2));
+        const auto max_aes_ctr_ex_entries = (entry_buffer_size / 2) / sizeof(*aes_ctr_ex_entries);
 
-        auto extract_impl = [&] () -> Result {
-            /* Set up the destination work path to point at the target directory. */
-            fs::Path dst_fs_path;
-            R_TRY(dst_fs_path.SetShallowBuffer(dst_path));
+        char job_name[1_KB];
+        util::TSNPrintf(job_name, sizeof(job_name), "Extracting %s%s", prefix, src_path);
+        ScopedProgressJob job(job_name);
 
-            /* Try to create the destination directory. */
-            dst_fs->CreateDirectory(dst_fs_path);
-
-            /* Verify that we can open the directory on the base filesystem. */
-            {
-                std::unique_ptr<fs::fsa::IDirectory> sub_dir;
-                R_TRY(dst_fs->OpenDirectory(std::addressof(sub_dir), dst_fs_path, fs::OpenDirectoryMode_Directory));
-            }
-
-            /* Create/Initialize subdirectory filesystem. */
-            fssystem::SubDirectoryFileSystem subdir_fs{dst_fs};
-            R_TRY(subdir_fs.Initialize(dst_fs_path));
+        auto extract_impl = [&] () -> Result {
+            /* Create a writer for the destination directory. */
+            std::unique_ptr<OutputWriter> writer;
+            R_TRY(CreateOutputWriter(std::addressof(writer), dst_fs, dst_path));
 
             /* Set up the source path to point at the target directory. */
             fs::Path src_fs_path;
             R_TRY(src_fs_path.SetShallowBuffer(src_path));
 
+            /* Only directories holding an updated file are wanted, so each is created when its first file is saved. */
+            std::vector<std::string> dir_stack;
+            size_t created_depth = 0;
+
             /* Iterate, copying files. */
-            R_RETURN(fssystem::IterateDirectoryRecursively(src_fs, src_fs_path,
+            R_TRY(fssystem::IterateDirectoryRecursively(src_fs, src_fs_path,
                 [&](const fs::Path &path, const fs::DirectoryEntry &) -> Result { /* On Enter Directory */
-                    /* Create the directory. */
-                    R_TRY_CATCH(subdir_fs.CreateDirectory(path)) {
-                        R_CATCH(fs::ResultPathAlreadyExists) { /* ... */ }
-                    } R_END_TRY_CATCH;
-
+                    dir_stack.emplace_back(path.GetString());
                     R_SUCCEED();
                 },
-                [&](const fs::Path &path, const fs::DirectoryEntry &) -> Result { /* On Exit Directory */
-                    /* If the directory has no files, we need to delete it. */
-                    R_TRY_CATCH(subdir_fs.DeleteDirectory(path)) {
-                        R_CATCH(fs::ResultDirectoryNotEmpty) { /* ... */ }
-                    } R_END_TRY_CATCH;
-
+                [&](const fs::Path &, const fs::DirectoryEntry &) -> Result { /* On Exit Directory */
+                    dir_stack.pop_back();
+                    created_depth = std::min(created_depth, dir_stack.size());
                     R_SUCCEED();
                 },
                 [&](const fs::Path &path, const fs::DirectoryEntry &ent) -> Result { /* On File */
-                    /* Delete a file, if one already exists. */
-                    subdir_fs.DeleteFile(path);
+                    HACTOOL_TRACE_ZONE("ExtractFile", "path", path.GetString());
 
                     /* We'll want to get the maximum generation that the file was updated in. */
                     s32 max_gen = 0;
@@ -525,13 +750,22 @@ namespace ams::hactool {
 
                     /* If we should, copy the file. */
                     if (was_updated && max_gen >= min_gen) {
+                        /* Create any parent directories which don't exist yet, outermost first. */
+                        while (created_depth < dir_stack.size()) {
+                            R_TRY(writer->CreateDirectory(dir_stack[created_depth++].c_str()));
+                        }
+
                         printf("Saving [%02d] %s%s...\n", max_gen, prefix, path.GetString());
-                        R_TRY(fssystem::CopyFile(std::addressof(subdir_fs), src_fs, path, path, buffer, WorkBufferSize));
+                        AddProgressTotal(ent.file_size, 1);
+                        R_TRY(CopyFileToOutput(writer.get(), src_fs, path, ent.file_size));
                     }
 
                     R_SUCCEED();
                 }
             ));
+
+            /* Wait for all writes to complete. */
+            R_RETURN(writer->Finalize());
         };
 
         const auto res = extract_impl();
@@ -542,13 +776,16 @@ namespace ams::hactool {
     }
 
     Result SaveToFile(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path, fs::IStorage *storage, s64 offset, size_t size) {
+        HACTOOL_TRACE_ZONE("SaveToFile", "path", path);
+
         /* Allocate a work buffer. */
-        void *buffer = std::malloc(WorkBufferSize);
+        const size_t work_buffer_size = GetAdaptiveBufferSize(WorkBufferSize, MinimumWorkBufferSize);
+        void *buffer = AllocateTracked(work_buffer_size, AllocationSite_WorkBuffer);
         if (buffer == nullptr) {
             fprintf(stderr, "[Warning]: Failed to allocate work buffer to save storage to %s!\n", path);
-            R_SUCCEED();
+            R_THROW(fs::ResultAllocationMemoryFailed());
         }
-        ON_SCOPE_EXIT { std::free(buffer); };
+        ON_SCOPE_EXIT { FreeTracked(buffer); };
 
         auto save_impl = [&] () -> Result {
             /* Get the fs path. */
@@ -569,24 +806,27 @@ namespace ams::hactool {
             /* Set the file size. */
             R_TRY(base_file->SetSize(size));
 
-            /* Create a progress printer. */
-            char prog_prefix[1_KB];
-            util::TSNPrintf(prog_prefix, sizeof(prog_prefix), "Saving storage to %s... ", path);
-            ProgressPrinter<40> printer{prog_prefix, static_cast<size_t>(size)};
+            /* Report progress. */
+            char job_name[1_KB];
+            util::TSNPrintf(job_name, sizeof(job_name), "Saving storage to %s", path);
+            ScopedProgressJob job(job_name);
+            AddProgressTotal(size, 1);
 
             /* Write. */
             const s64 start_offset = offset;
             const s64 end_offset   = static_cast<s64>(offset + size);
             while (offset < end_offset) {
-                const s64 cur_write_size = std::min<s64>(WorkBufferSize, end_offset - offset);
+                const s64 cur_write_size = std::min<s64>(work_buffer_size, end_offset - offset);
 
                 R_TRY(storage->Read(offset, buffer, cur_write_size));
-                R_TRY(base_file->Write(offset, buffer, cur_write_size, fs::WriteOption::None));
+                R_TRY(WriteNonZeroBlocks(base_file.get(), offset - start_offset, buffer, cur_write_size));
 
                 offset += cur_write_size;
-                printer.Update(static_cast<size_t>(offset - start_offset));
+                AddProgress(cur_write_size, 0);
             }
 
+            AddProgress(0, 1);
+
             R_SUCCEED();
         };
 
@@ -605,6 +845,8 @@ namespace ams::hactool {
     }
 
     Result SaveToFile(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path, const void *data, size_t size) {
+        HACTOOL_TRACE_ZONE("SaveToFile", "path", path);
+
         auto save_impl = [&] () -> Result {
             /* Get the fs path. */
             ams::fs::Path fs_path;
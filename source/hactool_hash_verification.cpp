@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_hash_verification.hpp"
+#include "hactool_sha256.hpp"
+#include "hactool_memory_accounting.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr size_t HashSize               = crypto::Sha256Generator::HashSize;
+        constexpr size_t VerificationBufferSize = 4_MB;
+
+        constexpr s32 HierarchicalSha256LayerCountMax = 5;
+        constexpr u32 IntegrityLayerCountMax          = 7;
+
+        /* Verifies the blocks of one level of a tree against the table of hashes above it. */
+        Result VerifyLevel(HashVerificationResult *out, fs::IStorage *storage, const u8 *hash_table, size_t hash_table_size, s64 offset, s64 size, size_t block_size, bool pad_last_block, u8 *buffer) {
+            R_UNLESS(0 < block_size && block_size <= VerificationBufferSize, fs::ResultInvalidSize());
+
+            const s64 num_blocks = util::DivideUp(size, static_cast<s64>(block_size));
+            R_UNLESS(num_blocks * static_cast<s64>(HashSize) <= static_cast<s64>(hash_table_size), fs::ResultInvalidSize());
+
+            /* Chunks hold whole blocks, so that each block is hashed from one read; block sizes needn't be powers of two. */
+            const size_t max_jobs   = VerificationBufferSize / block_size;
+            const size_t chunk_size = max_jobs * block_size;
+
+            std::vector<Sha256Job> jobs(max_jobs);
+            std::vector<u8> hashes(max_jobs * HashSize);
+
+            s64 block_index = 0;
+            for (s64 ofs = 0; ofs < size; /* ... */) {
+                const size_t cur_size   = static_cast<size_t>(std::min<s64>(chunk_size, size - ofs));
+                const size_t cur_blocks = util::DivideUp(cur_size, block_size);
+
+                R_TRY(storage->Read(offset + ofs, buffer, cur_size));
+
+                /* Integrity trees hash the last block as though it were zero-padded. */
+                if (pad_last_block) {
+                    std::memset(buffer + cur_size, 0, cur_blocks * block_size - cur_size);
+                }
+
+                for (size_t i = 0; i < cur_blocks; ++i) {
+                    const size_t block_offset = i * block_size;
+                    jobs[i] = Sha256Job{ buffer + block_offset, pad_last_block ? block_size : std::min(block_size, cur_size - block_offset), hashes.data() + i * HashSize };
+                }
+
+                GenerateSha256Batch(jobs.data(), cur_blocks);
+
+                for (size_t i = 0; i < cur_blocks; ++i, ++block_index) {
+                    if (!crypto::IsSameBytes(hashes.data() + i * HashSize, hash_table + block_index * HashSize, HashSize)) {
+                        ++out->invalid_block_count;
+                    }
+                }
+
+                out->block_count += cur_blocks;
+                ofs += cur_size;
+            }
+
+            R_SUCCEED();
+        }
+
+        Result ReadTable(std::vector<u8> *out, fs::IStorage *storage, s64 offset, s64 size) {
+            R_UNLESS(0 <= size && size <= static_cast<s64>(std::numeric_limits<u32>::max()), fs::ResultInvalidSize());
+
+            out->resize(static_cast<size_t>(size));
+            R_RETURN(storage->Read(offset, out->data(), out->size()));
+        }
+
+    }
+
+    Result VerifyHierarchicalSha256Storage(HashVerificationResult *out, fs::IStorage *storage, const fssystem::NcaFsHeader::HashData::HierarchicalSha256Data &hash_data) {
+        *out = {};
+
+        const s32 layer_count = hash_data.hash_layer_count;
+        const s32 block_size  = hash_data.hash_block_size;
+        R_UNLESS(2 <= layer_count && layer_count <= HierarchicalSha256LayerCountMax, fs::ResultInvalidSize());
+        R_UNLESS(block_size > 0,                                                         fs::ResultInvalidSize());
+
+        /* The master hash covers the whole first layer. */
+        std::vector<u8> table;
+        R_TRY(ReadTable(std::addressof(table), storage, hash_data.hash_layer_region[0].offset, hash_data.hash_layer_region[0].size));
+
+        u8 hash[HashSize];
+        crypto::GenerateSha256(hash, sizeof(hash), table.data(), table.size());
+        ++out->block_count;
+        if (!crypto::IsSameBytes(hash, hash_data.fs_data_master_hash.value, sizeof(hash))) {
+            ++out->invalid_block_count;
+        }
+
+        /* Each layer's table covers the blocks of the next layer. */
+        auto buffer = MakeTrackedArray<u8>(VerificationBufferSize, AllocationSite_VerificationBuffer);
+        R_UNLESS(buffer != nullptr, fs::ResultAllocationMemoryFailed());
+
+        for (s32 i = 1; i < layer_count; ++i) {
+            const auto &region = hash_data.hash_layer_region[i];
+            R_TRY(VerifyLevel(out, storage, table.data(), table.size(), region.offset, region.size, block_size, false, buffer.get()));
+
+            if (i + 1 < layer_count) {
+                R_TRY(ReadTable(std::addressof(table), storage, region.offset, region.size));
+            }
+        }
+
+        R_SUCCEED();
+    }
+
+    Result VerifyHierarchicalIntegrityStorage(HashVerificationResult *out, fs::IStorage *storage, const fssystem::NcaFsHeader::HashData::IntegrityMetaInfo &meta_info) {
+        *out = {};
+
+        const auto &level_info = meta_info.level_hash_info;
+        R_UNLESS(2 <= level_info.max_layers && level_info.max_layers <= IntegrityLayerCountMax, fs::ResultInvalidSize());
+
+        /* The master hash covers the first level. */
+        std::vector<u8> table(std::begin(meta_info.master_hash.value), std::end(meta_info.master_hash.value));
+
+        auto buffer = MakeTrackedArray<u8>(VerificationBufferSize, AllocationSite_VerificationBuffer);
+        R_UNLESS(buffer != nullptr, fs::ResultAllocationMemoryFailed());
+
+        /* Each level holds the hashes of the blocks of the next. */
+        const u32 level_count = level_info.max_layers - 1;
+        for (u32 i = 0; i < level_count; ++i) {
+            const auto &level = level_info.info[i];
+            const s64 level_offset = static_cast<s64>(level.offset);
+            const s64 level_size   = static_cast<s64>(level.size);
+            R_UNLESS(0 <= level.block_order && level.block_order < 32, fs::ResultInvalidSize());
+
+            R_TRY(VerifyLevel(out, storage, table.data(), table.size(), level_offset, level_size, static_cast<size_t>(1) << level.block_order, true, buffer.get()));
+
+            if (i + 1 < level_count) {
+                R_TRY(ReadTable(std::addressof(table), storage, level_offset, level_size));
+            }
+        }
+
+        R_SUCCEED();
+    }
+
+    Result VerifySha256PartitionFileSystem(HashVerificationResult *out, fs::IStorage *storage) {
+        *out = {};
+
+        /* Read the header and entries. */
+        Hfs0Header header;
+        R_TRY(storage->Read(0, std::addressof(header), sizeof(header)));
+        R_UNLESS(header.magic == Hfs0Magic, fs::ResultPartitionSignatureVerificationFailed());
+        R_UNLESS(header.entry_count >= 0,   fs::ResultInvalidSize());
+
+        std::vector<Hfs0Entry> entries(header.entry_count);
+        R_TRY(storage->Read(sizeof(header), entries.data(), entries.size() * sizeof(Hfs0Entry)));
+
+        const s64 data_offset = sizeof(header) + entries.size() * sizeof(Hfs0Entry) + header.name_table_size;
+
+        /* Hash targets are small (usually the first 0x200 bytes of each file), so gather as many as fit into one batch. */
+        auto buffer = MakeTrackedArray<u8>(VerificationBufferSize, AllocationSite_VerificationBuffer);
+        R_UNLESS(buffer != nullptr, fs::ResultAllocationMemoryFailed());
+
+        std::vector<Sha256Job> jobs;
+        std::vector<u8> hashes(entries.size() * HashSize);
+
+        auto FlushBatch = [&] (size_t batch_start) {
+            GenerateSha256Batch(jobs.data(), jobs.size());
+
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                if (!crypto::IsSameBytes(jobs[i].hash, entries[batch_start + i].hash, HashSize)) {
+                    ++out->invalid_block_count;
+                }
+            }
+
+            out->block_count += jobs.size();
+            jobs.clear();
+        };
+
+        size_t batch_start = 0, buffer_used = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const auto &entry = entries[i];
+            R_UNLESS(entry.hash_target_offset >= 0 && entry.hash_target_offset + static_cast<s64>(entry.hash_target_size) <= entry.size, fs::ResultInvalidSha256PartitionHashTarget());
+
+            const s64 target_offset = data_offset + entry.offset + entry.hash_target_offset;
+
+            /* Hash oversized targets on their own, a chunk at a time. */
+            if (entry.hash_target_size > VerificationBufferSize) {
+                FlushBatch(batch_start);
+
+                crypto::Sha256Generator generator;
+                generator.Initialize();
+                for (size_t ofs = 0; ofs < entry.hash_target_size; /* ... */) {
+                    const size_t cur_size = std::min<size_t>(VerificationBufferSize, entry.hash_target_size - ofs);
+                    R_TRY(storage->Read(target_offset + ofs, buffer.get(), cur_size));
+                    generator.Update(buffer.get(), cur_size);
+                    ofs += cur_size;
+                }
+                generator.GetHash(hashes.data() + i * HashSize, HashSize);
+
+                ++out->block_count;
+                if (!crypto::IsSameBytes(hashes.data() + i * HashSize, entry.hash, HashSize)) {
+                    ++out->invalid_block_count;
+                }
+
+                batch_start = i + 1;
+                buffer_used = 0;
+                continue;
+            }
+
+            if (buffer_used + entry.hash_target_size > VerificationBufferSize) {
+                FlushBatch(batch_start);
+                batch_start = i;
+                buffer_used = 0;
+            }
+
+            R_TRY(storage->Read(target_offset, buffer.get() + buffer_used, entry.hash_target_size));
+            jobs.push_back(Sha256Job{ buffer.get() + buffer_used, entry.hash_target_size, hashes.data() + i * HashSize });
+            buffer_used += entry.hash_target_size;
+        }
+
+        FlushBatch(batch_start);
+        R_SUCCEED();
+    }
+
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* Layout of an HFS0 partition: a header, an entry per file, then a name table. Each entry hashes part of its file. */
+    struct Hfs0Header {
+        u32 magic;
+        s32 entry_count;
+        u32 name_table_size;
+        u32 reserved;
+    };
+    static_assert(sizeof(Hfs0Header) == 0x10);
+
+    struct Hfs0Entry {
+        s64 offset;
+        s64 size;
+        u32 name_offset;
+        u32 hash_target_size;
+        s64 hash_target_offset;
+        u8 hash[crypto::Sha256Generator::HashSize];
+    };
+    static_assert(sizeof(Hfs0Entry) == 0x40);
+
+    constexpr inline u32 Hfs0Magic = util::FourCC<'H', 'F', 'S', '0'>::Code;
+
+    struct HashVerificationResult {
+        s64 block_count;
+        s64 invalid_block_count;
+
+        bool IsValid() const { return this->invalid_block_count == 0; }
+    };
+
+    /* Verify every block of a hash tree up to its master hash, hashing many blocks at once. */
+    Result VerifyHierarchicalSha256Storage(HashVerificationResult *out, fs::IStorage *storage, const fssystem::NcaFsHeader::HashData::HierarchicalSha256Data &hash_data);
+    Result VerifyHierarchicalIntegrityStorage(HashVerificationResult *out, fs::IStorage *storage, const fssystem::NcaFsHeader::HashData::IntegrityMetaInfo &meta_info);
+
+    /* Verify the hash of every entry in an HFS0 partition. */
+    Result VerifySha256PartitionFileSystem(HashVerificationResult *out, fs::IStorage *storage);
+
+}
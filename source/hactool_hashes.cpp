@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_hashes.hpp"
+#include "hactool_parallel.hpp"
+#include "hactool_progress.hpp"
+#include "hactool_memory_accounting.hpp"
+#include "hactool_trace.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr size_t HashChunkSize = 4_MB;
+
+        enum HashAlgorithm {
+            HashAlgorithm_Crc32,
+            HashAlgorithm_Md5,
+            HashAlgorithm_Sha1,
+            HashAlgorithm_Sha256,
+
+            HashAlgorithm_Count,
+        };
+
+        /* Slicing-by-8 tables for the reflected CRC-32 polynomial, so eight bytes are folded per step. */
+        constexpr u32 Crc32Polynomial = 0xEDB88320;
+
+        constexpr auto Crc32Tables = [] {
+            std::array<std::array<u32, 0x100>, 8> tables{};
+            for (u32 i = 0; i < 0x100; ++i) {
+                u32 crc = i;
+                for (int j = 0; j < 8; ++j) {
+                    crc = (crc >> 1) ^ ((crc & 1) ? Crc32Polynomial : 0);
+                }
+                tables[0][i] = crc;
+            }
+            for (u32 i = 0; i < 0x100; ++i) {
+                for (size_t t = 1; t < tables.size(); ++t) {
+                    tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+                }
+            }
+            return tables;
+        }();
+
+        u32 UpdateCrc32(u32 crc, const u8 *data, size_t size) {
+            crc = ~crc;
+
+            while (size >= 8) {
+                const u32 lo = crc ^ (static_cast<u32>(data[0]) | (static_cast<u32>(data[1]) << 8) | (static_cast<u32>(data[2]) << 16) | (static_cast<u32>(data[3]) << 24));
+                const u32 hi = static_cast<u32>(data[4]) | (static_cast<u32>(data[5]) << 8) | (static_cast<u32>(data[6]) << 16) | (static_cast<u32>(data[7]) << 24);
+                crc = Crc32Tables[7][lo & 0xFF] ^ Crc32Tables[6][(lo >> 8) & 0xFF] ^ Crc32Tables[5][(lo >> 16) & 0xFF] ^ Crc32Tables[4][lo >> 24] ^
+                      Crc32Tables[3][hi & 0xFF] ^ Crc32Tables[2][(hi >> 8) & 0xFF] ^ Crc32Tables[1][(hi >> 16) & 0xFF] ^ Crc32Tables[0][hi >> 24];
+
+                data += 8;
+                size -= 8;
+            }
+
+            while (size > 0) {
+                crc = (crc >> 8) ^ Crc32Tables[0][(crc ^ *data) & 0xFF];
+                ++data;
+                --size;
+            }
+
+            return ~crc;
+        }
+
+        struct HashState {
+            u32 crc32;
+            crypto::Md5Generator md5;
+            crypto::Sha1Generator sha1;
+            crypto::Sha256Generator sha256;
+        };
+
+        /* Minimal scanning of DAT/XML markup: tags, quoted attributes and the five predefined entities. */
+        void DecodeXmlEntities(std::string *out, const char *src, size_t size) {
+            static constexpr std::pair<const char *, char> Entities[] = { { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' } };
+
+            out->clear();
+            for (size_t i = 0; i < size; /* ... */) {
+                bool decoded = false;
+                if (src[i] == '&') {
+                    for (const auto &[entity, c] : Entities) {
+                        const size_t len = std::strlen(entity);
+                        if (i + len <= size && std::memcmp(src + i, entity, len) == 0) {
+                            out->push_back(c);
+                            i += len;
+                            decoded = true;
+                            break;
+                        }
+                    }
+                }
+
+                if (!decoded) {
+                    out->push_back(src[i++]);
+                }
+            }
+        }
+
+        bool IsXmlSpace(char c) {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        /* Calls f(key, key_len, value, value_len) for each attribute of the tag spanning [cur, end). */
+        void ForEachXmlAttribute(const char *cur, const char *end, auto f) {
+            /* Skip the tag name. */
+            while (cur < end && !IsXmlSpace(*cur)) {
+                ++cur;
+            }
+
+            while (cur < end) {
+                while (cur < end && IsXmlSpace(*cur)) {
+                    ++cur;
+                }
+
+                const char *key = cur;
+                while (cur < end && *cur != '=' && !IsXmlSpace(*cur)) {
+                    ++cur;
+                }
+                const size_t key_len = cur - key;
+
+                while (cur < end && IsXmlSpace(*cur)) {
+                    ++cur;
+                }
+                if (cur >= end || *cur != '=') {
+                    return;
+                }
+                ++cur;
+                while (cur < end && IsXmlSpace(*cur)) {
+                    ++cur;
+                }
+                if (cur >= end || (*cur != '"' && *cur != '\'')) {
+                    return;
+                }
+
+                const char quote = *(cur++);
+                const char *value = cur;
+                while (cur < end && *cur != quote) {
+                    ++cur;
+                }
+                if (cur >= end) {
+                    return;
+                }
+
+                f(key, key_len, value, static_cast<size_t>(cur - value));
+                ++cur;
+            }
+        }
+
+        bool IsAttribute(const char *key, size_t key_len, const char *name) {
+            return std::strlen(name) == key_len && std::memcmp(key, name, key_len) == 0;
+        }
+
+        bool ParseHexBytes(u8 *dst, size_t dst_size, const char *src, size_t src_len) {
+            if (src_len != dst_size * 2) {
+                return false;
+            }
+
+            for (size_t i = 0; i < src_len; ++i) {
+                const char c = src[i];
+
+                u8 v;
+                if ('0' <= c && c <= '9') {
+                    v = c - '0';
+                } else if ('a' <= c && c <= 'f') {
+                    v = c - 'a' + 0xA;
+                } else if ('A' <= c && c <= 'F') {
+                    v = c - 'A' + 0xA;
+                } else {
+                    return false;
+                }
+
+                if ((i % 2) == 0) {
+                    dst[i / 2] = v << 4;
+                } else {
+                    dst[i / 2] |= v;
+                }
+            }
+
+            return true;
+        }
+
+    }
+
+    Result ComputeHashes(HashTarget *targets, size_t target_count, fs::IStorage *storage) {
+        HACTOOL_TRACE_ZONE("ComputeHashes");
+        R_SUCCEED_IF(target_count == 0);
+
+        /* Determine the span to read. */
+        s64 start = std::numeric_limits<s64>::max();
+        s64 end   = 0;
+        for (size_t i = 0; i < target_count; ++i) {
+            start = std::min(start, targets[i].offset);
+            end   = std::max(end, targets[i].offset + targets[i].size);
+        }
+
+        /* Prepare the digests. */
+        std::vector<HashState> states(target_count);
+        for (auto &state : states) {
+            state.crc32 = 0;
+            state.md5.Initialize();
+            state.sha1.Initialize();
+            state.sha256.Initialize();
+        }
+
+        /* Allocate two buffers, so the next chunk is read while the current one is hashed. */
+        auto buffers = MakeTrackedArray<u8>(2 * HashChunkSize, AllocationSite_VerificationBuffer);
+        R_UNLESS(buffers != nullptr, fs::ResultAllocationMemoryFailed());
+
+        AddProgressTotal(end - start, 0);
+
+        std::vector<std::pair<size_t, HashAlgorithm>> jobs;
+        size_t cur_buffer = 0;
+
+        const size_t first_size = static_cast<size_t>(std::min<s64>(end - start, HashChunkSize));
+        R_TRY(storage->Read(start, buffers.get(), first_size));
+
+        for (s64 offset = start; offset < end; /* ... */) {
+            const size_t cur_size  = static_cast<size_t>(std::min<s64>(end - offset, HashChunkSize));
+            const s64 next_offset  = offset + cur_size;
+            const size_t next_size = static_cast<size_t>(std::min<s64>(end - next_offset, HashChunkSize));
+
+            const u8 *cur_data = buffers.get() + cur_buffer * HashChunkSize;
+            u8 *next_data      = buffers.get() + (cur_buffer ^ 1) * HashChunkSize;
+
+            /* Gather every digest this chunk feeds. */
+            jobs.clear();
+            for (size_t i = 0; i < target_count; ++i) {
+                if (targets[i].offset < next_offset && offset < targets[i].offset + targets[i].size) {
+                    for (int a = 0; a < HashAlgorithm_Count; ++a) {
+                        jobs.emplace_back(i, static_cast<HashAlgorithm>(a));
+                    }
+                }
+            }
+
+            /* The first job reads ahead; the rest each advance one digest. */
+            R_TRY(RunParallel(jobs.size() + 1, [&] (size_t job_index) -> Result {
+                if (job_index == 0) {
+                    if (next_size > 0) {
+                        R_TRY(storage->Read(next_offset, next_data, next_size));
+                    }
+                    R_SUCCEED();
+                }
+
+                const auto [target_index, algorithm] = jobs[job_index - 1];
+                const auto &target = targets[target_index];
+                auto &state        = states[target_index];
+
+                const s64 data_start = std::max(offset, target.offset);
+                const s64 data_end   = std::min(next_offset, target.offset + target.size);
+                const u8 *data       = cur_data + (data_start - offset);
+                const size_t size    = static_cast<size_t>(data_end - data_start);
+
+                switch (algorithm) {
+                    case HashAlgorithm_Crc32:  state.crc32 = UpdateCrc32(state.crc32, data, size); break;
+                    case HashAlgorithm_Md5:    state.md5.Update(data, size);                       break;
+                    case HashAlgorithm_Sha1:   state.sha1.Update(data, size);                      break;
+                    case HashAlgorithm_Sha256: state.sha256.Update(data, size);                    break;
+                    AMS_UNREACHABLE_DEFAULT_CASE();
+                }
+
+                R_SUCCEED();
+            }));
+
+            AddProgress(cur_size, 0);
+
+            offset      = next_offset;
+            cur_buffer ^= 1;
+        }
+
+        /* Finish the digests. */
+        for (size_t i = 0; i < target_count; ++i) {
+            auto &hashes = targets[i].hashes;
+            hashes.size  = targets[i].size;
+            hashes.crc32 = states[i].crc32;
+            states[i].md5.GetHash(hashes.md5, sizeof(hashes.md5));
+            states[i].sha1.GetHash(hashes.sha1, sizeof(hashes.sha1));
+            states[i].sha256.GetHash(hashes.sha256, sizeof(hashes.sha256));
+        }
+
+        R_SUCCEED();
+    }
+
+    Result HashDatabase::Load(const char *path) {
+        HACTOOL_TRACE_ZONE("LoadHashDatabase", "path", path);
+
+        /* Read the file. */
+        fs::FileHandle file;
+        R_TRY(fs::OpenFile(std::addressof(file), path, fs::OpenMode_Read));
+        ON_SCOPE_EXIT { fs::CloseFile(file); };
+
+        s64 file_size;
+        R_TRY(fs::GetFileSize(std::addressof(file_size), file));
+
+        auto buf = MakeTrackedArray<char>(file_size + 1, AllocationSite_FileData);
+        R_UNLESS(buf != nullptr, fs::ResultAllocationMemoryFailed());
+
+        R_TRY(fs::ReadFile(file, 0, buf.get(), file_size));
+        buf[file_size] = '\x00';
+
+        /* Collect every rom, remembering which game it belongs to. */
+        std::string game_name;
+        const char *cur = buf.get();
+        const char *end = buf.get() + file_size;
+        while ((cur = static_cast<const char *>(std::memchr(cur, '<', end - cur))) != nullptr) {
+            const char *tag_start = ++cur;
+            const char *tag_end   = static_cast<const char *>(std::memchr(cur, '>', end - cur));
+            if (tag_end == nullptr) {
+                break;
+            }
+            cur = tag_end + 1;
+
+            const size_t tag_name_len = std::find_if(tag_start, tag_end, [] (char c) { return IsXmlSpace(c) || c == '/'; }) - tag_start;
+            const bool is_game = IsAttribute(tag_start, tag_name_len, "game") || IsAttribute(tag_start, tag_name_len, "machine");
+            const bool is_rom  = IsAttribute(tag_start, tag_name_len, "rom");
+            if (!is_game && !is_rom) {
+                continue;
+            }
+
+            Entry entry = {};
+            entry.size = -1;
+            ForEachXmlAttribute(tag_start, tag_end, [&] (const char *key, size_t key_len, const char *value, size_t value_len) {
+                if (IsAttribute(key, key_len, "name")) {
+                    DecodeXmlEntities(is_game ? std::addressof(game_name) : std::addressof(entry.rom_name), value, value_len);
+                } else if (is_rom && IsAttribute(key, key_len, "size")) {
+                    entry.size = std::strtoll(std::string(value, value_len).c_str(), nullptr, 10);
+                } else if (is_rom && IsAttribute(key, key_len, "crc")) {
+                    u8 crc[sizeof(u32)];
+                    if ((entry.has_crc32 = ParseHexBytes(crc, sizeof(crc), value, value_len))) {
+                        entry.hashes.crc32 = (static_cast<u32>(crc[0]) << 24) | (static_cast<u32>(crc[1]) << 16) | (static_cast<u32>(crc[2]) << 8) | static_cast<u32>(crc[3]);
+                    }
+                } else if (is_rom && IsAttribute(key, key_len, "md5")) {
+                    entry.has_md5 = ParseHexBytes(entry.hashes.md5, sizeof(entry.hashes.md5), value, value_len);
+                } else if (is_rom && IsAttribute(key, key_len, "sha1")) {
+                    entry.has_sha1 = ParseHexBytes(entry.hashes.sha1, sizeof(entry.hashes.sha1), value, value_len);
+                } else if (is_rom && IsAttribute(key, key_len, "sha256")) {
+                    entry.has_sha256 = ParseHexBytes(entry.hashes.sha256, sizeof(entry.hashes.sha256), value, value_len);
+                }
+            });
+
+            if (is_rom && (entry.has_crc32 || entry.has_md5 || entry.has_sha1 || entry.has_sha256)) {
+                entry.game_name = game_name;
+                m_entries.push_back(std::move(entry));
+            }
+        }
+
+        R_SUCCEED();
+    }
+
+    const HashDatabase::Entry *HashDatabase::Find(const FileHashes &hashes) const {
+        for (const auto &entry : m_entries) {
+            if (entry.size >= 0 && entry.size != hashes.size) {
+                continue;
+            }
+            if (entry.has_crc32 && entry.hashes.crc32 != hashes.crc32) {
+                continue;
+            }
+            if (entry.has_md5 && !crypto::IsSameBytes(entry.hashes.md5, hashes.md5, sizeof(hashes.md5))) {
+                continue;
+            }
+            if (entry.has_sha1 && !crypto::IsSameBytes(entry.hashes.sha1, hashes.sha1, sizeof(hashes.sha1))) {
+                continue;
+            }
+            if (entry.has_sha256 && !crypto::IsSameBytes(entry.hashes.sha256, hashes.sha256, sizeof(hashes.sha256))) {
+                continue;
+            }
+
+            return std::addressof(entry);
+        }
+
+        return nullptr;
+    }
+
+}
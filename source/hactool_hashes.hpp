@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    struct FileHashes {
+        s64 size;
+        u32 crc32;
+        u8 md5[crypto::Md5Generator::HashSize];
+        u8 sha1[crypto::Sha1Generator::HashSize];
+        u8 sha256[crypto::Sha256Generator::HashSize];
+    };
+
+    /* A range of the input to fingerprint, e.g. the whole image or one nca inside it. */
+    struct HashTarget {
+        std::string name;
+        s64 offset;
+        s64 size;
+        FileHashes hashes;
+    };
+
+    /* Reads the storage once across the span of all targets. Each chunk feeds every digest of every target it overlaps, in parallel, while the next chunk is read. */
+    Result ComputeHashes(HashTarget *targets, size_t target_count, fs::IStorage *storage);
+
+    /* Expected hashes, from the <rom> entries of a DAT/XML file. */
+    class HashDatabase {
+        NON_COPYABLE(HashDatabase);
+        NON_MOVEABLE(HashDatabase);
+        public:
+            struct Entry {
+                std::string game_name;
+                std::string rom_name;
+                s64 size;
+                bool has_crc32;
+                bool has_md5;
+                bool has_sha1;
+                bool has_sha256;
+                FileHashes hashes;
+            };
+        private:
+            std::vector<Entry> m_entries;
+        public:
+            HashDatabase() : m_entries() { /* ... */ }
+
+            Result Load(const char *path);
+
+            size_t GetCount() const { return m_entries.size(); }
+
+            /* Finds an entry whose size and every listed hash agree with ours. */
+            const Entry *Find(const FileHashes &hashes) const;
+    };
+
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_library.hpp"
+#include "hactool_processor.hpp"
+#include "hactool_progress.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        Options MakeProcessorOptions(const LibraryOptions &options) {
+            Options processor_options;
+            processor_options.key_file_path     = options.key_file_path;
+            processor_options.titlekey_path     = options.titlekey_path;
+            processor_options.consolekey_path   = options.consolekey_path;
+            processor_options.dev               = options.dev;
+            processor_options.disable_key_warns = options.disable_key_warns;
+            processor_options.base_nca_path     = options.base_nca_path;
+            processor_options.base_xci_path     = options.base_xci_path;
+            processor_options.base_pfs_path     = options.base_pfs_path;
+            processor_options.base_appfs_path   = options.base_appfs_path;
+            processor_options.base_library_dir  = options.base_library_dir;
+            return processor_options;
+        }
+
+        void MakeNpdmView(Library::NpdmView *out, std::shared_ptr<const void> holder, const Processor::ProcessAsNpdmContext &ctx) {
+            *out = {};
+            if (ctx.npdm == nullptr) {
+                return;
+            }
+
+            out->holder        = std::move(holder);
+            out->npdm          = ctx.npdm;
+            out->acid          = ctx.acid;
+            out->aci           = ctx.aci;
+            out->acid_services = ctx.acid_services;
+            out->aci_services  = ctx.aci_services;
+        }
+
+        void MakeNcaView(Library::NcaView *out, std::shared_ptr<const void> holder, const Processor::ProcessAsNcaContext &ctx) {
+            *out = {};
+            if (ctx.reader == nullptr) {
+                return;
+            }
+
+            out->reader      = ctx.reader;
+            out->base_reader = ctx.base_reader;
+            out->exefs_index = ctx.exefs_index;
+            out->romfs_index = ctx.romfs_index;
+
+            for (size_t i = 0; i < fssystem::NcaHeader::FsCountMax; ++i) {
+                if (ctx.has_sections[i]) {
+                    out->sections[i] = ctx.sections[i];
+                }
+                if (ctx.is_mounted[i]) {
+                    out->file_systems[i] = ctx.file_systems[i];
+                }
+            }
+
+            MakeNpdmView(std::addressof(out->npdm), holder, ctx.npdm_ctx);
+            out->holder = std::move(holder);
+        }
+
+        void MakeApplicationFileSystemView(Library::ApplicationFileSystemView *out, std::shared_ptr<const void> holder, const Processor::ProcessAsApplicationFileSystemContext &ctx) {
+            *out = {};
+            if (ctx.fs == nullptr) {
+                return;
+            }
+
+            out->fs             = ctx.fs;
+            out->has_target     = ctx.has_target;
+            out->target_app_id  = ctx.target_app_id;
+            out->target_version = ctx.target_version;
+
+            MakeNcaView(std::addressof(out->program), holder, ctx.app_nca_ctx);
+            MakeNcaView(std::addressof(out->base_program), holder, ctx.app_base_nca_ctx);
+            out->holder = std::move(holder);
+        }
+
+    }
+
+    Library::Library(const LibraryOptions &options) : m_processor(std::make_unique<Processor>(MakeProcessorOptions(options))), m_api_version(options.api_version), m_initialized(false) {
+        /* ... */
+    }
+
+    Library::~Library() {
+        /* ... */
+    }
+
+    Result Library::Initialize() {
+        /* The embedder must have been built against the views this library provides. */
+        R_UNLESS(m_api_version == LibraryApiVersion, fs::ResultInvalidArgument());
+
+        /* Embedders have no terminal to draw on. */
+        ConfigureProgress(false, -1);
+
+        /* Setup keys, and open any bases. */
+        m_processor->PrepareToParse();
+
+        m_initialized = true;
+        R_SUCCEED();
+    }
+
+    Result Library::OpenFile(std::shared_ptr<fs::IStorage> *out, const char *path) {
+        R_RETURN(m_processor->OpenLocalFile(out, path));
+    }
+
+    Result Library::OpenNca(NcaView *out, const char *path) {
+        std::shared_ptr<fs::IStorage> storage;
+        R_TRY(this->OpenFile(std::addressof(storage), path));
+
+        R_RETURN(this->OpenNca(out, std::move(storage)));
+    }
+
+    Result Library::OpenNca(NcaView *out, std::shared_ptr<fs::IStorage> storage) {
+        AMS_ABORT_UNLESS(m_initialized);
+        AMS_ABORT_UNLESS(out != nullptr);
+
+        auto ctx = std::make_shared<Processor::ProcessAsNcaContext>();
+        R_TRY(m_processor->Parse(ctx.get(), std::move(storage)));
+
+        MakeNcaView(out, ctx, *ctx);
+        R_SUCCEED();
+    }
+
+    Result Library::OpenNpdm(NpdmView *out, const char *path) {
+        std::shared_ptr<fs::IStorage> storage;
+        R_TRY(this->OpenFile(std::addressof(storage), path));
+
+        R_RETURN(this->OpenNpdm(out, std::move(storage)));
+    }
+
+    Result Library::OpenNpdm(NpdmView *out, std::shared_ptr<fs::IStorage> storage) {
+        AMS_ABORT_UNLESS(m_initialized);
+        AMS_ABORT_UNLESS(out != nullptr);
+
+        auto ctx = std::make_shared<Processor::ProcessAsNpdmContext>();
+        R_TRY(m_processor->Parse(ctx.get(), std::move(storage)));
+
+        MakeNpdmView(out, ctx, *ctx);
+        R_SUCCEED();
+    }
+
+    Result Library::OpenXci(XciView *out, const char *path) {
+        std::shared_ptr<fs::IStorage> storage;
+        R_TRY(this->OpenFile(std::addressof(storage), path));
+
+        R_RETURN(this->OpenXci(out, std::move(storage)));
+    }
+
+    Result Library::OpenXci(XciView *out, std::shared_ptr<fs::IStorage> storage) {
+        AMS_ABORT_UNLESS(m_initialized);
+        AMS_ABORT_UNLESS(out != nullptr);
+
+        auto ctx = std::make_shared<Processor::ProcessAsXciContext>();
+        R_TRY(m_processor->Parse(ctx.get(), std::move(storage)));
+
+        *out = {};
+        out->header           = std::addressof(ctx->card_data.decrypted_header.data);
+        out->root_partition   = ctx->root_partition.fs;
+        out->update_partition = ctx->update_partition.fs;
+        out->logo_partition   = ctx->logo_partition.fs;
+        out->normal_partition = ctx->normal_partition.fs;
+        out->secure_partition = ctx->secure_partition.fs;
+        MakeApplicationFileSystemView(std::addressof(out->application), ctx, ctx->app_ctx);
+        out->holder = std::move(ctx);
+        R_SUCCEED();
+    }
+
+    Result Library::OpenPfs(PfsView *out, const char *path) {
+        std::shared_ptr<fs::IStorage> storage;
+        R_TRY(this->OpenFile(std::addressof(storage), path));
+
+        R_RETURN(this->OpenPfs(out, std::move(storage)));
+    }
+
+    Result Library::OpenPfs(PfsView *out, std::shared_ptr<fs::IStorage> storage) {
+        AMS_ABORT_UNLESS(m_initialized);
+        AMS_ABORT_UNLESS(out != nullptr);
+
+        auto ctx = std::make_shared<Processor::ProcessAsPfsContext>();
+        R_TRY(m_processor->Parse(ctx.get(), std::move(storage)));
+
+        *out = {};
+        out->fs       = ctx->fs;
+        out->is_exefs = ctx->is_exefs;
+        MakeNpdmView(std::addressof(out->npdm), ctx, ctx->npdm_ctx);
+        MakeApplicationFileSystemView(std::addressof(out->application), ctx, ctx->app_ctx);
+        out->holder = std::move(ctx);
+        R_SUCCEED();
+    }
+
+    Result Library::OpenApplicationFileSystem(ApplicationFileSystemView *out, const char *dir_path) {
+        std::shared_ptr<fs::fsa::IFileSystem> fs;
+        R_TRY(m_processor->OpenLocalDirectory(std::addressof(fs), dir_path));
+
+        R_RETURN(this->OpenApplicationFileSystem(out, std::move(fs)));
+    }
+
+    Result Library::OpenApplicationFileSystem(ApplicationFileSystemView *out, std::shared_ptr<fs::fsa::IFileSystem> fs) {
+        AMS_ABORT_UNLESS(m_initialized);
+        AMS_ABORT_UNLESS(out != nullptr);
+
+        auto ctx = std::make_shared<Processor::ProcessAsApplicationFileSystemContext>();
+        R_TRY(m_processor->Parse(ctx.get(), std::move(fs)));
+
+        MakeApplicationFileSystemView(out, ctx, *ctx);
+        R_SUCCEED();
+    }
+
+}
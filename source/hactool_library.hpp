@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+#include "hactool_npdm_capabilities.hpp"
+
+namespace ams::hactool {
+
+    /* Embedders only see the types declared here; the processor behind them is an implementation detail. */
+    class Processor;
+
+    /* Bumped whenever LibraryOptions or the views below change incompatibly. */
+    constexpr inline u32 LibraryApiVersion = 1;
+
+    /* The subset of the tool's options which affects opening; embedders leave api_version at its default. */
+    struct LibraryOptions {
+        u32 api_version = LibraryApiVersion;
+
+        const char *key_file_path = nullptr;
+        const char *titlekey_path = nullptr;
+        const char *consolekey_path = nullptr;
+        bool dev = false;
+        bool disable_key_warns = false;
+
+        const char *base_nca_path = nullptr;
+        const char *base_xci_path = nullptr;
+        const char *base_pfs_path = nullptr;
+        const char *base_appfs_path = nullptr;
+        const char *base_library_dir = nullptr;
+    };
+
+    /* Embeddable entry point: opens inputs and hands back views of what was parsed, without printing or saving anything. */
+    /* Views hold the parsed data alive through their holder, and stay valid after the library is destroyed. */
+    class Library {
+        NON_COPYABLE(Library);
+        NON_MOVEABLE(Library);
+        public:
+            struct NpdmView {
+                std::shared_ptr<const void> holder;
+
+                const ldr::Npdm *npdm = nullptr;
+                const ldr::Acid *acid = nullptr;
+                const ldr::Aci *aci = nullptr;
+
+                std::vector<npdm::ServiceAccessEntry> acid_services;
+                std::vector<npdm::ServiceAccessEntry> aci_services;
+
+                bool IsValid() const { return this->npdm != nullptr; }
+            };
+
+            struct NcaView {
+                std::shared_ptr<const void> holder;
+
+                std::shared_ptr<fssystem::NcaReader> reader;
+                std::shared_ptr<fssystem::NcaReader> base_reader; /* Only for patches opened against a base. */
+
+                s32 exefs_index = -1;
+                s32 romfs_index = -1;
+
+                /* These are nullptr for sections which are absent or could not be mounted. */
+                std::array<std::shared_ptr<fs::IStorage>, fssystem::NcaHeader::FsCountMax> sections{};
+                std::array<std::shared_ptr<fs::fsa::IFileSystem>, fssystem::NcaHeader::FsCountMax> file_systems{};
+
+                NpdmView npdm;
+
+                std::shared_ptr<fs::fsa::IFileSystem> GetExeFs() const { return this->exefs_index >= 0 ? this->file_systems[this->exefs_index] : nullptr; }
+                std::shared_ptr<fs::fsa::IFileSystem> GetRomFs() const { return this->romfs_index >= 0 ? this->file_systems[this->romfs_index] : nullptr; }
+            };
+
+            struct ApplicationFileSystemView {
+                std::shared_ptr<const void> holder;
+
+                std::shared_ptr<fs::fsa::IFileSystem> fs;
+
+                bool has_target = false;
+                ncm::ApplicationId target_app_id{};
+                u32 target_version = 0;
+
+                NcaView program;
+                NcaView base_program;
+            };
+
+            struct XciView {
+                std::shared_ptr<const void> holder;
+
+                const gc::impl::CardHeader *header = nullptr; /* Decrypted. */
+
+                std::shared_ptr<fs::fsa::IFileSystem> root_partition;
+                std::shared_ptr<fs::fsa::IFileSystem> update_partition;
+                std::shared_ptr<fs::fsa::IFileSystem> logo_partition;
+                std::shared_ptr<fs::fsa::IFileSystem> normal_partition;
+                std::shared_ptr<fs::fsa::IFileSystem> secure_partition;
+
+                ApplicationFileSystemView application;
+            };
+
+            struct PfsView {
+                std::shared_ptr<const void> holder;
+
+                std::shared_ptr<fs::fsa::IFileSystem> fs;
+                bool is_exefs = false;
+
+                NpdmView npdm;
+                ApplicationFileSystemView application;
+            };
+        private:
+            std::unique_ptr<Processor> m_processor;
+            u32 m_api_version;
+            bool m_initialized;
+        public:
+            explicit Library(const LibraryOptions &options);
+            ~Library();
+
+            /* Checks the api version, loads keys and opens any bases. Must succeed before anything is opened. */
+            Result Initialize();
+
+            /* Opens a file on the host as a storage, for callers which want to hand in their own. */
+            Result OpenFile(std::shared_ptr<fs::IStorage> *out, const char *path);
+
+            Result OpenNca(NcaView *out, const char *path);
+            Result OpenNca(NcaView *out, std::shared_ptr<fs::IStorage> storage);
+
+            Result OpenNpdm(NpdmView *out, const char *path);
+            Result OpenNpdm(NpdmView *out, std::shared_ptr<fs::IStorage> storage);
+
+            Result OpenXci(XciView *out, const char *path);
+            Result OpenXci(XciView *out, std::shared_ptr<fs::IStorage> storage);
+
+            Result OpenPfs(PfsView *out, const char *path);
+            Result OpenPfs(PfsView *out, std::shared_ptr<fs::IStorage> storage);
+
+            Result OpenApplicationFileSystem(ApplicationFileSystemView *out, const char *dir_path);
+            Result OpenApplicationFileSystem(ApplicationFileSystemView *out, std::shared_ptr<fs::fsa::IFileSystem> fs);
+    };
+
+}
@@ -16,7 +16,13 @@
 #include <stratosphere.hpp>
 #include "hactool_options.hpp"
 #include "hactool_processor.hpp"
+#include "hactool_crypto_benchmark.hpp"
+#include "hactool_trace.hpp"
+#include "hactool_progress.hpp"
+#include "hactool_memory_accounting.hpp"
 
+/* Library builds leave the entry point to the embedder. */
+#if !defined(HACTOOL_BUILD_LIBRARY)
 namespace ams {
 
     void Main() {
@@ -30,10 +36,68 @@ namespace ams {
             return;
         }
 
+        /* Limit tracked memory, and report on it at exit, if we should. */
+        if (options.memory_limit_mb > 0) {
+            hactool::SetMemoryLimit(static_cast<size_t>(options.memory_limit_mb) * 1_MB);
+        }
+        ON_SCOPE_EXIT {
+            if (options.print_memory_stats) {
+                hactool::PrintMemoryReport();
+            }
+        };
+
+        /* Configure progress reporting. */
+        hactool::ConfigureProgress(!options.disable_progress, options.progress_fd);
+
+        /* Start tracing, if we should. */
+        if (options.trace_out_path != nullptr) {
+            hactool::EnableTrace();
+        }
+        ON_SCOPE_EXIT {
+            if (options.trace_out_path != nullptr) {
+                if (const auto res = hactool::SaveTrace(options.trace_out_path); R_FAILED(res)) {
+                    fprintf(stderr, "[Warning]: Failed to save trace to %s: 2%03d-%04d\n", options.trace_out_path, res.GetModule(), res.GetDescription());
+                }
+            }
+        };
+
+        /* Run the crypto benchmark, if we should. */
+        if (options.crypto_benchmark) {
+            hactool::RunCryptoBenchmark();
+            if (options.in_file_path == nullptr) {
+                return;
+            }
+        }
+
+        #if defined(HACTOOL_BUILD_FIXTURE_GENERATOR)
+        /* Generate fixtures, if we should. */
+        if (options.fixture_out_dir_path != nullptr) {
+            if (const auto res = hactool::Processor(options).GenerateFixtures(); R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: tool failed to generate fixtures: 2%03d-%04d\n", res.GetModule(), res.GetDescription());
+            }
+            if (options.in_file_path == nullptr) {
+                return;
+            }
+        }
+        #endif
+
+        #if defined(HACTOOL_BUILD_BENCHMARK)
+        /* Run the benchmarks, if we should. */
+        if (options.bench_fixture_dir_path != nullptr) {
+            if (const auto res = hactool::Processor(options).RunBenchmarks(); R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: tool failed to run benchmarks: 2%03d-%04d\n", res.GetModule(), res.GetDescription());
+            }
+            if (options.in_file_path == nullptr) {
+                return;
+            }
+        }
+        #endif
+
         /* Process. */
         if (const auto res = hactool::Processor(options).Process(); R_FAILED(res)) {
             fprintf(stderr, "[Warning]: tool failed to process input: 2%03d-%04d\n", res.GetModule(), res.GetDescription());
         }
     }
 
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_memory_accounting.hpp"
+
+#if defined(ATMOSPHERE_OS_LINUX) || defined(ATMOSPHERE_OS_MACOS)
+#include <sys/resource.h>
+#endif
+
+namespace ams::hactool {
+
+    namespace {
+
+        struct AllocationHeader {
+            u64 size;
+            u64 site;
+        };
+        static_assert(sizeof(AllocationHeader) == 0x10);
+
+        struct AllocationCounters {
+            std::atomic<size_t> current;
+            std::atomic<size_t> peak;
+            std::atomic<size_t> total;
+            std::atomic<size_t> count;
+        };
+
+        constexpr const char * const AllocationSiteNames[AllocationSite_Count] = {
+            "Work buffers",
+            "Entry buffers",
+            "Output buffers",
+            "Verification buffers",
+            "File data",
+            "Tree nodes",
+            "Filesystem buffer pools",
+            "Compression buffers",
+        };
+
+        constinit AllocationCounters g_site_counters[AllocationSite_Count] = {};
+        constinit AllocationCounters g_total_counters = {};
+        constinit std::atomic<size_t> g_memory_limit = 0;
+        constinit std::atomic<size_t> g_failed_allocation_count = 0;
+
+        void UpdatePeak(std::atomic<size_t> &peak, size_t value) {
+            size_t cur = peak.load(std::memory_order_relaxed);
+            while (cur < value && !peak.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+                /* ... */
+            }
+        }
+
+        void CountAllocation(AllocationCounters &counters, size_t size) {
+            UpdatePeak(counters.peak, counters.current.fetch_add(size, std::memory_order_relaxed) + size);
+            counters.total.fetch_add(size, std::memory_order_relaxed);
+            counters.count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        bool TryReserve(size_t size) {
+            /* Take the memory first, so that concurrent allocations can't both squeeze under the limit. */
+            const size_t prev  = g_total_counters.current.fetch_add(size, std::memory_order_relaxed);
+            const size_t limit = g_memory_limit.load(std::memory_order_relaxed);
+            if (limit != 0 && prev + size > limit) {
+                g_total_counters.current.fetch_sub(size, std::memory_order_relaxed);
+                return false;
+            }
+
+            UpdatePeak(g_total_counters.peak, prev + size);
+            g_total_counters.total.fetch_add(size, std::memory_order_relaxed);
+            g_total_counters.count.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        void PrintSize(const char *name, size_t size) {
+            printf("    %-30s %10.3f MB\n", name, static_cast<double>(size) / static_cast<double>(1_MB));
+        }
+
+    }
+
+    void SetMemoryLimit(size_t limit) {
+        g_memory_limit.store(limit, std::memory_order_relaxed);
+    }
+
+    void *AllocateTracked(size_t size, AllocationSite site) {
+        AMS_ASSERT(site < AllocationSite_Count);
+
+        if (!TryReserve(size)) {
+            g_failed_allocation_count.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        auto *header = static_cast<AllocationHeader *>(std::malloc(sizeof(AllocationHeader) + size));
+        if (header == nullptr) {
+            g_total_counters.current.fetch_sub(size, std::memory_order_relaxed);
+            g_failed_allocation_count.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        header->size = size;
+        header->site = site;
+        CountAllocation(g_site_counters[site], size);
+
+        return header + 1;
+    }
+
+    void FreeTracked(void *p) {
+        if (p == nullptr) {
+            return;
+        }
+
+        auto *header = static_cast<AllocationHeader *>(p) - 1;
+        g_site_counters[header->site].current.fetch_sub(header->size, std::memory_order_relaxed);
+        g_total_counters.current.fetch_sub(header->size, std::memory_order_relaxed);
+
+        std::free(header);
+    }
+
+    size_t GetAdaptiveBufferSize(size_t desired, size_t minimum) {
+        const size_t limit = g_memory_limit.load(std::memory_order_relaxed);
+        if (limit == 0) {
+            return desired;
+        }
+
+        const size_t current  = g_total_counters.current.load(std::memory_order_relaxed);
+        const size_t headroom = current < limit ? limit - current : 0;
+
+        size_t size = desired;
+        while (size > minimum && size > headroom) {
+            size /= 2;
+        }
+        return std::max(size, minimum);
+    }
+
+    void NoteAllocation(size_t size, AllocationSite site) {
+        AMS_ASSERT(site < AllocationSite_Count);
+
+        /* Memory we don't allocate ourselves can't be refused, so it only counts towards the limit. */
+        UpdatePeak(g_total_counters.peak, g_total_counters.current.fetch_add(size, std::memory_order_relaxed) + size);
+        g_total_counters.total.fetch_add(size, std::memory_order_relaxed);
+        g_total_counters.count.fetch_add(1, std::memory_order_relaxed);
+
+        CountAllocation(g_site_counters[site], size);
+    }
+
+    void NoteFree(size_t size, AllocationSite site) {
+        g_site_counters[site].current.fetch_sub(size, std::memory_order_relaxed);
+        g_total_counters.current.fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    void PrintMemoryReport() {
+        printf("Memory usage:\n");
+        PrintSize("Peak tracked", g_total_counters.peak.load());
+        PrintSize("Total tracked", g_total_counters.total.load());
+        printf("    %-30s %10zu\n", "Tracked allocations", g_total_counters.count.load());
+
+        if (const size_t limit = g_memory_limit.load(); limit != 0) {
+            PrintSize("Limit", limit);
+            printf("    %-30s %10zu\n", "Refused allocations", g_failed_allocation_count.load());
+        }
+
+        #if defined(ATMOSPHERE_OS_LINUX) || defined(ATMOSPHERE_OS_MACOS)
+        {
+            struct rusage usage;
+            if (::getrusage(RUSAGE_SELF, std::addressof(usage)) == 0) {
+                #if defined(ATMOSPHERE_OS_MACOS)
+                const size_t max_rss = static_cast<size_t>(usage.ru_maxrss);
+                #else
+                const size_t max_rss = static_cast<size_t>(usage.ru_maxrss) * 1_KB;
+                #endif
+                PrintSize("Peak resident set", max_rss);
+            }
+        }
+        #endif
+
+        printf("    %-30s %13s %13s %10s\n", "By site:", "Peak (MB)", "Total (MB)", "Count");
+        for (int i = 0; i < AllocationSite_Count; ++i) {
+            const auto &counters = g_site_counters[i];
+            printf("        %-26s %13.3f %13.3f %10zu\n", AllocationSiteNames[i], static_cast<double>(counters.peak.load()) / static_cast<double>(1_MB), static_cast<double>(counters.total.load()) / static_cast<double>(1_MB), counters.count.load());
+        }
+    }
+
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    enum AllocationSite {
+        AllocationSite_WorkBuffer,
+        AllocationSite_EntryBuffer,
+        AllocationSite_OutputBuffer,
+        AllocationSite_VerificationBuffer,
+        AllocationSite_FileData,
+        AllocationSite_TreeNode,
+        AllocationSite_FileSystemBuffers,
+        AllocationSite_CompressionBuffer,
+
+        AllocationSite_Count,
+    };
+
+    /* Sets the limit on tracked memory in use at once; zero means unlimited. */
+    void SetMemoryLimit(size_t limit);
+
+    /* Allocates a buffer counted against the given site, returning nullptr if it would exceed the memory limit. */
+    void *AllocateTracked(size_t size, AllocationSite site);
+    void FreeTracked(void *p);
+
+    /* Picks a buffer size for a caller that can work in smaller pieces: desired, halved until it fits under the limit, but no less than minimum. */
+    size_t GetAdaptiveBufferSize(size_t desired, size_t minimum);
+
+    /* Counts memory allocated elsewhere (e.g. by new) against a site. */
+    void NoteAllocation(size_t size, AllocationSite site);
+    void NoteFree(size_t size, AllocationSite site);
+
+    /* Prints peak, total and per-site usage, along with the process's peak resident set where the OS reports it. */
+    void PrintMemoryReport();
+
+    struct TrackedDeleter {
+        void operator()(void *p) const { FreeTracked(p); }
+    };
+
+    template<typename T>
+    using TrackedUniquePtr = std::unique_ptr<T[], TrackedDeleter>;
+
+    template<typename T> requires std::is_trivially_copyable<T>::value
+    TrackedUniquePtr<T> MakeTrackedArray(size_t count, AllocationSite site) {
+        return TrackedUniquePtr<T>(static_cast<T *>(AllocateTracked(count * sizeof(T), site)));
+    }
+
+}
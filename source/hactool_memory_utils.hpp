@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* Returns whether every byte of a buffer equals value. */
+    /* The bulk is checked a cache line at a time by OR-reducing eight words XORed with the pattern, which compilers turn into vector code. */
+    /* Words are loaded with memcpy, which compiles to plain (unaligned) loads without aliasing the buffer as u64. */
+    inline bool IsFilledWith(const void *data, size_t size, u8 value) {
+        const u8 *cur = static_cast<const u8 *>(data);
+        const u64 pattern = UINT64_C(0x0101010101010101) * value;
+
+        /* Check whole cache lines. */
+        for (/* ... */; size >= 0x40; size -= 0x40, cur += 0x40) {
+            u64 words[8];
+            std::memcpy(words, cur, sizeof(words));
+
+            u64 acc = 0;
+            for (size_t i = 0; i < 8; ++i) {
+                acc |= words[i] ^ pattern;
+            }
+            if (acc != 0) {
+                return false;
+            }
+        }
+
+        /* Check the remaining bytes. */
+        while (size > 0) {
+            if (*cur != value) {
+                return false;
+            }
+            ++cur;
+            --size;
+        }
+
+        return true;
+    }
+
+    /* Returns whether a buffer is entirely zero. */
+    inline bool IsZeroFilled(const void *data, size_t size) {
+        return IsFilledWith(data, size, 0);
+    }
+
+}
@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_ncz_storage.hpp"
+#include "hactool_aes.hpp"
+#include "hactool_memory_accounting.hpp"
+#include "hactool_trace.hpp"
+#include "hactool_parallel.hpp"
+
+#if defined(HACTOOL_ENABLE_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr u64 SectionCountMax = 0x100;
+
+        #if defined(HACTOOL_ENABLE_ZSTD)
+
+        constexpr u8 BlockSizeLog2Min = 14;
+        constexpr u8 BlockSizeLog2Max = 27;
+
+        /* Blocks which a read only partially covers are kept around, since neighbouring reads usually want the rest. */
+        constexpr size_t BlockCacheCount = 4;
+
+        /* Payloads without a block table can only be decoded forwards, a window at a time. */
+        constexpr size_t StreamWindowSize = 1_MB;
+
+        ZSTD_DCtx *GetThreadDecompressionContext() {
+            thread_local std::unique_ptr<ZSTD_DCtx, decltype(&::ZSTD_freeDCtx)> s_dctx(::ZSTD_createDCtx(), ::ZSTD_freeDCtx);
+            return s_dctx.get();
+        }
+
+        class NczStorage : public ::ams::fs::IStorage, public ::ams::fs::impl::Newable {
+            NON_COPYABLE(NczStorage);
+            NON_MOVEABLE(NczStorage);
+            private:
+                struct CachedBlock {
+                    s64 index;
+                    u64 last_use;
+                    TrackedUniquePtr<u8> data;
+                };
+            private:
+                std::shared_ptr<fs::IStorage> m_base;
+                s64 m_base_size;
+                std::vector<NczSectionEntry> m_sections;
+                s64 m_size;
+                s64 m_payload_offset;
+
+                /* Block mode. */
+                bool m_is_block_compressed;
+                size_t m_block_size;
+                s64 m_block_count;
+                std::vector<s64> m_block_offsets;
+                std::array<CachedBlock, BlockCacheCount> m_block_cache;
+                u64 m_block_use_counter;
+                os::SdkMutex m_block_cache_lock;
+
+                /* Stream mode. */
+                std::unique_ptr<ZSTD_DStream, decltype(&::ZSTD_freeDStream)> m_stream;
+                TrackedUniquePtr<u8> m_stream_input;
+                size_t m_stream_input_size;
+                size_t m_stream_input_pos;
+                size_t m_stream_input_buffer_size;
+                s64 m_stream_input_offset;
+                s64 m_stream_output_offset;
+                TrackedUniquePtr<u8> m_window;
+                s64 m_window_offset;
+                size_t m_window_size;
+                os::SdkMutex m_stream_lock;
+            public:
+                NczStorage() : m_base(), m_base_size(0), m_sections(), m_size(0), m_payload_offset(0), m_is_block_compressed(false), m_block_size(0), m_block_count(0), m_block_offsets(), m_block_cache(), m_block_use_counter(0), m_block_cache_lock(), m_stream(nullptr, ::ZSTD_freeDStream), m_stream_input_size(0), m_stream_input_pos(0), m_stream_input_buffer_size(0), m_stream_input_offset(0), m_stream_output_offset(0), m_window_offset(0), m_window_size(0), m_stream_lock() {
+                    for (auto &entry : m_block_cache) {
+                        entry.index = -1;
+                    }
+                }
+
+                Result Initialize(std::shared_ptr<fs::IStorage> base) {
+                    m_base = std::move(base);
+                    R_TRY(m_base->GetSize(std::addressof(m_base_size)));
+
+                    /* Read the section table. */
+                    NczSectionHeader section_header;
+                    R_UNLESS(m_base_size >= NczUncompressedHeaderSize + static_cast<s64>(sizeof(section_header)), fs::ResultInvalidSize());
+                    R_TRY(m_base->Read(NczUncompressedHeaderSize, std::addressof(section_header), sizeof(section_header)));
+                    R_UNLESS(section_header.magic == NczSectionHeader::Magic,                                  fs::ResultInvalidArgument());
+                    R_UNLESS(0 < section_header.section_count && section_header.section_count <= SectionCountMax, fs::ResultInvalidSize());
+
+                    s64 offset = NczUncompressedHeaderSize + sizeof(section_header);
+                    const size_t sections_size = section_header.section_count * sizeof(NczSectionEntry);
+                    R_UNLESS(offset + static_cast<s64>(sections_size) <= m_base_size, fs::ResultInvalidSize());
+
+                    m_sections.resize(section_header.section_count);
+                    R_TRY(m_base->Read(offset, m_sections.data(), sections_size));
+                    offset += sections_size;
+
+                    s64 sections_end = NczUncompressedHeaderSize;
+                    for (const auto &section : m_sections) {
+                        R_UNLESS(section.offset >= 0 && section.size >= 0,                                 fs::ResultInvalidSize());
+                        R_UNLESS(util::IsAligned(section.offset, crypto::AesEncryptor128::BlockSize), fs::ResultInvalidSize());
+                        sections_end = std::max(sections_end, section.offset + section.size);
+                    }
+
+                    /* Determine whether the payload has a block table. */
+                    NczBlockHeader block_header = {};
+                    if (offset + static_cast<s64>(sizeof(block_header)) <= m_base_size) {
+                        R_TRY(m_base->Read(offset, std::addressof(block_header), sizeof(block_header)));
+                    }
+
+                    if (block_header.magic == NczBlockHeader::Magic) {
+                        R_UNLESS(block_header.version == NczBlockHeader::Version && block_header.type == NczBlockHeader::Type,     fs::ResultUnsupportedOperation());
+                        R_UNLESS(BlockSizeLog2Min <= block_header.block_size_log2 && block_header.block_size_log2 <= BlockSizeLog2Max, fs::ResultInvalidSize());
+                        R_UNLESS(block_header.decompressed_size >= 0,                                                          fs::ResultInvalidSize());
+
+                        m_is_block_compressed = true;
+                        m_block_size          = static_cast<size_t>(1) << block_header.block_size_log2;
+                        m_block_count         = block_header.block_count;
+                        m_size                = NczUncompressedHeaderSize + block_header.decompressed_size;
+                        R_UNLESS(m_block_count == util::DivideUp(block_header.decompressed_size, static_cast<s64>(m_block_size)), fs::ResultInvalidSize());
+                        R_UNLESS(sections_end <= m_size,                                                                         fs::ResultInvalidSize());
+
+                        /* Read the compressed block sizes, and turn them into offsets. */
+                        offset += sizeof(block_header);
+                        R_UNLESS(offset + m_block_count * static_cast<s64>(sizeof(u32)) <= m_base_size, fs::ResultInvalidSize());
+
+                        std::vector<u32> compressed_sizes(m_block_count);
+                        R_TRY(m_base->Read(offset, compressed_sizes.data(), compressed_sizes.size() * sizeof(u32)));
+                        offset += compressed_sizes.size() * sizeof(u32);
+
+                        m_payload_offset = offset;
+                        m_block_offsets.resize(m_block_count + 1);
+                        m_block_offsets[0] = 0;
+                        for (s64 i = 0; i < m_block_count; ++i) {
+                            R_UNLESS(compressed_sizes[i] <= this->GetBlockDecompressedSize(i), fs::ResultInvalidSize());
+                            m_block_offsets[i + 1] = m_block_offsets[i] + compressed_sizes[i];
+                        }
+                        R_UNLESS(m_payload_offset + m_block_offsets[m_block_count] <= m_base_size, fs::ResultInvalidSize());
+                    } else {
+                        m_is_block_compressed = false;
+                        m_size                = sections_end;
+                        m_payload_offset      = offset;
+
+                        m_stream_input_buffer_size = ::ZSTD_DStreamInSize();
+                        m_stream_input             = MakeTrackedArray<u8>(m_stream_input_buffer_size, AllocationSite_CompressionBuffer);
+                        m_window                   = MakeTrackedArray<u8>(StreamWindowSize, AllocationSite_CompressionBuffer);
+                        m_stream.reset(::ZSTD_createDStream());
+                        R_UNLESS(m_stream_input != nullptr && m_window != nullptr && m_stream != nullptr, fs::ResultAllocationMemoryFailed());
+
+                        R_TRY(this->ResetStream());
+                    }
+
+                    R_SUCCEED();
+                }
+
+                virtual Result Read(s64 offset, void *buffer, size_t size) override {
+                    /* Succeed immediately on zero-sized read. */
+                    R_SUCCEED_IF(size == 0);
+
+                    /* Validate arguments. */
+                    R_UNLESS(buffer != nullptr, fs::ResultNullptrArgument());
+                    R_UNLESS(offset >= 0,       fs::ResultOutOfRange());
+                    R_UNLESS(offset <= m_size && static_cast<s64>(size) <= m_size - offset, fs::ResultOutOfRange());
+
+                    /* The header is stored as-is. */
+                    u8 *dst = static_cast<u8 *>(buffer);
+                    if (offset < NczUncompressedHeaderSize) {
+                        const size_t cur_size = std::min<size_t>(size, NczUncompressedHeaderSize - offset);
+                        R_TRY(m_base->Read(offset, dst, cur_size));
+
+                        dst    += cur_size;
+                        offset += cur_size;
+                        size   -= cur_size;
+                    }
+                    R_SUCCEED_IF(size == 0);
+
+                    if (m_is_block_compressed) {
+                        R_RETURN(this->ReadBlocks(offset - NczUncompressedHeaderSize, dst, size));
+                    } else {
+                        R_RETURN(this->ReadStream(offset - NczUncompressedHeaderSize, dst, size));
+                    }
+                }
+
+                virtual Result OperateRange(void *dst, size_t dst_size, fs::OperationId op_id, s64 offset, s64 size, const void *src, size_t src_size) override {
+                    AMS_UNUSED(offset, size, src, src_size);
+
+                    switch (op_id) {
+                        case fs::OperationId::Invalidate:
+                            {
+                                std::scoped_lock lk(m_block_cache_lock);
+                                for (auto &entry : m_block_cache) {
+                                    entry.index = -1;
+                                }
+                                R_SUCCEED();
+                            }
+                        case fs::OperationId::QueryRange:
+                            {
+                                R_UNLESS(dst != nullptr,                         fs::ResultNullptrArgument());
+                                R_UNLESS(dst_size == sizeof(fs::QueryRangeInfo), fs::ResultInvalidSize());
+
+                                reinterpret_cast<fs::QueryRangeInfo *>(dst)->Clear();
+                                R_SUCCEED();
+                            }
+                        default:
+                            R_THROW(fs::ResultUnsupportedOperation());
+                    }
+                }
+
+                virtual Result GetSize(s64 *out) override {
+                    *out = m_size;
+                    R_SUCCEED();
+                }
+
+                virtual Result Flush() override {
+                    R_SUCCEED();
+                }
+
+                virtual Result Write(s64 offset, const void *buffer, size_t size) override {
+                    AMS_UNUSED(offset, buffer, size);
+                    R_THROW(fs::ResultUnsupportedOperation());
+                }
+
+                virtual Result SetSize(s64 size) override {
+                    AMS_UNUSED(size);
+                    R_THROW(fs::ResultUnsupportedOperation());
+                }
+            private:
+                size_t GetBlockDecompressedSize(s64 index) const {
+                    const s64 data_size = m_size - NczUncompressedHeaderSize;
+                    return static_cast<size_t>(std::min<s64>(m_block_size, data_size - index * static_cast<s64>(m_block_size)));
+                }
+
+                void Encrypt(u8 *data, s64 nca_offset, size_t size) const {
+                    ApplyNczSectionCrypto(m_sections.data(), m_sections.size(), data, nca_offset, size);
+                }
+
+                Result DecodeBlock(s64 index, u8 *dst) {
+                    HACTOOL_TRACE_ZONE("DecodeNczBlock");
+
+                    const size_t decompressed_size = this->GetBlockDecompressedSize(index);
+                    const s64 compressed_offset    = m_payload_offset + m_block_offsets[index];
+                    const size_t compressed_size   = static_cast<size_t>(m_block_offsets[index + 1] - m_block_offsets[index]);
+
+                    if (compressed_size == decompressed_size) {
+                        /* Blocks which didn't shrink are stored raw. */
+                        R_TRY(m_base->Read(compressed_offset, dst, decompressed_size));
+                    } else {
+                        auto compressed = MakeTrackedArray<u8>(compressed_size, AllocationSite_CompressionBuffer);
+                        R_UNLESS(compressed != nullptr, fs::ResultAllocationMemoryFailed());
+                        R_TRY(m_base->Read(compressed_offset, compressed.get(), compressed_size));
+
+                        auto *dctx = GetThreadDecompressionContext();
+                        R_UNLESS(dctx != nullptr, fs::ResultAllocationMemoryFailed());
+
+                        const size_t res = ::ZSTD_decompressDCtx(dctx, dst, decompressed_size, compressed.get(), compressed_size);
+                        R_UNLESS(!::ZSTD_isError(res) && res == decompressed_size, fs::ResultUnexpected());
+                    }
+
+                    this->Encrypt(dst, NczUncompressedHeaderSize + index * static_cast<s64>(m_block_size), decompressed_size);
+                    R_SUCCEED();
+                }
+
+                Result CopyFromCachedBlock(s64 index, s64 offset, u8 *dst, size_t size) {
+                    std::scoped_lock lk(m_block_cache_lock);
+
+                    /* Find the block, or the least recently used slot to decode it into. */
+                    CachedBlock *entry = nullptr;
+                    for (auto &cur : m_block_cache) {
+                        if (cur.index == index) {
+                            entry = std::addressof(cur);
+                            break;
+                        }
+                        if (entry == nullptr || cur.last_use < entry->last_use) {
+                            entry = std::addressof(cur);
+                        }
+                    }
+
+                    if (entry->index != index) {
+                        if (entry->data == nullptr) {
+                            entry->data = MakeTrackedArray<u8>(m_block_size, AllocationSite_CompressionBuffer);
+                            R_UNLESS(entry->data != nullptr, fs::ResultAllocationMemoryFailed());
+                        }
+
+                        entry->index = -1;
+                        R_TRY(this->DecodeBlock(index, entry->data.get()));
+                        entry->index = index;
+                    }
+                    entry->last_use = ++m_block_use_counter;
+
+                    /* Copy out the part of the block the read covers. */
+                    const s64 block_offset = index * static_cast<s64>(m_block_size);
+                    const s64 start        = std::max(offset, block_offset);
+                    const s64 end          = std::min(offset + static_cast<s64>(size), block_offset + static_cast<s64>(this->GetBlockDecompressedSize(index)));
+                    std::memcpy(dst + (start - offset), entry->data.get() + (start - block_offset), static_cast<size_t>(end - start));
+
+                    R_SUCCEED();
+                }
+
+                Result ReadBlocks(s64 offset, u8 *dst, size_t size) {
+                    const s64 block_size = static_cast<s64>(m_block_size);
+                    const s64 end        = offset + static_cast<s64>(size);
+                    const s64 first      = offset / block_size;
+                    const s64 last       = (end - 1) / block_size;
+
+                    /* Blocks the read only partially covers go through the cache. */
+                    const bool first_partial = (offset % block_size) != 0;
+                    const bool last_partial  = (end % block_size) != 0 && end != m_size - NczUncompressedHeaderSize;
+
+                    if (first_partial || (first == last && last_partial)) {
+                        R_TRY(this->CopyFromCachedBlock(first, offset, dst, size));
+                    }
+                    if (last_partial && last != first) {
+                        R_TRY(this->CopyFromCachedBlock(last, offset, dst, size));
+                    }
+
+                    /* Blocks it covers entirely are decoded straight into the destination, in parallel. */
+                    const s64 direct_first = first_partial ? first + 1 : first;
+                    const s64 direct_last  = last_partial  ? last - 1  : last;
+                    if (direct_first <= direct_last) {
+                        R_TRY(RunParallel(static_cast<size_t>(direct_last - direct_first + 1), [&] (size_t i) -> Result {
+                            const s64 index = direct_first + static_cast<s64>(i);
+                            R_RETURN(this->DecodeBlock(index, dst + (index * block_size - offset)));
+                        }));
+                    }
+
+                    R_SUCCEED();
+                }
+
+                Result ResetStream() {
+                    const size_t res = ::ZSTD_DCtx_reset(m_stream.get(), ZSTD_reset_session_only);
+                    R_UNLESS(!::ZSTD_isError(res), fs::ResultUnexpected());
+
+                    m_stream_input_offset  = m_payload_offset;
+                    m_stream_input_size    = 0;
+                    m_stream_input_pos     = 0;
+                    m_stream_output_offset = 0;
+                    m_window_offset        = 0;
+                    m_window_size          = 0;
+                    R_SUCCEED();
+                }
+
+                Result DecodeNextWindow() {
+                    HACTOOL_TRACE_ZONE("DecodeNczWindow");
+
+                    ZSTD_outBuffer output = { m_window.get(), StreamWindowSize, 0 };
+                    while (output.pos < output.size) {
+                        /* Refill the input, if we've consumed it. */
+                        if (m_stream_input_pos == m_stream_input_size) {
+                            const s64 remaining = m_base_size - m_stream_input_offset;
+                            if (remaining <= 0) {
+                                break;
+                            }
+
+                            const size_t cur_size = static_cast<size_t>(std::min<s64>(m_stream_input_buffer_size, remaining));
+                            R_TRY(m_base->Read(m_stream_input_offset, m_stream_input.get(), cur_size));
+
+                            m_stream_input_offset += cur_size;
+                            m_stream_input_size    = cur_size;
+                            m_stream_input_pos     = 0;
+                        }
+
+                        ZSTD_inBuffer input = { m_stream_input.get(), m_stream_input_size, m_stream_input_pos };
+                        const size_t res = ::ZSTD_decompressStream(m_stream.get(), std::addressof(output), std::addressof(input));
+                        R_UNLESS(!::ZSTD_isError(res), fs::ResultUnexpected());
+
+                        m_stream_input_pos = input.pos;
+                    }
+
+                    m_window_offset         = m_stream_output_offset;
+                    m_window_size           = output.pos;
+                    m_stream_output_offset += output.pos;
+
+                    this->Encrypt(m_window.get(), NczUncompressedHeaderSize + m_window_offset, m_window_size);
+                    R_SUCCEED();
+                }
+
+                Result ReadStream(s64 offset, u8 *dst, size_t size) {
+                    std::scoped_lock lk(m_stream_lock);
+
+                    while (size > 0) {
+                        /* Seeking backwards means starting over. */
+                        if (offset < m_window_offset) {
+                            R_TRY(this->ResetStream());
+                        }
+
+                        /* Decode forward until the window holds the offset. */
+                        if (offset >= m_window_offset + static_cast<s64>(m_window_size)) {
+                            R_TRY(this->DecodeNextWindow());
+                            R_UNLESS(m_window_size > 0, fs::ResultOutOfRange());
+                            continue;
+                        }
+
+                        const size_t offset_in_window = static_cast<size_t>(offset - m_window_offset);
+                        const size_t cur_size         = std::min(size, m_window_size - offset_in_window);
+                        std::memcpy(dst, m_window.get() + offset_in_window, cur_size);
+
+                        dst    += cur_size;
+                        offset += cur_size;
+                        size   -= cur_size;
+                    }
+
+                    R_SUCCEED();
+                }
+        };
+
+        #endif
+
+    }
+
+    void ApplyNczSectionCrypto(const NczSectionEntry *sections, size_t section_count, u8 *data, s64 nca_offset, size_t size) {
+        for (size_t i = 0; i < section_count; ++i) {
+            const auto &section = sections[i];
+            if (section.crypto_type != NczSectionEntry::CryptoType_AesCtr && section.crypto_type != NczSectionEntry::CryptoType_AesCtrEx) {
+                continue;
+            }
+
+            const s64 start = std::max(nca_offset, section.offset);
+            const s64 end   = std::min(nca_offset + static_cast<s64>(size), section.offset + section.size);
+            if (start >= end) {
+                continue;
+            }
+
+            /* The upper half of the counter comes from the section, the lower half is the block index. */
+            u8 iv[crypto::AesEncryptor128::IvSize];
+            std::memcpy(iv, section.counter, sizeof(iv) / 2);
+            const u64 ctr = static_cast<u64>(start) / crypto::AesEncryptor128::BlockSize;
+            for (size_t j = 0; j < sizeof(iv) / 2; ++j) {
+                iv[sizeof(iv) - 1 - j] = static_cast<u8>(ctr >> (BITSIZEOF(u8) * j));
+            }
+
+            u8 *p = data + (start - nca_offset);
+            ComputeAes128Ctr(p, p, static_cast<size_t>(end - start), section.key, iv);
+        }
+    }
+
+    bool IsNczStorage(fs::IStorage *storage) {
+        NczSectionHeader section_header;
+        if (R_FAILED(storage->Read(NczUncompressedHeaderSize, std::addressof(section_header), sizeof(section_header)))) {
+            return false;
+        }
+
+        return section_header.magic == NczSectionHeader::Magic;
+    }
+
+    Result OpenNczStorage(std::shared_ptr<fs::IStorage> *out, std::shared_ptr<fs::IStorage> base) {
+        #if defined(HACTOOL_ENABLE_ZSTD)
+        HACTOOL_TRACE_ZONE("OpenNczStorage");
+
+        auto storage = fssystem::AllocateShared<NczStorage>();
+        R_UNLESS(storage != nullptr, fs::ResultAllocationMemoryFailedAllocateShared());
+
+        R_TRY(storage->Initialize(std::move(base)));
+
+        *out = std::move(storage);
+        R_SUCCEED();
+        #else
+        AMS_UNUSED(out, base);
+        R_THROW(fs::ResultUnsupportedOperation());
+        #endif
+    }
+
+    Result OpenNczStorageIfCompressed(std::shared_ptr<fs::IStorage> *storage) {
+        /* Leave anything which isn't an NCZ alone. */
+        R_SUCCEED_IF(*storage == nullptr || !IsNczStorage(storage->get()));
+
+        #if !defined(HACTOOL_ENABLE_ZSTD)
+        fprintf(stderr, "[Warning]: Input is NCZ-compressed, but this build lacks zstd support.\n");
+        #endif
+
+        std::shared_ptr<fs::IStorage> ncz_storage;
+        R_TRY(OpenNczStorage(std::addressof(ncz_storage), std::move(*storage)));
+
+        *storage = std::move(ncz_storage);
+        R_SUCCEED();
+    }
+
+}
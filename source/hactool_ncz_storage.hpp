@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* NCZ keeps the first 0x4000 bytes of the NCA as-is, followed by a section table and the decrypted remainder compressed with zstd. */
+    struct NczSectionEntry {
+        static constexpr u64 CryptoType_None     = 1;
+        static constexpr u64 CryptoType_AesXts   = 2;
+        static constexpr u64 CryptoType_AesCtr   = 3;
+        static constexpr u64 CryptoType_AesCtrEx = 4;
+
+        s64 offset;
+        s64 size;
+        u64 crypto_type;
+        u64 reserved;
+        u8 key[crypto::AesEncryptor128::KeySize];
+        u8 counter[crypto::AesEncryptor128::IvSize];
+    };
+    static_assert(sizeof(NczSectionEntry) == 0x40);
+    static_assert(util::is_pod<NczSectionEntry>::value);
+
+    struct NczSectionHeader {
+        static constexpr u64 Magic = util::FourCC<'N', 'C', 'Z', 'S'>::Code | (static_cast<u64>(util::FourCC<'E', 'C', 'T', 'N'>::Code) << 32);
+
+        u64 magic;
+        u64 section_count;
+    };
+    static_assert(sizeof(NczSectionHeader) == 0x10);
+    static_assert(util::is_pod<NczSectionHeader>::value);
+
+    /* Present when the payload is split into independently compressed blocks, which allows random access. */
+    struct NczBlockHeader {
+        static constexpr u64 Magic = util::FourCC<'N', 'C', 'Z', 'B'>::Code | (static_cast<u64>(util::FourCC<'L', 'O', 'C', 'K'>::Code) << 32);
+        static constexpr u8 Version = 2;
+        static constexpr u8 Type    = 1;
+
+        u64 magic;
+        u8 version;
+        u8 type;
+        u8 reserved;
+        u8 block_size_log2;
+        u32 block_count;
+        s64 decompressed_size;
+    };
+    static_assert(sizeof(NczBlockHeader) == 0x18);
+    static_assert(util::is_pod<NczBlockHeader>::value);
+
+    constexpr inline s64 NczUncompressedHeaderSize = 0x4000;
+
+    /* AES-CTR is its own inverse, so this both encrypts decompressed data and decrypts data to be compressed. */
+    void ApplyNczSectionCrypto(const NczSectionEntry *sections, size_t section_count, u8 *data, s64 nca_offset, size_t size);
+
+    /* Checks for the section table magic; storages too small to hold one are simply not NCZ. */
+    bool IsNczStorage(fs::IStorage *storage);
+
+    /* Opens a read-only view of the original NCA. Only blocks that are touched are decompressed, and are re-encrypted as they are. */
+    Result OpenNczStorage(std::shared_ptr<fs::IStorage> *out, std::shared_ptr<fs::IStorage> base);
+
+    /* Replaces storage by its NCA view when it holds an NCZ, and leaves it untouched otherwise. */
+    Result OpenNczStorageIfCompressed(std::shared_ptr<fs::IStorage> *storage);
+
+}
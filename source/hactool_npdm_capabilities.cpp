@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include <vapours/svc/svc_definition_macro.hpp>
+#include "hactool_npdm_capabilities.hpp"
+
+namespace ams::hactool::npdm {
+
+    namespace {
+
+        constexpr inline const auto SystemCallNames = [] {
+            std::array<const char *, SystemCallCount> names{};
+            for (auto &name : names) {
+                name = "Unknown";
+            }
+
+            #define EMPTY_HANDLER(TYPE, NAME)
+            #define SET_NAME_HANDLER(ID, _, NAME, ...) static_assert(ID < SystemCallCount); names[ID] = #NAME ;
+            AMS_SVC_FOREACH_DEFINITION_IMPL(SET_NAME_HANDLER, _, EMPTY_HANDLER, EMPTY_HANDLER, EMPTY_HANDLER, EMPTY_HANDLER)
+            #undef EMPTY_HANDLER
+            #undef SET_NAME_HANDLER
+
+            return names;
+        }();
+
+        u64 GetServiceNameKey(const sm::ServiceName &name) {
+            u64 key;
+            static_assert(sizeof(key) == sizeof(name));
+            std::memcpy(std::addressof(key), std::addressof(name), sizeof(key));
+            return key;
+        }
+
+    }
+
+    const char *GetSystemCallName(size_t i) {
+        return i < SystemCallNames.size() ? SystemCallNames[i] : "Unknown";
+    }
+
+    void MappedRangeHolder::Insert(u64 a, size_t s, bool ro) {
+        /* Spill to the heap once the inline ranges are exhausted. */
+        if (m_overflow_ranges.empty() && m_count == m_inline_ranges.size()) {
+            m_overflow_ranges.reserve(2 * m_inline_ranges.size());
+            NoteAllocation(m_overflow_ranges.capacity() * sizeof(MappedRange), AllocationSite_TreeNode);
+
+            m_overflow_ranges.assign(m_inline_ranges.begin(), m_inline_ranges.end());
+        }
+
+        /* Insert after any ranges at the same address, so that equal addresses keep their capability order. */
+        const MappedRange range(a, s, ro);
+        if (!m_overflow_ranges.empty()) {
+            const size_t old_capacity = m_overflow_ranges.capacity();
+
+            const auto it = std::upper_bound(m_overflow_ranges.begin(), m_overflow_ranges.end(), a, [] (u64 address, const MappedRange &cur) { return address < cur.GetAddress(); });
+            m_overflow_ranges.insert(it, range);
+
+            if (const size_t new_capacity = m_overflow_ranges.capacity(); new_capacity != old_capacity) {
+                NoteFree(old_capacity * sizeof(MappedRange), AllocationSite_TreeNode);
+                NoteAllocation(new_capacity * sizeof(MappedRange), AllocationSite_TreeNode);
+            }
+        } else {
+            auto * const ranges = m_inline_ranges.data();
+            auto * const it     = std::upper_bound(ranges, ranges + m_count, a, [] (u64 address, const MappedRange &cur) { return address < cur.GetAddress(); });
+            std::move_backward(it, ranges + m_count, ranges + m_count + 1);
+            *it = range;
+        }
+
+        ++m_count;
+    }
+
+    void DecodeServiceAccessControl(std::vector<ServiceAccessEntry> *out, const void *data, size_t size) {
+        out->clear();
+
+        for (AccessControlEntry cur(data, size); cur.IsValid(); cur = cur.GetNextEntry()) {
+            ServiceAccessEntry entry = {};
+            entry.name        = cur.GetServiceName();
+            entry.name_size   = cur.GetServiceNameSize();
+            entry.is_host     = cur.IsHost();
+            entry.is_wildcard = cur.IsWildcard();
+            entry.is_allowed  = true;
+            cur.GetName(entry.display_name);
+
+            out->push_back(entry);
+        }
+    }
+
+    ServiceAccessRestriction::ServiceAccessRestriction(const std::vector<ServiceAccessEntry> &entries) {
+        for (auto &restrictions : m_restrictions) {
+            restrictions.wildcard_prefixes.push_back(TrieNode{ {}, false });
+        }
+
+        for (const auto &entry : entries) {
+            auto &restrictions = m_restrictions[entry.is_host ? 1 : 0];
+
+            if (!entry.is_wildcard) {
+                restrictions.names.insert(GetServiceNameKey(entry.name));
+                continue;
+            }
+
+            restrictions.wildcard_names.insert(GetServiceNameKey(entry.name));
+
+            /* Insert the prefix, which is everything before the '*'. */
+            u32 node = 0;
+            for (size_t i = 0; i + 1 < entry.name_size; ++i) {
+                const char c = entry.name.name[i];
+
+                auto &children = restrictions.wildcard_prefixes[node].children;
+                const auto it  = std::find_if(children.begin(), children.end(), [c] (const auto &child) { return child.first == c; });
+                if (it != children.end()) {
+                    node = it->second;
+                } else {
+                    const u32 child = restrictions.wildcard_prefixes.size();
+                    children.emplace_back(c, child);
+                    restrictions.wildcard_prefixes.push_back(TrieNode{ {}, false });
+                    node = child;
+                }
+            }
+            restrictions.wildcard_prefixes[node].is_terminal = true;
+        }
+    }
+
+    bool ServiceAccessRestriction::IsAllowed(const ServiceAccessEntry &entry) const {
+        const auto &restrictions = m_restrictions[entry.is_host ? 1 : 0];
+
+        /* A wildcard must be restricted by the same wildcard, or by any plain name. */
+        if (entry.is_wildcard) {
+            return !restrictions.names.empty() || restrictions.wildcard_names.contains(GetServiceNameKey(entry.name));
+        }
+
+        /* A plain name must be restricted by the same name... */
+        if (restrictions.names.contains(GetServiceNameKey(entry.name))) {
+            return true;
+        }
+
+        /* ...or by a wildcard whose prefix it begins with. */
+        u32 node = 0;
+        for (size_t i = 0; i <= sizeof(entry.name.name); ++i) {
+            const auto &cur = restrictions.wildcard_prefixes[node];
+            if (cur.is_terminal) {
+                return true;
+            }
+            if (i == sizeof(entry.name.name)) {
+                break;
+            }
+
+            const char c  = entry.name.name[i];
+            const auto it = std::find_if(cur.children.begin(), cur.children.end(), [c] (const auto &child) { return child.first == c; });
+            if (it == cur.children.end()) {
+                return false;
+            }
+            node = it->second;
+        }
+
+        return false;
+    }
+
+    void ParseKernelCapabilities(ParsedKernelCapabilities *out, const util::BitPack32 *caps, size_t num_caps) {
+        /* Walk all caps. */
+        for (size_t i = 0; i < num_caps; ++i) {
+            switch (GetCapabilityType(caps[i])) {
+                using enum CapabilityType;
+                case CorePriority:
+                    if (out->core_prio.has_value()) {
+                        fprintf(stderr, "[Warning]: KernelAccessControl contains multiple CorePriority capabilities\n");
+                    }
+                    out->core_prio = caps[i];
+                    break;
+                case SyscallMask:
+                    {
+                        const auto mask  = caps[i].Get<SyscallMask::Mask>();
+                        const auto index = caps[i].Get<SyscallMask::Index>();
+
+                        for (size_t n = 0; n < SyscallMask::Mask::Count; ++n) {
+                            const u32 svc_id = SyscallMask::Mask::Count * index + n;
+                            if (mask & (1u << n)) {
+                                out->system_calls[svc_id] = true;
+                            }
+                        }
+                    }
+                    break;
+                case MapRange:
+                    {
+                        if (i + 1 < num_caps) {
+                            const auto cap      = caps[i++];
+                            const auto size_cap = caps[i];
+                            if (GetCapabilityType(size_cap) == MapRange) {
+                                const u64 phys_addr = static_cast<u64>(cap.Get<MapRange::Address>() | (size_cap.Get<MapRangeSize::AddressHigh>() << MapRange::Address::Count)) * os::MemoryPageSize;
+
+                                const size_t num_pages = size_cap.Get<MapRangeSize::Pages>();
+                                const size_t size      = num_pages * os::MemoryPageSize;
+
+                                const bool is_ro = cap.Get<MapRange::ReadOnly>();
+                                if (size_cap.Get<MapRangeSize::Normal>()) {
+                                    out->mapped_static_ranges.Insert(phys_addr, size, is_ro);
+                                } else {
+                                    out->mapped_io_ranges.Insert(phys_addr, size, is_ro);
+                                }
+                            } else {
+                                fprintf(stderr, "[Warning]: KernelAccessControl contains invalid MapRange pair\n");
+                            }
+                        } else {
+                            fprintf(stderr, "[Warning]: KernelAccessControl truncates during MapRange pair\n");
+                        }
+                    }
+                    break;
+                case MapIoPage:
+                    {
+                        const u64 phys_addr = caps[i].Get<MapIoPage::Address>() * os::MemoryPageSize;
+                        out->mapped_io_ranges.Insert(phys_addr, os::MemoryPageSize, false);
+                    }
+                    break;
+                case MapRegion:
+                    if (out->mapped_regions.has_value()) {
+                        fprintf(stderr, "[Warning]: KernelAccessControl contains multiple MapRegion capabilities\n");
+                    }
+                    out->mapped_regions = caps[i];
+                    break;
+                case InterruptPair:
+                    {
+                        const u32 ids[2] = { caps[i].Get<InterruptPair::InterruptId0>(), caps[i].Get<InterruptPair::InterruptId1>(), };
+                        for (size_t i = 0; i < util::size(ids); ++i) {
+                            if (ids[i] != PaddingInterruptId) {
+                                out->interrupts[ids[i]] = true;
+                            }
+                        }
+                    }
+                    break;
+                case ProgramType:
+                    if (out->program_type.has_value()) {
+                        fprintf(stderr, "[Warning]: KernelAccessControl contains multiple ProgramType capabilities\n");
+                    }
+                    out->program_type = caps[i];
+                    break;
+                case KernelVersion:
+                    if (out->kernel_version.has_value()) {
+                        fprintf(stderr, "[Warning]: KernelAccessControl contains multiple KernelVersion capabilities\n");
+                    }
+                    out->kernel_version = caps[i];
+                    break;
+                case HandleTable:
+                    if (out->handle_table.has_value()) {
+                        fprintf(stderr, "[Warning]: KernelAccessControl contains multiple HandleTable capabilities\n");
+                    }
+                    out->handle_table = caps[i];
+                    break;
+                case DebugFlags:
+                    if (out->debug_flags.has_value()) {
+                        fprintf(stderr, "[Warning]: KernelAccessControl contains multiple DebugFlags capabilities\n");
+                    }
+                    out->debug_flags = caps[i];
+                    break;
+                case Invalid:
+                    fprintf(stderr, "[Warning]: KernelAccessControl contains invalid capability\n");
+                    break;
+                case Padding:
+                    break;
+                default:
+                    /* Keep going on malformed npdms, so that a single bad input doesn't end a corpus run. */
+                    if (out->num_unknown_caps >= util::size(out->unknown_caps)) {
+                        if (!out->unknown_caps_truncated) {
+                            fprintf(stderr, "[Warning]: KernelAccessControl contains more than %" PRIuZ " unknown capabilities, ignoring the rest\n", util::size(out->unknown_caps));
+                        }
+                        out->unknown_caps_truncated = true;
+                        break;
+                    }
+                    out->unknown_caps[out->num_unknown_caps++] = caps[i];
+                    break;
+            }
+        }
+    }
+
+}
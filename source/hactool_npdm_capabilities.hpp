@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+#include "hactool_memory_accounting.hpp"
+
+namespace ams::hactool::npdm {
+
+    /* See kern::KCapabilities, from which this is sourced. */
+    constexpr inline size_t InterruptIdCount = 0x400;
+    constexpr inline size_t SystemCallCount  = 0xC0;
+
+    enum class CapabilityType : u32 {
+        CorePriority  = (1u <<  3) - 1,
+        SyscallMask   = (1u <<  4) - 1,
+        MapRange      = (1u <<  6) - 1,
+        MapIoPage     = (1u <<  7) - 1,
+        MapRegion     = (1u << 10) - 1,
+        InterruptPair = (1u << 11) - 1,
+        ProgramType   = (1u << 13) - 1,
+        KernelVersion = (1u << 14) - 1,
+        HandleTable   = (1u << 15) - 1,
+        DebugFlags    = (1u << 16) - 1,
+
+        Invalid       = 0u,
+        Padding       = ~0u,
+    };
+
+    using RawCapabilityValue = util::BitPack32::Field<0, BITSIZEOF(util::BitPack32), u32>;
+
+    constexpr inline CapabilityType GetCapabilityType(const util::BitPack32 cap) {
+        const u32 value = cap.Get<RawCapabilityValue>();
+        return static_cast<CapabilityType>((~value & (value + 1)) - 1);
+    }
+
+    template<size_t Index, size_t Count, typename T = u32>
+    using Field = util::BitPack32::Field<Index, Count, T>;
+
+    #define DEFINE_FIELD(name, prev, ...) using name = Field<prev::Next, __VA_ARGS__>
+
+    template<CapabilityType Type>
+    constexpr inline u32 CapabilityFlag = static_cast<u32>(Type) + 1;
+
+    template<CapabilityType Type>
+    constexpr inline u32 CapabilityId = util::CountTrailingZeros<u32>(CapabilityFlag<Type>);
+
+    struct CorePriority {
+        using IdBits = Field<0, CapabilityId<CapabilityType::CorePriority> + 1>;
+
+        DEFINE_FIELD(LowestThreadPriority,  IdBits,                6);
+        DEFINE_FIELD(HighestThreadPriority, LowestThreadPriority,  6);
+        DEFINE_FIELD(MinimumCoreId,         HighestThreadPriority, 8);
+        DEFINE_FIELD(MaximumCoreId,         MinimumCoreId,         8);
+    };
+
+    struct SyscallMask {
+        using IdBits = Field<0, CapabilityId<CapabilityType::SyscallMask> + 1>;
+
+        DEFINE_FIELD(Mask,  IdBits, 24);
+        DEFINE_FIELD(Index, Mask,    3);
+    };
+
+    /* NOTE: This always parses as though a mesosphere extension is true to use 40 pa bits instead of 36. */
+    struct MapRange {
+        using IdBits = Field<0, CapabilityId<CapabilityType::MapRange> + 1>;
+
+        DEFINE_FIELD(Address,  IdBits,  24);
+        DEFINE_FIELD(ReadOnly, Address,  1, bool);
+    };
+
+    struct MapRangeSize {
+        using IdBits = Field<0, CapabilityId<CapabilityType::MapRange> + 1>;
+
+        DEFINE_FIELD(Pages, IdBits, 20);
+
+        DEFINE_FIELD(AddressHigh, Pages,        4);
+        DEFINE_FIELD(Normal,      AddressHigh,  1, bool);
+    };
+
+    struct MapIoPage {
+        using IdBits = Field<0, CapabilityId<CapabilityType::MapIoPage> + 1>;
+
+        DEFINE_FIELD(Address, IdBits, 24);
+    };
+
+    enum class RegionType : u32 {
+        None              = 0,
+        KernelTraceBuffer = 1,
+        OnMemoryBootImage = 2,
+        DTB               = 3,
+    };
+
+    struct MapRegion {
+        using IdBits = Field<0, CapabilityId<CapabilityType::MapRegion> + 1>;
+
+        DEFINE_FIELD(Region0,   IdBits,      6, RegionType);
+        DEFINE_FIELD(ReadOnly0, Region0,     1, bool);
+        DEFINE_FIELD(Region1,   ReadOnly0,   6, RegionType);
+        DEFINE_FIELD(ReadOnly1, Region1,     1, bool);
+        DEFINE_FIELD(Region2,   ReadOnly1,   6, RegionType);
+        DEFINE_FIELD(ReadOnly2, Region2,     1, bool);
+    };
+
+    constexpr inline u32 PaddingInterruptId = 0x3FF;
+    static_assert(PaddingInterruptId < InterruptIdCount);
+
+    struct InterruptPair {
+        using IdBits = Field<0, CapabilityId<CapabilityType::InterruptPair> + 1>;
+
+        DEFINE_FIELD(InterruptId0, IdBits,       10);
+        DEFINE_FIELD(InterruptId1, InterruptId0, 10);
+    };
+
+
+    struct ProgramType {
+        using IdBits = Field<0, CapabilityId<CapabilityType::ProgramType> + 1>;
+
+        DEFINE_FIELD(Type,     IdBits,  3);
+        DEFINE_FIELD(Reserved, Type,   15);
+    };
+
+    struct KernelVersion {
+        using IdBits = Field<0, CapabilityId<CapabilityType::KernelVersion> + 1>;
+
+        DEFINE_FIELD(MinorVersion, IdBits,        4);
+        DEFINE_FIELD(MajorVersion, MinorVersion, 13);
+    };
+
+    struct HandleTable {
+        using IdBits = Field<0, CapabilityId<CapabilityType::HandleTable> + 1>;
+
+        DEFINE_FIELD(Size,     IdBits, 10);
+        DEFINE_FIELD(Reserved, Size,    6);
+    };
+
+    struct DebugFlags {
+        using IdBits = Field<0, CapabilityId<CapabilityType::DebugFlags> + 1>;
+
+        DEFINE_FIELD(AllowDebug, IdBits,      1, bool);
+        DEFINE_FIELD(ForceDebug, AllowDebug,  1, bool);
+        DEFINE_FIELD(Reserved,   ForceDebug, 13);
+    };
+
+    #undef DEFINE_FIELD
+
+    struct InterruptFlagSetTag{};
+    using InterruptFlagSet = util::BitFlagSet<InterruptIdCount, InterruptFlagSetTag>;
+
+    struct SystemCallFlagSetTag{};
+    using SystemCallFlagSet = util::BitFlagSet<SystemCallCount, SystemCallFlagSetTag>;
+
+    class MappedRange {
+        private:
+            u64 m_address;
+            size_t m_size;
+            bool m_read_only;
+        public:
+            constexpr MappedRange() : m_address(), m_size(), m_read_only() { /* ... */ }
+            constexpr MappedRange(u64 a, size_t s, bool ro) : m_address(a), m_size(s), m_read_only(ro) { /* ... */ }
+
+            constexpr u64 GetAddress()  const { return m_address; }
+            constexpr size_t GetSize()  const { return m_size; }
+            constexpr bool IsReadOnly() const { return m_read_only; }
+    };
+
+    /* Mapped ranges, kept sorted by address in a flat list. */
+    /* Real capability blocks map only a handful of ranges, so these live inline and only spill to the heap past that. */
+    class MappedRangeHolder {
+        NON_COPYABLE(MappedRangeHolder);
+        NON_MOVEABLE(MappedRangeHolder);
+        public:
+            static constexpr size_t InlineRangeCount = 0x20;
+        private:
+            std::array<MappedRange, InlineRangeCount> m_inline_ranges;
+            std::vector<MappedRange> m_overflow_ranges;
+            size_t m_count;
+        public:
+            MappedRangeHolder() : m_inline_ranges(), m_overflow_ranges(), m_count(0) { /* ... */ }
+
+            ~MappedRangeHolder() {
+                if (const size_t capacity = m_overflow_ranges.capacity(); capacity != 0) {
+                    NoteFree(capacity * sizeof(MappedRange), AllocationSite_TreeNode);
+                }
+            }
+
+            void Insert(u64 a, size_t s, bool ro);
+
+            size_t size() const { return m_count; }
+            bool empty() const { return m_count == 0; }
+
+            const MappedRange *begin() const { return this->GetRanges(); }
+            const MappedRange *end() const { return this->GetRanges() + m_count; }
+        private:
+            const MappedRange *GetRanges() const { return m_overflow_ranges.empty() ? m_inline_ranges.data() : m_overflow_ranges.data(); }
+    };
+
+    class AccessControlEntry {
+        private:
+            const u8 *m_entry;
+            size_t m_capacity;
+        public:
+            AccessControlEntry(const void *e, size_t c) : m_entry(static_cast<const u8 *>(e)), m_capacity(c) {
+                /* ... */
+            }
+
+            AccessControlEntry GetNextEntry() const {
+                return AccessControlEntry(m_entry + this->GetSize(), m_capacity - this->GetSize());
+            }
+
+            size_t GetSize() const {
+                return this->GetServiceNameSize() + 1;
+            }
+
+            size_t GetServiceNameSize() const {
+                return (m_entry[0] & 7) + 1;
+            }
+
+            sm::ServiceName GetServiceName() const {
+                return sm::ServiceName::Encode(reinterpret_cast<const char *>(m_entry + 1), this->GetServiceNameSize());
+            }
+
+            bool IsHost() const {
+                return (m_entry[0] & 0x80) != 0;
+            }
+
+            bool IsWildcard() const {
+                return m_entry[this->GetServiceNameSize()] == '*';
+            }
+
+            bool IsValid() const {
+                /* Validate that we can access data. */
+                if (m_entry == nullptr || m_capacity == 0) {
+                    return false;
+                }
+
+                /* Validate that the size is correct. */
+                return this->GetSize() <= m_capacity;
+            }
+
+            void GetName(char *dst) {
+                std::memcpy(dst, m_entry + 1, this->GetServiceNameSize());
+                dst[this->GetServiceNameSize()] = 0;
+            }
+    };
+
+    struct ParsedKernelCapabilities {
+        util::optional<util::BitPack32> core_prio = util::nullopt;
+        SystemCallFlagSet system_calls{};
+        InterruptFlagSet interrupts{};
+        util::optional<util::BitPack32> program_type   = util::nullopt;
+        util::optional<util::BitPack32> kernel_version = util::nullopt;
+        util::optional<util::BitPack32> handle_table   = util::nullopt;
+        util::optional<util::BitPack32> debug_flags    = util::nullopt;
+        util::optional<util::BitPack32> mapped_regions = util::nullopt;
+
+        MappedRangeHolder mapped_static_ranges{};
+        MappedRangeHolder mapped_io_ranges{};
+        util::optional<util::BitPack32> unknown_caps[0x40]{};
+        size_t num_unknown_caps = 0;
+        bool unknown_caps_truncated = false;
+    };
+
+    struct ServiceAccessEntry {
+        sm::ServiceName name;
+        char display_name[sizeof(sm::ServiceName) + 1];
+        u8 name_size;
+        bool is_host;
+        bool is_wildcard;
+
+        /* For aci entries, whether the acid permits the entry. */
+        bool is_allowed;
+    };
+
+    /* The acid's service restrictions, compiled so that checking an entry costs a hash lookup or a walk of at most one name. */
+    /* Matches sm's own validation, including that a wildcard entry is allowed by any plain restriction of the same kind. */
+    class ServiceAccessRestriction {
+        private:
+            struct TrieNode {
+                std::vector<std::pair<char, u32>> children;
+                bool is_terminal;
+            };
+
+            struct Restrictions {
+                std::unordered_set<u64> names;
+                std::unordered_set<u64> wildcard_names;
+                std::vector<TrieNode> wildcard_prefixes;
+            };
+        private:
+            Restrictions m_restrictions[2];
+        public:
+            explicit ServiceAccessRestriction(const std::vector<ServiceAccessEntry> &entries);
+
+            bool IsAllowed(const ServiceAccessEntry &entry) const;
+    };
+
+
+    const char *GetSystemCallName(size_t i);
+
+    void DecodeServiceAccessControl(std::vector<ServiceAccessEntry> *out, const void *data, size_t size);
+
+    void ParseKernelCapabilities(ParsedKernelCapabilities *out, const util::BitPack32 *caps, size_t num_caps);
+
+}
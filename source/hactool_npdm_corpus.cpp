@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_npdm_corpus.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr u32 CorpusMagic   = util::FourCC<'N','P','D','C'>::Code;
+        constexpr u32 CorpusVersion = 1;
+
+        constexpr size_t BitsPerWord = BITSIZEOF(u64);
+
+        void SetBit(u64 *words, size_t index) {
+            words[index / BitsPerWord] |= UINT64_C(1) << (index % BitsPerWord);
+        }
+
+        /* Keeps the bits past the last program clear, so that negation can't invent programs. */
+        void ClearUnusedBits(NpdmCorpus::Bitset &bits, size_t count) {
+            if (const size_t used = count % BitsPerWord; used != 0 && !bits.empty()) {
+                bits.back() &= (UINT64_C(1) << used) - 1;
+            }
+        }
+
+        /* Either side may end in '*', which matches any name with that prefix. */
+        bool IsServiceMatch(const std::string &entry, const char *query) {
+            const size_t query_len    = std::strlen(query);
+            const bool entry_wildcard = !entry.empty() && entry.back() == '*';
+            const bool query_wildcard = query_len > 0 && query[query_len - 1] == '*';
+
+            const std::string_view e(entry.data(), entry.size() - (entry_wildcard ? 1 : 0));
+            const std::string_view q(query, query_len - (query_wildcard ? 1 : 0));
+
+            if (!entry_wildcard && !query_wildcard) {
+                return e == q;
+            } else if (entry_wildcard && !query_wildcard) {
+                return q.starts_with(e);
+            } else if (!entry_wildcard && query_wildcard) {
+                return e.starts_with(q);
+            } else {
+                return e.starts_with(q) || q.starts_with(e);
+            }
+        }
+
+        bool ParseIndex(size_t *out, const char *str) {
+            char *end = nullptr;
+            const auto value = std::strtoull(str, std::addressof(end), 0);
+            if (end == str || end == nullptr || *end != '\x00') {
+                return false;
+            }
+
+            *out = static_cast<size_t>(value);
+            return true;
+        }
+
+        class CorpusWriter {
+            private:
+                std::vector<u8> &m_data;
+            public:
+                explicit CorpusWriter(std::vector<u8> &data) : m_data(data) { /* ... */ }
+
+                template<typename T> requires std::is_trivially_copyable<T>::value
+                void Write(const T &value) {
+                    const u8 *p = reinterpret_cast<const u8 *>(std::addressof(value));
+                    m_data.insert(m_data.end(), p, p + sizeof(value));
+                }
+
+                template<typename T>
+                void WriteArray(const std::vector<T> &values) {
+                    this->Write<u64>(values.size());
+
+                    const u8 *p = reinterpret_cast<const u8 *>(values.data());
+                    m_data.insert(m_data.end(), p, p + values.size() * sizeof(T));
+                }
+
+                void WriteString(const std::string &str) {
+                    this->Write<u32>(str.size());
+                    m_data.insert(m_data.end(), str.begin(), str.end());
+                }
+        };
+
+        class CorpusReader {
+            private:
+                const u8 *m_data;
+                size_t m_size;
+                size_t m_offset;
+            public:
+                CorpusReader(const void *data, size_t size) : m_data(static_cast<const u8 *>(data)), m_size(size), m_offset(0) { /* ... */ }
+
+                bool IsEnd() const { return m_offset == m_size; }
+
+                template<typename T> requires std::is_trivially_copyable<T>::value
+                bool Read(T *out) {
+                    if (m_size - m_offset < sizeof(T)) {
+                        return false;
+                    }
+
+                    std::memcpy(out, m_data + m_offset, sizeof(T));
+                    m_offset += sizeof(T);
+                    return true;
+                }
+
+                template<typename T>
+                bool ReadArray(std::vector<T> *out) {
+                    u64 count;
+                    if (!this->Read(std::addressof(count)) || count > (m_size - m_offset) / sizeof(T)) {
+                        return false;
+                    }
+
+                    out->resize(count);
+                    std::memcpy(out->data(), m_data + m_offset, count * sizeof(T));
+                    m_offset += count * sizeof(T);
+                    return true;
+                }
+
+                bool ReadString(std::string *out) {
+                    u32 size;
+                    if (!this->Read(std::addressof(size)) || size > m_size - m_offset) {
+                        return false;
+                    }
+
+                    out->assign(reinterpret_cast<const char *>(m_data + m_offset), size);
+                    m_offset += size;
+                    return true;
+                }
+        };
+
+    }
+
+    void NpdmCorpus::Build(std::vector<Row> rows) {
+        m_programs.clear();
+        m_services.clear();
+        m_word_count = util::DivideUp(rows.size(), BitsPerWord);
+
+        m_system_call_columns.assign(npdm::SystemCallCount * m_word_count, 0);
+        m_fs_permission_columns.assign(FsPermissionCount * m_word_count, 0);
+
+        std::map<std::pair<std::string, bool>, size_t> service_indices;
+        std::vector<std::pair<size_t, size_t>> service_bits;
+
+        struct IoEntry {
+            u64 address;
+            u64 size;
+            u32 program;
+        };
+        std::vector<IoEntry> io_entries;
+
+        for (size_t row_index = 0; row_index < rows.size(); ++row_index) {
+            auto &row = rows[row_index];
+
+            for (size_t i = 0; i < npdm::SystemCallCount; ++i) {
+                if (row.system_calls[i]) {
+                    SetBit(this->GetColumn(m_system_call_columns, i), row_index);
+                }
+            }
+
+            for (size_t i = 0; i < FsPermissionCount; ++i) {
+                if (row.fs_permissions & (UINT64_C(1) << i)) {
+                    SetBit(this->GetColumn(m_fs_permission_columns, i), row_index);
+                }
+            }
+
+            for (auto &service : row.services) {
+                const auto [it, inserted] = service_indices.emplace(std::make_pair(service.name, service.is_host), m_services.size());
+                if (inserted) {
+                    m_services.push_back(std::move(service));
+                }
+                service_bits.emplace_back(it->second, row_index);
+            }
+
+            for (const auto &range : row.io_ranges) {
+                io_entries.push_back(IoEntry{ range.address, range.size, static_cast<u32>(row_index) });
+            }
+
+            m_programs.push_back(std::move(row.program));
+        }
+
+        /* Services are only known once every row is seen, so their columns are filled last. */
+        m_service_columns.assign(m_services.size() * m_word_count, 0);
+        for (const auto &[service_index, row_index] : service_bits) {
+            SetBit(this->GetColumn(m_service_columns, service_index), row_index);
+        }
+
+        std::sort(io_entries.begin(), io_entries.end(), [] (const IoEntry &lhs, const IoEntry &rhs) { return lhs.address < rhs.address; });
+
+        m_io_addresses.resize(io_entries.size());
+        m_io_sizes.resize(io_entries.size());
+        m_io_programs.resize(io_entries.size());
+        for (size_t i = 0; i < io_entries.size(); ++i) {
+            m_io_addresses[i] = io_entries[i].address;
+            m_io_sizes[i]     = io_entries[i].size;
+            m_io_programs[i]  = io_entries[i].program;
+        }
+    }
+
+    bool NpdmCorpus::Load(const void *data, size_t size) {
+        CorpusReader reader(data, size);
+
+        u32 magic, version;
+        if (!reader.Read(std::addressof(magic)) || magic != CorpusMagic || !reader.Read(std::addressof(version)) || version != CorpusVersion) {
+            return false;
+        }
+
+        u64 program_count;
+        if (!reader.Read(std::addressof(program_count)) || program_count > std::numeric_limits<u32>::max()) {
+            return false;
+        }
+
+        std::vector<Program> programs;
+        for (u64 i = 0; i < program_count; ++i) {
+            Program program;
+            if (!reader.Read(std::addressof(program.program_id)) || !reader.ReadString(std::addressof(program.name)) || !reader.ReadString(std::addressof(program.source))) {
+                return false;
+            }
+            programs.push_back(std::move(program));
+        }
+
+        u64 service_count;
+        if (!reader.Read(std::addressof(service_count))) {
+            return false;
+        }
+
+        std::vector<ServiceEntry> services;
+        for (u64 i = 0; i < service_count; ++i) {
+            ServiceEntry service;
+            u8 is_host;
+            if (!reader.ReadString(std::addressof(service.name)) || !reader.Read(std::addressof(is_host))) {
+                return false;
+            }
+            service.is_host = is_host != 0;
+            services.push_back(std::move(service));
+        }
+
+        Bitset system_call_columns, fs_permission_columns, service_columns;
+        std::vector<u64> io_addresses, io_sizes;
+        std::vector<u32> io_programs;
+        if (!reader.ReadArray(std::addressof(system_call_columns)) || !reader.ReadArray(std::addressof(fs_permission_columns)) || !reader.ReadArray(std::addressof(service_columns)) ||
+            !reader.ReadArray(std::addressof(io_addresses)) || !reader.ReadArray(std::addressof(io_sizes)) || !reader.ReadArray(std::addressof(io_programs)) || !reader.IsEnd())
+        {
+            return false;
+        }
+
+        /* Check that the columns agree with one another. */
+        const size_t word_count = util::DivideUp(programs.size(), BitsPerWord);
+        if (system_call_columns.size() != npdm::SystemCallCount * word_count || fs_permission_columns.size() != FsPermissionCount * word_count || service_columns.size() != services.size() * word_count) {
+            return false;
+        }
+        if (io_sizes.size() != io_addresses.size() || io_programs.size() != io_addresses.size()) {
+            return false;
+        }
+        for (const auto program : io_programs) {
+            if (program >= programs.size()) {
+                return false;
+            }
+        }
+
+        m_programs              = std::move(programs);
+        m_word_count            = word_count;
+        m_system_call_columns   = std::move(system_call_columns);
+        m_fs_permission_columns = std::move(fs_permission_columns);
+        m_services              = std::move(services);
+        m_service_columns       = std::move(service_columns);
+        m_io_addresses          = std::move(io_addresses);
+        m_io_sizes              = std::move(io_sizes);
+        m_io_programs           = std::move(io_programs);
+        return true;
+    }
+
+    std::vector<u8> NpdmCorpus::Serialize() const {
+        std::vector<u8> data;
+        CorpusWriter writer(data);
+
+        writer.Write(CorpusMagic);
+        writer.Write(CorpusVersion);
+
+        writer.Write<u64>(m_programs.size());
+        for (const auto &program : m_programs) {
+            writer.Write(program.program_id);
+            writer.WriteString(program.name);
+            writer.WriteString(program.source);
+        }
+
+        writer.Write<u64>(m_services.size());
+        for (const auto &service : m_services) {
+            writer.WriteString(service.name);
+            writer.Write<u8>(service.is_host ? 1 : 0);
+        }
+
+        writer.WriteArray(m_system_call_columns);
+        writer.WriteArray(m_fs_permission_columns);
+        writer.WriteArray(m_service_columns);
+        writer.WriteArray(m_io_addresses);
+        writer.WriteArray(m_io_sizes);
+        writer.WriteArray(m_io_programs);
+
+        return data;
+    }
+
+    Result NpdmCorpus::Query(Bitset *out, const char *query) const {
+        /* Start from every program. */
+        out->assign(m_word_count, ~UINT64_C(0));
+        ClearUnusedBits(*out, m_programs.size());
+
+        /* Narrow by each term in turn. */
+        std::string terms(query);
+        for (char *save = nullptr, *term = strtok_r(terms.data(), " \t,", std::addressof(save)); term != nullptr; term = strtok_r(nullptr, " \t,", std::addressof(save))) {
+            Bitset term_bits;
+            R_TRY(this->QueryTerm(std::addressof(term_bits), term));
+
+            for (size_t i = 0; i < m_word_count; ++i) {
+                (*out)[i] &= term_bits[i];
+            }
+        }
+
+        R_SUCCEED();
+    }
+
+    /* Terms are kind:value, optionally preceded by '!' to negate them: */
+    /*   svc:<name or id>           may call the system call                          */
+    /*   fs:<name or bit>           has the filesystem permission bit                 */
+    /*   host:<name>, access:<name> may host or access the service ('*' as a prefix)  */
+    /*   service:<name>             either of the above                               */
+    /*   io:<address>[-<end>]       maps io memory overlapping the range (hex)        */
+    Result NpdmCorpus::QueryTerm(Bitset *out, const char *term) const {
+        const bool negate = term[0] == '!';
+        if (negate) {
+            ++term;
+        }
+
+        const char *separator = std::strchr(term, ':');
+        if (separator == nullptr) {
+            fprintf(stderr, "[Warning]: Npdm query term \"%s\" has no kind\n", term);
+            R_THROW(fs::ResultInvalidArgument());
+        }
+
+        const std::string_view kind(term, separator - term);
+        const char *value = separator + 1;
+
+        out->assign(m_word_count, 0);
+        auto OrColumn = [&] (const u64 *column) {
+            for (size_t i = 0; i < m_word_count; ++i) {
+                (*out)[i] |= column[i];
+            }
+        };
+
+        if (kind == "svc") {
+            size_t index;
+            if (!ParseIndex(std::addressof(index), value)) {
+                for (index = 0; index < npdm::SystemCallCount; ++index) {
+                    if (std::strcmp(npdm::GetSystemCallName(index), value) == 0) {
+                        break;
+                    }
+                }
+            }
+
+            if (index >= npdm::SystemCallCount) {
+                fprintf(stderr, "[Warning]: Unknown system call \"%s\"\n", value);
+                R_THROW(fs::ResultInvalidArgument());
+            }
+
+            OrColumn(this->GetColumn(m_system_call_columns, index));
+        } else if (kind == "fs") {
+            size_t index;
+            if (!ParseIndex(std::addressof(index), value)) {
+                for (index = 0; index < FsPermissionCount; ++index) {
+                    if (std::strcmp(fs::impl::IdString().ToString(static_cast<fssrv::impl::AccessControlBits::Bits>(UINT64_C(1) << index)), value) == 0) {
+                        break;
+                    }
+                }
+            }
+
+            if (index >= FsPermissionCount) {
+                fprintf(stderr, "[Warning]: Unknown filesystem permission \"%s\"\n", value);
+                R_THROW(fs::ResultInvalidArgument());
+            }
+
+            OrColumn(this->GetColumn(m_fs_permission_columns, index));
+        } else if (kind == "host" || kind == "access" || kind == "service") {
+            for (size_t i = 0; i < m_services.size(); ++i) {
+                const auto &service = m_services[i];
+                if ((kind == "host" && !service.is_host) || (kind == "access" && service.is_host)) {
+                    continue;
+                }
+
+                if (IsServiceMatch(service.name, value)) {
+                    OrColumn(this->GetColumn(m_service_columns, i));
+                }
+            }
+        } else if (kind == "io") {
+            char *end = nullptr;
+            const u64 start = std::strtoull(value, std::addressof(end), 16);
+            u64 last = start;
+            if (end != nullptr && *end == '-') {
+                last = std::strtoull(end + 1, std::addressof(end), 16);
+            }
+
+            if (end == value || end == nullptr || *end != '\x00' || last < start) {
+                fprintf(stderr, "[Warning]: Invalid io range \"%s\"\n", value);
+                R_THROW(fs::ResultInvalidArgument());
+            }
+
+            /* Ranges are sorted by address, so stop at the first which begins past the query. */
+            for (size_t i = 0; i < m_io_addresses.size() && m_io_addresses[i] <= last; ++i) {
+                if (start < m_io_addresses[i] + m_io_sizes[i]) {
+                    SetBit(out->data(), m_io_programs[i]);
+                }
+            }
+        } else {
+            fprintf(stderr, "[Warning]: Unknown npdm query kind \"%.*s\"\n", static_cast<int>(kind.size()), kind.data());
+            R_THROW(fs::ResultInvalidArgument());
+        }
+
+        if (negate) {
+            for (auto &word : *out) {
+                word = ~word;
+            }
+            ClearUnusedBits(*out, m_programs.size());
+        }
+
+        R_SUCCEED();
+    }
+
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+#include "hactool_npdm_capabilities.hpp"
+
+namespace ams::hactool {
+
+    /* The capabilities of many programs, kept as one bitset over programs per capability. */
+    /* A query is then a handful of word-wise ands over the columns it names. */
+    class NpdmCorpus {
+        NON_COPYABLE(NpdmCorpus);
+        NON_MOVEABLE(NpdmCorpus);
+        public:
+            using Bitset = std::vector<u64>;
+
+            static constexpr size_t FsPermissionCount = BITSIZEOF(u64);
+
+            struct Program {
+                u64 program_id;
+                std::string name;
+                std::string source;
+            };
+
+            struct ServiceEntry {
+                std::string name;
+                bool is_host;
+            };
+
+            struct IoRange {
+                u64 address;
+                u64 size;
+            };
+
+            /* Everything decoded from one npdm, before it's folded into the columns. */
+            struct Row {
+                Program program;
+                npdm::SystemCallFlagSet system_calls;
+                u64 fs_permissions;
+                std::vector<ServiceEntry> services;
+                std::vector<IoRange> io_ranges;
+            };
+        private:
+            std::vector<Program> m_programs;
+            size_t m_word_count;
+
+            Bitset m_system_call_columns;
+            Bitset m_fs_permission_columns;
+
+            /* Service names are interned, with one column per distinct name and role. */
+            std::vector<ServiceEntry> m_services;
+            Bitset m_service_columns;
+
+            /* Io ranges, sorted by address. */
+            std::vector<u64> m_io_addresses;
+            std::vector<u64> m_io_sizes;
+            std::vector<u32> m_io_programs;
+        public:
+            NpdmCorpus() : m_programs(), m_word_count(0), m_system_call_columns(), m_fs_permission_columns(), m_services(), m_service_columns(), m_io_addresses(), m_io_sizes(), m_io_programs() { /* ... */ }
+
+            void Build(std::vector<Row> rows);
+
+            bool Load(const void *data, size_t size);
+            std::vector<u8> Serialize() const;
+
+            /* Terms are separated by spaces and all must hold; see the implementation for the syntax. */
+            Result Query(Bitset *out, const char *query) const;
+
+            size_t GetProgramCount() const { return m_programs.size(); }
+            size_t GetServiceCount() const { return m_services.size(); }
+            size_t GetIoRangeCount() const { return m_io_addresses.size(); }
+
+            const Program &GetProgram(size_t index) const { return m_programs[index]; }
+        private:
+            u64 *GetColumn(Bitset &columns, size_t index) { return columns.data() + index * m_word_count; }
+            const u64 *GetColumn(const Bitset &columns, size_t index) const { return columns.data() + index * m_word_count; }
+
+            Result QueryTerm(Bitset *out, const char *term) const;
+    };
+
+}
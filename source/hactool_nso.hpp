@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* See ldr::NsoHeader, from which this is sourced. */
+    struct NsoHeader {
+        static constexpr u32 Magic = util::FourCC<'N','S','O','0'>::Code;
+
+        enum Segment : size_t {
+            Segment_Text = 0,
+            Segment_Ro   = 1,
+            Segment_Rw   = 2,
+            Segment_Count,
+        };
+
+        enum Flag : u32 {
+            Flag_CompressedText = (1 << 0),
+            Flag_CompressedRo   = (1 << 1),
+            Flag_CompressedRw   = (1 << 2),
+            Flag_CheckHashText  = (1 << 3),
+            Flag_CheckHashRo    = (1 << 4),
+            Flag_CheckHashRw    = (1 << 5),
+        };
+
+        /* The last word of each segment is the module name offset, module name size and bss size, respectively. */
+        struct SegmentInfo {
+            u32 file_offset;
+            u32 dst_offset;
+            u32 size;
+            u32 extra;
+        };
+
+        struct SegmentRange {
+            u32 offset;
+            u32 size;
+        };
+
+        u32 magic;
+        u32 version;
+        u32 reserved_08;
+        u32 flags;
+        union {
+            struct {
+                u32 text_file_offset;
+                u32 text_dst_offset;
+                u32 text_size;
+                u32 module_name_offset;
+                u32 ro_file_offset;
+                u32 ro_dst_offset;
+                u32 ro_size;
+                u32 module_name_size;
+                u32 rw_file_offset;
+                u32 rw_dst_offset;
+                u32 rw_size;
+                u32 bss_size;
+            };
+            SegmentInfo segments[Segment_Count];
+        };
+        u8 module_id[0x20];
+        u32 file_sizes[Segment_Count];
+        u8 reserved_6C[0x1C];
+        SegmentRange api_info;
+        SegmentRange dynstr;
+        SegmentRange dynsym;
+        u8 segment_hashes[Segment_Count][crypto::Sha256Generator::HashSize];
+
+        static constexpr u32 GetCompressedFlag(size_t segment) { return Flag_CompressedText << segment; }
+        static constexpr u32 GetCheckHashFlag(size_t segment) { return Flag_CheckHashText << segment; }
+    };
+    static_assert(util::is_pod<NsoHeader>::value);
+    static_assert(sizeof(NsoHeader) == 0x100);
+
+}
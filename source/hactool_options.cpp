@@ -117,12 +117,18 @@ namespace ams::hactool {
             MakeOptionHandler("intype", 't', [] (Options &options, const char *arg) {
                 if (std::strcmp(arg, "npdm") == 0) {
                     options.file_type = FileType::Npdm;
+                } else if (std::strcmp(arg, "npdmcorpus") == 0) {
+                    options.file_type = FileType::NpdmCorpus;
+                } else if (std::strcmp(arg, "nso") == 0 || std::strcmp(arg, "nso0") == 0) {
+                    options.file_type = FileType::Nso;
                 } else if (std::strcmp(arg, "nca") == 0) {
                     options.file_type = FileType::Nca;
                 } else if (std::strcmp(arg, "xci") == 0) {
                     options.file_type = FileType::Xci;
                 } else if (std::strcmp(arg, "appfs") == 0) {
                     options.file_type = FileType::AppFs;
+                } else if (std::strcmp(arg, "sysupdate") == 0 || std::strcmp(arg, "firmware") == 0) {
+                    options.file_type = FileType::SystemUpdate;
                 } else if (std::strcmp(arg, "pfs") == 0 || std::strcmp(arg, "pfs0") == 0 || std::strcmp(arg, "nsp") == 0) {
                     options.file_type = FileType::Pfs;
                 } else {
@@ -152,28 +158,78 @@ namespace ams::hactool {
             MakeOptionHandler("exefs", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.exefs_out_file_path), arg); }),
             MakeOptionHandler("romfs", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.romfs_out_file_path), arg); }),
             MakeOptionHandler("exefsdir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.exefs_out_dir_path), arg); }),
+            MakeOptionHandler("nsodir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.nso_out_dir_path), arg); }),
+            MakeOptionHandler("uncompressed", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.uncompressed_nso_path), arg); }),
+            MakeOptionHandler("nsoimage", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.nso_image_path), arg); }),
             MakeOptionHandler("romfsdir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.romfs_out_dir_path), arg); }),
             MakeOptionHandler("outdir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.default_out_dir_path), arg); }),
             MakeOptionHandler("outfile", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.default_out_file_path), arg); }),
             MakeOptionHandler("plaintext", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.plaintext_out_path), arg); }),
             MakeOptionHandler("ciphertext", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.ciphertext_out_path), arg); }),
             MakeOptionHandler("json", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.json_out_file_path), arg); }),
+            MakeOptionHandler("npdmcorpus", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.npdm_corpus_out_path), arg); }),
+            MakeOptionHandler("npdmquery", [] (Options &options, const char *arg) { options.npdm_query = arg; }),
+            MakeOptionHandler("sysupdatedir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.system_update_out_dir_path), arg); }),
+            MakeOptionHandler("systitles", [] (Options &options, const char *arg) { options.system_title_ids = arg; }),
+            MakeOptionHandler("trace", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.trace_out_path), arg); }),
+            MakeOptionHandler("memstats", [] (Options &options) { options.print_memory_stats = true; }),
+            MakeOptionHandler("memlimit", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.memory_limit_mb), arg); }),
+            MakeOptionHandler("noprogress", [] (Options &options) { options.disable_progress = true; }),
+            MakeOptionHandler("progressfd", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.progress_fd), arg); }),
             MakeOptionHandler("rootdir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.root_partition_out_dir), arg); }),
             MakeOptionHandler("securedir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.secure_partition_out_dir), arg); }),
             MakeOptionHandler("normaldir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.normal_partition_out_dir), arg); }),
             MakeOptionHandler("updatedir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.update_partition_out_dir), arg); }),
             MakeOptionHandler("logodir", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.logo_partition_out_dir), arg); }),
+            MakeOptionHandler("nsz", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.nsz_out_path), arg); }),
+            MakeOptionHandler("nsp", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.nsp_out_path), arg); }),
+            MakeOptionHandler("trim", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.xci_trim_out_path), arg); }),
+            MakeOptionHandler("untrim", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.xci_untrim_out_path), arg); }),
+            MakeOptionHandler("hashdat", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.hash_dat_path), arg); }),
+            MakeOptionHandler("nszlevel", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.nsz_compression_level), arg); }),
             MakeOptionHandler("basenca", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.base_nca_path), arg); }),
             MakeOptionHandler("basexci", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.base_xci_path), arg); }),
             MakeOptionHandler("basepfs", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.base_pfs_path), arg); }),
             MakeOptionHandler("basensp", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.base_pfs_path), arg); }),
             MakeOptionHandler("baseappfs", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.base_appfs_path), arg); }),
+            MakeOptionHandler("baselib", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.base_library_dir), arg); }),
             MakeOptionHandler("listromfs", [] (Options &options) { options.list_romfs = true; }),
+            MakeOptionHandler("hashes", [] (Options &options) { options.print_hashes = true; }),
+            MakeOptionHandler("listnso", [] (Options &options) { options.print_nsos = true; }),
             MakeOptionHandler("listupdate", [] (Options &options) { options.list_update = true; }),
+            MakeOptionHandler("cryptobench", [] (Options &options) { options.crypto_benchmark = true; }),
             MakeOptionHandler("appindex", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.preferred_app_index), arg); }),
             MakeOptionHandler("programindex", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.preferred_program_index), arg); }),
             MakeOptionHandler("appversion", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.preferred_version), arg); }),
             MakeOptionHandler("updatedsince", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.updated_generation), arg); }),
+            #if defined(HACTOOL_BUILD_FIXTURE_GENERATOR)
+            MakeOptionHandler("fixtureout", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.fixture_out_dir_path), arg); }),
+            MakeOptionHandler("fixturefiles", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.fixture_file_count), arg); }),
+            MakeOptionHandler("fixtureminsize", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.fixture_min_file_size), arg); }),
+            MakeOptionHandler("fixturemaxsize", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.fixture_max_file_size), arg); }),
+            MakeOptionHandler("fixturesizes", [] (Options &options, const char *arg) {
+                if (std::strcmp(arg, "fixed") == 0) {
+                    options.fixture_size_distribution = FixtureSizeDistribution::Fixed;
+                } else if (std::strcmp(arg, "uniform") == 0) {
+                    options.fixture_size_distribution = FixtureSizeDistribution::Uniform;
+                } else if (std::strcmp(arg, "loguniform") == 0) {
+                    options.fixture_size_distribution = FixtureSizeDistribution::LogUniform;
+                } else {
+                    return false;
+                }
+
+                return true;
+            }),
+            MakeOptionHandler("fixturegenerations", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.fixture_generation_count), arg); }),
+            MakeOptionHandler("fixtureseed", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.fixture_seed), arg); }),
+            MakeOptionHandler("fixturecompression", [] (Options &options) { options.fixture_compression = true; }),
+            MakeOptionHandler("fixturesparse", [] (Options &options) { options.fixture_sparse = true; }),
+            #endif
+            #if defined(HACTOOL_BUILD_BENCHMARK)
+            MakeOptionHandler("bench", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.bench_fixture_dir_path), arg); }),
+            MakeOptionHandler("benchjson", [] (Options &options, const char *arg) { return CreateFilePath(std::addressof(options.bench_json_out_path), arg); }),
+            MakeOptionHandler("benchiterations", [] (Options &options, const char *arg) { return ParseIntegerArgument(std::addressof(options.bench_iterations), arg); }),
+            #endif
         };
 
     }
@@ -369,8 +425,14 @@ namespace ams::hactool {
             options.consolekey_path = GetKeysFilePath("console.keys");
         }
 
-        /* If we have an input file, we're valid. */
-        options.valid = options.in_file_path != nullptr;
+        /* If we have an input file (or are only benchmarking), we're valid. */
+        options.valid = options.in_file_path != nullptr || options.crypto_benchmark;
+        #if defined(HACTOOL_BUILD_FIXTURE_GENERATOR)
+        options.valid |= options.fixture_out_dir_path != nullptr;
+        #endif
+        #if defined(HACTOOL_BUILD_BENCHMARK)
+        options.valid |= options.bench_fixture_dir_path != nullptr;
+        #endif
         return options;
     }
 }
\ No newline at end of file
@@ -30,9 +30,20 @@ namespace ams::hactool {
         Kip,
         Ini,
         Npdm,
+        Nso,
+        NpdmCorpus,
         AppFs,
+        SystemUpdate,
     };
 
+    #if defined(HACTOOL_BUILD_FIXTURE_GENERATOR)
+    enum class FixtureSizeDistribution {
+        Fixed,
+        Uniform,
+        LogUniform,
+    };
+    #endif
+
     struct Options {
         const char *in_file_path = nullptr;
         FileType file_type = FileType::Nca;
@@ -40,6 +51,7 @@ namespace ams::hactool {
         const char *base_xci_path = nullptr;
         const char *base_pfs_path = nullptr;
         const char *base_appfs_path = nullptr;
+        const char *base_library_dir = nullptr;
         bool valid = false;
         bool raw = false;
         bool verify = false;
@@ -59,6 +71,9 @@ namespace ams::hactool {
         const char *header_out_path = nullptr;
         const char *exefs_out_file_path = nullptr;
         const char *exefs_out_dir_path = nullptr;
+        const char *nso_out_dir_path = nullptr;
+        const char *uncompressed_nso_path = nullptr;
+        const char *nso_image_path = nullptr;
         const char *romfs_out_file_path = nullptr;
         const char *romfs_out_dir_path = nullptr;
         const char *ini_out_dir_path = nullptr;
@@ -68,13 +83,47 @@ namespace ams::hactool {
         const char *ciphertext_out_path = nullptr;
         const char *uncompressed_out_path = nullptr;
         const char *json_out_file_path = nullptr;
+        const char *npdm_corpus_out_path = nullptr;
+        const char *npdm_query = nullptr;
+        const char *system_update_out_dir_path = nullptr;
+        const char *system_title_ids = nullptr;
+        const char *trace_out_path = nullptr;
+        bool print_memory_stats = false;
+        int memory_limit_mb = 0;
+        bool disable_progress = false;
+        int progress_fd = -1;
         const char *root_partition_out_dir = nullptr;
         const char *update_partition_out_dir = nullptr;
         const char *normal_partition_out_dir = nullptr;
         const char *logo_partition_out_dir = nullptr;
         const char *secure_partition_out_dir = nullptr;
+        const char *nsz_out_path = nullptr;
+        int nsz_compression_level = 18;
+        const char *nsp_out_path = nullptr;
+        const char *xci_trim_out_path = nullptr;
+        const char *xci_untrim_out_path = nullptr;
+        const char *hash_dat_path = nullptr;
         bool list_romfs = false;
+        bool print_hashes = false;
+        bool print_nsos = false;
         bool list_update = false;
+        bool crypto_benchmark = false;
+        #if defined(HACTOOL_BUILD_FIXTURE_GENERATOR)
+        const char *fixture_out_dir_path = nullptr;
+        int fixture_file_count = 64;
+        int fixture_min_file_size = 4_KB;
+        int fixture_max_file_size = 1_MB;
+        FixtureSizeDistribution fixture_size_distribution = FixtureSizeDistribution::LogUniform;
+        int fixture_generation_count = 1;
+        int fixture_seed = 0;
+        bool fixture_compression = false;
+        bool fixture_sparse = false;
+        #endif
+        #if defined(HACTOOL_BUILD_BENCHMARK)
+        const char *bench_fixture_dir_path = nullptr;
+        const char *bench_json_out_path = nullptr;
+        int bench_iterations = 10;
+        #endif
         /* TODO: More things. */
     };
 
@@ -0,0 +1,816 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_output_writer.hpp"
+#include "hactool_memory_accounting.hpp"
+#include "hactool_memory_utils.hpp"
+
+#if defined(ATMOSPHERE_OS_LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+namespace ams::hactool {
+
+    namespace {
+
+        /* Splits a normalized path into its parent directory (without trailing separator) and its final component. */
+        util::string_view GetParentPath(const char *path, const char **out_name) {
+            const char *sep = std::strrchr(path, '/');
+            if (sep == nullptr) {
+                *out_name = path;
+                return util::string_view();
+            }
+
+            *out_name = sep + 1;
+            return util::string_view(path, sep - path);
+        }
+
+        /* Generic writer, which goes through the fs library. */
+        class FileSystemOutputWriter final : public OutputWriter {
+            private:
+                fssystem::SubDirectoryFileSystem m_fs;
+                void *m_buffer;
+                std::vector<std::unique_ptr<fs::fsa::IFile>> m_files;
+                std::unordered_set<std::string> m_fresh_directories;
+            public:
+                explicit FileSystemOutputWriter(std::shared_ptr<fs::fsa::IFileSystem> &fs) : m_fs(fs), m_buffer(nullptr), m_files(), m_fresh_directories() { /* ... */ }
+
+                virtual ~FileSystemOutputWriter() {
+                    if (m_buffer != nullptr) {
+                        FreeTracked(m_buffer);
+                    }
+                }
+
+                Result Initialize(const fs::Path &root_path, bool root_created) {
+                    /* Initialize our subdirectory filesystem. */
+                    R_TRY(m_fs.Initialize(root_path));
+
+                    /* Nothing can exist yet in a root we created ourselves. */
+                    if (root_created) {
+                        m_fresh_directories.emplace();
+                    }
+
+                    /* Allocate our buffer. All writes are synchronous, so one is enough. */
+                    m_buffer = AllocateTracked(BufferSize, AllocationSite_OutputBuffer);
+                    R_UNLESS(m_buffer != nullptr, fs::ResultAllocationMemoryFailed());
+
+                    R_SUCCEED();
+                }
+
+                virtual Result CreateDirectory(const char *path) override {
+                    fs::Path fs_path;
+                    R_TRY(fs_path.SetShallowBuffer(path));
+
+                    R_TRY_CATCH(m_fs.CreateDirectory(fs_path)) {
+                        R_CATCH(fs::ResultPathAlreadyExists) { R_SUCCEED(); }
+                    } R_END_TRY_CATCH;
+
+                    /* Remember that the directory is empty, so that files created in it needn't be deleted first. */
+                    m_fresh_directories.emplace(path);
+                    R_SUCCEED();
+                }
+
+                virtual void *AcquireBuffer() override {
+                    return m_buffer;
+                }
+
+                virtual void ReleaseBuffer(void *buffer) override {
+                    AMS_ASSERT(buffer == m_buffer);
+                    AMS_UNUSED(buffer);
+                }
+
+                virtual Result WriteFile(const char *path, void *buffer, const void *data, size_t size) override {
+                    AMS_UNUSED(buffer);
+
+                    std::unique_ptr<fs::fsa::IFile> file;
+                    R_TRY(this->CreateAndOpenFile(std::addressof(file), path, size));
+
+                    R_RETURN(file->Write(0, data, size, fs::WriteOption::None));
+                }
+
+                virtual Result OpenFile(FileHandle *out, const char *path, s64 size) override {
+                    std::unique_ptr<fs::fsa::IFile> file;
+                    R_TRY(this->CreateAndOpenFile(std::addressof(file), path, size));
+
+                    /* Find a free handle. */
+                    size_t index;
+                    for (index = 0; index < m_files.size(); ++index) {
+                        if (m_files[index] == nullptr) {
+                            break;
+                        }
+                    }
+                    if (index == m_files.size()) {
+                        m_files.emplace_back();
+                    }
+
+                    m_files[index] = std::move(file);
+                    *out = static_cast<FileHandle>(index);
+                    R_SUCCEED();
+                }
+
+                virtual Result Write(FileHandle handle, s64 offset, void *buffer, const void *data, size_t size) override {
+                    AMS_UNUSED(buffer);
+                    AMS_ASSERT(0 <= handle && static_cast<size_t>(handle) < m_files.size());
+
+                    R_RETURN(m_files[handle]->Write(offset, data, size, fs::WriteOption::None));
+                }
+
+                virtual Result CloseFile(FileHandle handle) override {
+                    AMS_ASSERT(0 <= handle && static_cast<size_t>(handle) < m_files.size());
+
+                    m_files[handle].reset();
+                    R_SUCCEED();
+                }
+
+                virtual Result Finalize() override {
+                    m_files.clear();
+                    R_SUCCEED();
+                }
+            private:
+                Result CreateAndOpenFile(std::unique_ptr<fs::fsa::IFile> *out, const char *path, s64 size) {
+                    fs::Path fs_path;
+                    R_TRY(fs_path.SetShallowBuffer(path));
+
+                    /* Delete a file, if one could already exist. */
+                    const char *name;
+                    if (const auto parent = GetParentPath(path, std::addressof(name)); m_fresh_directories.find(std::string(parent.data(), parent.length())) == m_fresh_directories.end()) {
+                        m_fs.DeleteFile(fs_path);
+                    }
+
+                    /* Create and open the file. */
+                    R_TRY(m_fs.CreateFile(fs_path, size));
+                    R_RETURN(m_fs.OpenFile(out, fs_path, fs::OpenMode_Write));
+                }
+        };
+
+        #if defined(ATMOSPHERE_OS_LINUX) && defined(IORING_FEAT_CQE_SKIP)
+
+        Result ConvertErrnoToResult(int error) {
+            switch (error) {
+                case ENOENT:
+                case ENOTDIR:
+                    R_THROW(fs::ResultPathNotFound());
+                case EEXIST:
+                    R_THROW(fs::ResultPathAlreadyExists());
+                case ENOSPC:
+                case EDQUOT:
+                case EFBIG:
+                    R_THROW(fs::ResultUsableSpaceNotEnough());
+                case EACCES:
+                case EPERM:
+                case EROFS:
+                    R_THROW(fs::ResultPermissionDenied());
+                case ENOMEM:
+                    R_THROW(fs::ResultAllocationMemoryFailed());
+                default:
+                    R_THROW(fs::ResultUnexpected());
+            }
+        }
+
+        /* Linux writer, which keeps many file creations and writes in flight through io_uring. */
+        /* Every file lives in a registered ("direct") descriptor slot, so a whole small file is a */
+        /* single linked chain of open -> fallocate -> write -> close, with no per-file syscalls. Larger files */
+        /* are written in pieces with their zero blocks left as holes, so they are never preallocated. */
+        class IoUringOutputWriter final : public OutputWriter {
+            private:
+                static constexpr u32 QueueDepth    = 256;
+                static constexpr s32 FileSlotCount = 256;
+                static constexpr s32 BufferCount   = 8;
+                static constexpr s32 NoBuffer      = 0xFF;
+
+                static constexpr size_t PathLengthMax = PATH_MAX;
+
+                /* Granularity at which zero runs of larger files are left unwritten. */
+                static constexpr size_t SparseBlockSize = 64_KB;
+
+                /* Directories beyond this many are addressed relative to the root instead of by their own handle. */
+                static constexpr size_t OpenDirectoryCountMax = 512;
+
+                static constexpr u8 SqeLinkToNext    = IOSQE_IO_LINK;
+                static constexpr u8 SqeAlwaysRunNext = IOSQE_IO_HARDLINK;
+
+                enum class Operation : u8 {
+                    Open      = 1,
+                    Fallocate = 2,
+                    Write     = 3,
+                    Close     = 4,
+                };
+
+                enum class SlotState : u8 {
+                    Free,
+                    Opening,
+                    Open,
+                    OpenFailed,
+                    Closing,
+                };
+
+                struct DirectoryState {
+                    int fd;
+                };
+
+                struct BufferState {
+                    void *data;
+                    s32 pending;
+                    bool held;
+                };
+
+                /* User data layout: [63:60] operation, [59:48] slot, [47:40] buffer, [39:0] size. */
+                static constexpr u64 MakeUserData(Operation op, s32 slot, s32 buffer, size_t size) {
+                    return (static_cast<u64>(op) << 60) | (static_cast<u64>(slot & 0xFFF) << 48) | (static_cast<u64>(buffer & 0xFF) << 40) | (static_cast<u64>(size) & ((UINT64_C(1) << 40) - 1));
+                }
+
+                static constexpr Operation GetOperation(u64 user_data) { return static_cast<Operation>(user_data >> 60); }
+                static constexpr s32 GetSlot(u64 user_data)            { return static_cast<s32>((user_data >> 48) & 0xFFF); }
+                static constexpr s32 GetBuffer(u64 user_data)          { return static_cast<s32>((user_data >> 40) & 0xFF); }
+                static constexpr size_t GetSize(u64 user_data)         { return static_cast<size_t>(user_data & ((UINT64_C(1) << 40) - 1)); }
+            private:
+                int m_root_fd;
+                int m_ring_fd;
+                void *m_ring;
+                size_t m_ring_size;
+                io_uring_sqe *m_sqes;
+                size_t m_sqes_size;
+                u32 *m_sq_head;
+                u32 *m_sq_tail;
+                u32 *m_sq_array;
+                u32 m_sq_mask;
+                u32 m_sq_entries;
+                u32 *m_cq_head;
+                u32 *m_cq_tail;
+                io_uring_cqe *m_cqes;
+                u32 m_cq_mask;
+                u32 m_cq_entries;
+                u32 m_sq_local_tail;
+                u32 m_to_submit;
+                u32 m_in_flight;
+                BufferState m_buffers[BufferCount];
+                SlotState m_slots[FileSlotCount];
+                s64 m_slot_sizes[FileSlotCount];
+                int m_slot_dir_fds[FileSlotCount];
+                u16 m_slot_name_offsets[FileSlotCount];
+                std::unique_ptr<char[]> m_slot_paths;
+                std::unordered_map<std::string, DirectoryState> m_directories;
+                size_t m_open_directory_count;
+                Result m_first_error;
+                bool m_is_ring_broken;
+            public:
+                IoUringOutputWriter() : m_root_fd(-1), m_ring_fd(-1), m_ring(MAP_FAILED), m_ring_size(0), m_sqes(static_cast<io_uring_sqe *>(MAP_FAILED)), m_sqes_size(0), m_sq_local_tail(0), m_to_submit(0), m_in_flight(0), m_buffers(), m_slots(), m_slot_sizes(), m_slot_dir_fds(), m_slot_name_offsets(), m_slot_paths(), m_directories(), m_open_directory_count(0), m_first_error(ResultSuccess()), m_is_ring_broken(false) {
+                    for (auto &slot : m_slots) {
+                        slot = SlotState::Free;
+                    }
+                }
+
+                virtual ~IoUringOutputWriter() {
+                    /* Wait for anything still in flight to land before tearing down the buffers. */
+                    if (m_ring_fd >= 0) {
+                        this->Finalize();
+                        ::close(m_ring_fd);
+                    }
+
+                    if (m_sqes != MAP_FAILED) {
+                        ::munmap(m_sqes, m_sqes_size);
+                    }
+                    if (m_ring != MAP_FAILED) {
+                        ::munmap(m_ring, m_ring_size);
+                    }
+
+                    for (auto &buffer : m_buffers) {
+                        if (buffer.data != nullptr) {
+                            FreeTracked(buffer.data);
+                        }
+                    }
+
+                    for (const auto &it : m_directories) {
+                        if (it.second.fd >= 0) {
+                            ::close(it.second.fd);
+                        }
+                    }
+
+                    if (m_root_fd >= 0) {
+                        ::close(m_root_fd);
+                    }
+                }
+
+                Result Initialize(const char *root_path) {
+                    /* Open the root directory. */
+                    m_root_fd = ::open(root_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                    R_UNLESS(m_root_fd >= 0, ConvertErrnoToResult(errno));
+
+                    /* Create the ring. We need direct descriptors, which implies a recent kernel. */
+                    io_uring_params params = {};
+                    m_ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, QueueDepth, std::addressof(params)));
+                    R_UNLESS(m_ring_fd >= 0,                                  fs::ResultUnsupportedOperation());
+                    R_UNLESS((params.features & IORING_FEAT_SINGLE_MMAP) != 0, fs::ResultUnsupportedOperation());
+                    R_UNLESS((params.features & IORING_FEAT_CQE_SKIP) != 0,    fs::ResultUnsupportedOperation());
+
+                    /* Check that the kernel supports every operation we use. */
+                    {
+                        constexpr size_t ProbeOpCount = 0x100;
+                        auto probe_storage = std::make_unique<u8[]>(sizeof(io_uring_probe) + ProbeOpCount * sizeof(io_uring_probe_op));
+                        R_UNLESS(probe_storage != nullptr, fs::ResultAllocationMemoryFailedMakeUnique());
+                        std::memset(probe_storage.get(), 0, sizeof(io_uring_probe) + ProbeOpCount * sizeof(io_uring_probe_op));
+
+                        auto *probe = reinterpret_cast<io_uring_probe *>(probe_storage.get());
+                        R_UNLESS(::syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PROBE, probe, ProbeOpCount) >= 0, fs::ResultUnsupportedOperation());
+
+                        for (const auto op : { IORING_OP_OPENAT, IORING_OP_FALLOCATE, IORING_OP_WRITE, IORING_OP_CLOSE }) {
+                            R_UNLESS(op <= probe->last_op,                                  fs::ResultUnsupportedOperation());
+                            R_UNLESS((probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0, fs::ResultUnsupportedOperation());
+                        }
+                    }
+
+                    /* Map the rings. */
+                    m_ring_size = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(u32), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+                    m_ring      = ::mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+                    R_UNLESS(m_ring != MAP_FAILED, fs::ResultAllocationMemoryFailed());
+
+                    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+                    m_sqes      = static_cast<io_uring_sqe *>(::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES));
+                    R_UNLESS(m_sqes != MAP_FAILED, fs::ResultAllocationMemoryFailed());
+
+                    u8 *ring8 = static_cast<u8 *>(m_ring);
+                    m_sq_head    = reinterpret_cast<u32 *>(ring8 + params.sq_off.head);
+                    m_sq_tail    = reinterpret_cast<u32 *>(ring8 + params.sq_off.tail);
+                    m_sq_array   = reinterpret_cast<u32 *>(ring8 + params.sq_off.array);
+                    m_sq_mask    = *reinterpret_cast<u32 *>(ring8 + params.sq_off.ring_mask);
+                    m_sq_entries = params.sq_entries;
+                    m_cq_head    = reinterpret_cast<u32 *>(ring8 + params.cq_off.head);
+                    m_cq_tail    = reinterpret_cast<u32 *>(ring8 + params.cq_off.tail);
+                    m_cqes       = reinterpret_cast<io_uring_cqe *>(ring8 + params.cq_off.cqes);
+                    m_cq_mask    = *reinterpret_cast<u32 *>(ring8 + params.cq_off.ring_mask);
+                    m_cq_entries = params.cq_entries;
+
+                    m_sq_local_tail = *m_sq_tail;
+
+                    /* Register an empty file table for our direct descriptors. */
+                    {
+                        int fds[FileSlotCount];
+                        for (auto &fd : fds) {
+                            fd = -1;
+                        }
+                        R_UNLESS(::syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_FILES, fds, FileSlotCount) >= 0, fs::ResultUnsupportedOperation());
+                    }
+
+                    /* Allocate path storage for our slots; paths are consumed when their open is submitted. */
+                    m_slot_paths = std::make_unique<char[]>(FileSlotCount * PathLengthMax);
+                    R_UNLESS(m_slot_paths != nullptr, fs::ResultAllocationMemoryFailedMakeUnique());
+
+                    /* Allocate our buffers. */
+                    for (auto &buffer : m_buffers) {
+                        buffer.data = AllocateTracked(BufferSize, AllocationSite_OutputBuffer);
+                        R_UNLESS(buffer.data != nullptr, fs::ResultAllocationMemoryFailed());
+                    }
+
+                    R_SUCCEED();
+                }
+
+                virtual Result CreateDirectory(const char *path) override {
+                    R_TRY(m_first_error);
+
+                    /* Create the directory relative to its parent, so the kernel needn't walk the whole path. */
+                    const char *name;
+                    const int parent_fd = this->GetParentDirectory(path, std::addressof(name));
+                    if (::mkdirat(parent_fd, name, 0755) != 0) {
+                        R_UNLESS(errno == EEXIST, ConvertErrnoToResult(errno));
+                    }
+
+                    /* Keep a handle to the directory, for creating its children, unless we already know it. */
+                    const auto [it, inserted] = m_directories.try_emplace(GetRelativePath(path), DirectoryState{ -1 });
+                    R_SUCCEED_IF(!inserted);
+
+                    if (m_open_directory_count < OpenDirectoryCountMax) {
+                        it->second.fd = ::openat(parent_fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+                        if (it->second.fd >= 0) {
+                            ++m_open_directory_count;
+                        }
+                    }
+
+                    R_SUCCEED();
+                }
+
+                virtual void *AcquireBuffer() override {
+                    while (true) {
+                        /* Once the ring is broken no write will land, but none will be issued either, so any buffer can be reused. */
+                        for (auto &buffer : m_buffers) {
+                            if (!buffer.held && (buffer.pending == 0 || m_is_ring_broken)) {
+                                buffer.held = true;
+                                return buffer.data;
+                            }
+                        }
+
+                        /* All buffers are busy; wait for a write to land. */
+                        const auto res = this->Enter(1);
+                        AMS_UNUSED(res);
+                    }
+                }
+
+                virtual void ReleaseBuffer(void *buffer) override {
+                    m_buffers[this->GetBufferIndex(buffer)].held = false;
+                }
+
+                virtual Result WriteFile(const char *path, void *buffer, const void *data, size_t size) override {
+                    R_TRY(m_first_error);
+
+                    /* Reserve everything up front, so that the link chain is never split across submissions. */
+                    R_TRY(this->ReserveSqes(4));
+                    s32 slot;
+                    R_TRY(this->AllocateSlot(std::addressof(slot), path));
+                    const s32 buffer_index = this->GetBufferIndex(buffer);
+
+                    /* Every byte is written, so preallocating leaves no holes behind. */
+                    this->PrepareOpen(slot, SqeLinkToNext);
+                    if (size > 0) {
+                        this->PrepareFallocate(slot, size, SqeAlwaysRunNext);
+                        this->PrepareWrite(slot, 0, buffer_index, data, size, SqeAlwaysRunNext);
+                    }
+                    this->PrepareClose(slot);
+
+                    m_slots[slot] = SlotState::Closing;
+
+                    /* Submit in batches, once a reasonable amount of work has accumulated. */
+                    if (m_to_submit >= m_sq_entries / 2) {
+                        R_TRY(this->Enter(0));
+                    }
+
+                    R_SUCCEED();
+                }
+
+                virtual Result OpenFile(FileHandle *out, const char *path, s64 size) override {
+                    R_TRY(m_first_error);
+
+                    R_TRY(this->ReserveSqes(1));
+                    s32 slot;
+                    R_TRY(this->AllocateSlot(std::addressof(slot), path));
+
+                    /* The file isn't preallocated, as that would allocate the zero blocks Write leaves as holes. */
+                    this->PrepareOpen(slot, 0);
+                    m_slot_sizes[slot] = size;
+
+                    /* Writes are submitted separately, so we must wait for the descriptor to be installed. */
+                    m_slots[slot] = SlotState::Opening;
+                    while (m_slots[slot] == SlotState::Opening) {
+                        R_TRY(this->Enter(1));
+                    }
+
+                    if (m_slots[slot] == SlotState::OpenFailed) {
+                        m_slots[slot] = SlotState::Free;
+                        R_RETURN(m_first_error);
+                    }
+
+                    *out = slot;
+                    R_SUCCEED();
+                }
+
+                virtual Result Write(FileHandle handle, s64 offset, void *buffer, const void *data, size_t size) override {
+                    R_TRY(m_first_error);
+                    AMS_ASSERT(m_slots[handle] == SlotState::Open);
+
+                    /* Skip zero blocks, but always write the one which ends the file, so that it reaches its full size. */
+                    const u8 *src = static_cast<const u8 *>(data);
+                    const bool is_last = offset + static_cast<s64>(size) >= m_slot_sizes[handle];
+                    auto IsWrittenBlock = [&] (size_t pos) {
+                        const size_t cur_size = std::min(SparseBlockSize, size - pos);
+                        return (is_last && pos + cur_size == size) || !IsZeroFilled(src + pos, cur_size);
+                    };
+
+                    /* Reserve everything up front, so the writes for one chunk are submitted together. */
+                    u32 run_count = 0;
+                    for (size_t pos = 0; pos < size; pos += SparseBlockSize) {
+                        if (IsWrittenBlock(pos) && (pos == 0 || !IsWrittenBlock(pos - SparseBlockSize))) {
+                            ++run_count;
+                        }
+                    }
+                    if (run_count == 0) {
+                        R_SUCCEED();
+                    }
+                    R_TRY(this->ReserveSqes(run_count));
+
+                    const s32 buffer_index = this->GetBufferIndex(buffer);
+                    size_t run_start = size;
+                    for (size_t pos = 0; pos < size; pos += SparseBlockSize) {
+                        if (IsWrittenBlock(pos)) {
+                            if (run_start == size) {
+                                run_start = pos;
+                            }
+                        } else if (run_start != size) {
+                            this->PrepareWrite(handle, offset + run_start, buffer_index, src + run_start, pos - run_start, 0);
+                            run_start = size;
+                        }
+                    }
+                    if (run_start != size) {
+                        this->PrepareWrite(handle, offset + run_start, buffer_index, src + run_start, size - run_start, 0);
+                    }
+
+                    if (m_to_submit >= m_sq_entries / 2) {
+                        R_TRY(this->Enter(0));
+                    }
+
+                    R_SUCCEED();
+                }
+
+                virtual Result CloseFile(FileHandle handle) override {
+                    AMS_ASSERT(m_slots[handle] == SlotState::Open);
+
+                    /* In-flight writes hold their own reference to the file, so the slot can be closed immediately. */
+                    R_TRY(this->ReserveSqes(1));
+                    this->PrepareClose(handle);
+                    m_slots[handle] = SlotState::Closing;
+
+                    R_RETURN(m_first_error);
+                }
+
+                virtual Result Finalize() override {
+                    while (m_in_flight > 0) {
+                        R_TRY(this->Enter(1));
+                    }
+
+                    R_RETURN(m_first_error);
+                }
+            private:
+                static const char *GetRelativePath(const char *path) {
+                    while (*path == '/') {
+                        ++path;
+                    }
+                    return *path != '\x00' ? path : ".";
+                }
+
+                s32 GetBufferIndex(const void *buffer) const {
+                    for (s32 i = 0; i < BufferCount; ++i) {
+                        if (m_buffers[i].data == buffer) {
+                            return i;
+                        }
+                    }
+                    AMS_ABORT("Buffer was not acquired from this writer");
+                }
+
+                int GetParentDirectory(const char *path, const char **out_name) const {
+                    /* Find the parent's handle, if we have one. */
+                    const auto parent = GetParentPath(GetRelativePath(path), out_name);
+                    if (parent.empty()) {
+                        return m_root_fd;
+                    }
+
+                    if (const auto it = m_directories.find(std::string(parent.data(), parent.length())); it != m_directories.end() && it->second.fd >= 0) {
+                        return it->second.fd;
+                    }
+
+                    /* Otherwise, address the entry by its full path from the root. */
+                    *out_name = GetRelativePath(path);
+                    return m_root_fd;
+                }
+
+                const char *GetSlotPath(s32 slot) const {
+                    return m_slot_paths.get() + slot * PathLengthMax;
+                }
+
+                Result AllocateSlot(s32 *out, const char *path) {
+                    while (true) {
+                        for (s32 i = 0; i < FileSlotCount; ++i) {
+                            if (m_slots[i] == SlotState::Free) {
+                                char *dst = m_slot_paths.get() + i * PathLengthMax;
+                                util::Strlcpy(dst, GetRelativePath(path), PathLengthMax);
+
+                                const char *name;
+                                m_slot_dir_fds[i]      = this->GetParentDirectory(dst, std::addressof(name));
+                                m_slot_name_offsets[i] = static_cast<u16>(name - dst);
+
+                                *out = i;
+                                R_SUCCEED();
+                            }
+                        }
+
+                        /* All slots are busy; wait for a close to land. */
+                        R_TRY(this->Enter(1));
+                    }
+                }
+
+                Result ReserveSqes(u32 count) {
+                    /* Ensure the completion queue can never overflow. */
+                    while (m_in_flight + count > m_cq_entries) {
+                        R_TRY(this->Enter(1));
+                    }
+
+                    /* Ensure the submission queue has room. */
+                    if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) + count > m_sq_entries) {
+                        R_TRY(this->Enter(0));
+                    }
+
+                    R_SUCCEED();
+                }
+
+                io_uring_sqe *GetSqe() {
+                    const u32 index = m_sq_local_tail & m_sq_mask;
+
+                    io_uring_sqe *sqe = m_sqes + index;
+                    std::memset(sqe, 0, sizeof(*sqe));
+                    m_sq_array[index] = index;
+
+                    ++m_sq_local_tail;
+                    ++m_to_submit;
+                    ++m_in_flight;
+                    return sqe;
+                }
+
+                void PrepareOpen(s32 slot, u8 flags) {
+                    auto *sqe = this->GetSqe();
+                    sqe->opcode     = IORING_OP_OPENAT;
+                    sqe->flags      = flags;
+                    sqe->fd         = m_slot_dir_fds[slot];
+                    sqe->addr       = reinterpret_cast<uintptr_t>(this->GetSlotPath(slot) + m_slot_name_offsets[slot]);
+                    sqe->len        = 0644;
+                    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+                    sqe->file_index = slot + 1;
+                    sqe->user_data  = MakeUserData(Operation::Open, slot, NoBuffer, 0);
+                }
+
+                void PrepareFallocate(s32 slot, s64 size, u8 flags) {
+                    auto *sqe = this->GetSqe();
+                    sqe->opcode    = IORING_OP_FALLOCATE;
+                    sqe->flags     = IOSQE_FIXED_FILE | flags;
+                    sqe->fd        = slot;
+                    sqe->off       = 0;
+                    sqe->addr      = static_cast<u64>(size);
+                    sqe->len       = 0;
+                    sqe->user_data = MakeUserData(Operation::Fallocate, slot, NoBuffer, 0);
+                }
+
+                void PrepareWrite(s32 slot, s64 offset, s32 buffer_index, const void *data, size_t size, u8 flags) {
+                    auto *sqe = this->GetSqe();
+                    sqe->opcode    = IORING_OP_WRITE;
+                    sqe->flags     = IOSQE_FIXED_FILE | flags;
+                    sqe->fd        = slot;
+                    sqe->off       = static_cast<u64>(offset);
+                    sqe->addr      = reinterpret_cast<uintptr_t>(data);
+                    sqe->len       = static_cast<u32>(size);
+                    sqe->user_data = MakeUserData(Operation::Write, slot, buffer_index, size);
+
+                    ++m_buffers[buffer_index].pending;
+                }
+
+                void PrepareClose(s32 slot) {
+                    auto *sqe = this->GetSqe();
+                    sqe->opcode     = IORING_OP_CLOSE;
+                    sqe->fd         = 0;
+                    sqe->file_index = slot + 1;
+                    sqe->user_data  = MakeUserData(Operation::Close, slot, NoBuffer, 0);
+                }
+
+                Result Enter(u32 min_complete) {
+                    /* Nothing will complete on a broken ring. */
+                    R_UNLESS(!m_is_ring_broken, m_first_error);
+
+                    /* Publish our submissions. */
+                    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+                    /* Submit, and wait if we should. */
+                    do {
+                        const u32 flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+                        const long ret  = ::syscall(__NR_io_uring_enter, m_ring_fd, m_to_submit, min_complete, flags, nullptr, 0);
+                        if (ret < 0) {
+                            if (errno == EINTR) {
+                                continue;
+                            }
+
+                            /* The completion queue is full; make room and retry. */
+                            if (errno == EAGAIN || errno == EBUSY) {
+                                this->ReapCompletions();
+                                continue;
+                            }
+
+                            /* The ring itself is broken, so nothing in flight will complete; fail this and every later operation. */
+                            this->OnRingError(errno);
+                            R_RETURN(m_first_error);
+                        }
+
+                        m_to_submit -= static_cast<u32>(ret);
+                        min_complete = 0;
+                    } while (m_to_submit > 0 || min_complete > 0);
+
+                    this->ReapCompletions();
+                    R_SUCCEED();
+                }
+
+                void ReapCompletions() {
+                    u32 head = *m_cq_head;
+                    const u32 tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+                    while (head != tail) {
+                        const auto &cqe = m_cqes[head & m_cq_mask];
+                        this->OnCompletion(cqe.user_data, cqe.res);
+
+                        ++head;
+                        --m_in_flight;
+                    }
+
+                    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+                }
+
+                void OnCompletion(u64 user_data, s32 res) {
+                    const auto slot = GetSlot(user_data);
+
+                    switch (GetOperation(user_data)) {
+                        case Operation::Open:
+                            if (res < 0) {
+                                this->OnError(slot, "create", -res);
+                            }
+                            if (m_slots[slot] == SlotState::Opening) {
+                                m_slots[slot] = res < 0 ? SlotState::OpenFailed : SlotState::Open;
+                            }
+                            break;
+                        case Operation::Fallocate:
+                            /* Preallocation is only a hint; filesystems which don't support it are fine. */
+                            break;
+                        case Operation::Write:
+                            --m_buffers[GetBuffer(user_data)].pending;
+                            if (res < 0) {
+                                this->OnError(slot, "write", -res);
+                            } else if (static_cast<size_t>(res) != GetSize(user_data)) {
+                                /* The rest of the chain has already run, so a short write can't be resumed. */
+                                fprintf(stderr, "[Warning]: Short write to output file (%s): wrote 0x%" PRIX32 " of 0x%zX bytes\n", this->GetSlotPath(slot), static_cast<u32>(res), GetSize(user_data));
+                                this->LatchError(EIO);
+                            }
+                            break;
+                        case Operation::Close:
+                            m_slots[slot] = SlotState::Free;
+                            break;
+                        AMS_UNREACHABLE_DEFAULT_CASE();
+                    }
+                }
+
+                void OnError(s32 slot, const char *operation, int error) {
+                    fprintf(stderr, "[Warning]: Failed to %s output file (%s): %s\n", operation, this->GetSlotPath(slot), std::strerror(error));
+                    this->LatchError(error);
+                }
+
+                void OnRingError(int error) {
+                    fprintf(stderr, "[Warning]: Failed to submit output operations: %s\n", std::strerror(error));
+                    this->LatchError(error);
+                    m_is_ring_broken = true;
+                }
+
+                void LatchError(int error) {
+                    if (R_SUCCEEDED(m_first_error)) {
+                        m_first_error = ConvertErrnoToResult(error);
+                    }
+                }
+        };
+
+        #endif
+
+    }
+
+    Result CreateOutputWriter(std::unique_ptr<OutputWriter> *out, std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *root_path) {
+        /* Get the fs path. */
+        fs::Path fs_path;
+        R_UNLESS(root_path != nullptr, fs::ResultNullptrArgument());
+        R_TRY(fs_path.SetShallowBuffer(root_path));
+
+        /* Try to create the root directory. */
+        const bool root_created = R_SUCCEEDED(fs->CreateDirectory(fs_path));
+
+        /* Verify that we can open the directory on the base filesystem. */
+        {
+            std::unique_ptr<fs::fsa::IDirectory> sub_dir;
+            R_TRY(fs->OpenDirectory(std::addressof(sub_dir), fs_path, fs::OpenDirectoryMode_Directory));
+        }
+
+        /* On linux, try to use io_uring. Our local filesystem paths are host paths, so we can use them directly. */
+        #if defined(ATMOSPHERE_OS_LINUX) && defined(IORING_FEAT_CQE_SKIP)
+        {
+            auto writer = std::make_unique<IoUringOutputWriter>();
+            if (writer != nullptr && R_SUCCEEDED(writer->Initialize(root_path))) {
+                *out = std::move(writer);
+                R_SUCCEED();
+            }
+        }
+        #endif
+
+        /* Fall back to going through the filesystem. */
+        auto writer = std::make_unique<FileSystemOutputWriter>(fs);
+        R_UNLESS(writer != nullptr, fs::ResultAllocationMemoryFailedMakeUnique());
+
+        R_TRY(writer->Initialize(fs_path, root_created));
+
+        *out = std::move(writer);
+        R_SUCCEED();
+    }
+
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* Writes a tree of output files below a root directory. */
+    /* Paths passed to a writer are normalized and relative to the root (e.g. "/dir/file.bin"). */
+    /* Data is always written out of buffers obtained from AcquireBuffer; a buffer may back any */
+    /* number of writes, and is recycled once it has been released and all of its writes are done. */
+    class OutputWriter {
+        NON_COPYABLE(OutputWriter);
+        NON_MOVEABLE(OutputWriter);
+        public:
+            using FileHandle = s32;
+
+            static constexpr size_t BufferSize = 4_MB;
+        public:
+            OutputWriter() { /* ... */ }
+            virtual ~OutputWriter() { /* ... */ }
+
+            /* Creates a directory, succeeding if it already exists. */
+            virtual Result CreateDirectory(const char *path) = 0;
+
+            virtual void *AcquireBuffer() = 0;
+            virtual void ReleaseBuffer(void *buffer) = 0;
+
+            /* Creates (or replaces) a file whose entire contents are in data, which must lie inside buffer. */
+            virtual Result WriteFile(const char *path, void *buffer, const void *data, size_t size) = 0;
+
+            /* Creates (or replaces) a file to be written in pieces. */
+            virtual Result OpenFile(FileHandle *out, const char *path, s64 size) = 0;
+            virtual Result Write(FileHandle handle, s64 offset, void *buffer, const void *data, size_t size) = 0;
+            virtual Result CloseFile(FileHandle handle) = 0;
+
+            /* Waits for all outstanding work, returning the first error encountered. */
+            virtual Result Finalize() = 0;
+    };
+
+    /* Creates the root directory and a writer for it, preferring the fastest backend available on the host. */
+    Result CreateOutputWriter(std::unique_ptr<OutputWriter> *out, std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *root_path);
+
+}
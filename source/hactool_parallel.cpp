@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_parallel.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ams::hactool {
+
+    namespace {
+
+        class ParallelJobPool {
+            NON_COPYABLE(ParallelJobPool);
+            NON_MOVEABLE(ParallelJobPool);
+            private:
+                using JobFunction = impl::ParallelJobFunction;
+            private:
+                std::vector<std::thread> m_threads;
+                std::mutex m_submit_lock;
+                std::mutex m_lock;
+                std::condition_variable m_work_cv;
+                std::condition_variable m_done_cv;
+                JobFunction m_func;
+                void *m_arg;
+                size_t m_count;
+                size_t m_next;
+                size_t m_active;
+                u64 m_generation;
+                Result m_result;
+                bool m_exit;
+            public:
+                explicit ParallelJobPool(size_t thread_count) : m_func(nullptr), m_arg(nullptr), m_count(0), m_next(0), m_active(0), m_generation(0), m_result(ResultSuccess()), m_exit(false) {
+                    for (size_t i = 0; i < thread_count; ++i) {
+                        m_threads.emplace_back([this] () { this->WorkerMain(); });
+                    }
+                }
+
+                ~ParallelJobPool() {
+                    {
+                        std::scoped_lock lk(m_lock);
+                        m_exit = true;
+                    }
+                    m_work_cv.notify_all();
+
+                    for (auto &thread : m_threads) {
+                        thread.join();
+                    }
+                }
+
+                size_t GetThreadCount() const {
+                    return m_threads.size();
+                }
+
+                Result Run(size_t count, JobFunction func, void *arg) {
+                    /* Run inline when there's nothing to share, or nobody free to share it with. */
+                    if (count <= 1 || m_threads.empty() || !m_submit_lock.try_lock()) {
+                        for (size_t i = 0; i < count; ++i) {
+                            R_TRY(func(arg, i));
+                        }
+                        R_SUCCEED();
+                    }
+                    std::unique_lock submit_lk(m_submit_lock, std::adopt_lock);
+
+                    /* Publish the job. */
+                    {
+                        std::scoped_lock lk(m_lock);
+                        m_func   = func;
+                        m_arg    = arg;
+                        m_count  = count;
+                        m_next   = 0;
+                        m_active = 0;
+                        m_result = ResultSuccess();
+                        ++m_generation;
+                    }
+                    m_work_cv.notify_all();
+
+                    /* Help out, then wait for stragglers. */
+                    this->Work();
+
+                    std::unique_lock lk(m_lock);
+                    m_done_cv.wait(lk, [&] () { return m_active == 0 && m_next >= m_count; });
+                    m_func = nullptr;
+                    m_arg  = nullptr;
+
+                    R_RETURN(m_result);
+                }
+            private:
+                void Work() {
+                    while (true) {
+                        JobFunction func;
+                        void *arg;
+                        size_t index;
+                        {
+                            std::scoped_lock lk(m_lock);
+
+                            /* Stop handing out work once the job is done, or has failed. */
+                            if (m_func == nullptr || m_next >= m_count || R_FAILED(m_result)) {
+                                m_next = m_count;
+                                return;
+                            }
+
+                            func  = m_func;
+                            arg   = m_arg;
+                            index = m_next++;
+                            ++m_active;
+                        }
+
+                        const Result res = func(arg, index);
+
+                        {
+                            std::scoped_lock lk(m_lock);
+                            if (R_FAILED(res) && R_SUCCEEDED(m_result)) {
+                                m_result = res;
+                            }
+                            if (--m_active == 0) {
+                                m_done_cv.notify_all();
+                            }
+                        }
+                    }
+                }
+
+                void WorkerMain() {
+                    u64 seen_generation = 0;
+                    while (true) {
+                        {
+                            std::unique_lock lk(m_lock);
+                            m_work_cv.wait(lk, [&] () { return m_exit || (m_func != nullptr && m_generation != seen_generation); });
+                            if (m_exit) {
+                                return;
+                            }
+
+                            seen_generation = m_generation;
+                        }
+
+                        this->Work();
+                    }
+                }
+        };
+
+        ParallelJobPool &GetParallelJobPool() {
+            static ParallelJobPool s_pool(std::max<size_t>(std::thread::hardware_concurrency(), 1) - 1);
+            return s_pool;
+        }
+
+    }
+
+    namespace impl {
+
+        Result RunParallelImpl(size_t count, ParallelJobFunction func, void *arg) {
+            R_RETURN(GetParallelJobPool().Run(count, func, arg));
+        }
+
+    }
+
+    size_t GetParallelism() {
+        return GetParallelJobPool().GetThreadCount() + 1;
+    }
+
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    namespace impl {
+
+        using ParallelJobFunction = Result (*)(void *, size_t);
+
+        Result RunParallelImpl(size_t count, ParallelJobFunction func, void *arg);
+
+    }
+
+    /* Number of threads a parallel job is spread across, counting the caller. */
+    size_t GetParallelism();
+
+    /* Calls f(0) ... f(count - 1) across a shared pool of worker threads, returning the first failure. */
+    /* The caller works too, and a job started while another is running simply runs inline. */
+    template<typename F>
+    Result RunParallel(size_t count, F f) {
+        R_RETURN(impl::RunParallelImpl(count, [] (void *arg, size_t i) -> Result { R_RETURN((*static_cast<F *>(arg))(i)); }, std::addressof(f)));
+    }
+
+}
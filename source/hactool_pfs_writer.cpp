@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_pfs_writer.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr size_t HeaderAlignment = 0x20;
+
+        size_t GetNameTableSize(const std::vector<std::string> &names) {
+            size_t size = 0;
+            for (const auto &name : names) {
+                size += name.size() + 1;
+            }
+
+            /* Pad so that the whole header is aligned. */
+            const size_t unpadded = sizeof(PartitionFileSystemHeader) + names.size() * sizeof(PartitionFileSystemEntry) + size;
+            return size + util::AlignUp(unpadded, HeaderAlignment) - unpadded;
+        }
+
+    }
+
+    Result PartitionFileSystemWriter::Initialize(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path, std::vector<std::string> names) {
+        m_names = std::move(names);
+        m_sizes.assign(m_names.size(), 0);
+        m_header_size = sizeof(PartitionFileSystemHeader) + m_names.size() * sizeof(PartitionFileSystemEntry) + GetNameTableSize(m_names);
+
+        /* Get the fs path. */
+        ams::fs::Path fs_path;
+        R_UNLESS(path != nullptr, fs::ResultNullptrArgument());
+        R_TRY(fs_path.SetShallowBuffer(path));
+
+        /* Delete an existing file, this is allowed to fail. */
+        fs->DeleteFile(fs_path);
+
+        /* Create the file, with room for the header. */
+        R_TRY(fs->CreateFile(fs_path, m_header_size));
+        R_TRY(fs->OpenFile(std::addressof(m_file), fs_path, static_cast<fs::OpenMode>(fs::OpenMode_ReadWrite | fs::OpenMode_AllowAppend)));
+
+        m_file_start    = m_header_size;
+        m_file_size     = 0;
+        m_current_index = -1;
+        R_SUCCEED();
+    }
+
+    Result PartitionFileSystemWriter::BeginFile(s32 index) {
+        AMS_ABORT_UNLESS(m_file != nullptr);
+        AMS_ABORT_UNLESS(index == m_current_index + 1 && index < static_cast<s32>(m_names.size()));
+
+        m_current_index = index;
+        m_file_size     = 0;
+        R_SUCCEED();
+    }
+
+    Result PartitionFileSystemWriter::EndFile() {
+        AMS_ABORT_UNLESS(0 <= m_current_index && m_current_index < static_cast<s32>(m_names.size()));
+
+        m_sizes[m_current_index] = m_file_size;
+        m_file_start += m_file_size;
+        m_file_size   = 0;
+        R_SUCCEED();
+    }
+
+    Result PartitionFileSystemWriter::Write(const void *data, size_t size) {
+        R_TRY(m_file->Write(m_file_start + m_file_size, data, size, fs::WriteOption::None));
+
+        m_file_size += size;
+        R_SUCCEED();
+    }
+
+    Result PartitionFileSystemWriter::WriteAt(s64 offset_in_file, const void *data, size_t size) {
+        R_UNLESS(offset_in_file >= 0 && offset_in_file + static_cast<s64>(size) <= m_file_size, fs::ResultOutOfRange());
+
+        R_RETURN(m_file->Write(m_file_start + offset_in_file, data, size, fs::WriteOption::None));
+    }
+
+    Result PartitionFileSystemWriter::Finalize() {
+        AMS_ABORT_UNLESS(m_current_index + 1 == static_cast<s32>(m_names.size()));
+
+        /* Build the header, now that every size is known. */
+        std::vector<u8> header(m_header_size, 0);
+        const size_t name_table_size = GetNameTableSize(m_names);
+
+        const PartitionFileSystemHeader pfs_header = { PartitionFileSystemMagic, static_cast<s32>(m_names.size()), static_cast<u32>(name_table_size), 0 };
+        std::memcpy(header.data(), std::addressof(pfs_header), sizeof(pfs_header));
+
+        auto *entries   = header.data() + sizeof(pfs_header);
+        auto *names     = entries + m_names.size() * sizeof(PartitionFileSystemEntry);
+        s64 offset      = 0;
+        u32 name_offset = 0;
+        for (size_t i = 0; i < m_names.size(); ++i) {
+            const PartitionFileSystemEntry entry = { offset, m_sizes[i], name_offset, 0 };
+            std::memcpy(entries + i * sizeof(entry), std::addressof(entry), sizeof(entry));
+            std::memcpy(names + name_offset, m_names[i].c_str(), m_names[i].size() + 1);
+
+            offset      += m_sizes[i];
+            name_offset += m_names[i].size() + 1;
+        }
+
+        R_TRY(m_file->Write(0, header.data(), header.size(), fs::WriteOption::Flush));
+
+        m_file.reset();
+        R_SUCCEED();
+    }
+
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* Layout of a PFS0: a header, an entry per file, then a name table padded so file data starts aligned. */
+    struct PartitionFileSystemHeader {
+        u32 magic;
+        s32 entry_count;
+        u32 name_table_size;
+        u32 reserved;
+    };
+    static_assert(sizeof(PartitionFileSystemHeader) == 0x10);
+
+    struct PartitionFileSystemEntry {
+        s64 offset;
+        s64 size;
+        u32 name_offset;
+        u32 reserved;
+    };
+    static_assert(sizeof(PartitionFileSystemEntry) == 0x18);
+
+    constexpr inline u32 PartitionFileSystemMagic = util::FourCC<'P', 'F', 'S', '0'>::Code;
+
+    /* Writes a PFS0 whose file sizes aren't known up front. */
+    /* The names fix the header size, so files are streamed in order after a placeholder header, which is filled in by Finalize. */
+    class PartitionFileSystemWriter {
+        NON_COPYABLE(PartitionFileSystemWriter);
+        NON_MOVEABLE(PartitionFileSystemWriter);
+        private:
+            std::unique_ptr<fs::fsa::IFile> m_file;
+            std::vector<std::string> m_names;
+            std::vector<s64> m_sizes;
+            s64 m_header_size;
+            s64 m_file_start;
+            s64 m_file_size;
+            s32 m_current_index;
+        public:
+            PartitionFileSystemWriter() : m_file(), m_names(), m_sizes(), m_header_size(0), m_file_start(0), m_file_size(0), m_current_index(-1) { /* ... */ }
+
+            Result Initialize(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path, std::vector<std::string> names);
+
+            /* Files must be written in the order their names were given. */
+            Result BeginFile(s32 index);
+            Result EndFile();
+
+            /* Appends to the current file. */
+            Result Write(const void *data, size_t size);
+
+            /* Overwrites data already written to the current file, e.g. a table reserved before its contents were known. */
+            Result WriteAt(s64 offset_in_file, const void *data, size_t size);
+
+            s64 GetCurrentFileSize() const { return m_file_size; }
+
+            Result Finalize();
+    };
+
+}
@@ -16,6 +16,8 @@
 #include <stratosphere.hpp>
 #include "hactool_processor.hpp"
 #include "hactool_fs_utils.hpp"
+#include "hactool_ticket.hpp"
+#include "hactool_trace.hpp"
 
 namespace ams::hactool {
 
@@ -25,152 +27,25 @@ namespace ams::hactool {
 
         constexpr const char MetaNcaFileNameExtension[] = ".cnmt.nca";
         constexpr const char NcaFileNameExtension[] = ".nca";
-
-        constexpr const char TicketFileNameExtension[] = ".tik";
-
-        struct alignas(4) CommonTicketData {
-            u32 signature_type;
-            u8 signature_data[0x100];
-            u8 padding0[0x3C];
-            char issuer[0x40];
-            u8 title_key_block[0x100];
-            u8 format_version;
-            u8 titlekey_type;
-            u16 ticket_version;
-            u8 license_type;
-            u8 key_generation;
-            u16 property_mask;
-            u8 reserved[8];
-            u8 ticket_id[8];
-            u8 device_id[8];
-            u8 rights_id[0x10];
-            u8 account_id[0x4];
-            u32 total_section_size;
-            u32 section_header_offset;
-            u16 section_header_count;
-            u16 section_header_entry_size;
-        };
-        static_assert(util::is_pod<CommonTicketData>::value);
-        static_assert(sizeof(CommonTicketData) == 0x2C0);
-
-        bool IsValidCommonTicketFormat(const void *data, size_t size) {
-            /* Check that the data is the right size for a ticket. */
-            if (size != sizeof(CommonTicketData)) {
-                return false;
-            }
-
-            /* Check the ticket. */
-            const auto &ticket = *static_cast<const CommonTicketData *>(data);
-
-            /* Check that the ticket is an aes key. */
-            if (ticket.titlekey_type != 0) {
-                return false;
-            }
-
-            /* Check that the ticket's rights id isn't all-zero. */
-            size_t i;
-            for (i = 0; i < util::size(ticket.rights_id); ++i) {
-                if (ticket.rights_id[i] != 0) {
-                    break;
-                }
-            }
-
-            if (i == util::size(ticket.rights_id)) {
-                return false;
-            }
-
-            /* Check that the ticket is a proper aes-key. */
-            for (i = 0; i < sizeof(spl::AesKey); ++i) {
-                if (ticket.title_key_block[i] != 0) {
-                    break;
-                }
-            }
-            if (i == sizeof(spl::AesKey)) {
-                return false;
-            }
-
-            for (i = sizeof(spl::AesKey); i < util::size(ticket.title_key_block); ++i) {
-                if (ticket.title_key_block[i] != 0) {
-                    break;
-                }
-            }
-            if (i != util::size(ticket.title_key_block)) {
-                return false;
-            }
-
-            /* Check that the ticket's section header is proper. */
-            if (ticket.section_header_offset != sizeof(CommonTicketData)) {
-                return false;
-            }
-
-            /* Ticket is good enough. */
-            return true;
-        }
+        constexpr const char NczFileNameExtension[] = ".ncz";
 
         bool TryLoadKeyFromCommonTicket(fssrv::impl::ExternalKeyManager &km, const void *data, size_t size) {
-            if (IsValidCommonTicketFormat(data, size)) {
-                /* Get the ticket. */
-                const auto &ticket = *static_cast<const CommonTicketData *>(data);
-
-                /* Decode the rights id. */
-                fs::RightsId rights_id = {};
-                std::memcpy(std::addressof(rights_id), ticket.rights_id, sizeof(rights_id));
-
-                /* Decode the key. */
-                spl::AccessKey access_key = {};
-                std::memcpy(std::addressof(access_key), ticket.title_key_block, sizeof(access_key));
-
-                /* Register with the key manager. */
-                km.Register(rights_id, access_key);
-
-                return true;
-            } else {
+            fs::RightsId rights_id;
+            spl::AccessKey access_key;
+            if (!DecodeCommonTicket(std::addressof(rights_id), std::addressof(access_key), data, size)) {
                 return false;
             }
-        }
-
-        Result ReadContentMetaFile(std::unique_ptr<u8[]> *out, size_t *out_size, std::shared_ptr<fs::fsa::IFileSystem> &fs) {
-            bool found = false;
-            R_RETURN(fssystem::IterateDirectoryRecursively(fs.get(),
-                [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
-                [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
-                [&] (const fs::Path &path, const fs::DirectoryEntry &entry) -> Result {
-                    /* If we already found the content meta, finish. */
-                    R_SUCCEED_IF(found);
-
-                    /* If the path isn't a meta nca, finish. */
-                    R_SUCCEED_IF(!ncm::IsContentMetaFileName(entry.name));
-
-                    /* Open the file storage. */
-                    std::shared_ptr<fs::IStorage> storage;
-                    R_TRY(OpenFileStorage(std::addressof(storage), fs, path.GetString()));
-
-                    /* Get the meta file size. */
-                    s64 size;
-                    R_TRY(storage->GetSize(std::addressof(size)));
 
-                    /* Allocate buffer. */
-                    auto data = std::make_unique<u8[]>(static_cast<size_t>(size));
-                    R_UNLESS(data != nullptr, fs::ResultAllocationMemoryFailedMakeUnique());
-
-                    /* Read the meta into the buffer. */
-                    R_TRY(storage->Read(0, data.get(), size));
-
-                    /* Return the output buffer. */
-                    *out      = std::move(data);
-                    *out_size = static_cast<size_t>(size);
-                    found = true;
-
-                    R_SUCCEED();
-                }
-            ));
-
-            R_THROW(ncm::ResultContentMetaNotFound());
+            /* Register with the key manager. */
+            km.Register(rights_id, access_key);
+            return true;
         }
 
     }
 
     Result Processor::ProcessAsApplicationFileSystem(std::shared_ptr<fs::fsa::IFileSystem> fs, ProcessAsApplicationFileSystemContext *ctx) {
+        HACTOOL_TRACE_ZONE("ProcessAsApplicationFileSystem");
+
         /* Ensure we have a context. */
         ProcessAsApplicationFileSystemContext local_ctx{};
         if (ctx == nullptr) {
@@ -217,6 +92,8 @@ namespace ams::hactool {
                     /* If the path isn't a meta nca, finish. */
                     R_SUCCEED_IF(!PathView(entry.name).HasSuffix(MetaNcaFileNameExtension));
 
+                    HACTOOL_TRACE_ZONE("DiscoverContentMeta", "path", path.GetString());
+
                     /* Try opening the meta. */
                     std::shared_ptr<fs::IStorage> meta_nca_storage;
                     if (const auto res = OpenFileStorage(std::addressof(meta_nca_storage), ctx->fs, path.GetString()); R_FAILED(res)) {
@@ -243,7 +120,7 @@ namespace ams::hactool {
                     }
 
                     /* Read the content meta file. */
-                    std::unique_ptr<u8[]> meta_data;
+                    TrackedUniquePtr<u8> meta_data;
                     size_t meta_size;
                     if (const auto res = ReadContentMetaFile(std::addressof(meta_data), std::addressof(meta_size), meta_nca_ctx.file_systems[MetaFileSystemPartitionIndex]); R_FAILED(res)) {
                         fprintf(stderr, "[Warning]: Failed to read cnmt from %s: 2%03d-%04d\n", path.GetString(), res.GetModule(), res.GetDescription());
@@ -279,21 +156,29 @@ namespace ams::hactool {
                             continue;
                         }
 
-                        /* Try to open the storage for the specified file. */
+                        /* Try to open the storage for the specified file, which compressed packages store as ncz. */
                         std::shared_ptr<fs::IStorage> storage;
                         {
                             const auto cid_str = ncm::GetContentIdString(info.GetId());
-                            char file_name[ncm::ContentIdStringLength + 0x10];
-                            util::TSNPrintf(file_name, sizeof(file_name), "%s%s", cid_str.data, NcaFileNameExtension);
 
-                            const auto res = [&] () -> Result {
+                            auto open_content = [&] (const char *extension) -> Result {
+                                char file_name[ncm::ContentIdStringLength + 0x10];
+                                util::TSNPrintf(file_name, sizeof(file_name), "%s%s", cid_str.data, extension);
+
                                 ams::fs::Path fs_path;
                                 R_TRY(fs_path.Initialize(path));
                                 R_TRY(fs_path.RemoveChild());
                                 R_TRY(fs_path.AppendChild(file_name));
 
                                 R_RETURN(OpenFileStorage(std::addressof(storage), ctx->fs, fs_path.GetString()));
-                            }();
+                            };
+
+                            auto res = open_content(NcaFileNameExtension);
+                            if (R_FAILED(res)) {
+                                if (const auto ncz_res = open_content(NczFileNameExtension); R_SUCCEEDED(ncz_res)) {
+                                    res = ncz_res;
+                                }
+                            }
                             if (R_FAILED(res)) {
                                 fprintf(stderr, "[Warning]: Failed to open NCA (type %d) specified by %s: 2%03d-%04d\n", static_cast<int>(info.GetType()), path.GetString(), res.GetModule(), res.GetDescription());
                                 R_SUCCEED();
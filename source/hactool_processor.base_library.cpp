@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_processor.hpp"
+#include "hactool_fs_utils.hpp"
+#include "hactool_ticket.hpp"
+#include "hactool_trace.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr const s32 MetaFileSystemPartitionIndex = 0;
+
+        constexpr const char MetaNcaFileNameExtension[] = ".cnmt.nca";
+        constexpr const char NcaFileNameExtension[] = ".nca";
+        constexpr const char NczFileNameExtension[] = ".ncz";
+
+        constexpr const char BaseLibraryIndexPath[] = "/.hactool_baselib";
+
+        /* Only patches have a base; anything else would be needlessly (and wrongly) layered over one. */
+        bool IsPatchNca(const fssystem::NcaReader &reader) {
+            for (s32 i = 0; i < fssystem::NcaHeader::FsCountMax; ++i) {
+                if (!reader.HasFsInfo(i)) {
+                    continue;
+                }
+
+                fssystem::NcaFsHeader fs_header;
+                if (R_SUCCEEDED(reader.ReadHeader(std::addressof(fs_header), i)) && fs_header.patch_info.HasIndirectTable()) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+    }
+
+    void Processor::OpenBaseLibrary() {
+        HACTOOL_TRACE_ZONE("OpenBaseLibrary", "path", m_options.base_library_dir);
+
+        if (const auto res = OpenSubDirectoryFileSystem(std::addressof(m_base_library_fs), m_local_fs, m_options.base_library_dir); R_FAILED(res)) {
+            fprintf(stderr, "Failed to open base library (%s): 2%03d-%04d\n", m_options.base_library_dir, res.GetModule(), res.GetDescription());
+            return;
+        }
+
+        /* Load the cached index, if there is one. */
+        {
+            std::shared_ptr<fs::IStorage> index_storage;
+            s64 index_size;
+            if (R_SUCCEEDED(OpenFileStorage(std::addressof(index_storage), m_base_library_fs, BaseLibraryIndexPath)) && R_SUCCEEDED(index_storage->GetSize(std::addressof(index_size)))) {
+                std::vector<char> index_data(index_size);
+                if (R_SUCCEEDED(index_storage->Read(0, index_data.data(), index_data.size()))) {
+                    m_base_library.Load(index_data.data(), index_data.size());
+                }
+            }
+        }
+
+        /* Bring the index up to date, parsing only metas and tickets which are new or have changed. */
+        std::set<std::string> seen_metas;
+        std::set<std::string> seen_tickets;
+        const auto iter_res = fssystem::IterateDirectoryRecursively(m_base_library_fs.get(),
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &path, const fs::DirectoryEntry &entry) -> Result {
+                if (PathView(entry.name).HasSuffix(TicketFileNameExtension)) {
+                    seen_tickets.emplace(path.GetString());
+                    R_SUCCEED_IF(m_base_library.HasTicket(path.GetString(), entry.file_size));
+
+                    /* Record tickets which aren't usable too, so that they aren't reread until they change. */
+                    BaseLibraryIndex::TicketEntry ticket = { entry.file_size, false, {}, {} };
+                    if (const auto res = this->IndexBaseLibraryTicket(std::addressof(ticket), path.GetString()); R_FAILED(res)) {
+                        fprintf(stderr, "[Warning]: Failed to index %s in base library: 2%03d-%04d\n", path.GetString(), res.GetModule(), res.GetDescription());
+                    } else if (!ticket.has_key) {
+                        fprintf(stderr, "[Warning]: Failed to load common title key from ticket file (%s). Is it not a common ticket?\n", path.GetString());
+                    }
+
+                    m_base_library.SetTicket(path.GetString(), ticket);
+                    R_SUCCEED();
+                }
+
+                R_SUCCEED_IF(!PathView(entry.name).HasSuffix(MetaNcaFileNameExtension));
+
+                seen_metas.emplace(path.GetString());
+                R_SUCCEED_IF(m_base_library.HasMeta(path.GetString(), entry.file_size));
+
+                BaseLibraryIndex::MetaEntry meta = { entry.file_size, {} };
+                if (const auto res = this->IndexBaseLibraryMeta(std::addressof(meta), path.GetString()); R_FAILED(res)) {
+                    fprintf(stderr, "[Warning]: Failed to index %s in base library: 2%03d-%04d\n", path.GetString(), res.GetModule(), res.GetDescription());
+                }
+
+                /* Record failures too, so that they aren't retried until the meta changes. */
+                m_base_library.SetMeta(path.GetString(), std::move(meta));
+                R_SUCCEED();
+            }
+        );
+        if (R_FAILED(iter_res)) {
+            fprintf(stderr, "[Warning]: Failed to scan base library (%s): 2%03d-%04d\n", m_options.base_library_dir, iter_res.GetModule(), iter_res.GetDescription());
+        } else {
+            m_base_library.RemoveMetasExcept(seen_metas);
+            m_base_library.RemoveTicketsExcept(seen_tickets);
+        }
+
+        /* Save the index, if it changed. */
+        if (m_base_library.IsDirty()) {
+            const auto index_data = m_base_library.Serialize();
+            if (const auto res = SaveToFile(m_base_library_fs, BaseLibraryIndexPath, index_data.data(), index_data.size()); R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: Failed to save base library index: 2%03d-%04d\n", res.GetModule(), res.GetDescription());
+            }
+        }
+
+        /* Register the library's titlekeys, so that its titlekey-crypto programs can be opened. */
+        for (const auto &[path, ticket] : m_base_library.GetTickets()) {
+            if (ticket.has_key) {
+                m_external_nca_key_manager.Register(ticket.rights_id, ticket.access_key);
+            }
+        }
+
+        m_base_library.Finalize();
+        m_has_base_library = true;
+    }
+
+    Result Processor::IndexBaseLibraryTicket(BaseLibraryIndex::TicketEntry *out, const char *path) {
+        HACTOOL_TRACE_ZONE("IndexBaseLibraryTicket", "path", path);
+
+        std::shared_ptr<fs::IStorage> storage;
+        R_TRY(OpenFileStorage(std::addressof(storage), m_base_library_fs, path));
+
+        s64 size;
+        R_TRY(storage->GetSize(std::addressof(size)));
+
+        /* Anything too small to be a common ticket has no key for us. */
+        R_SUCCEED_IF(size < static_cast<s64>(sizeof(CommonTicketData)));
+
+        CommonTicketData ticket_data;
+        R_TRY(storage->Read(0, std::addressof(ticket_data), sizeof(ticket_data)));
+
+        out->has_key = DecodeCommonTicket(std::addressof(out->rights_id), std::addressof(out->access_key), std::addressof(ticket_data), sizeof(ticket_data));
+        R_SUCCEED();
+    }
+
+    Result Processor::IndexBaseLibraryMeta(BaseLibraryIndex::MetaEntry *out, const char *path) {
+        HACTOOL_TRACE_ZONE("IndexBaseLibraryMeta", "path", path);
+
+        /* Mount the meta nca. */
+        std::shared_ptr<fs::IStorage> storage;
+        R_TRY(OpenFileStorage(std::addressof(storage), m_base_library_fs, path));
+
+        ProcessAsNcaContext meta_nca_ctx{};
+        R_TRY(this->ProcessAsNca(std::move(storage), std::addressof(meta_nca_ctx)));
+        R_UNLESS(meta_nca_ctx.is_mounted[MetaFileSystemPartitionIndex], fs::ResultPathNotFound());
+
+        /* Read the cnmt. */
+        TrackedUniquePtr<u8> meta_data;
+        size_t meta_size;
+        R_TRY(ReadContentMetaFile(std::addressof(meta_data), std::addressof(meta_size), meta_nca_ctx.file_systems[MetaFileSystemPartitionIndex]));
+
+        const auto meta_reader = ncm::PackagedContentMetaReader(meta_data.get(), meta_size);
+        const auto * const meta_header = meta_reader.GetHeader();
+
+        /* Only applications hold base programs. */
+        R_SUCCEED_IF(meta_header->type != ncm::ContentMetaType::Application);
+
+        const auto app_id = meta_reader.GetApplicationId();
+        R_UNLESS(app_id.has_value(), ncm::ResultContentMetaNotFound());
+
+        /* Record each program which is present next to the meta. */
+        for (size_t i = 0; i < meta_reader.GetContentCount(); ++i) {
+            const auto &info = *meta_reader.GetContentInfo(i);
+            if (info.GetType() != ncm::ContentType::Program) {
+                continue;
+            }
+
+            const auto cid_str = ncm::GetContentIdString(info.GetId());
+            for (const char *extension : { NcaFileNameExtension, NczFileNameExtension }) {
+                char file_name[ncm::ContentIdStringLength + 0x10];
+                util::TSNPrintf(file_name, sizeof(file_name), "%s%s", cid_str.data, extension);
+
+                ams::fs::Path fs_path;
+                R_TRY(fs_path.Initialize(path));
+                R_TRY(fs_path.RemoveChild());
+                R_TRY(fs_path.AppendChild(file_name));
+
+                fs::DirectoryEntryType type;
+                if (R_SUCCEEDED(m_base_library_fs->GetEntryType(std::addressof(type), fs_path)) && type == fs::DirectoryEntryType_File) {
+                    out->programs.push_back(BaseLibraryIndex::ProgramEntry{ app_id->value + info.GetIdOffset(), meta_header->version, fs_path.GetString() });
+                    break;
+                }
+            }
+        }
+
+        R_SUCCEED();
+    }
+
+    void Processor::FindBaseInLibrary(ProcessAsNcaContext *ctx) {
+        const u64 program_id = ctx->reader->GetProgramId();
+        if (!IsPatchNca(*ctx->reader)) {
+            return;
+        }
+
+        /* Bases are processed once, on first use. */
+        if (const auto it = m_base_library_readers.find(program_id); it != m_base_library_readers.end()) {
+            ctx->base_reader = it->second;
+            return;
+        }
+
+        /* Claim the slot first, so that processing the base can't recurse into resolving it again. */
+        auto &base_reader = m_base_library_readers[program_id];
+
+        const auto *program = m_base_library.FindLatestProgram(program_id);
+        if (program == nullptr) {
+            fprintf(stderr, "[Warning]: Base library has no program %016" PRIX64 "\n", program_id);
+            return;
+        }
+
+        HACTOOL_TRACE_ZONE("OpenBaseLibraryProgram", "path", program->path.c_str());
+
+        std::shared_ptr<fs::IStorage> storage;
+        if (const auto res = OpenFileStorage(std::addressof(storage), m_base_library_fs, program->path.c_str()); R_FAILED(res)) {
+            fprintf(stderr, "[Warning]: Failed to open base program %s: 2%03d-%04d\n", program->path.c_str(), res.GetModule(), res.GetDescription());
+            return;
+        }
+
+        ProcessAsNcaContext base_ctx{};
+        if (const auto res = this->ProcessAsNca(std::move(storage), std::addressof(base_ctx)); R_FAILED(res)) {
+            fprintf(stderr, "[Warning]: Failed to process base program %s: 2%03d-%04d\n", program->path.c_str(), res.GetModule(), res.GetDescription());
+            return;
+        }
+
+        base_reader      = base_ctx.reader;
+        ctx->base_reader = base_reader;
+    }
+
+}
@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_processor.hpp"
+#include "hactool_fs_utils.hpp"
+
+#if defined(HACTOOL_BUILD_BENCHMARK)
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr const char BenchmarkKeysName[]        = "test.keys";
+        constexpr const char BenchmarkProgramName[]     = "program.nca";
+        constexpr const char BenchmarkPatchName[]       = "program_v1.nca";
+        constexpr const char BenchmarkApplicationName[] = "application.nsp";
+        constexpr const char BenchmarkGameCardName[]    = "application.xci";
+        constexpr const char BenchmarkScratchName[]     = "bench_scratch";
+        constexpr const char BenchmarkScratchFileName[] = "bench_scratch.bin";
+
+        class ScopedStdoutSilencer {
+            NON_COPYABLE(ScopedStdoutSilencer);
+            NON_MOVEABLE(ScopedStdoutSilencer);
+            private:
+                int m_saved_fd;
+            public:
+                ScopedStdoutSilencer() : m_saved_fd(-1) {
+                    std::fflush(stdout);
+
+                    if (const int null_fd = ::open("/dev/null", O_WRONLY); null_fd >= 0) {
+                        m_saved_fd = ::dup(STDOUT_FILENO);
+                        ::dup2(null_fd, STDOUT_FILENO);
+                        ::close(null_fd);
+                    }
+                }
+
+                ~ScopedStdoutSilencer() {
+                    std::fflush(stdout);
+
+                    if (m_saved_fd >= 0) {
+                        ::dup2(m_saved_fd, STDOUT_FILENO);
+                        ::close(m_saved_fd);
+                    }
+                }
+        };
+
+        struct BenchmarkResult {
+            const char *name;
+            std::vector<s64> samples_ns;
+            s64 bytes_per_iteration;
+            Result result;
+
+            s64 GetPercentile(int percentile) const {
+                /* Samples are sorted once measurement finishes; use the nearest rank. */
+                const size_t rank = (percentile * samples_ns.size() + 99) / 100;
+                return samples_ns[std::max<size_t>(rank, 1) - 1];
+            }
+
+            s64 GetMean() const {
+                s64 total = 0;
+                for (const auto ns : samples_ns) {
+                    total += ns;
+                }
+                return total / static_cast<s64>(samples_ns.size());
+            }
+        };
+
+        /* Setup runs before every iteration (including the warm-up), outside of the timed region. */
+        template<typename S, typename F>
+        BenchmarkResult Measure(const char *name, int iterations, s64 bytes_per_iteration, S setup, F f) {
+            BenchmarkResult bench = { name, {}, bytes_per_iteration, ResultSuccess() };
+
+            /* Warm up caches and allocators, and bail out if the case can't run at all. */
+            {
+                ScopedStdoutSilencer silencer;
+                bench.result = setup();
+                if (R_SUCCEEDED(bench.result)) {
+                    bench.result = f();
+                }
+            }
+            if (R_FAILED(bench.result)) {
+                fprintf(stderr, "[Warning]: Benchmark %s failed: 2%03d-%04d\n", name, bench.result.GetModule(), bench.result.GetDescription());
+                return bench;
+            }
+
+            for (int i = 0; i < iterations; ++i) {
+                ScopedStdoutSilencer silencer;
+
+                if (const auto setup_res = setup(); R_FAILED(setup_res)) {
+                    bench.result = setup_res;
+                    break;
+                }
+
+                const auto start = os::GetSystemTick();
+                const auto res   = f();
+                const auto ns    = (os::GetSystemTick() - start).ToTimeSpan().GetNanoSeconds();
+
+                if (R_FAILED(res)) {
+                    bench.result = res;
+                    break;
+                }
+                bench.samples_ns.push_back(ns);
+            }
+
+            std::sort(bench.samples_ns.begin(), bench.samples_ns.end());
+            return bench;
+        }
+
+        template<typename F>
+        BenchmarkResult Measure(const char *name, int iterations, s64 bytes_per_iteration, F f) {
+            return Measure(name, iterations, bytes_per_iteration, [] () -> Result { R_SUCCEED(); }, f);
+        }
+
+        void MakeBenchmarkPath(char *dst, size_t dst_size, const char *dir, const char *name) {
+            util::SNPrintf(dst, dst_size, "%s/%s", dir, name);
+        }
+
+        Result GetTotalFileSize(s64 *out, fs::fsa::IFileSystem *fs) {
+            s64 total = 0;
+            R_TRY(fssystem::IterateDirectoryRecursively(fs,
+                fs::MakeConstantPath("/"),
+                [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result {
+                    R_SUCCEED();
+                },
+                [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result {
+                    R_SUCCEED();
+                },
+                [&] (const fs::Path &, const fs::DirectoryEntry &ent) -> Result {
+                    total += ent.file_size;
+                    R_SUCCEED();
+                }
+            ));
+
+            *out = total;
+            R_SUCCEED();
+        }
+
+        void AppendFormat(std::string &dst, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+        void AppendFormat(std::string &dst, const char *fmt, ...) {
+            char buf[0x200];
+
+            std::va_list vl;
+            va_start(vl, fmt);
+            util::VSNPrintf(buf, sizeof(buf), fmt, vl);
+            va_end(vl);
+
+            dst += buf;
+        }
+
+        std::string FormatBenchmarkJson(const std::vector<BenchmarkResult> &results, int iterations) {
+            std::string json;
+            AppendFormat(json, "{\n  \"iterations\": %d,\n  \"benchmarks\": [", iterations);
+
+            bool first = true;
+            for (const auto &bench : results) {
+                AppendFormat(json, "%s\n    { \"name\": \"%s\", ", first ? "" : ",", bench.name);
+                first = false;
+
+                if (R_FAILED(bench.result) || bench.samples_ns.empty()) {
+                    AppendFormat(json, "\"result\": \"2%03d-%04d\" }", bench.result.GetModule(), bench.result.GetDescription());
+                    continue;
+                }
+
+                AppendFormat(json, "\"samples\": %zu, \"min_ns\": %" PRId64 ", \"mean_ns\": %" PRId64 ", \"p50_ns\": %" PRId64 ", \"p90_ns\": %" PRId64 ", \"p99_ns\": %" PRId64 ", \"max_ns\": %" PRId64,
+                             bench.samples_ns.size(), bench.samples_ns.front(), bench.GetMean(), bench.GetPercentile(50), bench.GetPercentile(90), bench.GetPercentile(99), bench.samples_ns.back());
+
+                if (bench.bytes_per_iteration > 0) {
+                    AppendFormat(json, ", \"bytes\": %" PRId64 ", \"p50_mb_per_s\": %.3f", bench.bytes_per_iteration, static_cast<double>(bench.bytes_per_iteration) * 1000.0 / static_cast<double>(std::max<s64>(bench.GetPercentile(50), 1)));
+                }
+                json += " }";
+            }
+
+            json += "\n  ]\n}\n";
+            return json;
+        }
+
+    }
+
+    Result Processor::RunBenchmarks() {
+        const char *dir = m_options.bench_fixture_dir_path;
+        const int iterations = std::max(m_options.bench_iterations, 1);
+
+        char keys_path[fs::EntryNameLengthMax + 1], program_path[fs::EntryNameLengthMax + 1], patch_path[fs::EntryNameLengthMax + 1];
+        char application_path[fs::EntryNameLengthMax + 1], game_card_path[fs::EntryNameLengthMax + 1], scratch_path[fs::EntryNameLengthMax + 1];
+        char scratch_file_path[fs::EntryNameLengthMax + 1];
+        MakeBenchmarkPath(keys_path, sizeof(keys_path), dir, BenchmarkKeysName);
+        MakeBenchmarkPath(program_path, sizeof(program_path), dir, BenchmarkProgramName);
+        MakeBenchmarkPath(patch_path, sizeof(patch_path), dir, BenchmarkPatchName);
+        MakeBenchmarkPath(application_path, sizeof(application_path), dir, BenchmarkApplicationName);
+        MakeBenchmarkPath(game_card_path, sizeof(game_card_path), dir, BenchmarkGameCardName);
+        MakeBenchmarkPath(scratch_path, sizeof(scratch_path), dir, BenchmarkScratchName);
+        MakeBenchmarkPath(scratch_file_path, sizeof(scratch_file_path), dir, BenchmarkScratchFileName);
+
+        /* The fixtures are only valid under the keyset they were generated with. */
+        m_options.key_file_path   = keys_path;
+        m_options.titlekey_path   = nullptr;
+        m_options.consolekey_path = nullptr;
+        this->PresetInternalKeys();
+
+        std::vector<BenchmarkResult> results;
+
+        /* Key loading and derivation. */
+        results.push_back(Measure("keys.load_derive", iterations, 0, [&] () -> Result {
+            this->PresetInternalKeys();
+            R_SUCCEED();
+        }));
+
+        /* Open the base program, which most cases operate on. */
+        std::shared_ptr<fs::IStorage> program_storage;
+        ProcessAsNcaContext program_ctx{};
+        if (const auto res = OpenFileStorage(std::addressof(program_storage), m_local_fs, program_path); R_SUCCEEDED(res)) {
+            results.push_back(Measure("nca.header", iterations, 0, [&] () -> Result {
+                std::shared_ptr<fssystem::NcaReader> reader;
+                R_RETURN(this->OpenNcaReader(std::addressof(reader), program_storage));
+            }));
+
+            results.push_back(Measure("nca.open_sections", iterations, 0, [&] () -> Result {
+                ProcessAsNcaContext ctx{};
+                R_RETURN(this->ProcessAsNca(program_storage, std::addressof(ctx)));
+            }));
+
+            if (const auto process_res = this->ProcessAsNca(program_storage, std::addressof(program_ctx)); R_FAILED(process_res)) {
+                fprintf(stderr, "[Warning]: Failed to process benchmark program (%s): 2%03d-%04d\n", program_path, process_res.GetModule(), process_res.GetDescription());
+            }
+        } else {
+            fprintf(stderr, "[Warning]: Failed to open benchmark program (%s): 2%03d-%04d\n", program_path, res.GetModule(), res.GetDescription());
+        }
+
+        /* Romfs listing and extraction. */
+        if (program_ctx.romfs_index >= 0 && program_ctx.is_mounted[program_ctx.romfs_index]) {
+            auto &romfs = program_ctx.file_systems[program_ctx.romfs_index];
+
+            s64 romfs_data_size = 0;
+            R_TRY(GetTotalFileSize(std::addressof(romfs_data_size), romfs.get()));
+
+            results.push_back(Measure("romfs.list", iterations, 0, [&] () -> Result {
+                R_RETURN(PrintDirectory(romfs, "rom:", "/"));
+            }));
+
+            /* Extraction into a stale directory would measure overwrites rather than creation. */
+            auto DeleteScratchDirectory = [&] () -> Result {
+                fs::Path path;
+                R_TRY(path.SetShallowBuffer(scratch_path));
+                m_local_fs->DeleteDirectoryRecursively(path);
+                R_SUCCEED();
+            };
+
+            results.push_back(Measure("romfs.extract_directory", iterations, romfs_data_size, DeleteScratchDirectory, [&] () -> Result {
+                R_RETURN(ExtractDirectory(m_local_fs, romfs, "rom:", scratch_path, "/"));
+            }));
+
+            s64 section_size = 0;
+            R_TRY(program_ctx.sections[program_ctx.romfs_index]->GetSize(std::addressof(section_size)));
+
+            results.push_back(Measure("fs.save_to_file", iterations, section_size, [&] () -> Result {
+                R_RETURN(SaveToFile(m_local_fs, scratch_file_path, program_ctx.sections[program_ctx.romfs_index].get()));
+            }));
+
+            /* Clean up after ourselves. */
+            {
+                R_TRY(DeleteScratchDirectory());
+
+                fs::Path path;
+                R_TRY(path.SetShallowBuffer(scratch_file_path));
+                m_local_fs->DeleteFile(path);
+            }
+        }
+
+        /* Updated romfs listing, against the base program. */
+        std::shared_ptr<fs::IStorage> patch_storage;
+        if (program_ctx.reader != nullptr && R_SUCCEEDED(OpenFileStorage(std::addressof(patch_storage), m_local_fs, patch_path))) {
+            ProcessAsNcaContext patch_ctx{};
+            patch_ctx.base_reader = program_ctx.reader;
+
+            if (const auto res = this->ProcessAsNca(patch_storage, std::addressof(patch_ctx)); R_SUCCEEDED(res) && patch_ctx.romfs_index >= 0 && patch_ctx.is_mounted[patch_ctx.romfs_index]) {
+                const auto index = patch_ctx.romfs_index;
+                auto *romfs = static_cast<fssystem::RomFsFileSystem *>(patch_ctx.file_systems[index].get());
+
+                results.push_back(Measure("romfs.list_updated", iterations, 0, [&] () -> Result {
+                    R_RETURN(PrintUpdatedRomFsDirectory(romfs, patch_ctx.storage_contexts[index].indirect_storage, patch_ctx.storage_contexts[index].aes_ctr_ex_storage, 1, "rom:", "/"));
+                }));
+            } else {
+                fprintf(stderr, "[Warning]: Failed to open benchmark update romfs (%s)\n", patch_path);
+            }
+        }
+
+        /* Application filesystem scanning. */
+        std::shared_ptr<fs::IStorage> application_storage;
+        if (R_SUCCEEDED(OpenFileStorage(std::addressof(application_storage), m_local_fs, application_path))) {
+            results.push_back(Measure("appfs.scan", iterations, 0, [&] () -> Result {
+                ProcessAsPfsContext ctx{};
+                R_RETURN(this->ProcessAsPfs(application_storage, std::addressof(ctx)));
+            }));
+        } else {
+            fprintf(stderr, "[Warning]: Failed to open benchmark application (%s)\n", application_path);
+        }
+
+        /* Game card partition mounting. */
+        std::shared_ptr<fs::IStorage> game_card_storage;
+        if (R_SUCCEEDED(OpenFileStorage(std::addressof(game_card_storage), m_local_fs, game_card_path))) {
+            results.push_back(Measure("xci.mount", iterations, 0, [&] () -> Result {
+                ProcessAsXciContext ctx{};
+                R_RETURN(this->ProcessAsXci(game_card_storage, std::addressof(ctx)));
+            }));
+        } else {
+            fprintf(stderr, "[Warning]: Failed to open benchmark game card (%s)\n", game_card_path);
+        }
+
+        /* Report. */
+        const auto json = FormatBenchmarkJson(results, iterations);
+        if (m_options.bench_json_out_path != nullptr) {
+            R_TRY(SaveToFile(m_local_fs, m_options.bench_json_out_path, json.data(), json.size()));
+
+            printf("Benchmark (%d iterations):\n", iterations);
+            for (const auto &bench : results) {
+                if (R_SUCCEEDED(bench.result) && !bench.samples_ns.empty()) {
+                    printf("    %-28s p50 %10.3f ms    p99 %10.3f ms\n", bench.name, bench.GetPercentile(50) / 1'000'000.0, bench.GetPercentile(99) / 1'000'000.0);
+                } else {
+                    printf("    %-28s failed (2%03d-%04d)\n", bench.name, bench.result.GetModule(), bench.result.GetDescription());
+                }
+            }
+        } else {
+            printf("%s", json.c_str());
+        }
+
+        R_SUCCEED();
+    }
+
+}
+
+#endif
@@ -0,0 +1,1089 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include <exosphere/pkg1.hpp>
+#include "hactool_processor.hpp"
+#include "hactool_fs_utils.hpp"
+#include "hactool_fixture_images.hpp"
+#include "hactool_aes.hpp"
+#include "hactool_memory_utils.hpp"
+#include "hactool_xci_layout.hpp"
+
+#if defined(HACTOOL_BUILD_FIXTURE_GENERATOR)
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr size_t AesKeySize  = crypto::AesEncryptor128::KeySize;
+        constexpr size_t HashSize    = crypto::Sha256Generator::HashSize;
+        constexpr size_t RsaKeySize  = crypto::Rsa2048PssSha256Verifier::ModulusSize;
+        constexpr size_t SectorSize  = 0x200;
+
+        constexpr size_t NcaFullHeaderSize = sizeof(fssystem::NcaHeader) + fssystem::NcaHeader::FsCountMax * sizeof(fssystem::NcaFsHeader);
+
+        constexpr u64 FixtureApplicationId = UINT64_C(0x0100F1C5F1C50000);
+        constexpr u64 FixturePatchId       = FixtureApplicationId | 0x800;
+
+        constexpr size_t FixtureMainSize          = 256_KB;
+        constexpr size_t ExeFsHashBlockSize       = 64_KB;
+        constexpr size_t MetaHashBlockSize        = 4_KB;
+        constexpr s64    PatchChunkSize           = 16_KB;
+        constexpr s64    CompressionChunkSize     = 64_KB;
+        constexpr s64    CompressionEntrySizeMax  = 4_MB;
+
+        constexpr u8 CompressionType_None  = 0;
+        constexpr u8 CompressionType_Zeros = 1;
+        constexpr u8 CompressionType_Lz4   = 3;
+
+        constexpr s32 SparseStorageIndex_Data = 0;
+        constexpr s32 SparseStorageIndex_Zero = 1;
+
+        constexpr u8 AesCtrExEncryption_Encrypted = 0;
+
+        /* Test signing key for ACIDs and NCA header signature 2. It is not a console key, and is only ever used for fixtures. */
+        constexpr const u8 FixtureRsaModulus[RsaKeySize] = {
+            0xBA, 0xBD, 0x31, 0x56, 0x7B, 0x1B, 0xC9, 0x2C, 0x69, 0xDA, 0xB4, 0x99, 0xA5, 0x04, 0xEA, 0xB0,
+            0x0F, 0xA6, 0x6D, 0x9C, 0xE4, 0x6F, 0x59, 0x7B, 0xBC, 0x14, 0x44, 0x54, 0xA8, 0x0D, 0x3C, 0x59,
+            0x80, 0x10, 0x52, 0x67, 0x47, 0x1B, 0x8E, 0x43, 0x71, 0xDF, 0x1D, 0xFE, 0x1B, 0x52, 0x9E, 0x13,
+            0xA1, 0x96, 0xC4, 0xA1, 0x0D, 0xB8, 0x0E, 0xE7, 0x4B, 0x53, 0x9B, 0xD7, 0x06, 0xFD, 0xD7, 0x2C,
+            0xB9, 0xA9, 0x6C, 0x76, 0x15, 0xE3, 0xA1, 0x45, 0x2B, 0x42, 0x39, 0x9A, 0xF3, 0x57, 0xFB, 0xEC,
+            0x9B, 0x98, 0x85, 0xA9, 0xB2, 0x31, 0xF9, 0x2B, 0xBC, 0x7C, 0x99, 0xEB, 0x64, 0x74, 0x18, 0x85,
+            0xE2, 0x66, 0x38, 0xB5, 0x3B, 0x87, 0xC6, 0x47, 0xC5, 0x56, 0xFB, 0x8E, 0x6C, 0xBE, 0x8D, 0x54,
+            0xDD, 0x09, 0xBA, 0x00, 0x57, 0x99, 0x97, 0x96, 0xEF, 0xBF, 0xD7, 0xB0, 0xD7, 0xFF, 0xB6, 0xB0,
+            0x1B, 0xE0, 0x7A, 0x47, 0x65, 0x0C, 0x0B, 0x17, 0x75, 0xFC, 0x34, 0x61, 0x8B, 0xCC, 0xA6, 0xBA,
+            0xD6, 0x6C, 0x09, 0xE5, 0xF6, 0x13, 0xA5, 0x52, 0xE6, 0x75, 0xA4, 0x15, 0x3A, 0x92, 0x55, 0x61,
+            0x8B, 0xDB, 0x77, 0x30, 0x4B, 0xB6, 0xA7, 0xD7, 0xFB, 0x31, 0xAC, 0x6D, 0xAA, 0x8B, 0x77, 0x77,
+            0xE8, 0x6B, 0x49, 0xB1, 0x28, 0xDF, 0xC6, 0x10, 0x14, 0x0E, 0xE3, 0x2E, 0x98, 0x21, 0xC8, 0xD1,
+            0x32, 0xCD, 0x28, 0x2D, 0xF3, 0x97, 0xE5, 0x6E, 0x75, 0x35, 0xFA, 0xC2, 0x89, 0x68, 0x17, 0x6E,
+            0x51, 0x10, 0x41, 0x5D, 0x14, 0xF7, 0x8D, 0xAE, 0xB5, 0x36, 0xB4, 0x35, 0x7E, 0x2E, 0xB9, 0xB0,
+            0x5F, 0x27, 0x88, 0xCA, 0xCD, 0x3C, 0x29, 0xDF, 0x9B, 0xA1, 0x7B, 0x25, 0x79, 0xAA, 0x40, 0xC2,
+            0xDE, 0x7A, 0x41, 0xDB, 0xA6, 0x0B, 0x58, 0x06, 0x2B, 0x35, 0x22, 0x06, 0x6C, 0xAA, 0x7F, 0x11,        };
+
+        constexpr const u8 FixtureRsaPrivateExponent[RsaKeySize] = {
+            0x00, 0x00, 0xF9, 0x0A, 0xF7, 0xE0, 0x0D, 0x91, 0xDA, 0xB2, 0x32, 0x7A, 0x4C, 0xFE, 0xF4, 0xA0,
+            0x8B, 0xED, 0x07, 0xF0, 0x2C, 0x03, 0x15, 0xC6, 0xD5, 0xB8, 0xA4, 0x5B, 0x55, 0x02, 0x6B, 0xDE,
+            0xDA, 0x48, 0xE3, 0x68, 0x17, 0x98, 0x12, 0x12, 0xFA, 0x85, 0xF6, 0x49, 0xA5, 0xDE, 0xA9, 0x67,
+            0x75, 0x82, 0xD9, 0x2C, 0xC6, 0xC3, 0x36, 0x1D, 0xD9, 0xBA, 0x65, 0xB1, 0x54, 0x39, 0x49, 0x82,
+            0x92, 0xB0, 0x41, 0xA5, 0x59, 0xD6, 0xE0, 0x13, 0xEB, 0x28, 0xD5, 0x56, 0x0A, 0x22, 0xB0, 0xD3,
+            0xE8, 0xFB, 0x0B, 0xD2, 0xA2, 0x68, 0x1F, 0xA7, 0xA0, 0x4E, 0xEC, 0x74, 0x7B, 0x06, 0xB6, 0x89,
+            0x08, 0x68, 0x03, 0x03, 0x97, 0xBB, 0xB7, 0x68, 0x7A, 0x9B, 0x04, 0xC4, 0x93, 0xCB, 0x42, 0x46,
+            0x05, 0xCE, 0x2E, 0x16, 0x39, 0x99, 0x18, 0xF6, 0x83, 0x99, 0x96, 0x59, 0x6A, 0x51, 0x2C, 0xAE,
+            0x71, 0x89, 0x3D, 0x89, 0x0F, 0x98, 0x56, 0xD4, 0xF5, 0xF2, 0xE3, 0xE0, 0x45, 0xFE, 0x43, 0xC0,
+            0xB8, 0xB4, 0xC6, 0xB1, 0xDA, 0xF8, 0x2A, 0x0B, 0x98, 0xC1, 0xB3, 0xA7, 0x4F, 0x26, 0x1F, 0xB8,
+            0x3C, 0xDC, 0x7E, 0x34, 0xDE, 0xAE, 0x76, 0x71, 0x5B, 0x6D, 0xFA, 0x88, 0x9F, 0x85, 0x9C, 0xFC,
+            0x0B, 0xBE, 0xEE, 0x50, 0x8C, 0xAC, 0x67, 0xD6, 0x97, 0x2F, 0x4D, 0xC9, 0x01, 0x88, 0x6B, 0x38,
+            0x22, 0x4A, 0x05, 0x07, 0x6F, 0x77, 0x62, 0xB7, 0x12, 0x12, 0xCC, 0x4C, 0xD6, 0x1C, 0xA7, 0xF7,
+            0xF6, 0x1F, 0x7E, 0xEE, 0x27, 0x34, 0x92, 0x3E, 0xAA, 0x6F, 0x7F, 0xC9, 0x19, 0xEA, 0xB2, 0x18,
+            0xD1, 0xCF, 0xC7, 0x0B, 0xE3, 0x11, 0x6F, 0xD5, 0x22, 0x60, 0xF8, 0x32, 0x1E, 0x71, 0xBD, 0x95,
+            0x75, 0xA5, 0xA7, 0xA0, 0x45, 0x07, 0xF8, 0x08, 0x2E, 0xA7, 0xD2, 0xC0, 0xE6, 0x9F, 0xA3, 0x81,        };
+
+        /* Content meta, as stored inside a meta nca. */
+        struct ContentMetaHeader {
+            u64 id;
+            u32 version;
+            u8 type;
+            u8 platform;
+            u16 extended_header_size;
+            u16 content_count;
+            u16 content_meta_count;
+            u8 attributes;
+            u8 storage_id;
+            u8 install_type;
+            u8 reserved_17;
+            u32 required_download_system_version;
+            u8 reserved_1C[4];
+        };
+        static_assert(sizeof(ContentMetaHeader) == 0x20);
+
+        struct ApplicationMetaExtendedHeader {
+            u64 patch_id;
+            u32 required_system_version;
+            u32 required_application_version;
+        };
+        static_assert(sizeof(ApplicationMetaExtendedHeader) == 0x10);
+
+        struct PatchMetaExtendedHeader {
+            u64 application_id;
+            u32 required_system_version;
+            u32 extended_data_size;
+            u8 reserved[8];
+        };
+        static_assert(sizeof(PatchMetaExtendedHeader) == 0x18);
+
+        struct PackagedContentInfo {
+            u8 hash[HashSize];
+            u8 content_id[sizeof(ncm::ContentId)];
+            u8 size[6];
+            u8 content_type;
+            u8 id_offset;
+        };
+        static_assert(sizeof(PackagedContentInfo) == 0x38);
+
+        constexpr u8 ContentMetaType_Application = 0x80;
+        constexpr u8 ContentMetaType_Patch       = 0x81;
+
+        constexpr u8 ContentType_Meta    = 0;
+        constexpr u8 ContentType_Program = 1;
+
+        /* Access control blocks inside an npdm. */
+        struct FsAccessControlDescriptor {
+            u8 version;
+            u8 content_owner_id_count;
+            u8 save_data_owner_id_count;
+            u8 reserved;
+            u64 flags;
+            u64 content_owner_id_min;
+            u64 content_owner_id_max;
+            u64 save_data_owner_id_min;
+            u64 save_data_owner_id_max;
+        } PACKED;
+        static_assert(sizeof(FsAccessControlDescriptor) == 0x2C);
+
+        struct FsAccessControlData {
+            u8 version;
+            u8 reserved[3];
+            u64 flags;
+            u32 content_owner_info_offset;
+            u32 content_owner_info_size;
+            u32 save_data_owner_info_offset;
+            u32 save_data_owner_info_size;
+        } PACKED;
+        static_assert(sizeof(FsAccessControlData) == 0x1C);
+
+        constexpr const char * const FixtureServiceNames[] = { "fsp-srv", "hid", "lm", "set" };
+
+        constexpr u32 FixtureKernelCapabilities[] = {
+            (3u << 24) | (0u << 16) | (28u << 10) | (59u << 4) | 0x7, /* CorePriority: cores 0-3, priorities 28-59. */
+            (0u << 29) | (0xFFFFFFu << 5) | 0xF,                      /* SyscallMask: every syscall. */
+            (1u << 29) | (0xFFFFFFu << 5) | 0xF,
+            (2u << 29) | (0xFFFFFFu << 5) | 0xF,
+            (3u << 29) | (0xFFFFFFu << 5) | 0xF,
+            (4u << 29) | (0xFFFFFFu << 5) | 0xF,
+            (5u << 29) | (0xFFFFFFu << 5) | 0xF,
+            (1023u << 16) | 0x7FFF,                                   /* HandleTable: 1023 handles. */
+            (3u << 19) | (0u << 15) | 0x3FFF,                         /* KernelVersion: 3.0. */
+        };
+
+        struct FixtureSection {
+            fssystem::NcaFsHeader header;
+            std::vector<u8> image;
+            std::vector<FixtureAesCtrExEntry> aes_ctr_ex_entries;
+            std::vector<FixtureIndirectEntry> sparse_entries;
+            std::vector<std::pair<s64, s64>> base_ranges; /* For patches: the (offset, size) ranges read from the base. */
+        };
+
+        template<typename T>
+        void AppendPod(std::vector<u8> *out, const T &v) {
+            const u8 *p = reinterpret_cast<const u8 *>(std::addressof(v));
+            out->insert(out->end(), p, p + sizeof(T));
+        }
+
+        void AppendBytes(std::vector<u8> *out, const void *data, size_t size) {
+            const u8 *p = static_cast<const u8 *>(data);
+            out->insert(out->end(), p, p + size);
+        }
+
+        void GenerateRandomBytes(util::TinyMT &rng, void *dst, size_t size) {
+            rng.GenerateRandomBytes(dst, size);
+        }
+
+        std::vector<u8> GenerateRandomData(util::TinyMT &rng, size_t size) {
+            std::vector<u8> data(size);
+            GenerateRandomBytes(rng, data.data(), data.size());
+            return data;
+        }
+
+        /* RSA-2048-PSS-SHA256 signing of a message hash with the fixture key. */
+        void SignWithFixtureKey(u8 *dst, const u8 *hash, util::TinyMT &rng) {
+            constexpr size_t SaltSize   = HashSize;
+            constexpr size_t MaskedSize = RsaKeySize - HashSize - 1;
+
+            /* H = SHA256(0^64 || mHash || salt). */
+            u8 salt[SaltSize];
+            GenerateRandomBytes(rng, salt, sizeof(salt));
+
+            u8 m_prime[8 + HashSize + SaltSize] = {};
+            std::memcpy(m_prime + 8, hash, HashSize);
+            std::memcpy(m_prime + 8 + HashSize, salt, SaltSize);
+
+            u8 em[RsaKeySize] = {};
+            crypto::GenerateSha256(em + MaskedSize, HashSize, m_prime, sizeof(m_prime));
+            em[RsaKeySize - 1] = 0xBC;
+
+            /* DB = PS || 0x01 || salt, masked with MGF1(H). */
+            em[MaskedSize - SaltSize - 1] = 0x01;
+            std::memcpy(em + MaskedSize - SaltSize, salt, SaltSize);
+
+            for (u32 counter = 0; counter * HashSize < MaskedSize; ++counter) {
+                u8 seed[HashSize + sizeof(u32)];
+                std::memcpy(seed, em + MaskedSize, HashSize);
+                util::StoreBigEndian(reinterpret_cast<u32 *>(seed + HashSize), counter);
+
+                u8 mask[HashSize];
+                crypto::GenerateSha256(mask, sizeof(mask), seed, sizeof(seed));
+
+                for (size_t i = 0; i < HashSize && counter * HashSize + i < MaskedSize; ++i) {
+                    em[counter * HashSize + i] ^= mask[i];
+                }
+            }
+            em[0] &= 0x7F;
+
+            /* s = em^d mod n. */
+            crypto::RsaCalculator<RsaKeySize, RsaKeySize> calculator;
+            AMS_ABORT_UNLESS(calculator.Initialize(FixtureRsaModulus, sizeof(FixtureRsaModulus), FixtureRsaPrivateExponent, sizeof(FixtureRsaPrivateExponent)));
+            AMS_ABORT_UNLESS(calculator.ExpMod(dst, em, RsaKeySize));
+        }
+
+        s64 PickFileSize(const Options &options, util::TinyMT &rng) {
+            const s64 min_size = std::max(options.fixture_min_file_size, 0);
+            const s64 max_size = std::max<s64>(options.fixture_max_file_size, min_size);
+
+            switch (options.fixture_size_distribution) {
+                case FixtureSizeDistribution::Fixed:
+                    return max_size;
+                case FixtureSizeDistribution::Uniform:
+                    return min_size + static_cast<s64>(rng.GenerateRandomU64() % static_cast<u64>(max_size - min_size + 1));
+                case FixtureSizeDistribution::LogUniform:
+                    {
+                        const double lo = std::log(static_cast<double>(std::max<s64>(min_size, 1)));
+                        const double hi = std::log(static_cast<double>(std::max<s64>(max_size, 1)));
+                        const double u  = static_cast<double>(rng.GenerateRandomU32()) / 4294967296.0;
+                        return std::clamp<s64>(static_cast<s64>(std::exp(lo + (hi - lo) * u)), min_size, max_size);
+                    }
+                AMS_UNREACHABLE_DEFAULT_CASE();
+            }
+        }
+
+        enum class FileContent {
+            Random,
+            ZeroRun,
+            Repetitive,
+        };
+
+        FileContent GetFileContent(size_t index) {
+            switch (index % 4) {
+                case 1:  return FileContent::Repetitive;
+                case 3:  return FileContent::ZeroRun;
+                default: return FileContent::Random;
+            }
+        }
+
+        std::vector<u8> GenerateFileData(const Options &options, util::TinyMT &rng, FileContent content) {
+            auto data = GenerateRandomData(rng, PickFileSize(options, rng));
+
+            switch (content) {
+                case FileContent::Random:
+                    break;
+                case FileContent::ZeroRun:
+                    /* Leave runs of zeroes for the compression layer to find. */
+                    std::memset(data.data() + data.size() / 2, 0, data.size() - data.size() / 2);
+                    break;
+                case FileContent::Repetitive:
+                    {
+                        /* Repeat a short phrase with the odd byte changed, so that lz4 has matches to find. */
+                        const size_t phrase_size = 0x20 + rng.GenerateRandomU32() % 0xE0;
+                        for (size_t i = phrase_size; i < data.size(); ++i) {
+                            if ((rng.GenerateRandomU32() % 0x40) != 0) {
+                                data[i] = data[i - phrase_size];
+                            }
+                        }
+                    }
+                    break;
+                AMS_UNREACHABLE_DEFAULT_CASE();
+            }
+
+            return data;
+        }
+
+        void GenerateRomFsFiles(std::vector<FixtureFile> *out, const Options &options, util::TinyMT &rng) {
+            const s32 file_count = std::max(options.fixture_file_count, 1);
+            const s32 dir_count  = std::max(file_count / 32, 1);
+
+            out->clear();
+            for (s32 i = 0; i < file_count; ++i) {
+                char path[0x40];
+                util::TSNPrintf(path, sizeof(path), "/dir%03d/file%05d.bin", i % dir_count, i);
+
+                out->push_back(FixtureFile{ path, GenerateFileData(options, rng, GetFileContent(i)) });
+            }
+        }
+
+        void UpdateRomFsFiles(std::vector<FixtureFile> *files, const Options &options, util::TinyMT &rng, s32 generation) {
+            /* Rewrite an eighth of the files, and add one new file per update. */
+            for (size_t i = 0; i < files->size(); ++i) {
+                if ((i + generation) % 8 == 0) {
+                    (*files)[i].data = GenerateFileData(options, rng, GetFileContent(i));
+                }
+            }
+
+            char path[0x40];
+            util::TSNPrintf(path, sizeof(path), "/update/v%d.bin", generation);
+            files->push_back(FixtureFile{ path, GenerateFileData(options, rng, GetFileContent(files->size())) });
+        }
+
+        void BuildNpdm(std::vector<u8> *out, u64 program_id, util::TinyMT &rng) {
+            /* Build the service access control. */
+            std::vector<u8> sac;
+            for (const auto *name : FixtureServiceNames) {
+                const size_t len = std::strlen(name);
+                sac.push_back(static_cast<u8>(len - 1));
+                AppendBytes(std::addressof(sac), name, len);
+            }
+
+            /* Build the filesystem access control. */
+            const FsAccessControlDescriptor fac = { 1, 0, 0, 0, ~UINT64_C(0), 0, 0, 0, 0 };
+            const FsAccessControlData fah       = { 1, {}, ~UINT64_C(0), sizeof(FsAccessControlData), 0, sizeof(FsAccessControlData), 0 };
+
+            /* Lay out the acid. */
+            std::vector<u8> acid(sizeof(ldr::Acid), 0);
+            const size_t acid_fac_offset = acid.size();
+            AppendPod(std::addressof(acid), fac);
+            acid.resize(util::AlignUp(acid.size(), 0x10), 0);
+            const size_t acid_sac_offset = acid.size();
+            AppendBytes(std::addressof(acid), sac.data(), sac.size());
+            acid.resize(util::AlignUp(acid.size(), 0x10), 0);
+            const size_t acid_kac_offset = acid.size();
+            AppendBytes(std::addressof(acid), FixtureKernelCapabilities, sizeof(FixtureKernelCapabilities));
+
+            {
+                auto &acid_header = *reinterpret_cast<ldr::Acid *>(acid.data());
+                acid_header.magic          = ldr::Acid::Magic;
+                acid_header.size           = acid.size() - sizeof(acid_header.signature);
+                acid_header.flags          = 1;
+                acid_header.program_id_min = { program_id };
+                acid_header.program_id_max = { program_id };
+                acid_header.fac_offset     = acid_fac_offset;
+                acid_header.fac_size       = sizeof(fac);
+                acid_header.sac_offset     = acid_sac_offset;
+                acid_header.sac_size       = sac.size();
+                acid_header.kac_offset     = acid_kac_offset;
+                acid_header.kac_size       = sizeof(FixtureKernelCapabilities);
+                std::memcpy(acid_header.modulus, FixtureRsaModulus, sizeof(acid_header.modulus));
+
+                /* The acid signature can only be checked against console keys; sign it with the fixture key so that it is well-formed. */
+                u8 hash[HashSize];
+                crypto::GenerateSha256(hash, sizeof(hash), acid_header.modulus, acid_header.size);
+                SignWithFixtureKey(acid_header.signature, hash, rng);
+            }
+
+            /* Lay out the aci. */
+            std::vector<u8> aci(sizeof(ldr::Aci), 0);
+            const size_t aci_fah_offset = aci.size();
+            AppendPod(std::addressof(aci), fah);
+            aci.resize(util::AlignUp(aci.size(), 0x10), 0);
+            const size_t aci_sac_offset = aci.size();
+            AppendBytes(std::addressof(aci), sac.data(), sac.size());
+            aci.resize(util::AlignUp(aci.size(), 0x10), 0);
+            const size_t aci_kac_offset = aci.size();
+            AppendBytes(std::addressof(aci), FixtureKernelCapabilities, sizeof(FixtureKernelCapabilities));
+
+            {
+                auto &aci_header = *reinterpret_cast<ldr::Aci *>(aci.data());
+                aci_header.magic      = ldr::Aci::Magic;
+                aci_header.program_id = { program_id };
+                aci_header.fah_offset = aci_fah_offset;
+                aci_header.fah_size   = sizeof(fah);
+                aci_header.sac_offset = aci_sac_offset;
+                aci_header.sac_size   = sac.size();
+                aci_header.kac_offset = aci_kac_offset;
+                aci_header.kac_size   = sizeof(FixtureKernelCapabilities);
+            }
+
+            /* Lay out the npdm. */
+            out->assign(sizeof(ldr::Npdm), 0);
+            const size_t acid_offset = out->size();
+            AppendBytes(out, acid.data(), acid.size());
+            out->resize(util::AlignUp(out->size(), 0x10), 0);
+            const size_t aci_offset = out->size();
+            AppendBytes(out, aci.data(), aci.size());
+
+            auto &npdm = *reinterpret_cast<ldr::Npdm *>(out->data());
+            npdm.magic                  = ldr::Npdm::Magic;
+            npdm.flags                  = ldr::Npdm::MetaFlag_Is64Bit | (ldr::Npdm::AddressSpaceType_64Bit << ldr::Npdm::MetaFlag_AddressSpaceTypeShift);
+            npdm.main_thread_priority   = 44;
+            npdm.default_cpu_id         = 0;
+            npdm.main_thread_stack_size = 1_MB;
+            npdm.acid_offset            = acid_offset;
+            npdm.acid_size              = acid.size();
+            npdm.aci_offset             = aci_offset;
+            npdm.aci_size               = aci.size();
+            util::Strlcpy(npdm.program_name, "Fixture", sizeof(npdm.program_name));
+        }
+
+        void BuildContentMeta(std::vector<u8> *out, u8 type, u64 id, u32 version, const std::vector<std::pair<const std::vector<u8> *, u8>> &contents) {
+            const bool is_patch = type == ContentMetaType_Patch;
+
+            ContentMetaHeader header = {};
+            header.id                   = id;
+            header.version              = version;
+            header.type                 = type;
+            header.extended_header_size = is_patch ? sizeof(PatchMetaExtendedHeader) : sizeof(ApplicationMetaExtendedHeader);
+            header.content_count        = contents.size();
+
+            out->clear();
+            AppendPod(out, header);
+            if (is_patch) {
+                AppendPod(out, PatchMetaExtendedHeader{ FixtureApplicationId, 0, 0, {} });
+            } else {
+                AppendPod(out, ApplicationMetaExtendedHeader{ FixturePatchId, 0, 0 });
+            }
+
+            for (const auto &[nca, content_type] : contents) {
+                PackagedContentInfo info = {};
+                crypto::GenerateSha256(info.hash, sizeof(info.hash), nca->data(), nca->size());
+                std::memcpy(info.content_id, info.hash, sizeof(info.content_id));
+                for (size_t i = 0; i < sizeof(info.size); ++i) {
+                    info.size[i] = static_cast<u8>(static_cast<u64>(nca->size()) >> (8 * i));
+                }
+                info.content_type = content_type;
+                AppendPod(out, info);
+            }
+
+            /* Digest. */
+            out->resize(out->size() + HashSize, 0);
+        }
+
+        void GetContentIdFileName(char *dst, size_t dst_size, const std::vector<u8> &nca, const char *extension) {
+            u8 hash[HashSize];
+            crypto::GenerateSha256(hash, sizeof(hash), nca.data(), nca.size());
+
+            ncm::ContentId content_id;
+            std::memcpy(std::addressof(content_id), hash, sizeof(content_id));
+
+            util::TSNPrintf(dst, dst_size, "%s%s", ncm::GetContentIdString(content_id).data, extension);
+        }
+
+        void InitializeSectionHeader(FixtureSection *section, fssystem::NcaFsHeader::FsType fs_type, fssystem::NcaFsHeader::HashType hash_type, fssystem::NcaFsHeader::EncryptionType encryption_type, util::TinyMT &rng) {
+            section->header = {};
+            section->header.version         = 2;
+            section->header.fs_type         = fs_type;
+            section->header.hash_type       = hash_type;
+            section->header.encryption_type = encryption_type;
+            section->header.aes_ctr_upper_iv.part.secure_value = rng.GenerateRandomU32();
+        }
+
+        void MakePartitionFsSection(FixtureSection *out, const std::vector<FixtureFile> &files, size_t hash_block_size, util::TinyMT &rng) {
+            InitializeSectionHeader(out, fssystem::NcaFsHeader::FsType::PartitionFs, fssystem::NcaFsHeader::HashType::HierarchicalSha256Hash, fssystem::NcaFsHeader::EncryptionType::AesCtr, rng);
+
+            std::vector<u8> pfs;
+            BuildPartitionFileSystemImage(std::addressof(pfs), files);
+            BuildHierarchicalSha256Image(std::addressof(out->image), std::addressof(out->header.hash_data.hierarchical_sha256_data), pfs, hash_block_size);
+        }
+
+        void CompressSectionImage(FixtureSection *section) {
+            /* Store zero-filled chunks as zero entries, chunks lz4 can shrink as lz4 blocks, and everything else uncompressed. */
+            const auto &virtual_image = section->image;
+            const s64 virtual_size = virtual_image.size();
+
+            std::vector<u8> physical_image, compressed;
+            std::vector<FixtureCompressionEntry> entries;
+            for (s64 ofs = 0; ofs < virtual_size; ofs += CompressionChunkSize) {
+                const s64 cur_size = std::min(CompressionChunkSize, virtual_size - ofs);
+                const u8 *cur_data = virtual_image.data() + ofs;
+
+                u8 type = CompressionType_None;
+                if (IsZeroFilled(cur_data, cur_size)) {
+                    type = CompressionType_Zeros;
+                } else if (CompressLz4Block(std::addressof(compressed), cur_data, cur_size)) {
+                    type = CompressionType_Lz4;
+                }
+
+                /* Each lz4 block needs its own entry; other runs are merged. */
+                auto *last = entries.empty() ? nullptr : std::addressof(entries.back());
+                const s64 last_size = last != nullptr ? ofs - last->virt_offset : 0;
+                if (type != CompressionType_Lz4 && last != nullptr && last->compression_type == type && last_size + cur_size <= CompressionEntrySizeMax) {
+                    if (type == CompressionType_None) {
+                        last->phys_size += cur_size;
+                    }
+                } else {
+                    u32 phys_size = 0;
+                    if (type == CompressionType_None) {
+                        phys_size = cur_size;
+                    } else if (type == CompressionType_Lz4) {
+                        phys_size = compressed.size();
+                    }
+                    entries.push_back(FixtureCompressionEntry{ ofs, static_cast<s64>(physical_image.size()), type, 0, 0, phys_size });
+                }
+
+                if (type == CompressionType_None) {
+                    AppendBytes(std::addressof(physical_image), cur_data, cur_size);
+                } else if (type == CompressionType_Lz4) {
+                    AppendBytes(std::addressof(physical_image), compressed.data(), compressed.size());
+                }
+            }
+
+            /* Append the table. */
+            FixtureBucketTreeHeader table_header;
+            std::vector<u8> table;
+            BuildBucketTree(std::addressof(table), std::addressof(table_header), entries, virtual_size);
+
+            physical_image.resize(util::AlignUp(physical_image.size(), SectorSize), 0);
+
+            auto &compression_info = section->header.compression_info;
+            compression_info.bucket.offset = physical_image.size();
+            compression_info.bucket.size   = table.size();
+            std::memcpy(compression_info.bucket.header, std::addressof(table_header), sizeof(table_header));
+
+            AppendBytes(std::addressof(physical_image), table.data(), table.size());
+            section->image = std::move(physical_image);
+        }
+
+        void MakeRomFsSection(FixtureSection *out, const std::vector<FixtureFile> &files, bool compress, util::TinyMT &rng) {
+            InitializeSectionHeader(out, fssystem::NcaFsHeader::FsType::RomFs, fssystem::NcaFsHeader::HashType::HierarchicalIntegrityHash, fssystem::NcaFsHeader::EncryptionType::AesCtr, rng);
+
+            std::vector<u8> romfs;
+            BuildRomFsImage(std::addressof(romfs), files);
+            BuildHierarchicalIntegrityImage(std::addressof(out->image), std::addressof(out->header.hash_data.integrity_meta_info), romfs);
+
+            if (compress) {
+                CompressSectionImage(out);
+            }
+        }
+
+        void MakePatchRomFsSection(FixtureSection *out, const std::vector<u8> &base_image, const std::vector<FixtureFile> &files, s32 generation, bool compress, util::TinyMT &rng) {
+            InitializeSectionHeader(out, fssystem::NcaFsHeader::FsType::RomFs, fssystem::NcaFsHeader::HashType::HierarchicalIntegrityHash, fssystem::NcaFsHeader::EncryptionType::AesCtrEx, rng);
+            out->header.aes_ctr_upper_iv.part.generation = generation;
+
+            /* Build the image the patch presents. The compression layer sits above the indirect layer, so the patch is made against the (compressed) base image. */
+            std::vector<u8> romfs;
+            BuildRomFsImage(std::addressof(romfs), files);
+            BuildHierarchicalIntegrityImage(std::addressof(out->image), std::addressof(out->header.hash_data.integrity_meta_info), romfs);
+            if (compress) {
+                CompressSectionImage(out);
+            }
+
+            const std::vector<u8> virtual_image = std::move(out->image);
+
+            /* Reference the base wherever it already holds the right data, and carry everything else in the patch. */
+            const s64 virtual_size = virtual_image.size();
+
+            std::vector<u8> patch_data;
+            std::vector<FixtureIndirectEntry> indirect_entries;
+            out->base_ranges.clear();
+            s32 last_index = -1;
+            for (s64 ofs = 0; ofs < virtual_size; ofs += PatchChunkSize) {
+                const s64 cur_size = std::min(PatchChunkSize, virtual_size - ofs);
+                const bool same_as_base = ofs + cur_size <= static_cast<s64>(base_image.size()) && std::memcmp(virtual_image.data() + ofs, base_image.data() + ofs, cur_size) == 0;
+                const s32 storage_index = same_as_base ? 0 : 1;
+
+                if (storage_index != last_index) {
+                    const s64 phys_offset = same_as_base ? ofs : static_cast<s64>(patch_data.size());
+
+                    FixtureIndirectEntry entry = {};
+                    std::memcpy(entry.virt_offset, std::addressof(ofs), sizeof(entry.virt_offset));
+                    std::memcpy(entry.phys_offset, std::addressof(phys_offset), sizeof(entry.phys_offset));
+                    entry.storage_index = storage_index;
+                    indirect_entries.push_back(entry);
+
+                    last_index = storage_index;
+                }
+
+                if (same_as_base) {
+                    if (!out->base_ranges.empty() && out->base_ranges.back().first + out->base_ranges.back().second == ofs) {
+                        out->base_ranges.back().second += cur_size;
+                    } else {
+                        out->base_ranges.emplace_back(ofs, cur_size);
+                    }
+                } else {
+                    AppendBytes(std::addressof(patch_data), virtual_image.data() + ofs, cur_size);
+                }
+            }
+
+            /* Lay out the physical section: patch data, then the indirect table, then the aes-ctr-ex table. */
+            FixtureBucketTreeHeader indirect_header;
+            std::vector<u8> indirect_table;
+            BuildBucketTree(std::addressof(indirect_table), std::addressof(indirect_header), indirect_entries, virtual_size);
+
+            const s64 indirect_offset   = util::AlignUp(patch_data.size(), SectorSize);
+            const s64 aes_ctr_ex_offset = util::AlignUp(indirect_offset + indirect_table.size(), SectorSize);
+
+            /* Give the patch data and the indirect table separate counter entries. */
+            auto AddAesCtrExEntry = [&] (s64 offset) {
+                FixtureAesCtrExEntry entry = {};
+                std::memcpy(entry.offset, std::addressof(offset), sizeof(entry.offset));
+                entry.encryption_value = AesCtrExEncryption_Encrypted;
+                entry.generation       = generation;
+                out->aes_ctr_ex_entries.push_back(entry);
+            };
+
+            out->aes_ctr_ex_entries.clear();
+            AddAesCtrExEntry(0);
+            if (indirect_offset != 0) {
+                AddAesCtrExEntry(indirect_offset);
+            }
+
+            FixtureBucketTreeHeader aes_ctr_ex_header;
+            std::vector<u8> aes_ctr_ex_table;
+            BuildBucketTree(std::addressof(aes_ctr_ex_table), std::addressof(aes_ctr_ex_header), out->aes_ctr_ex_entries, aes_ctr_ex_offset);
+
+            out->image = std::move(patch_data);
+            out->image.resize(indirect_offset, 0);
+            AppendBytes(std::addressof(out->image), indirect_table.data(), indirect_table.size());
+            out->image.resize(aes_ctr_ex_offset, 0);
+            AppendBytes(std::addressof(out->image), aes_ctr_ex_table.data(), aes_ctr_ex_table.size());
+
+            auto &patch_info = out->header.patch_info;
+            patch_info.indirect_offset   = indirect_offset;
+            patch_info.indirect_size     = indirect_table.size();
+            patch_info.aes_ctr_ex_offset = aes_ctr_ex_offset;
+            patch_info.aes_ctr_ex_size   = aes_ctr_ex_table.size();
+            std::memcpy(patch_info.indirect_header, std::addressof(indirect_header), sizeof(indirect_header));
+            std::memcpy(patch_info.aes_ctr_ex_header, std::addressof(aes_ctr_ex_header), sizeof(aes_ctr_ex_header));
+        }
+
+        void MakeSparseSection(FixtureSection *out, const FixtureSection &base_section, const FixtureSection &patch_section, s32 generation) {
+            /* Keep only the parts of the base section the patch reads; the rest reads as zeroes. */
+            *out = base_section;
+            out->sparse_entries.clear();
+            out->header.sparse_info.generation = generation;
+
+            const s64 virtual_size = util::AlignUp(base_section.image.size(), SectorSize);
+
+            auto IsReadByPatch = [&] (s64 offset, s64 size) {
+                for (const auto &[range_offset, range_size] : patch_section.base_ranges) {
+                    if (range_offset < offset + size && offset < range_offset + range_size) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+
+            s64 phys_size  = 0;
+            s32 last_index = -1;
+            for (s64 ofs = 0; ofs < virtual_size; ofs += PatchChunkSize) {
+                const s64 cur_size = std::min(PatchChunkSize, virtual_size - ofs);
+                const s32 storage_index = IsReadByPatch(ofs, cur_size) ? SparseStorageIndex_Data : SparseStorageIndex_Zero;
+
+                if (storage_index != last_index) {
+                    const s64 phys_offset = storage_index == SparseStorageIndex_Data ? phys_size : ofs;
+
+                    FixtureIndirectEntry entry = {};
+                    std::memcpy(entry.virt_offset, std::addressof(ofs), sizeof(entry.virt_offset));
+                    std::memcpy(entry.phys_offset, std::addressof(phys_offset), sizeof(entry.phys_offset));
+                    entry.storage_index = storage_index;
+                    out->sparse_entries.push_back(entry);
+
+                    last_index = storage_index;
+                }
+
+                if (storage_index == SparseStorageIndex_Data) {
+                    phys_size += cur_size;
+                }
+            }
+        }
+
+        void EncryptSectionRange(u8 *data, size_t size, const u8 *key, fssystem::NcaAesCtrUpperIv upper_iv, s64 nca_offset) {
+            u8 iv[crypto::AesEncryptor128::BlockSize];
+            fssystem::AesCtrStorageBySharedPointer::MakeIv(iv, sizeof(iv), upper_iv.value, nca_offset);
+            ComputeAes128Ctr(data, data, size, key, iv);
+        }
+
+        void BuildNca(std::vector<u8> *out, const fssystem::NcaCryptoConfiguration &crypto_cfg, fssystem::NcaHeader::ContentType content_type, u64 program_id, std::vector<FixtureSection> &sections, util::TinyMT &rng) {
+            AMS_ABORT_UNLESS(sections.size() <= static_cast<size_t>(fssystem::NcaHeader::FsCountMax));
+
+            out->assign(NcaFullHeaderSize, 0);
+
+            auto *header    = reinterpret_cast<fssystem::NcaHeader *>(out->data());
+            auto *fs_header = reinterpret_cast<fssystem::NcaFsHeader *>(out->data() + sizeof(fssystem::NcaHeader));
+
+            header->magic                            = fssystem::NcaHeader::Magic;
+            header->distribution_type                = fssystem::NcaHeader::DistributionType::Download;
+            header->content_type                     = content_type;
+            header->key_generation                   = 0;
+            header->key_generation_2                 = 0;
+            header->key_index                        = 0;
+            header->program_id                       = program_id;
+            header->sdk_addon_version                = 0x000B0000;
+            header->header1_signature_key_generation = 0;
+
+            /* Generate the key area. The stored keys are random; the real keys are whatever they decrypt to under the keyset. */
+            u8 decryption_keys[fssystem::NcaHeader::DecryptionKey_Count][AesKeySize];
+            GenerateRandomBytes(rng, header->encrypted_key_area, sizeof(header->encrypted_key_area));
+            {
+                const s32 key_type = fssystem::GetKeyTypeValue(header->key_index, std::max(header->key_generation, header->key_generation_2));
+                for (s32 i = 0; i < fssystem::NcaHeader::DecryptionKey_Count; ++i) {
+                    crypto_cfg.generate_key(decryption_keys[i], AesKeySize, header->encrypted_key_area + i * AesKeySize, AesKeySize, key_type);
+                }
+            }
+            const u8 *ctr_key = decryption_keys[fssystem::NcaHeader::DecryptionKey_AesCtr];
+
+            /* Append and encrypt each section. */
+            for (size_t i = 0; i < sections.size(); ++i) {
+                auto &section = sections[i];
+
+                const s64 start = out->size();
+                const s64 size  = util::AlignUp(section.image.size(), SectorSize);
+
+                if (section.header.sparse_info.generation != 0) {
+                    /* The section keeps its full extents, which are only used for the counter, so nothing may follow it. */
+                    AMS_ABORT_UNLESS(i + 1 == sections.size());
+                    AMS_ABORT_UNLESS(section.header.encryption_type == fssystem::NcaFsHeader::EncryptionType::AesCtr);
+
+                    /* Data is encrypted as it would be in the full section, and only the data entries are stored. */
+                    std::vector<u8> encrypted(section.image);
+                    encrypted.resize(size, 0);
+                    EncryptSectionRange(encrypted.data(), size, ctr_key, section.header.aes_ctr_upper_iv, start);
+
+                    for (size_t j = 0; j < section.sparse_entries.size(); ++j) {
+                        const auto &entry = section.sparse_entries[j];
+                        const s64 entry_start = entry.GetOffset();
+                        const s64 entry_end   = (j + 1 < section.sparse_entries.size()) ? section.sparse_entries[j + 1].GetOffset() : size;
+                        if (entry.storage_index == SparseStorageIndex_Data) {
+                            out->insert(out->end(), encrypted.begin() + entry_start, encrypted.begin() + entry_end);
+                        }
+                    }
+
+                    /* The table follows the data, encrypted with the sparse generation. */
+                    FixtureBucketTreeHeader table_header;
+                    std::vector<u8> table;
+                    BuildBucketTree(std::addressof(table), std::addressof(table_header), section.sparse_entries, size);
+
+                    out->resize(util::AlignUp(out->size(), SectorSize), 0);
+                    const s64 table_offset = out->size() - start;
+                    AppendBytes(out, table.data(), table.size());
+                    out->resize(util::AlignUp(out->size(), SectorSize), 0);
+
+                    auto table_upper_iv = section.header.aes_ctr_upper_iv;
+                    table_upper_iv.part.generation = static_cast<u32>(section.header.sparse_info.generation) << 16;
+                    EncryptSectionRange(out->data() + start + table_offset, table.size(), ctr_key, table_upper_iv, start + table_offset);
+
+                    auto &sparse_info = section.header.sparse_info;
+                    sparse_info.bucket.offset   = table_offset;
+                    sparse_info.bucket.size     = table.size();
+                    sparse_info.physical_offset = start;
+                    std::memcpy(sparse_info.bucket.header, std::addressof(table_header), sizeof(table_header));
+
+                    /* NOTE: inserting may have moved the buffer. */
+                    header    = reinterpret_cast<fssystem::NcaHeader *>(out->data());
+                    fs_header = reinterpret_cast<fssystem::NcaFsHeader *>(out->data() + sizeof(fssystem::NcaHeader));
+                } else {
+                    out->insert(out->end(), section.image.begin(), section.image.end());
+                    out->resize(start + size, 0);
+
+                    /* NOTE: inserting may have moved the buffer. */
+                    header    = reinterpret_cast<fssystem::NcaHeader *>(out->data());
+                    fs_header = reinterpret_cast<fssystem::NcaFsHeader *>(out->data() + sizeof(fssystem::NcaHeader));
+
+                    u8 *data = out->data() + start;
+                    if (section.header.encryption_type == fssystem::NcaFsHeader::EncryptionType::AesCtrEx) {
+                        /* Data is encrypted per-entry with the entry's generation, and the table with the section's counter. */
+                        const s64 table_offset = section.header.patch_info.aes_ctr_ex_offset;
+                        for (size_t j = 0; j < section.aes_ctr_ex_entries.size(); ++j) {
+                            const auto &entry = section.aes_ctr_ex_entries[j];
+                            const s64 entry_start = entry.GetOffset();
+                            const s64 entry_end   = (j + 1 < section.aes_ctr_ex_entries.size()) ? section.aes_ctr_ex_entries[j + 1].GetOffset() : table_offset;
+                            if (entry.encryption_value != AesCtrExEncryption_Encrypted) {
+                                continue;
+                            }
+
+                            auto upper_iv = section.header.aes_ctr_upper_iv;
+                            upper_iv.part.generation = entry.generation;
+                            EncryptSectionRange(data + entry_start, entry_end - entry_start, ctr_key, upper_iv, start + entry_start);
+                        }
+
+                        EncryptSectionRange(data + table_offset, size - table_offset, ctr_key, section.header.aes_ctr_upper_iv, start + table_offset);
+                    } else {
+                        EncryptSectionRange(data, size, ctr_key, section.header.aes_ctr_upper_iv, start);
+                    }
+                }
+
+                header->fs_info[i].start_sector = start / SectorSize;
+                header->fs_info[i].end_sector   = (start + size) / SectorSize;
+
+                fs_header[i] = section.header;
+                crypto::GenerateSha256(header->fs_header_hash[i].value, sizeof(header->fs_header_hash[i].value), std::addressof(fs_header[i]), sizeof(fs_header[i]));
+            }
+
+            header->content_size = out->size();
+
+            /* Header signature 1 can only be made with console keys, so is left unset. Signature 2 uses the key in the fixture npdm. */
+            if (content_type == fssystem::NcaHeader::ContentType::Program) {
+                u8 hash[HashSize];
+                crypto::GenerateSha256(hash, sizeof(hash), std::addressof(header->magic), sizeof(fssystem::NcaHeader) - offsetof(fssystem::NcaHeader, magic));
+                SignWithFixtureKey(header->header_sign_2, hash, rng);
+            }
+
+            /* Encrypt the header. */
+            u8 header_keys[fssystem::NcaCryptoConfiguration::HeaderEncryptionKeyCount][AesKeySize];
+            for (size_t i = 0; i < util::size(header_keys); ++i) {
+                crypto_cfg.generate_key(header_keys[i], AesKeySize, crypto_cfg.header_encrypted_encryption_keys[i], AesKeySize, static_cast<s32>(fssystem::KeyType::NcaHeaderKey1) + i);
+            }
+            EncryptAes128Xts(out->data(), out->data(), NcaFullHeaderSize, header_keys[0], header_keys[1], 0, SectorSize);
+        }
+
+        constexpr s64 XciRootPartitionOffset = 0xF000;
+
+        gc::impl::MemoryCapacity GetXciMemoryCapacity(s64 size) {
+            constexpr std::pair<s64, gc::impl::MemoryCapacity> Capacities[] = {
+                { INT64_C(1) << 30, gc::impl::MemoryCapacity_1GB  },
+                { INT64_C(2) << 30, gc::impl::MemoryCapacity_2GB  },
+                { INT64_C(4) << 30, gc::impl::MemoryCapacity_4GB  },
+                { INT64_C(8) << 30, gc::impl::MemoryCapacity_8GB  },
+                { INT64_C(16) << 30, gc::impl::MemoryCapacity_16GB },
+            };
+
+            for (const auto &[capacity, memory_capacity] : Capacities) {
+                if (size <= capacity) {
+                    return memory_capacity;
+                }
+            }
+            return gc::impl::MemoryCapacity_32GB;
+        }
+
+        Result BuildXci(std::vector<u8> *out, const std::vector<FixtureFile> &secure_files, util::TinyMT &rng) {
+            /* Build the partitions. */
+            std::vector<FixtureFile> root_files;
+            for (const char *name : { "update", "normal", "secure" }) {
+                FixtureFile partition = { name, {}, 0 };
+                BuildSha256PartitionFileSystemImage(std::addressof(partition.data), std::addressof(partition.hash_target_size), std::strcmp(name, "secure") == 0 ? secure_files : std::vector<FixtureFile>{});
+                root_files.push_back(std::move(partition));
+            }
+
+            std::vector<u8> root;
+            size_t root_header_size;
+            BuildSha256PartitionFileSystemImage(std::addressof(root), std::addressof(root_header_size), root_files);
+
+            /* Lay out the card: initial data, then the body, whose root partition follows the header and certificates. */
+            out->assign(CardInitialDataRegionSize + XciRootPartitionOffset, 0);
+            AppendBytes(out, root.data(), root.size());
+
+            const s64 body_size = out->size() - CardInitialDataRegionSize;
+
+            gc::impl::CardHeaderWithSignature header = {};
+            header.data.magic                       = gc::impl::CardHeader::Magic;
+            header.data.rom_area_start_page         = XciRootPartitionOffset / CardPageSize;
+            header.data.backup_area_start_page      = 0xFFFFFFFF;
+            header.data.rom_size                    = GetXciMemoryCapacity(body_size);
+            header.data.valid_data_end_page         = body_size / CardPageSize - 1;
+            header.data.lim_area_page               = header.data.valid_data_end_page;
+            header.data.partition_fs_header_address = XciRootPartitionOffset;
+            header.data.partition_fs_header_size    = root_header_size;
+            crypto::GenerateSha256(header.data.partition_fs_header_hash, sizeof(header.data.partition_fs_header_hash), root.data(), root_header_size);
+            crypto::GenerateSha256(header.data.initial_data_hash, sizeof(header.data.initial_data_hash), out->data(), sizeof(gc::impl::CardInitialData));
+            GenerateRandomBytes(rng, header.data.package_id, sizeof(header.data.package_id));
+            GenerateRandomBytes(rng, header.data.iv, sizeof(header.data.iv));
+
+            /* The encrypted part of the header can only be encrypted with console keys, so pick contents which decrypt to a normal card. */
+            bool found_encrypted_data = false;
+            for (s32 attempt = 0; attempt < 0x10000 && !found_encrypted_data; ++attempt) {
+                GenerateRandomBytes(rng, std::addressof(header.data.encrypted_data), sizeof(header.data.encrypted_data));
+
+                auto decrypted = header;
+                R_TRY(gc::impl::GcCrypto::DecryptCardHeader(std::addressof(decrypted.data), sizeof(decrypted.data)));
+
+                found_encrypted_data = static_cast<fs::GameCardCompatibilityType>(decrypted.data.encrypted_data.compatibility_type) == fs::GameCardCompatibilityType::Normal;
+            }
+            R_UNLESS(found_encrypted_data, fs::ResultInvalidArgument());
+
+            std::memcpy(out->data() + CardInitialDataRegionSize, std::addressof(header), sizeof(header));
+            R_SUCCEED();
+        }
+
+        Result SaveFixture(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *dir, const char *name, const std::vector<u8> &data) {
+            char path[fs::EntryNameLengthMax + 1];
+            util::TSNPrintf(path, sizeof(path), "%s/%s", dir, name);
+
+            R_TRY(SaveToFile(fs, path, data.data(), data.size()));
+
+            printf("    %-40s 0x%012" PRIX64 "\n", name, static_cast<u64>(data.size()));
+            R_SUCCEED();
+        }
+
+    }
+
+    Result Processor::GenerateFixtures() {
+        const char *out_dir = m_options.fixture_out_dir_path;
+
+        util::TinyMT rng;
+        rng.Initialize(static_cast<u32>(m_options.fixture_seed));
+
+        /* Create the output directory, which is allowed to exist. */
+        {
+            fs::Path path;
+            R_TRY(path.SetShallowBuffer(out_dir));
+            m_local_fs->CreateDirectory(path);
+        }
+
+        printf("Generating fixtures in %s:\n", out_dir);
+
+        /* Generate a test keyset, and use it as though it had been passed in. */
+        {
+            std::string keys;
+            for (int gen = pkg1::KeyGeneration_1_0_0; gen < pkg1::KeyGeneration_Max; ++gen) {
+                u8 key[AesKeySize];
+                GenerateRandomBytes(rng, key, sizeof(key));
+
+                char line[0x80];
+                util::TSNPrintf(line, sizeof(line), "master_key_%02x = ", gen);
+                keys += line;
+                for (const u8 b : key) {
+                    util::TSNPrintf(line, sizeof(line), "%02x", b);
+                    keys += line;
+                }
+                keys += "\n";
+            }
+
+            R_TRY(SaveFixture(m_local_fs, out_dir, "test.keys", std::vector<u8>(keys.begin(), keys.end())));
+
+            char keys_path[fs::EntryNameLengthMax + 1];
+            util::TSNPrintf(keys_path, sizeof(keys_path), "%s/test.keys", out_dir);
+            m_options.key_file_path   = ::strdup(keys_path);
+            m_options.titlekey_path   = nullptr;
+            m_options.consolekey_path = nullptr;
+
+            this->PresetInternalKeys();
+        }
+
+        const bool is_prod = !m_options.dev;
+        fssystem::SetUpKekAccessKeys(is_prod);
+        const auto &crypto_cfg = *fssystem::GetNcaCryptoConfiguration(is_prod);
+
+        /* Save the npdm on its own, as well as inside the program. */
+        std::vector<u8> npdm;
+        BuildNpdm(std::addressof(npdm), FixtureApplicationId, rng);
+        R_TRY(SaveFixture(m_local_fs, out_dir, "main.npdm", npdm));
+
+        /* A sparse base only keeps what an update reads from it, so needs an update to be made against. */
+        const bool compress = m_options.fixture_compression;
+        const bool sparse   = m_options.fixture_sparse && m_options.fixture_generation_count > 0;
+        if (m_options.fixture_sparse && !sparse) {
+            fprintf(stderr, "[Warning]: A sparse fixture is only generated along with updates.\n");
+        }
+
+        /* Build the base application. */
+        std::vector<FixtureFile> romfs_files;
+        GenerateRomFsFiles(std::addressof(romfs_files), m_options, rng);
+
+        std::vector<FixtureSection> base_sections(2);
+        std::vector<u8> base_program, base_meta;
+        {
+            MakePartitionFsSection(std::addressof(base_sections[0]), { FixtureFile{ "main", GenerateRandomData(rng, FixtureMainSize) }, FixtureFile{ "main.npdm", npdm } }, ExeFsHashBlockSize, rng);
+            MakeRomFsSection(std::addressof(base_sections[1]), romfs_files, compress, rng);
+
+            auto sections = base_sections;
+            BuildNca(std::addressof(base_program), crypto_cfg, fssystem::NcaHeader::ContentType::Program, FixtureApplicationId, sections, rng);
+        }
+        const auto &base_romfs_image = base_sections[1].image;
+        {
+            std::vector<u8> cnmt;
+            BuildContentMeta(std::addressof(cnmt), ContentMetaType_Application, FixtureApplicationId, 0, { { std::addressof(base_program), ContentType_Program } });
+
+            char cnmt_name[0x40];
+            util::TSNPrintf(cnmt_name, sizeof(cnmt_name), "Application_%016" PRIx64 ".cnmt", FixtureApplicationId);
+
+            std::vector<FixtureSection> sections(1);
+            MakePartitionFsSection(std::addressof(sections[0]), { FixtureFile{ cnmt_name, std::move(cnmt) } }, MetaHashBlockSize, rng);
+            BuildNca(std::addressof(base_meta), crypto_cfg, fssystem::NcaHeader::ContentType::Meta, FixtureApplicationId, sections, rng);
+        }
+
+        std::vector<FixtureFile> base_contents;
+        {
+            char name[0x40];
+            GetContentIdFileName(name, sizeof(name), base_program, ".nca");
+            base_contents.push_back(FixtureFile{ name, base_program });
+            GetContentIdFileName(name, sizeof(name), base_meta, ".cnmt.nca");
+            base_contents.push_back(FixtureFile{ name, base_meta });
+        }
+
+        R_TRY(SaveFixture(m_local_fs, out_dir, "program.nca", base_program));
+        {
+            std::vector<u8> nsp;
+            BuildPartitionFileSystemImage(std::addressof(nsp), base_contents);
+            R_TRY(SaveFixture(m_local_fs, out_dir, "application.nsp", nsp));
+        }
+
+        /* Build the game card. */
+        {
+            std::vector<u8> xci;
+            if (const auto res = BuildXci(std::addressof(xci), base_contents, rng); R_SUCCEEDED(res)) {
+                R_TRY(SaveFixture(m_local_fs, out_dir, "application.xci", xci));
+            } else {
+                fprintf(stderr, "[Warning]: Failed to generate game card fixture: 2%03d-%04d\n", res.GetModule(), res.GetDescription());
+            }
+        }
+
+        /* Build each update against the base. */
+        FixtureSection last_patch_romfs_section;
+        for (s32 generation = 1; generation <= m_options.fixture_generation_count; ++generation) {
+            const u32 version = static_cast<u32>(generation) << 16;
+
+            UpdateRomFsFiles(std::addressof(romfs_files), m_options, rng, generation);
+
+            std::vector<u8> patch_program, patch_meta;
+            {
+                std::vector<FixtureSection> sections(2);
+                MakePartitionFsSection(std::addressof(sections[0]), { FixtureFile{ "main", GenerateRandomData(rng, FixtureMainSize) }, FixtureFile{ "main.npdm", npdm } }, ExeFsHashBlockSize, rng);
+                MakePatchRomFsSection(std::addressof(sections[1]), base_romfs_image, romfs_files, generation, compress, rng);
+                last_patch_romfs_section = sections[1];
+
+                BuildNca(std::addressof(patch_program), crypto_cfg, fssystem::NcaHeader::ContentType::Program, FixtureApplicationId, sections, rng);
+            }
+            {
+                std::vector<u8> cnmt;
+                BuildContentMeta(std::addressof(cnmt), ContentMetaType_Patch, FixturePatchId, version, { { std::addressof(patch_program), ContentType_Program } });
+
+                char cnmt_name[0x40];
+                util::TSNPrintf(cnmt_name, sizeof(cnmt_name), "Patch_%016" PRIx64 ".cnmt", FixturePatchId);
+
+                std::vector<FixtureSection> sections(1);
+                MakePartitionFsSection(std::addressof(sections[0]), { FixtureFile{ cnmt_name, std::move(cnmt) } }, MetaHashBlockSize, rng);
+                BuildNca(std::addressof(patch_meta), crypto_cfg, fssystem::NcaHeader::ContentType::Meta, FixturePatchId, sections, rng);
+            }
+
+            std::vector<FixtureFile> patch_contents;
+            {
+                char name[0x40];
+                GetContentIdFileName(name, sizeof(name), patch_program, ".nca");
+                patch_contents.push_back(FixtureFile{ name, patch_program });
+                GetContentIdFileName(name, sizeof(name), patch_meta, ".cnmt.nca");
+                patch_contents.push_back(FixtureFile{ name, patch_meta });
+            }
+
+            char name[0x40];
+            util::TSNPrintf(name, sizeof(name), "program_v%d.nca", generation);
+            R_TRY(SaveFixture(m_local_fs, out_dir, name, patch_program));
+
+            std::vector<u8> nsp;
+            BuildPartitionFileSystemImage(std::addressof(nsp), patch_contents);
+            util::TSNPrintf(name, sizeof(name), "update_v%d.nsp", generation);
+            R_TRY(SaveFixture(m_local_fs, out_dir, name, nsp));
+        }
+
+        /* Build a sparse copy of the base program, holding only what the last update reads from it. */
+        if (sparse) {
+            const s32 generation = m_options.fixture_generation_count;
+
+            std::vector<u8> sparse_program;
+            {
+                std::vector<FixtureSection> sections(2);
+                sections[0] = base_sections[0];
+                MakeSparseSection(std::addressof(sections[1]), base_sections[1], last_patch_romfs_section, generation);
+
+                BuildNca(std::addressof(sparse_program), crypto_cfg, fssystem::NcaHeader::ContentType::Program, FixtureApplicationId, sections, rng);
+            }
+
+            R_TRY(SaveFixture(m_local_fs, out_dir, "program_sparse.nca", sparse_program));
+            printf("Process program_v%d.nca with \"--basenca %s/program_sparse.nca\" to read through the sparse base.\n", generation, out_dir);
+        }
+
+        printf("Process fixtures with \"-k %s/test.keys%s\" (and --basenca/--basensp for updates).\n", out_dir, m_options.dev ? " --dev" : "");
+        R_SUCCEED();
+    }
+
+}
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_processor.hpp"
+#include "hactool_fs_utils.hpp"
+#include "hactool_hashes.hpp"
+#include "hactool_hash_verification.hpp"
+#include "hactool_pfs_writer.hpp"
+#include "hactool_progress.hpp"
+#include "hactool_xci_layout.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr const char NcaFileNameExtension[] = ".nca";
+
+        struct PartitionEntryInfo {
+            std::string name;
+            s64 offset;
+            s64 size;
+        };
+
+        /* Reads the entries of a PFS0 or HFS0, with offsets relative to the start of the partition. */
+        Result ReadPartitionEntries(std::vector<PartitionEntryInfo> *out, fs::IStorage *storage) {
+            PartitionFileSystemHeader header;
+            R_TRY(storage->Read(0, std::addressof(header), sizeof(header)));
+            R_UNLESS(header.magic == PartitionFileSystemMagic || header.magic == Hfs0Magic, fs::ResultPartitionSignatureVerificationFailed());
+            R_UNLESS(header.entry_count >= 0, fs::ResultInvalidSize());
+
+            const bool is_hfs0       = header.magic == Hfs0Magic;
+            const size_t entry_size  = is_hfs0 ? sizeof(Hfs0Entry) : sizeof(PartitionFileSystemEntry);
+            const s64 entries_size   = static_cast<s64>(header.entry_count) * entry_size;
+            const s64 data_offset    = sizeof(header) + entries_size + header.name_table_size;
+
+            std::vector<u8> meta(entries_size + header.name_table_size + 1, 0);
+            R_TRY(storage->Read(sizeof(header), meta.data(), entries_size + header.name_table_size));
+            const char *names = reinterpret_cast<const char *>(meta.data() + entries_size);
+
+            out->clear();
+            for (s32 i = 0; i < header.entry_count; ++i) {
+                s64 offset, size;
+                u32 name_offset;
+                if (is_hfs0) {
+                    Hfs0Entry entry;
+                    std::memcpy(std::addressof(entry), meta.data() + i * entry_size, sizeof(entry));
+                    offset      = entry.offset;
+                    size        = entry.size;
+                    name_offset = entry.name_offset;
+                } else {
+                    PartitionFileSystemEntry entry;
+                    std::memcpy(std::addressof(entry), meta.data() + i * entry_size, sizeof(entry));
+                    offset      = entry.offset;
+                    size        = entry.size;
+                    name_offset = entry.name_offset;
+                }
+                R_UNLESS(name_offset < header.name_table_size, fs::ResultOutOfRange());
+
+                out->push_back(PartitionEntryInfo{ std::string(names + name_offset), data_offset + offset, size });
+            }
+
+            R_SUCCEED();
+        }
+
+        /* Adds a target for every nca in a partition which sits at base_offset within the input. */
+        Result AddNcaHashTargets(std::vector<HashTarget> *targets, fs::IStorage *partition, s64 base_offset) {
+            std::vector<PartitionEntryInfo> entries;
+            R_TRY(ReadPartitionEntries(std::addressof(entries), partition));
+
+            for (const auto &entry : entries) {
+                if (PathView(entry.name).HasSuffix(NcaFileNameExtension)) {
+                    targets->push_back(HashTarget{ entry.name, base_offset + entry.offset, entry.size, {} });
+                }
+            }
+
+            R_SUCCEED();
+        }
+
+        const char *GetInputName(const char *path) {
+            const char *name = path;
+            for (const char *cur = path; *cur != '\x00'; ++cur) {
+                if (*cur == '/' || *cur == '\\') {
+                    name = cur + 1;
+                }
+            }
+            return name;
+        }
+
+    }
+
+    void Processor::PrintHashes(ProcessAsXciContext &ctx) {
+        std::vector<HashTarget> targets;
+
+        s64 size;
+        R_ABORT_UNLESS(ctx.storage->GetSize(std::addressof(size)));
+        targets.push_back(HashTarget{ GetInputName(m_options.in_file_path), 0, size, {} });
+
+        /* The secure partition is a file of the root partition, which follows the key area and header. */
+        if (ctx.secure_partition.storage != nullptr) {
+            const s64 root_offset = (ctx.key_area_storage != nullptr ? static_cast<s64>(CardInitialDataRegionSize) : 0) + ctx.card_data.header.data.partition_fs_header_address;
+
+            std::vector<PartitionEntryInfo> root_entries;
+            if (const auto res = ReadPartitionEntries(std::addressof(root_entries), ctx.root_partition.storage.get()); R_SUCCEEDED(res)) {
+                for (const auto &entry : root_entries) {
+                    if (entry.name == "secure") {
+                        if (const auto res = AddNcaHashTargets(std::addressof(targets), ctx.secure_partition.storage.get(), root_offset + entry.offset); R_FAILED(res)) {
+                            fprintf(stderr, "[Warning]: Failed to read secure partition entries: 2%03d-%04d\n", res.GetModule(), res.GetDescription());
+                        }
+                    }
+                }
+            } else {
+                fprintf(stderr, "[Warning]: Failed to read root partition entries: 2%03d-%04d\n", res.GetModule(), res.GetDescription());
+            }
+        }
+
+        this->PrintHashTargets(ctx.storage.get(), targets);
+    }
+
+    void Processor::PrintHashes(ProcessAsPfsContext &ctx) {
+        std::vector<HashTarget> targets;
+
+        s64 size;
+        R_ABORT_UNLESS(ctx.storage->GetSize(std::addressof(size)));
+        targets.push_back(HashTarget{ GetInputName(m_options.in_file_path), 0, size, {} });
+
+        if (const auto res = AddNcaHashTargets(std::addressof(targets), ctx.storage.get(), 0); R_FAILED(res)) {
+            fprintf(stderr, "[Warning]: Failed to read partition entries: 2%03d-%04d\n", res.GetModule(), res.GetDescription());
+        }
+
+        this->PrintHashTargets(ctx.storage.get(), targets);
+    }
+
+    void Processor::PrintHashes(ProcessAsNcaContext &ctx) {
+        std::vector<HashTarget> targets;
+
+        s64 size;
+        R_ABORT_UNLESS(ctx.storage->GetSize(std::addressof(size)));
+        targets.push_back(HashTarget{ GetInputName(m_options.in_file_path), 0, size, {} });
+
+        this->PrintHashTargets(ctx.storage.get(), targets);
+    }
+
+    void Processor::PrintHashTargets(fs::IStorage *storage, std::vector<HashTarget> &targets) {
+        /* Load the database of expected hashes, once. */
+        if (m_options.hash_dat_path != nullptr && m_hash_database == nullptr) {
+            m_hash_database = std::make_unique<HashDatabase>();
+            if (const auto res = m_hash_database->Load(m_options.hash_dat_path); R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: Failed to load hash database (%s): 2%03d-%04d\n", m_options.hash_dat_path, res.GetModule(), res.GetDescription());
+            }
+        }
+
+        /* Hash everything in one pass. */
+        {
+            ScopedProgressJob job("Hashing");
+            if (const auto res = ComputeHashes(targets.data(), targets.size(), storage); R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: Failed to compute hashes: 2%03d-%04d\n", res.GetModule(), res.GetDescription());
+                return;
+            }
+        }
+
+        auto _ = this->PrintHeader("Hashes");
+        for (const auto &target : targets) {
+            auto _ = this->PrintHeader(target.name.c_str());
+
+            this->PrintHex12("Size", target.hashes.size);
+            this->PrintHex8("CRC32", target.hashes.crc32);
+            this->PrintBytes("MD5", target.hashes.md5, sizeof(target.hashes.md5));
+            this->PrintBytes("SHA1", target.hashes.sha1, sizeof(target.hashes.sha1));
+            this->PrintBytes("SHA256", target.hashes.sha256, sizeof(target.hashes.sha256));
+
+            if (m_hash_database != nullptr) {
+                if (const auto *entry = m_hash_database->Find(target.hashes); entry != nullptr) {
+                    this->PrintFormat("DAT Match", "%s (%s)", entry->rom_name.c_str(), entry->game_name.c_str());
+                } else {
+                    this->PrintString("DAT Match", "None");
+                }
+            }
+        }
+    }
+
+}
@@ -17,6 +17,12 @@
 #include <stratosphere.hpp>
 #include "hactool_options.hpp"
 #include "hactool_application_list.hpp"
+#include "hactool_memory_accounting.hpp"
+#include "hactool_hashes.hpp"
+#include "hactool_base_library.hpp"
+#include "hactool_nso.hpp"
+#include "hactool_npdm_capabilities.hpp"
+#include "hactool_npdm_corpus.hpp"
 
 namespace ams::hactool {
 
@@ -36,11 +42,11 @@ namespace ams::hactool {
                     ScopedIndentHolder(char *p) : m_p(p) { /* ... */ }
                     ~ScopedIndentHolder() { *m_p = 0; }
             };
-
+        public:
             struct ProcessAsNpdmContext {
                 std::shared_ptr<fs::IStorage> storage;
 
-                std::unique_ptr<u8[]> raw_data;
+                TrackedUniquePtr<u8> raw_data;
 
                 const ldr::Npdm *npdm = nullptr;
                 const ldr::Acid *acid = nullptr;
@@ -54,9 +60,23 @@ namespace ams::hactool {
                 const void *aci_sac = nullptr;
                 const void *aci_kac = nullptr;
 
+                std::vector<npdm::ServiceAccessEntry> acid_services;
+                std::vector<npdm::ServiceAccessEntry> aci_services;
+
                 const void *modulus = nullptr;
             };
 
+            struct ProcessAsNsoContext {
+                std::shared_ptr<fs::IStorage> storage;
+                std::string name;
+
+                NsoHeader header{};
+                std::string module_name;
+
+                std::array<TrackedUniquePtr<u8>, NsoHeader::Segment_Count> segments{};
+                std::array<bool, NsoHeader::Segment_Count> is_segment_hash_valid{};
+            };
+
             struct ProcessAsNcaContext {
                 std::shared_ptr<fs::IStorage> storage;
                 std::shared_ptr<fssystem::NcaReader> reader;
@@ -74,6 +94,7 @@ namespace ams::hactool {
                 std::array<std::shared_ptr<fs::fsa::IFileSystem>, fssystem::NcaHeader::FsCountMax> file_systems{};
 
                 ProcessAsNpdmContext npdm_ctx;
+                std::vector<ProcessAsNsoContext> nso_ctxs;
             };
 
             struct ProcessAsApplicationFileSystemContext {
@@ -133,8 +154,38 @@ namespace ams::hactool {
                 bool is_exefs;
 
                 ProcessAsNpdmContext npdm_ctx;
+                std::vector<ProcessAsNsoContext> nso_ctxs;
                 ProcessAsApplicationFileSystemContext app_ctx;
             };
+
+            struct ProcessAsSystemUpdateContext {
+                std::shared_ptr<fs::fsa::IFileSystem> fs;
+
+                struct Content {
+                    ncm::ContentType type;
+                    std::string id;
+                    std::string path;
+                };
+
+                struct Title {
+                    u64 id;
+                    u32 version;
+                    ncm::ContentMetaType type;
+                    bool is_found;
+
+                    /* The meta nca comes first. */
+                    std::vector<Content> contents;
+
+                    /* Only a system update lists other titles. */
+                    std::vector<ncm::ContentMetaInfo> content_metas;
+                };
+
+                bool has_system_update;
+                Title system_update;
+
+                /* Sorted by id. */
+                std::vector<Title> titles;
+            };
         private:
             Options m_options;
             fssrv::impl::ExternalKeyManager m_external_nca_key_manager;
@@ -149,12 +200,39 @@ namespace ams::hactool {
             ProcessAsPfsContext m_base_pfs_ctx;
             ProcessAsApplicationFileSystemContext m_base_appfs_ctx;
 
+            bool m_has_base_library;
+            std::shared_ptr<fs::fsa::IFileSystem> m_base_library_fs;
+            BaseLibraryIndex m_base_library;
+            std::unordered_map<u64, std::shared_ptr<fssystem::NcaReader>> m_base_library_readers;
+
+            std::unique_ptr<HashDatabase> m_hash_database;
+
             os::SdkMutex m_print_lock;
             char m_indent_buffer[1_KB];
         public:
             Processor(const Options &options);
 
             Result Process();
+
+            /* Parsing for embedders: loads keys and bases, then fills contexts without printing or saving anything. */
+            void PrepareToParse();
+
+            Result OpenLocalFile(std::shared_ptr<fs::IStorage> *out, const char *path);
+            Result OpenLocalDirectory(std::shared_ptr<fs::fsa::IFileSystem> *out, const char *path);
+
+            Result Parse(ProcessAsNcaContext *out, std::shared_ptr<fs::IStorage> storage);
+            Result Parse(ProcessAsNpdmContext *out, std::shared_ptr<fs::IStorage> storage);
+            Result Parse(ProcessAsXciContext *out, std::shared_ptr<fs::IStorage> storage);
+            Result Parse(ProcessAsPfsContext *out, std::shared_ptr<fs::IStorage> storage);
+            Result Parse(ProcessAsApplicationFileSystemContext *out, std::shared_ptr<fs::fsa::IFileSystem> fs);
+
+            #if defined(HACTOOL_BUILD_FIXTURE_GENERATOR)
+            Result GenerateFixtures();
+            #endif
+
+            #if defined(HACTOOL_BUILD_BENCHMARK)
+            Result RunBenchmarks();
+            #endif
         private:
             /* Printing. */
             [[nodiscard]] ScopedIndentHolder IncreaseIndentation() {
@@ -229,27 +307,70 @@ namespace ams::hactool {
 
             /* Utility/management. */
             void PresetInternalKeys();
+            void OpenBases();
+            void OpenBaseLibrary();
+            Result IndexBaseLibraryMeta(BaseLibraryIndex::MetaEntry *out, const char *path);
+            Result IndexBaseLibraryTicket(BaseLibraryIndex::TicketEntry *out, const char *path);
+            void FindBaseInLibrary(ProcessAsNcaContext *ctx);
+
+            enum class AesCtrKeyError {
+                None,
+                MissingTitleKey,
+                MissingTitleKek,
+            };
+            bool GetDecryptedAesCtrKey(void *dst, size_t dst_size, const fssystem::NcaReader &reader, AesCtrKeyError *out_error = nullptr, s32 *out_titlekek_index = nullptr);
 
             /* Procesing. */
+            Result OpenNcaReader(std::shared_ptr<fssystem::NcaReader> *out, std::shared_ptr<fs::IStorage> storage);
             Result ProcessAsNca(std::shared_ptr<fs::IStorage> storage, ProcessAsNcaContext *ctx = nullptr);
             Result ProcessAsNpdm(std::shared_ptr<fs::IStorage> storage, ProcessAsNpdmContext *ctx = nullptr);
+            Result ProcessAsNso(std::shared_ptr<fs::IStorage> storage, ProcessAsNsoContext *ctx = nullptr);
+            Result ProcessExeFsNsos(std::vector<ProcessAsNsoContext> *out, std::shared_ptr<fs::fsa::IFileSystem> &fs);
+            bool IsExeFsNsoOutputWanted() const;
             Result ProcessAsXci(std::shared_ptr<fs::IStorage> storage, ProcessAsXciContext *ctx = nullptr);
             Result ProcessAsPfs(std::shared_ptr<fs::IStorage> storage, ProcessAsPfsContext *ctx = nullptr);
             Result ProcessAsApplicationFileSystem(std::shared_ptr<fs::fsa::IFileSystem> fs, ProcessAsApplicationFileSystemContext *ctx = nullptr);
+            Result ProcessAsSystemUpdate(std::shared_ptr<fs::fsa::IFileSystem> fs, ProcessAsSystemUpdateContext *ctx = nullptr);
 
             /* Printing. */
             void PrintAsNca(ProcessAsNcaContext &ctx);
             void PrintAsNpdm(ProcessAsNpdmContext &ctx);
+            void PrintAsNso(ProcessAsNsoContext &ctx);
             void PrintAsXci(ProcessAsXciContext &ctx);
             void PrintAsPfs(ProcessAsPfsContext &ctx);
             void PrintAsApplicationFileSystem(ProcessAsApplicationFileSystemContext &ctx);
+            void PrintAsSystemUpdate(ProcessAsSystemUpdateContext &ctx);
 
             /* Saving. */
             void SaveAsNca(ProcessAsNcaContext &ctx);
             void SaveAsNpdm(ProcessAsNpdmContext &ctx);
+            void SaveAsNso(ProcessAsNsoContext &ctx);
+            void SaveExeFsNsos(std::vector<ProcessAsNsoContext> &nso_ctxs);
             void SaveAsXci(ProcessAsXciContext &ctx);
             void SaveAsPfs(ProcessAsPfsContext &ctx);
             void SaveAsApplicationFileSystem(ProcessAsApplicationFileSystemContext &ctx);
+            Result SaveAsSystemUpdate(ProcessAsSystemUpdateContext &ctx);
+
+            /* Conversion. */
+            Result SaveAsNsz(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path);
+            Result SaveAsNsp(ProcessAsXciContext &ctx, const char *path);
+            Result SaveTrimmedXci(ProcessAsXciContext &ctx, const char *path);
+            Result SaveUntrimmedXci(ProcessAsXciContext &ctx, const char *path);
+
+            /* Fingerprinting. */
+            void PrintHashes(ProcessAsXciContext &ctx);
+            void PrintHashes(ProcessAsPfsContext &ctx);
+            void PrintHashes(ProcessAsNcaContext &ctx);
+            void PrintHashTargets(fs::IStorage *storage, std::vector<HashTarget> &targets);
+
+            /* Npdm corpus. */
+            Result ProcessAsNpdmCorpus();
+            Result BuildNpdmCorpus(NpdmCorpus *out, const char *dir_path);
+            Result ReadNpdmCorpusInput(std::vector<NpdmCorpus::Row> *out, std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path);
+
+            /* System update. */
+            Result OpenSystemUpdateInput(std::shared_ptr<fs::fsa::IFileSystem> *out, const char *path);
+            Result ReadSystemUpdateMeta(ProcessAsSystemUpdateContext::Title *out, std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path, const char *content_id);
     };
 
     inline void Processor::PrintLineImpl(const char *fmt, ...) const {
@@ -16,6 +16,7 @@
 #include <stratosphere.hpp>
 #include <exosphere/pkg1.hpp>
 #include "hactool_processor.hpp"
+#include "hactool_trace.hpp"
 
 namespace ams::hactool {
 
@@ -454,6 +455,8 @@ namespace ams::hactool {
         }
 
         void LoadKeyValueFile(const char *path, auto f) {
+            HACTOOL_TRACE_ZONE("LoadKeyValueFile", "path", path);
+
             /* Open the file. */
             fs::FileHandle file;
             if (const auto res = fs::OpenFile(std::addressof(file), path, fs::OpenMode_Read); R_FAILED(res)) {
@@ -470,7 +473,7 @@ namespace ams::hactool {
             }
 
             /* Allocate buffer for the file. */
-            auto buf = std::make_unique<char[]>(file_size + 1);
+            auto buf = MakeTrackedArray<char>(file_size + 1, AllocationSite_FileData);
             if (buf == nullptr) {
                 fprintf(stderr, "[Warning]: failed to allocate memory for key file (%s)\n", path);
                 return;
@@ -491,6 +494,8 @@ namespace ams::hactool {
     }
 
     void Processor::PresetInternalKeys() {
+        HACTOOL_TRACE_ZONE("PresetInternalKeys");
+
         /* Setup the initial keyset. */
         InitializeKeySet(g_keyset, m_options.dev);
 
@@ -502,7 +507,10 @@ namespace ams::hactool {
         }
 
         /* Derive keys. */
-        DeriveKeys(g_keyset);
+        {
+            HACTOOL_TRACE_ZONE("DeriveKeys");
+            DeriveKeys(g_keyset);
+        }
 
         /* Set all master keys with spl. */
         for (int gen = pkg1::KeyGeneration_1_0_0; gen < pkg1::KeyGeneration_Max; ++gen) {
@@ -525,4 +533,44 @@ namespace ams::hactool {
         }
     }
 
+    bool Processor::GetDecryptedAesCtrKey(void *dst, size_t dst_size, const fssystem::NcaReader &reader, AesCtrKeyError *out_error, s32 *out_titlekek_index) {
+        AMS_ABORT_UNLESS(dst_size == AesKeySize);
+
+        auto SetError = [&] (AesCtrKeyError error) {
+            if (out_error != nullptr) {
+                *out_error = error;
+            }
+        };
+        SetError(AesCtrKeyError::None);
+
+        /* Ncas without a rights id carry their key in the key area. */
+        constexpr fs::RightsId ZeroRightsId = {};
+        fs::RightsId rights_id;
+        reader.GetRightsId(rights_id.data, sizeof(rights_id.data));
+        if (crypto::IsSameBytes(std::addressof(rights_id), std::addressof(ZeroRightsId), sizeof(rights_id))) {
+            std::memcpy(dst, reader.GetDecryptionKey(fssystem::NcaHeader::DecryptionKey_AesCtr), AesKeySize);
+            return true;
+        }
+
+        /* Otherwise, the key is the titlekey, decrypted with the titlekek for the nca's generation. */
+        spl::AccessKey encrypted_titlekey;
+        if (R_FAILED(m_external_nca_key_manager.Find(std::addressof(encrypted_titlekey), rights_id))) {
+            SetError(AesCtrKeyError::MissingTitleKey);
+            return false;
+        }
+
+        const u8 key_generation = reader.GetKeyGeneration();
+        const s32 titlekek_index = key_generation > 0 ? key_generation - 1 : 0;
+        if (out_titlekek_index != nullptr) {
+            *out_titlekek_index = titlekek_index;
+        }
+        if (titlekek_index >= pkg1::KeyGeneration_Max || IsZero(g_keyset.titlekeks[titlekek_index], AesKeySize)) {
+            SetError(AesCtrKeyError::MissingTitleKek);
+            return false;
+        }
+
+        crypto::DecryptAes128(dst, dst_size, g_keyset.titlekeks[titlekek_index], AesKeySize, std::addressof(encrypted_titlekey), sizeof(encrypted_titlekey));
+        return true;
+    }
+
 }
\ No newline at end of file
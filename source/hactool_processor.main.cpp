@@ -16,6 +16,7 @@
 #include <stratosphere.hpp>
 #include "hactool_processor.hpp"
 #include "hactool_fs_utils.hpp"
+#include "hactool_trace.hpp"
 
 namespace ams::hactool {
 
@@ -25,6 +26,7 @@ namespace ams::hactool {
         m_has_base_xci   = false;
         m_has_base_pfs   = false;
         m_has_base_appfs = false;
+        m_has_base_library = false;
 
         /* Create local file system for host root. */
         fssrv::fscreator::LocalFileSystemCreator local_fs_creator(true);
@@ -35,65 +37,126 @@ namespace ams::hactool {
         std::memset(m_indent_buffer, 0, sizeof(m_indent_buffer));
     }
 
-    Result Processor::Process() {
-        /* Setup our internal keys. */
-        this->PresetInternalKeys();
+    void Processor::OpenBases() {
+        HACTOOL_TRACE_ZONE("OpenBases");
 
-        /* Open any bases we've been provided. */
-        {
-            if (m_options.base_nca_path != nullptr) {
-                std::shared_ptr<fs::IStorage> storage = nullptr;
-                if (const auto open_res = OpenFileStorage(std::addressof(storage), m_local_fs, m_options.base_nca_path); R_SUCCEEDED(open_res)) {
-                    if (const auto proc_res = this->ProcessAsNca(std::move(storage), std::addressof(m_base_nca_ctx)); R_SUCCEEDED(proc_res)) {
-                        m_has_base_nca = true;
-                    } else {
-                        fprintf(stderr, "Failed to process base nca (%s): 2%03d-%04d\n", m_options.base_nca_path, proc_res.GetModule(), proc_res.GetDescription());
-                    }
+        if (m_options.base_nca_path != nullptr) {
+            std::shared_ptr<fs::IStorage> storage = nullptr;
+            if (const auto open_res = OpenInputStorage(std::addressof(storage), m_local_fs, m_options.base_nca_path); R_SUCCEEDED(open_res)) {
+                if (const auto proc_res = this->ProcessAsNca(std::move(storage), std::addressof(m_base_nca_ctx)); R_SUCCEEDED(proc_res)) {
+                    m_has_base_nca = true;
                 } else {
-                    fprintf(stderr, "Failed to open base nca (%s): 2%03d-%04d\n", m_options.base_nca_path, open_res.GetModule(), open_res.GetDescription());
+                    fprintf(stderr, "Failed to process base nca (%s): 2%03d-%04d\n", m_options.base_nca_path, proc_res.GetModule(), proc_res.GetDescription());
                 }
+            } else {
+                fprintf(stderr, "Failed to open base nca (%s): 2%03d-%04d\n", m_options.base_nca_path, open_res.GetModule(), open_res.GetDescription());
             }
+        }
 
-            if (m_options.base_xci_path != nullptr) {
-                std::shared_ptr<fs::IStorage> storage = nullptr;
-                if (const auto open_res = OpenFileStorage(std::addressof(storage), m_local_fs, m_options.base_xci_path); R_SUCCEEDED(open_res)) {
-                    if (const auto proc_res = this->ProcessAsXci(std::move(storage), std::addressof(m_base_xci_ctx)); R_SUCCEEDED(proc_res)) {
-                        m_has_base_xci = true;
-                    } else {
-                        fprintf(stderr, "Failed to process base xci (%s): 2%03d-%04d\n", m_options.base_xci_path, proc_res.GetModule(), proc_res.GetDescription());
-                    }
+        if (m_options.base_xci_path != nullptr) {
+            std::shared_ptr<fs::IStorage> storage = nullptr;
+            if (const auto open_res = OpenInputStorage(std::addressof(storage), m_local_fs, m_options.base_xci_path); R_SUCCEEDED(open_res)) {
+                if (const auto proc_res = this->ProcessAsXci(std::move(storage), std::addressof(m_base_xci_ctx)); R_SUCCEEDED(proc_res)) {
+                    m_has_base_xci = true;
                 } else {
-                    fprintf(stderr, "Failed to open base xci (%s): 2%03d-%04d\n", m_options.base_xci_path, open_res.GetModule(), open_res.GetDescription());
+                    fprintf(stderr, "Failed to process base xci (%s): 2%03d-%04d\n", m_options.base_xci_path, proc_res.GetModule(), proc_res.GetDescription());
                 }
+            } else {
+                fprintf(stderr, "Failed to open base xci (%s): 2%03d-%04d\n", m_options.base_xci_path, open_res.GetModule(), open_res.GetDescription());
             }
+        }
 
-            if (m_options.base_pfs_path != nullptr) {
-                std::shared_ptr<fs::IStorage> storage = nullptr;
-                if (const auto open_res = OpenFileStorage(std::addressof(storage), m_local_fs, m_options.base_pfs_path); R_SUCCEEDED(open_res)) {
-                    if (const auto proc_res = this->ProcessAsPfs(std::move(storage), std::addressof(m_base_pfs_ctx)); R_SUCCEEDED(proc_res)) {
-                        m_has_base_pfs = true;
-                    } else {
-                        fprintf(stderr, "Failed to process base pfs (%s): 2%03d-%04d\n", m_options.base_pfs_path, proc_res.GetModule(), proc_res.GetDescription());
-                    }
+        if (m_options.base_pfs_path != nullptr) {
+            std::shared_ptr<fs::IStorage> storage = nullptr;
+            if (const auto open_res = OpenInputStorage(std::addressof(storage), m_local_fs, m_options.base_pfs_path); R_SUCCEEDED(open_res)) {
+                if (const auto proc_res = this->ProcessAsPfs(std::move(storage), std::addressof(m_base_pfs_ctx)); R_SUCCEEDED(proc_res)) {
+                    m_has_base_pfs = true;
                 } else {
-                    fprintf(stderr, "Failed to open base pfs (%s): 2%03d-%04d\n", m_options.base_pfs_path, open_res.GetModule(), open_res.GetDescription());
+                    fprintf(stderr, "Failed to process base pfs (%s): 2%03d-%04d\n", m_options.base_pfs_path, proc_res.GetModule(), proc_res.GetDescription());
                 }
+            } else {
+                fprintf(stderr, "Failed to open base pfs (%s): 2%03d-%04d\n", m_options.base_pfs_path, open_res.GetModule(), open_res.GetDescription());
             }
+        }
 
-            if (m_options.base_appfs_path != nullptr) {
-                std::shared_ptr<fs::fsa::IFileSystem> fs = nullptr;
-                if (const auto open_res = OpenSubDirectoryFileSystem(std::addressof(fs), m_local_fs, m_options.base_appfs_path); R_SUCCEEDED(open_res)) {
-                    if (const auto proc_res = this->ProcessAsApplicationFileSystem(std::move(fs), std::addressof(m_base_appfs_ctx)); R_SUCCEEDED(proc_res)) {
-                        m_has_base_appfs = true;
-                    } else {
-                        fprintf(stderr, "Failed to process base app fs (%s): 2%03d-%04d\n", m_options.base_appfs_path, proc_res.GetModule(), proc_res.GetDescription());
-                    }
+        if (m_options.base_appfs_path != nullptr) {
+            std::shared_ptr<fs::fsa::IFileSystem> fs = nullptr;
+            if (const auto open_res = OpenSubDirectoryFileSystem(std::addressof(fs), m_local_fs, m_options.base_appfs_path); R_SUCCEEDED(open_res)) {
+                if (const auto proc_res = this->ProcessAsApplicationFileSystem(std::move(fs), std::addressof(m_base_appfs_ctx)); R_SUCCEEDED(proc_res)) {
+                    m_has_base_appfs = true;
                 } else {
-                    fprintf(stderr, "Failed to open base app fs (%s): 2%03d-%04d\n", m_options.base_appfs_path, open_res.GetModule(), open_res.GetDescription());
+                    fprintf(stderr, "Failed to process base app fs (%s): 2%03d-%04d\n", m_options.base_appfs_path, proc_res.GetModule(), proc_res.GetDescription());
                 }
+            } else {
+                fprintf(stderr, "Failed to open base app fs (%s): 2%03d-%04d\n", m_options.base_appfs_path, open_res.GetModule(), open_res.GetDescription());
             }
         }
 
+        /* Only the library's index is loaded here; bases are processed as patches ask for them. */
+        if (m_options.base_library_dir != nullptr) {
+            this->OpenBaseLibrary();
+        }
+    }
+
+    void Processor::PrepareToParse() {
+        this->PresetInternalKeys();
+        this->OpenBases();
+    }
+
+    Result Processor::OpenLocalFile(std::shared_ptr<fs::IStorage> *out, const char *path) {
+        R_RETURN(OpenInputStorage(out, m_local_fs, path));
+    }
+
+    Result Processor::OpenLocalDirectory(std::shared_ptr<fs::fsa::IFileSystem> *out, const char *path) {
+        R_RETURN(OpenSubDirectoryFileSystem(out, m_local_fs, path));
+    }
+
+    Result Processor::Parse(ProcessAsNcaContext *out, std::shared_ptr<fs::IStorage> storage) {
+        AMS_ABORT_UNLESS(out != nullptr);
+        R_RETURN(this->ProcessAsNca(std::move(storage), out));
+    }
+
+    Result Processor::Parse(ProcessAsNpdmContext *out, std::shared_ptr<fs::IStorage> storage) {
+        AMS_ABORT_UNLESS(out != nullptr);
+        R_RETURN(this->ProcessAsNpdm(std::move(storage), out));
+    }
+
+    Result Processor::Parse(ProcessAsXciContext *out, std::shared_ptr<fs::IStorage> storage) {
+        AMS_ABORT_UNLESS(out != nullptr);
+        R_RETURN(this->ProcessAsXci(std::move(storage), out));
+    }
+
+    Result Processor::Parse(ProcessAsPfsContext *out, std::shared_ptr<fs::IStorage> storage) {
+        AMS_ABORT_UNLESS(out != nullptr);
+        R_RETURN(this->ProcessAsPfs(std::move(storage), out));
+    }
+
+    Result Processor::Parse(ProcessAsApplicationFileSystemContext *out, std::shared_ptr<fs::fsa::IFileSystem> fs) {
+        AMS_ABORT_UNLESS(out != nullptr);
+        R_RETURN(this->ProcessAsApplicationFileSystem(std::move(fs), out));
+    }
+
+    Result Processor::Process() {
+        /* Setup our internal keys. */
+        this->PresetInternalKeys();
+
+        /* A corpus spans many programs, so it has no use for bases. */
+        if (m_options.file_type == FileType::NpdmCorpus) {
+            R_RETURN(this->ProcessAsNpdmCorpus());
+        }
+
+        /* Nor does a system update, whose titles are all complete. */
+        if (m_options.file_type == FileType::SystemUpdate) {
+            std::shared_ptr<fs::fsa::IFileSystem> input = nullptr;
+            R_UNLESS(m_options.in_file_path != nullptr, fs::ResultInvalidArgument());
+            R_TRY(this->OpenSystemUpdateInput(std::addressof(input), m_options.in_file_path));
+
+            R_RETURN(this->ProcessAsSystemUpdate(std::move(input)));
+        }
+
+        /* Open any bases we've been provided. */
+        this->OpenBases();
+
         if (m_options.file_type == FileType::AppFs) {
             /* Open the filesystem. */
             std::shared_ptr<fs::fsa::IFileSystem> input = nullptr;
@@ -106,7 +169,7 @@ namespace ams::hactool {
             /* Open the file storage. */
             std::shared_ptr<fs::IStorage> input = nullptr;
             if (m_options.in_file_path != nullptr) {
-                R_TRY(OpenFileStorage(std::addressof(input), m_local_fs, m_options.in_file_path));
+                R_TRY(OpenInputStorage(std::addressof(input), m_local_fs, m_options.in_file_path));
             }
 
             /* Process for the specific file type. */
@@ -117,6 +180,9 @@ namespace ams::hactool {
                 case FileType::Npdm:
                     R_TRY(this->ProcessAsNpdm(std::move(input)));
                     break;
+                case FileType::Nso:
+                    R_TRY(this->ProcessAsNso(std::move(input)));
+                    break;
                 case FileType::Xci:
                     R_TRY(this->ProcessAsXci(std::move(input)));
                     break;
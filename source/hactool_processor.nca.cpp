@@ -16,7 +16,12 @@
 #include <stratosphere.hpp>
 #include <exosphere/pkg1.hpp>
 #include "hactool_processor.hpp"
+#include "hactool_aes.hpp"
 #include "hactool_fs_utils.hpp"
+#include "hactool_hash_verification.hpp"
+#include "hactool_ncz_storage.hpp"
+#include "hactool_parallel.hpp"
+#include "hactool_trace.hpp"
 
 namespace ams::hactool {
 
@@ -28,22 +33,65 @@ namespace ams::hactool {
         constexpr size_t MaxCacheCount = 1024;
         constexpr size_t BlockSize     = 16_KB;
 
+        constexpr size_t AesKeySize = crypto::AesEncryptor128::KeySize;
+
+        constexpr const char * const SectionIndexNames[fssystem::NcaHeader::FsCountMax] = { "0", "1", "2", "3" };
+
         alignas(os::MemoryPageSize) constinit u8 g_buffer_manager_heap[BufferManagerHeapSize] = {};
         alignas(os::MemoryPageSize) constinit u8 g_buffer_pool[BufferPoolSize] = {};
 
         constinit util::TypedStorage<fssystem::FileSystemBufferManager> g_buffer_manager = {};
 
+        /* Sections are opened concurrently, so the allocator shared by the creators must be locked. */
+        /* The buffer manager takes its own lock. */
+        class LockedMemoryResource : public MemoryResource {
+            private:
+                MemoryResource *m_base;
+                os::SdkMutex m_lock;
+            public:
+                explicit LockedMemoryResource(MemoryResource *base) : m_base(base), m_lock() { /* ... */ }
+            private:
+                virtual void *AllocateImpl(size_t size, size_t alignment) override {
+                    std::scoped_lock lk(m_lock);
+                    return m_base->Allocate(size, alignment);
+                }
+
+                virtual void DeallocateImpl(void *buffer, size_t size, size_t alignment) override {
+                    std::scoped_lock lk(m_lock);
+                    m_base->Deallocate(buffer, size, alignment);
+                }
+
+                virtual bool IsEqualImpl(const MemoryResource &rhs) const override {
+                    return this == std::addressof(rhs);
+                }
+        };
+
         constinit util::TypedStorage<mem::StandardAllocator> g_buffer_allocator = {};
-        constinit util::TypedStorage<fssrv::MemoryResourceFromStandardAllocator> g_allocator = {};
+        constinit util::TypedStorage<fssrv::MemoryResourceFromStandardAllocator> g_base_allocator = {};
+        constinit util::TypedStorage<LockedMemoryResource> g_allocator = {};
 
+        constinit os::SdkMutex g_initialize_lock;
         constinit bool g_initialized = false;
 
+        /* The library's crypto configuration, with section decryption going through our aes kernels. */
+        constinit fssystem::NcaCryptoConfiguration g_nca_crypto_configuration = {};
+
+        void DecryptAesCtr(void *dst, size_t dst_size, u8 key_index, u8 key_generation, const void *enc_key, size_t enc_key_size, const void *iv, size_t iv_size, const void *src, size_t src_size) {
+            u8 key[AesKeySize];
+            g_nca_crypto_configuration.generate_key(key, sizeof(key), enc_key, enc_key_size, fssystem::GetKeyTypeValue(key_index, key_generation));
+
+            DecryptAes128CtrForPreparedKey(dst, dst_size, key_index, key_generation, key, sizeof(key), iv, iv_size, src, src_size);
+        }
+
         /* FileSystem creators. */
         constinit util::TypedStorage<fssrv::fscreator::RomFileSystemCreator>       g_rom_fs_creator = {};
         constinit util::TypedStorage<fssrv::fscreator::PartitionFileSystemCreator> g_partition_fs_creator = {};
         constinit util::TypedStorage<fssrv::fscreator::StorageOnNcaCreator>        g_storage_on_nca_creator = {};
 
         void InitializeFileSystemHelpers(const Options &options) {
+            /* Ncas may be opened from several threads at once. */
+            std::scoped_lock lk(g_initialize_lock);
+
             if (!g_initialized) {
                 g_initialized = true;
 
@@ -53,9 +101,13 @@ namespace ams::hactool {
                 /* Setup our crypto configuration. */
                 fssystem::SetUpKekAccessKeys(is_prod);
 
+                /* The buffer pools are static, but count them so reports reflect them. */
+                NoteAllocation(BufferPoolSize + BufferManagerHeapSize, AllocationSite_FileSystemBuffers);
+
                 /* Initialize buffer allocator. */
                 util::ConstructAt(g_buffer_allocator, g_buffer_pool, BufferPoolSize);
-                util::ConstructAt(g_allocator, GetPointer(g_buffer_allocator));
+                util::ConstructAt(g_base_allocator, GetPointer(g_buffer_allocator));
+                util::ConstructAt(g_allocator, GetPointer(g_base_allocator));
 
                 /* Initialize the buffer manager. */
                 util::ConstructAt(g_buffer_manager);
@@ -64,10 +116,26 @@ namespace ams::hactool {
                 /* Initialize fs creators. */
                 util::ConstructAt(g_rom_fs_creator, GetPointer(g_allocator));
                 util::ConstructAt(g_partition_fs_creator);
-                util::ConstructAt(g_storage_on_nca_creator, GetPointer(g_allocator), *fssystem::GetNcaCryptoConfiguration(is_prod), *fssystem::GetNcaCompressionConfiguration(), GetPointer(g_buffer_manager), fs::impl::GetNcaHashGeneratorFactorySelector());
+                g_nca_crypto_configuration = *fssystem::GetNcaCryptoConfiguration(is_prod);
+                g_nca_crypto_configuration.decrypt_aes_ctr          = DecryptAesCtr;
+                g_nca_crypto_configuration.decrypt_aes_ctr_external = DecryptAes128CtrForPreparedKey;
+                util::ConstructAt(g_storage_on_nca_creator, GetPointer(g_allocator), g_nca_crypto_configuration, *fssystem::GetNcaCompressionConfiguration(), GetPointer(g_buffer_manager), fs::impl::GetNcaHashGeneratorFactorySelector());
             }
         }
 
+        void AppendFormat(std::string &dst, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+        void AppendFormat(std::string &dst, const char *fmt, ...) {
+            char buf[0x200];
+
+            std::va_list vl;
+            va_start(vl, fmt);
+            util::VSNPrintf(buf, sizeof(buf), fmt, vl);
+            va_end(vl);
+
+            dst += buf;
+        }
+
         bool IsExternalKeyRequired(const std::shared_ptr<fssystem::NcaReader> &nca_reader) {
             constexpr fs::RightsId ZeroRightsId = {};
             fs::RightsId rights_id;
@@ -76,44 +144,47 @@ namespace ams::hactool {
             return !crypto::IsSameBytes(std::addressof(rights_id), std::addressof(ZeroRightsId), sizeof(rights_id));
         }
 
-        Result ParseNca(std::shared_ptr<fssystem::NcaReader> *out, std::shared_ptr<fs::IStorage> file_storage, fssrv::impl::ExternalKeyManager &external_key_manager) {
-            /* Create the nca reader. */
-            std::shared_ptr<fssystem::NcaReader> nca_reader;
-            R_TRY(util::GetReference(g_storage_on_nca_creator).CreateNcaReader(std::addressof(nca_reader), std::move(file_storage)));
-
-            /* If necessary, set the external key. */
-            if (IsExternalKeyRequired(nca_reader)) {
-                /* Get the rights id. */
-                fs::RightsId rights_id;
-                nca_reader->GetRightsId(rights_id.data, sizeof(rights_id.data));
-
-                /* Get the encrypted titlekey. */
-                spl::AccessKey encrypted_titlekey;
-                if (R_SUCCEEDED(external_key_manager.Find(std::addressof(encrypted_titlekey), rights_id))) {
-                    /* Decrypt the titlekey with the appropriate key generation. */
-                    spl::AccessKey access_key = {};
-                    R_ABORT_UNLESS(spl::PrepareCommonEsTitleKey(std::addressof(access_key), std::addressof(encrypted_titlekey), sizeof(encrypted_titlekey), nca_reader->GetKeyGeneration()));
-
-                    nca_reader->SetExternalDecryptionKey(std::addressof(access_key), sizeof(access_key));
-                } else {
-                    fprintf(stderr, "[Warning]: Failed to find titlekey for rights id ");
-                    for (size_t i = 0; i < sizeof(rights_id.data); ++i) {
-                        fprintf(stderr, "%02X", rights_id.data[i]);
-                    }
-                    fprintf(stderr, "\n");
-                }
-            }
+    }
 
-            /* Set output reader. */
-            *out = std::move(nca_reader);
-            R_SUCCEED();
+    Result Processor::OpenNcaReader(std::shared_ptr<fssystem::NcaReader> *out, std::shared_ptr<fs::IStorage> storage) {
+        /* Ensure file system helpers are initialized. */
+        InitializeFileSystemHelpers(m_options);
+
+        /* Parse the header. */
+        HACTOOL_TRACE_ZONE("ParseNcaHeader");
+        std::shared_ptr<fssystem::NcaReader> nca_reader;
+        R_TRY(util::GetReference(g_storage_on_nca_creator).CreateNcaReader(std::addressof(nca_reader), std::move(storage)));
+
+        /* Give every nca its decrypted ctr key as an external key, so that its sections are decrypted with decrypt_aes_ctr_external. */
+        /* That's the titlekey for ncas with a rights id, and the key area's key otherwise. */
+        u8 ctr_key[AesKeySize];
+        AesCtrKeyError key_error;
+        s32 titlekek_index = 0;
+        if (this->GetDecryptedAesCtrKey(ctr_key, sizeof(ctr_key), *nca_reader, std::addressof(key_error), std::addressof(titlekek_index))) {
+            nca_reader->SetExternalDecryptionKey(ctr_key, sizeof(ctr_key));
+        } else {
+            fs::RightsId rights_id;
+            nca_reader->GetRightsId(rights_id.data, sizeof(rights_id.data));
+
+            /* The titlekey and the titlekek come from different places, so say which one is missing. */
+            if (key_error == AesCtrKeyError::MissingTitleKek) {
+                fprintf(stderr, "[Warning]: Missing titlekek_%02x, needed to decrypt the titlekey for rights id ", titlekek_index);
+            } else {
+                fprintf(stderr, "[Warning]: Failed to find titlekey for rights id ");
+            }
+            for (size_t i = 0; i < sizeof(rights_id.data); ++i) {
+                fprintf(stderr, "%02X", rights_id.data[i]);
+            }
+            fprintf(stderr, "\n");
         }
 
+        /* Set output reader. */
+        *out = std::move(nca_reader);
+        R_SUCCEED();
     }
 
     Result Processor::ProcessAsNca(std::shared_ptr<fs::IStorage> storage, ProcessAsNcaContext *ctx) {
-        /* Ensure file system helpers are initialized. */
-        InitializeFileSystemHelpers(m_options);
+        HACTOOL_TRACE_ZONE("ProcessAsNca");
 
         /* Ensure we have a context. */
         ProcessAsNcaContext local_ctx{};
@@ -121,14 +192,19 @@ namespace ams::hactool {
             ctx = std::addressof(local_ctx);
         }
 
+        /* Present compressed content as the nca it decompresses to. */
+        R_TRY(OpenNczStorageIfCompressed(std::addressof(storage)));
+
         /* Set the storage. */
         ctx->storage = std::move(storage);
 
         /* Create an NCA reader for the input file. */
-        R_TRY(ParseNca(std::addressof(ctx->reader), ctx->storage, m_external_nca_key_manager));
+        R_TRY(this->OpenNcaReader(std::addressof(ctx->reader), ctx->storage));
 
         /* Decide on a base, if one isn't already set. */
         {
+            HACTOOL_TRACE_ZONE("ResolveBaseNca");
+
             /* First see if we explicitly have a viable base nca. */
             if (ctx->base_reader == nullptr && m_has_base_nca && m_base_nca_ctx.reader != nullptr && m_base_nca_ctx.reader->GetProgramId() == ctx->reader->GetProgramId()) {
                 ctx->base_reader = m_base_nca_ctx.reader;
@@ -166,12 +242,24 @@ namespace ams::hactool {
                 GetBaseFromAppFs(m_base_appfs_ctx, "baseappfs");
                 m_has_base_appfs = true;
             }
+
+            /* Finally, look the program up in the base library. */
+            if (ctx->base_reader == nullptr && m_has_base_library) {
+                this->FindBaseInLibrary(ctx);
+            }
         }
 
         /* Open storages for each section. */
-        std::shared_ptr<fs::IStorage> npdm_storage;
+        /* Sections are independent, so they're opened concurrently, and each one's warnings are held back to print in order. */
+        std::array<std::string, fssystem::NcaHeader::FsCountMax> section_warnings;
+        std::array<bool, fssystem::NcaHeader::FsCountMax> section_has_npdm{};
+
+        R_TRY(RunParallel(fssystem::NcaHeader::FsCountMax, [&] (size_t index) -> Result {
+            const s32 i = static_cast<s32>(index);
+            auto &warnings = section_warnings[i];
+
+            HACTOOL_TRACE_ZONE("OpenNcaSection", "section", SectionIndexNames[i]);
 
-        for (s32 i = 0; i < fssystem::NcaHeader::FsCountMax; ++i) {
             ctx->storage_contexts[i].open_raw_storage = true;
 
             const auto res = [&]() -> Result {
@@ -186,7 +274,7 @@ namespace ams::hactool {
                 ctx->has_sections[i] = true;
 
                 if (ctx->header_readers[i].ExistsSparseLayer()) {
-                    continue;
+                    R_SUCCEED();
                 }
 
                 /* Try to open the non-raw section. */
@@ -203,24 +291,15 @@ namespace ams::hactool {
                                 if (R_SUCCEEDED(mount_res)) {
                                     ctx->is_mounted[i] = true;
 
-                                    /* Check if section is exefs. */
-                                    if (ctx->exefs_index < 0 && ctx->reader->GetContentType() == fssystem::NcaHeader::ContentType::Program) {
-                                        bool is_exefs = false;
-                                        const auto check_npdm_res = fssystem::HasFile(std::addressof(is_exefs), ctx->file_systems[i].get(), fs::MakeConstantPath("/main.npdm"));
-                                        if (R_SUCCEEDED(check_npdm_res)) {
-                                            if (is_exefs) {
-                                                ctx->exefs_index = i;
-
-                                                if (const auto open_npdm_res = OpenFileStorage(std::addressof(npdm_storage), ctx->file_systems[i], "/main.npdm"); R_FAILED(open_npdm_res)) {
-                                                    fprintf(stderr, "[Warning]: main.npdm exists in exefs section %d but could not be opened: 2%03d-%04d\n", i, open_npdm_res.GetModule(), open_npdm_res.GetDescription());
-                                                }
-                                            }
-                                        } else {
-                                            fprintf(stderr, "[Warning]: Failed to check if NCA section %d is exefs: 2%03d-%04d\n", i, check_npdm_res.GetModule(), check_npdm_res.GetDescription());
+                                    /* Check if section is exefs; the first one found is chosen once all sections are open. */
+                                    if (ctx->reader->GetContentType() == fssystem::NcaHeader::ContentType::Program) {
+                                        const auto check_npdm_res = fssystem::HasFile(std::addressof(section_has_npdm[i]), ctx->file_systems[i].get(), fs::MakeConstantPath("/main.npdm"));
+                                        if (R_FAILED(check_npdm_res)) {
+                                            AppendFormat(warnings, "[Warning]: Failed to check if NCA section %d is exefs: 2%03d-%04d\n", i, check_npdm_res.GetModule(), check_npdm_res.GetDescription());
                                         }
                                     }
                                 } else {
-                                    fprintf(stderr, "[Warning]: Failed to mount NCA section %d as PartitionFileSystem: 2%03d-%04d\n", i, mount_res.GetModule(), mount_res.GetDescription());
+                                    AppendFormat(warnings, "[Warning]: Failed to mount NCA section %d as PartitionFileSystem: 2%03d-%04d\n", i, mount_res.GetModule(), mount_res.GetDescription());
                                 }
                             }
                             break;
@@ -229,28 +308,49 @@ namespace ams::hactool {
                                 const auto mount_res = util::GetReference(g_rom_fs_creator).Create(std::addressof(ctx->file_systems[i]), ctx->sections[i]);
                                 if (R_SUCCEEDED(mount_res)) {
                                     ctx->is_mounted[i] = true;
-
-                                    if (ctx->romfs_index < 0) {
-                                        ctx->romfs_index = i;
-                                    }
-
                                 } else {
-                                    fprintf(stderr, "[Warning]: Failed to mount NCA section %d as RomFsFileSystem: 2%03d-%04d\n", i, mount_res.GetModule(), mount_res.GetDescription());
+                                    AppendFormat(warnings, "[Warning]: Failed to mount NCA section %d as RomFsFileSystem: 2%03d-%04d\n", i, mount_res.GetModule(), mount_res.GetDescription());
                                 }
                             }
                             break;
                         default:
-                            fprintf(stderr, "[Warning]: NCA section %d has unknown section type %d\n", i, static_cast<int>(fs_type));
+                            AppendFormat(warnings, "[Warning]: NCA section %d has unknown section type %d\n", i, static_cast<int>(fs_type));
                             break;
                     }
                 } else {
-                    fprintf(stderr, "[Warning]: Failed to open NCA section %d: 2%03d-%04d, NCA may be corrupt.\n", i, real_res.GetModule(), real_res.GetDescription());
+                    AppendFormat(warnings, "[Warning]: Failed to open NCA section %d: 2%03d-%04d, NCA may be corrupt.\n", i, real_res.GetModule(), real_res.GetDescription());
                 }
             } else if (fs::ResultPartitionNotFound::Includes(res)) {
                 ctx->has_sections[i] = false;
             } else {
                 /* TODO: Should we stop here instead of pretending the NCA doesn't have this section? */
-                fprintf(stderr, "[Warning]: Failed to open raw NCA section %d: 2%03d-%04d\n", i, res.GetModule(), res.GetDescription());
+                AppendFormat(warnings, "[Warning]: Failed to open raw NCA section %d: 2%03d-%04d\n", i, res.GetModule(), res.GetDescription());
+            }
+
+            R_SUCCEED();
+        }));
+
+        /* Report, and pick the exefs and romfs, in section order. */
+        std::shared_ptr<fs::IStorage> npdm_storage;
+        for (s32 i = 0; i < fssystem::NcaHeader::FsCountMax; ++i) {
+            if (!section_warnings[i].empty()) {
+                fputs(section_warnings[i].c_str(), stderr);
+            }
+
+            if (!ctx->is_mounted[i]) {
+                continue;
+            }
+
+            if (ctx->exefs_index < 0 && section_has_npdm[i]) {
+                ctx->exefs_index = i;
+
+                if (const auto open_npdm_res = OpenFileStorage(std::addressof(npdm_storage), ctx->file_systems[i], "/main.npdm"); R_FAILED(open_npdm_res)) {
+                    fprintf(stderr, "[Warning]: main.npdm exists in exefs section %d but could not be opened: 2%03d-%04d\n", i, open_npdm_res.GetModule(), open_npdm_res.GetDescription());
+                }
+            }
+
+            if (ctx->romfs_index < 0 && ctx->header_readers[i].GetFsType() == fssystem::NcaFsHeader::FsType::RomFs) {
+                ctx->romfs_index = i;
             }
         }
 
@@ -262,6 +362,13 @@ namespace ams::hactool {
             }
         }
 
+        /* Decode the exefs nsos, but only for an nca we'll print or save, and only when nso output is wanted. */
+        if (ctx == std::addressof(local_ctx) && ctx->exefs_index >= 0 && this->IsExeFsNsoOutputWanted()) {
+            if (const auto process_nso_res = this->ProcessExeFsNsos(std::addressof(ctx->nso_ctxs), ctx->file_systems[ctx->exefs_index]); R_FAILED(process_nso_res)) {
+                fprintf(stderr, "[Warning]: Failed to process exefs nsos: 2%03d-%04d\n", process_nso_res.GetModule(), process_nso_res.GetDescription());
+            }
+        }
+
         /* Print. */
         if (ctx == std::addressof(local_ctx)) {
             this->PrintAsNca(*ctx);
@@ -369,6 +476,10 @@ namespace ams::hactool {
         for (s32 i = 0; i < fssystem::NcaHeader::FsCountMax; ++i) {
             if (i == ctx.exefs_index) {
                 this->PrintAsNpdm(ctx.npdm_ctx);
+
+                for (auto &nso_ctx : ctx.nso_ctxs) {
+                    this->PrintAsNso(nso_ctx);
+                }
             }
         }
 
@@ -407,11 +518,42 @@ namespace ams::hactool {
                 this->PrintBool("Has Compression Layer", ctx.header_readers[i].ExistsCompressionLayer());
 
                 /* TODO: Print specific information about the integrity layers. */
+
+                if (m_options.verify && ctx.has_real_sections[i] && ctx.raw_sections[i] != nullptr) {
+                    HashVerificationResult verification = {};
+                    Result verify_res = ResultSuccess();
+                    bool has_hash_tree = true;
+                    switch (ctx.header_readers[i].GetHashType()) {
+                        case fssystem::NcaFsHeader::HashType::HierarchicalSha256Hash:
+                            verify_res = VerifyHierarchicalSha256Storage(std::addressof(verification), ctx.raw_sections[i].get(), ctx.header_readers[i].GetHashData().hierarchical_sha256_data);
+                            break;
+                        case fssystem::NcaFsHeader::HashType::HierarchicalIntegrityHash:
+                            verify_res = VerifyHierarchicalIntegrityStorage(std::addressof(verification), ctx.raw_sections[i].get(), ctx.header_readers[i].GetHashData().integrity_meta_info);
+                            break;
+                        default:
+                            has_hash_tree = false;
+                            break;
+                    }
+
+                    if (R_FAILED(verify_res)) {
+                        fprintf(stderr, "[Warning]: Failed to verify hash tree for section %d: 2%03d-%04d\n", i, verify_res.GetModule(), verify_res.GetDescription());
+                    } else if (has_hash_tree) {
+                        char field_name[0x40];
+                        MakeVerifyFieldName(field_name, sizeof(field_name), "Hash Tree", verification.IsValid());
+                        this->PrintFormat(field_name, "%" PRId64 "/%" PRId64 " blocks valid", verification.block_count - verification.invalid_block_count, verification.block_count);
+                    }
+                }
             }
         }
+
+        if (m_options.print_hashes) {
+            this->PrintHashes(ctx);
+        }
     }
 
     void Processor::SaveAsNca(ProcessAsNcaContext &ctx) {
+        HACTOOL_TRACE_ZONE("SaveAsNca");
+
         /* If we should, save the header. */
         if (m_options.header_out_path != nullptr) {
             /* Get the header. */
@@ -480,6 +622,8 @@ namespace ams::hactool {
                         if (!m_options.list_romfs) {
                             ExtractUpdatedRomFsDirectory(m_local_fs, static_cast<fssystem::RomFsFileSystem *>(ctx.file_systems[i].get()), ctx.storage_contexts[i].indirect_storage, ctx.storage_contexts[i].aes_ctr_ex_storage, m_options.updated_generation, prefix, dir_path, "/");
                         }
+                    } else if (ctx.header_readers[i].GetFsType() == fssystem::NcaFsHeader::FsType::RomFs) {
+                        ExtractRomFsDirectory(m_local_fs, static_cast<fssystem::RomFsFileSystem *>(ctx.file_systems[i].get()), ctx.sections[i].get(), prefix, dir_path, "/");
                     } else {
                         ExtractDirectory(m_local_fs, ctx.file_systems[i], prefix, dir_path, "/");
                     }
@@ -495,6 +639,9 @@ namespace ams::hactool {
             }
         }
 
+        /* Save the exefs nsos, uncompressed. */
+        this->SaveExeFsNsos(ctx.nso_ctxs);
+
         /* TODO: what else? */
         AMS_UNUSED(ctx);
     }
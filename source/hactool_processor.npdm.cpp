@@ -14,16 +14,19 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <stratosphere.hpp>
-#include <vapours/svc/svc_definition_macro.hpp>
 #include <stratosphere/rapidjson/document.h>
 #include <stratosphere/rapidjson/prettywriter.h>
 #include "hactool_processor.hpp"
 #include "hactool_fs_utils.hpp"
+#include "hactool_npdm_capabilities.hpp"
+#include "hactool_trace.hpp"
 
 namespace ams::hactool {
 
     namespace {
 
+        using namespace ::ams::hactool::npdm;
+
         Result ValidateSubregion(size_t allowed_start, size_t allowed_end, size_t start, size_t size, size_t min_size = 0) {
             R_UNLESS(size >= min_size,            ldr::ResultInvalidMeta());
             R_UNLESS(allowed_start <= start,      ldr::ResultInvalidMeta());
@@ -69,424 +72,12 @@ namespace ams::hactool {
             R_SUCCEED();
         }
 
-
-        /* See kern::KCapabilities, from which this is sourced. */
-        constexpr size_t InterruptIdCount = 0x400;
-        constexpr size_t SystemCallCount  = 0xC0;
-
-        enum class CapabilityType : u32 {
-            CorePriority  = (1u <<  3) - 1,
-            SyscallMask   = (1u <<  4) - 1,
-            MapRange      = (1u <<  6) - 1,
-            MapIoPage     = (1u <<  7) - 1,
-            MapRegion     = (1u << 10) - 1,
-            InterruptPair = (1u << 11) - 1,
-            ProgramType   = (1u << 13) - 1,
-            KernelVersion = (1u << 14) - 1,
-            HandleTable   = (1u << 15) - 1,
-            DebugFlags    = (1u << 16) - 1,
-
-            Invalid       = 0u,
-            Padding       = ~0u,
-        };
-
-        using RawCapabilityValue = util::BitPack32::Field<0, BITSIZEOF(util::BitPack32), u32>;
-
-        static constexpr CapabilityType GetCapabilityType(const util::BitPack32 cap) {
-            const u32 value = cap.Get<RawCapabilityValue>();
-            return static_cast<CapabilityType>((~value & (value + 1)) - 1);
-        }
-
-        template<size_t Index, size_t Count, typename T = u32>
-        using Field = util::BitPack32::Field<Index, Count, T>;
-
-        #define DEFINE_FIELD(name, prev, ...) using name = Field<prev::Next, __VA_ARGS__>
-
-        template<CapabilityType Type>
-        static constexpr inline u32 CapabilityFlag = static_cast<u32>(Type) + 1;
-
-        template<CapabilityType Type>
-        static constexpr inline u32 CapabilityId = util::CountTrailingZeros<u32>(CapabilityFlag<Type>);
-
-        struct CorePriority {
-            using IdBits = Field<0, CapabilityId<CapabilityType::CorePriority> + 1>;
-
-            DEFINE_FIELD(LowestThreadPriority,  IdBits,                6);
-            DEFINE_FIELD(HighestThreadPriority, LowestThreadPriority,  6);
-            DEFINE_FIELD(MinimumCoreId,         HighestThreadPriority, 8);
-            DEFINE_FIELD(MaximumCoreId,         MinimumCoreId,         8);
-        };
-
-        struct SyscallMask {
-            using IdBits = Field<0, CapabilityId<CapabilityType::SyscallMask> + 1>;
-
-            DEFINE_FIELD(Mask,  IdBits, 24);
-            DEFINE_FIELD(Index, Mask,    3);
-        };
-
-        /* NOTE: This always parses as though a mesosphere extension is true to use 40 pa bits instead of 36. */
-        struct MapRange {
-            using IdBits = Field<0, CapabilityId<CapabilityType::MapRange> + 1>;
-
-            DEFINE_FIELD(Address,  IdBits,  24);
-            DEFINE_FIELD(ReadOnly, Address,  1, bool);
-        };
-
-        struct MapRangeSize {
-            using IdBits = Field<0, CapabilityId<CapabilityType::MapRange> + 1>;
-
-            DEFINE_FIELD(Pages, IdBits, 20);
-
-            DEFINE_FIELD(AddressHigh, Pages,        4);
-            DEFINE_FIELD(Normal,      AddressHigh,  1, bool);
-        };
-
-        struct MapIoPage {
-            using IdBits = Field<0, CapabilityId<CapabilityType::MapIoPage> + 1>;
-
-            DEFINE_FIELD(Address, IdBits, 24);
-        };
-
-        enum class RegionType : u32 {
-            None              = 0,
-            KernelTraceBuffer = 1,
-            OnMemoryBootImage = 2,
-            DTB               = 3,
-        };
-
-        struct MapRegion {
-            using IdBits = Field<0, CapabilityId<CapabilityType::MapRegion> + 1>;
-
-            DEFINE_FIELD(Region0,   IdBits,      6, RegionType);
-            DEFINE_FIELD(ReadOnly0, Region0,     1, bool);
-            DEFINE_FIELD(Region1,   ReadOnly0,   6, RegionType);
-            DEFINE_FIELD(ReadOnly1, Region1,     1, bool);
-            DEFINE_FIELD(Region2,   ReadOnly1,   6, RegionType);
-            DEFINE_FIELD(ReadOnly2, Region2,     1, bool);
-        };
-
-        static const u32 PaddingInterruptId = 0x3FF;
-        static_assert(PaddingInterruptId < InterruptIdCount);
-
-        struct InterruptPair {
-            using IdBits = Field<0, CapabilityId<CapabilityType::InterruptPair> + 1>;
-
-            DEFINE_FIELD(InterruptId0, IdBits,       10);
-            DEFINE_FIELD(InterruptId1, InterruptId0, 10);
-        };
-
-
-        struct ProgramType {
-            using IdBits = Field<0, CapabilityId<CapabilityType::ProgramType> + 1>;
-
-            DEFINE_FIELD(Type,     IdBits,  3);
-            DEFINE_FIELD(Reserved, Type,   15);
-        };
-
-        struct KernelVersion {
-            using IdBits = Field<0, CapabilityId<CapabilityType::KernelVersion> + 1>;
-
-            DEFINE_FIELD(MinorVersion, IdBits,        4);
-            DEFINE_FIELD(MajorVersion, MinorVersion, 13);
-        };
-
-        struct HandleTable {
-            using IdBits = Field<0, CapabilityId<CapabilityType::HandleTable> + 1>;
-
-            DEFINE_FIELD(Size,     IdBits, 10);
-            DEFINE_FIELD(Reserved, Size,    6);
-        };
-
-        struct DebugFlags {
-            using IdBits = Field<0, CapabilityId<CapabilityType::DebugFlags> + 1>;
-
-            DEFINE_FIELD(AllowDebug, IdBits,      1, bool);
-            DEFINE_FIELD(ForceDebug, AllowDebug,  1, bool);
-            DEFINE_FIELD(Reserved,   ForceDebug, 13);
-        };
-
-        #undef DEFINE_FIELD
-
-        struct InterruptFlagSetTag{};
-        using InterruptFlagSet = util::BitFlagSet<InterruptIdCount, InterruptFlagSetTag>;
-
-        struct SystemCallFlagSetTag{};
-        using SystemCallFlagSet = util::BitFlagSet<SystemCallCount, SystemCallFlagSetTag>;
-
-        class MappedRange : public util::IntrusiveRedBlackTreeBaseNode<MappedRange> {
-            private:
-                u64 m_address;
-                size_t m_size;
-                bool m_read_only;
-            public:
-                MappedRange(u64 a, size_t s, bool ro) : m_address(a), m_size(s), m_read_only(ro) { /* ... */ }
-
-                constexpr u64 GetAddress()  const { return m_address; }
-                constexpr size_t GetSize()  const { return m_size; }
-                constexpr bool IsReadOnly() const { return m_read_only; }
-        };
-
-        struct MappedRangeCompare {
-            using RedBlackKeyType = uintptr_t;
-
-            static constexpr ALWAYS_INLINE int Compare(const RedBlackKeyType a, const RedBlackKeyType &b) {
-                if (a < b) {
-                    return -1;
-                } else if (a > b) {
-                    return 1;
-                } else {
-                    return 0;
-                }
-            }
-
-            static constexpr ALWAYS_INLINE int Compare(const RedBlackKeyType &a, const MappedRange &b) {
-                return Compare(a, b.GetAddress());
-            }
-
-            static constexpr ALWAYS_INLINE int Compare(const MappedRange &a, const MappedRange &b) {
-                return Compare(a.GetAddress(), b.GetAddress());
-            }
-        };
-
-        using MappedRangeTree = util::IntrusiveRedBlackTreeBaseTraits<MappedRange>::TreeType<MappedRangeCompare>;
-
-        struct MappedRangeHolder {
-            private:
-                MappedRangeTree m_tree;
-            public:
-                MappedRangeHolder() : m_tree() { /* ... */ }
-
-                ~MappedRangeHolder() {
-                    while (!m_tree.empty()) {
-                        auto it = m_tree.begin();
-                        while (it != m_tree.end()) {
-                            auto *region = std::addressof(*it);
-                            it = m_tree.erase(it);
-                            delete region;
-                        }
-                    }
-                }
-
-                void Insert(u64 a, size_t s, bool ro) {
-                    m_tree.insert(*(new MappedRange(a, s, ro)));
-                }
-
-                auto begin() const { return m_tree.begin(); }
-                auto end() const { return m_tree.end(); }
-        };
-
-        const char *GetSystemCallName(size_t i) {
-            #define EMPTY_HANDLER(TYPE, NAME)
-            #define RETURN_NAME_HANDLER(ID, _, NAME, ...) if (i == ID) { return #NAME ; }
-            AMS_SVC_FOREACH_DEFINITION_IMPL(RETURN_NAME_HANDLER, _, EMPTY_HANDLER, EMPTY_HANDLER, EMPTY_HANDLER, EMPTY_HANDLER)
-            #undef EMPTY_HANDLER
-            #undef RETURN_NAME_HANDLER
-
-            return "Unknown";
-        }
-
-        class AccessControlEntry {
-            private:
-                const u8 *m_entry;
-                size_t m_capacity;
-            public:
-                AccessControlEntry(const void *e, size_t c) : m_entry(static_cast<const u8 *>(e)), m_capacity(c) {
-                    /* ... */
-                }
-
-                AccessControlEntry GetNextEntry() const {
-                    return AccessControlEntry(m_entry + this->GetSize(), m_capacity - this->GetSize());
-                }
-
-                size_t GetSize() const {
-                    return this->GetServiceNameSize() + 1;
-                }
-
-                size_t GetServiceNameSize() const {
-                    return (m_entry[0] & 7) + 1;
-                }
-
-                sm::ServiceName GetServiceName() const {
-                    return sm::ServiceName::Encode(reinterpret_cast<const char *>(m_entry + 1), this->GetServiceNameSize());
-                }
-
-                bool IsHost() const {
-                    return (m_entry[0] & 0x80) != 0;
-                }
-
-                bool IsWildcard() const {
-                    return m_entry[this->GetServiceNameSize()] == '*';
-                }
-
-                bool IsValid() const {
-                    /* Validate that we can access data. */
-                    if (m_entry == nullptr || m_capacity == 0) {
-                        return false;
-                    }
-
-                    /* Validate that the size is correct. */
-                    return this->GetSize() <= m_capacity;
-                }
-
-                void GetName(char *dst) {
-                    std::memcpy(dst, m_entry + 1, this->GetServiceNameSize());
-                    dst[this->GetServiceNameSize()] = 0;
-                }
-        };
-
-        bool IsAllowedAccessControl(AccessControlEntry access_control, sm::ServiceName service, bool is_host, bool is_wildcard) {
-            /* Iterate over all entries in the access control, checking to see if we have a match. */
-            while (access_control.IsValid()) {
-                if (access_control.IsHost() == is_host) {
-                    bool is_valid = true;
-
-                    if (access_control.IsWildcard() == is_wildcard) {
-                        /* Check for exact match. */
-                        is_valid &= access_control.GetServiceName() == service;
-                    } else if (access_control.IsWildcard()) {
-                        /* Also allow fuzzy match for wildcard. */
-                        sm::ServiceName ac_service = access_control.GetServiceName();
-                        is_valid &= std::memcmp(std::addressof(ac_service), std::addressof(service), access_control.GetServiceNameSize() - 1) == 0;
-                    }
-
-                    if (is_valid) {
-                        return true;
-                    }
-                }
-                access_control = access_control.GetNextEntry();
-            }
-
-            return false;
-        }
-
-        struct ParsedKernelCapabilities {
-            util::optional<util::BitPack32> core_prio = util::nullopt;
-            SystemCallFlagSet system_calls{};
-            InterruptFlagSet interrupts{};
-            util::optional<util::BitPack32> program_type   = util::nullopt;
-            util::optional<util::BitPack32> kernel_version = util::nullopt;
-            util::optional<util::BitPack32> handle_table   = util::nullopt;
-            util::optional<util::BitPack32> debug_flags    = util::nullopt;
-            util::optional<util::BitPack32> mapped_regions = util::nullopt;
-
-            MappedRangeHolder mapped_static_ranges{};
-            MappedRangeHolder mapped_io_ranges{};
-            util::optional<util::BitPack32> unknown_caps[0x40]{};
-            size_t num_unknown_caps = 0;
-        };
-
-        void ParseKernelCapabilities(ParsedKernelCapabilities *out, const util::BitPack32 *caps, size_t num_caps) {
-            /* Walk all caps. */
-            for (size_t i = 0; i < num_caps; ++i) {
-                switch (GetCapabilityType(caps[i])) {
-                    using enum CapabilityType;
-                    case CorePriority:
-                        if (out->core_prio.has_value()) {
-                            fprintf(stderr, "[Warning]: KernelAccessControl contains multiple CorePriority capabilities\n");
-                        }
-                        out->core_prio = caps[i];
-                        break;
-                    case SyscallMask:
-                        {
-                            const auto mask  = caps[i].Get<SyscallMask::Mask>();
-                            const auto index = caps[i].Get<SyscallMask::Index>();
-
-                            for (size_t n = 0; n < SyscallMask::Mask::Count; ++n) {
-                                const u32 svc_id = SyscallMask::Mask::Count * index + n;
-                                if (mask & (1u << n)) {
-                                    out->system_calls[svc_id] = true;
-                                }
-                            }
-                        }
-                        break;
-                    case MapRange:
-                        {
-                            if (i + 1 < num_caps) {
-                                const auto cap      = caps[i++];
-                                const auto size_cap = caps[i];
-                                if (GetCapabilityType(size_cap) == MapRange) {
-                                    const u64 phys_addr = static_cast<u64>(cap.Get<MapRange::Address>() | (size_cap.Get<MapRangeSize::AddressHigh>() << MapRange::Address::Count)) * os::MemoryPageSize;
-
-                                    const size_t num_pages = size_cap.Get<MapRangeSize::Pages>();
-                                    const size_t size      = num_pages * os::MemoryPageSize;
-
-                                    const bool is_ro = cap.Get<MapRange::ReadOnly>();
-                                    if (size_cap.Get<MapRangeSize::Normal>()) {
-                                        out->mapped_static_ranges.Insert(phys_addr, size, is_ro);
-                                    } else {
-                                        out->mapped_io_ranges.Insert(phys_addr, size, is_ro);
-                                    }
-                                } else {
-                                    fprintf(stderr, "[Warning]: KernelAccessControl contains invalid MapRange pair\n");
-                                }
-                            } else {
-                                fprintf(stderr, "[Warning]: KernelAccessControl truncates during MapRange pair\n");
-                            }
-                        }
-                        break;
-                    case MapIoPage:
-                        {
-                            const u64 phys_addr = caps[i].Get<MapIoPage::Address>() * os::MemoryPageSize;
-                            out->mapped_io_ranges.Insert(phys_addr, os::MemoryPageSize, false);
-                        }
-                        break;
-                    case MapRegion:
-                        if (out->mapped_regions.has_value()) {
-                            fprintf(stderr, "[Warning]: KernelAccessControl contains multiple MapRegion capabilities\n");
-                        }
-                        out->mapped_regions = caps[i];
-                        break;
-                    case InterruptPair:
-                        {
-                            const u32 ids[2] = { caps[i].Get<InterruptPair::InterruptId0>(), caps[i].Get<InterruptPair::InterruptId1>(), };
-                            for (size_t i = 0; i < util::size(ids); ++i) {
-                                if (ids[i] != PaddingInterruptId) {
-                                    out->interrupts[ids[i]] = true;
-                                }
-                            }
-                        }
-                        break;
-                    case ProgramType:
-                        if (out->program_type.has_value()) {
-                            fprintf(stderr, "[Warning]: KernelAccessControl contains multiple ProgramType capabilities\n");
-                        }
-                        out->program_type = caps[i];
-                        break;
-                    case KernelVersion:
-                        if (out->kernel_version.has_value()) {
-                            fprintf(stderr, "[Warning]: KernelAccessControl contains multiple KernelVersion capabilities\n");
-                        }
-                        out->kernel_version = caps[i];
-                        break;
-                    case HandleTable:
-                        if (out->handle_table.has_value()) {
-                            fprintf(stderr, "[Warning]: KernelAccessControl contains multiple HandleTable capabilities\n");
-                        }
-                        out->handle_table = caps[i];
-                        break;
-                    case DebugFlags:
-                        if (out->debug_flags.has_value()) {
-                            fprintf(stderr, "[Warning]: KernelAccessControl contains multiple DebugFlags capabilities\n");
-                        }
-                        out->debug_flags = caps[i];
-                        break;
-                    case Invalid:
-                        fprintf(stderr, "[Warning]: KernelAccessControl contains invalid capability\n");
-                        break;
-                    case Padding:
-                        break;
-                    default:
-                        AMS_ABORT_UNLESS(out->num_unknown_caps < util::size(out->unknown_caps));
-                        out->unknown_caps[out->num_unknown_caps++] = caps[i];
-                        break;
-                }
-            }
-        }
-
     }
 
     /* Procesing. */
     Result Processor::ProcessAsNpdm(std::shared_ptr<fs::IStorage> storage, ProcessAsNpdmContext *ctx) {
+        HACTOOL_TRACE_ZONE("ProcessAsNpdm");
+
         /* Ensure we have a context. */
         ProcessAsNpdmContext local_ctx{};
         if (ctx == nullptr) {
@@ -513,8 +104,8 @@ namespace ams::hactool {
         /* Ensure size is small enough. */
 
         /* Allocate space to hold the npdm. */
-        ctx->raw_data = std::make_unique<u8[]>(static_cast<size_t>(total_size));
-        R_UNLESS(ctx->raw_data != nullptr, fs::ResultAllocationMemoryFailedMakeUnique());
+        ctx->raw_data = MakeTrackedArray<u8>(static_cast<size_t>(total_size), AllocationSite_FileData);
+        R_UNLESS(ctx->raw_data != nullptr, fs::ResultAllocationMemoryFailed());
 
         /* Read the npdm. */
         R_TRY(ctx->storage->Read(0, ctx->raw_data.get(), total_size));
@@ -547,6 +138,16 @@ namespace ams::hactool {
 
         ctx->modulus = acid->modulus;
 
+        /* Decode the service access controls, checking each aci entry against the acid's restrictions. */
+        npdm::DecodeServiceAccessControl(std::addressof(ctx->acid_services), ctx->acid_sac, acid->sac_size);
+        npdm::DecodeServiceAccessControl(std::addressof(ctx->aci_services), ctx->aci_sac, aci->sac_size);
+        {
+            const npdm::ServiceAccessRestriction restriction(ctx->acid_services);
+            for (auto &entry : ctx->aci_services) {
+                entry.is_allowed = restriction.IsAllowed(entry);
+            }
+        }
+
         /* Print. */
         if (ctx == std::addressof(local_ctx)) {
             this->PrintAsNpdm(*ctx);
@@ -809,47 +410,30 @@ namespace ams::hactool {
 
         /* Print Service Access Control. */
         if (ctx.acid_sac != nullptr && ctx.aci_sac != nullptr) {
-            auto PrintServiceAccessControl = [&] (const char *name, AccessControlEntry access_control, auto get_allowed_summary) {
+            auto PrintServiceAccessControl = [&] (const char *name, const std::vector<ServiceAccessEntry> &entries) {
                 auto _ = this->PrintHeader(name);
 
                 const char *field_name = "Hosts";
-                for (auto cur = access_control; cur.IsValid(); cur = cur.GetNextEntry()) {
-                    if (cur.IsHost()) {
-                        char name[sizeof(sm::ServiceName) + 1];
-                        cur.GetName(name);
-
-                        this->PrintFormat(field_name, "%-16s%s", name, get_allowed_summary(cur));
+                for (const auto &entry : entries) {
+                    if (entry.is_host) {
+                        this->PrintFormat(field_name, "%-16s%s", entry.display_name, entry.is_allowed ? "" : "(Invalid)");
                         field_name = "";
                     }
                 }
 
                 field_name = "Accesses";
-                for (auto cur = access_control; cur.IsValid(); cur = cur.GetNextEntry()) {
-                    if (!cur.IsHost()) {
-                        char name[sizeof(sm::ServiceName) + 1];
-                        cur.GetName(name);
-
-                        this->PrintFormat(field_name, "%-16s%s", name, get_allowed_summary(cur));
+                for (const auto &entry : entries) {
+                    if (!entry.is_host) {
+                        this->PrintFormat(field_name, "%-16s%s", entry.display_name, entry.is_allowed ? "" : "(Invalid)");
                         field_name = "";
                     }
                 }
             };
 
-            AccessControlEntry restriction(ctx.acid_sac, ctx.acid->sac_size);
-            AccessControlEntry access_control(ctx.aci_sac, ctx.aci->sac_size);
-
-            PrintServiceAccessControl("Service Access Control", access_control, [&] (AccessControlEntry entry) -> const char * {
-                if (IsAllowedAccessControl(restriction, entry.GetServiceName(), entry.IsHost(), entry.IsWildcard())) {
-                    return "";
-                } else {
-                    return "(Invalid)";
-                }
-            });
+            PrintServiceAccessControl("Service Access Control", ctx.aci_services);
 
             if (ctx.acid->sac_size != ctx.aci->sac_size || std::memcmp(ctx.acid_sac, ctx.aci_sac, ctx.acid->sac_size) != 0) {
-                PrintServiceAccessControl("Service Access Control Restrictiction", restriction, [&] (AccessControlEntry) -> const char * {
-                    return "";
-                });
+                PrintServiceAccessControl("Service Access Control Restrictiction", ctx.acid_services);
             }
         }
 
@@ -1128,21 +712,15 @@ namespace ams::hactool {
                     rapidjson::Value service_access(rapidjson::kArrayType);
                     rapidjson::Value service_host(rapidjson::kArrayType);
 
-                    AccessControlEntry restriction(ctx.acid_sac, ctx.acid->sac_size);
-                    AccessControlEntry access_control(ctx.aci_sac, ctx.aci->sac_size);
-
-                    for (auto cur = access_control; cur.IsValid(); cur = cur.GetNextEntry()) {
-                        if (!IsAllowedAccessControl(restriction, cur.GetServiceName(), cur.IsHost(), cur.IsWildcard())) {
+                    for (const auto &entry : ctx.aci_services) {
+                        if (!entry.is_allowed) {
                             continue;
                         }
 
-                        char name[sizeof(sm::ServiceName) + 1] = {};
-                        cur.GetName(name);
-
-                        if (cur.IsHost()) {
-                            service_host.PushBack(rapidjson::Value().SetString(name, d.GetAllocator()), d.GetAllocator());
+                        if (entry.is_host) {
+                            service_host.PushBack(rapidjson::Value().SetString(entry.display_name, d.GetAllocator()), d.GetAllocator());
                         } else {
-                            service_access.PushBack(rapidjson::Value().SetString(name, d.GetAllocator()), d.GetAllocator());
+                            service_access.PushBack(rapidjson::Value().SetString(entry.display_name, d.GetAllocator()), d.GetAllocator());
                         }
                     }
 
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_processor.hpp"
+#include "hactool_fs_utils.hpp"
+#include "hactool_npdm_corpus.hpp"
+#include "hactool_parallel.hpp"
+#include "hactool_progress.hpp"
+#include "hactool_trace.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr const char NpdmFileNameExtension[]    = ".npdm";
+        constexpr const char MetaNcaFileNameExtension[] = ".cnmt.nca";
+        constexpr const char NcaFileNameExtension[]     = ".nca";
+        constexpr const char NczFileNameExtension[]     = ".ncz";
+        constexpr const char NspFileNameExtension[]     = ".nsp";
+        constexpr const char NszFileNameExtension[]     = ".nsz";
+
+        bool IsCorpusNcaName(const char *name) {
+            const PathView path(name);
+            return !path.HasSuffix(MetaNcaFileNameExtension) && (path.HasSuffix(NcaFileNameExtension) || path.HasSuffix(NczFileNameExtension));
+        }
+
+        bool IsCorpusPfsName(const char *name) {
+            const PathView path(name);
+            return path.HasSuffix(NspFileNameExtension) || path.HasSuffix(NszFileNameExtension);
+        }
+
+        void DecodeNpdmCorpusRow(NpdmCorpus::Row *out, const Processor::ProcessAsNpdmContext &ctx, std::string source) {
+            out->program.program_id = ctx.aci->program_id.value;
+            out->program.name.assign(ctx.npdm->program_name, strnlen(ctx.npdm->program_name, sizeof(ctx.npdm->program_name)));
+            out->program.source = std::move(source);
+
+            /* What's granted is the aci, which the loader has already checked against the acid. */
+            npdm::ParsedKernelCapabilities parsed;
+            npdm::ParseKernelCapabilities(std::addressof(parsed), static_cast<const util::BitPack32 *>(ctx.aci_kac), ctx.aci->kac_size / sizeof(util::BitPack32));
+
+            out->system_calls = parsed.system_calls;
+            for (const auto &range : parsed.mapped_io_ranges) {
+                out->io_ranges.push_back(NpdmCorpus::IoRange{ range.GetAddress(), range.GetSize() });
+            }
+
+            fssrv::impl::AccessControl access_control(ctx.aci_fah, ctx.aci->fah_size, ctx.acid_fac, ctx.acid->fac_size);
+            out->fs_permissions = access_control.GetRawFlagBits();
+
+            for (const auto &entry : ctx.aci_services) {
+                out->services.push_back(NpdmCorpus::ServiceEntry{ entry.display_name, entry.is_host });
+            }
+        }
+
+    }
+
+    Result Processor::ProcessAsNpdmCorpus() {
+        HACTOOL_TRACE_ZONE("ProcessAsNpdmCorpus");
+
+        R_UNLESS(m_options.in_file_path != nullptr, fs::ResultInvalidArgument());
+
+        fs::Path in_path;
+        R_TRY(in_path.SetShallowBuffer(m_options.in_file_path));
+
+        fs::DirectoryEntryType in_type;
+        R_TRY(m_local_fs->GetEntryType(std::addressof(in_type), in_path));
+
+        NpdmCorpus corpus;
+        if (in_type == fs::DirectoryEntryType_Directory) {
+            /* Build the corpus from every npdm in the directory. */
+            R_TRY(this->BuildNpdmCorpus(std::addressof(corpus), m_options.in_file_path));
+        } else {
+            /* Load a corpus saved by a previous run. */
+            std::shared_ptr<fs::IStorage> storage;
+            R_TRY(OpenFileStorage(std::addressof(storage), m_local_fs, m_options.in_file_path));
+
+            s64 size;
+            R_TRY(storage->GetSize(std::addressof(size)));
+
+            std::vector<u8> data(size);
+            R_TRY(storage->Read(0, data.data(), data.size()));
+
+            if (!corpus.Load(data.data(), data.size())) {
+                fprintf(stderr, "[Warning]: %s is not an npdm corpus. Is file type correct?\n", m_options.in_file_path);
+                R_THROW(fs::ResultInvalidArgument());
+            }
+        }
+
+        /* Save, if we should. */
+        if (m_options.npdm_corpus_out_path != nullptr) {
+            const auto data = corpus.Serialize();
+
+            printf("Saving npdm corpus to %s...\n", m_options.npdm_corpus_out_path);
+            if (const auto res = SaveToFile(m_local_fs, m_options.npdm_corpus_out_path, data.data(), data.size()); R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: Failed to save npdm corpus to %s: 2%03d-%04d\n", m_options.npdm_corpus_out_path, res.GetModule(), res.GetDescription());
+            }
+        }
+
+        /* Print. */
+        {
+            auto _ = this->PrintHeader("NPDM Corpus");
+            this->PrintInteger("Programs", corpus.GetProgramCount());
+            this->PrintInteger("Services", corpus.GetServiceCount());
+            this->PrintInteger("Io Ranges", corpus.GetIoRangeCount());
+
+            if (m_options.npdm_query != nullptr) {
+                NpdmCorpus::Bitset matches;
+                R_TRY(corpus.Query(std::addressof(matches), m_options.npdm_query));
+
+                size_t match_count = 0;
+                for (const auto word : matches) {
+                    match_count += util::PopCount(word);
+                }
+
+                this->PrintString("Query", m_options.npdm_query);
+                this->PrintInteger("Match Count", match_count);
+
+                const char *field_name = "Matches";
+                for (size_t i = 0; i < corpus.GetProgramCount(); ++i) {
+                    if (matches[i / BITSIZEOF(u64)] & (UINT64_C(1) << (i % BITSIZEOF(u64)))) {
+                        const auto &program = corpus.GetProgram(i);
+                        this->PrintFormat(field_name, "%016" PRIX64 " %-16s %s", program.program_id, program.name.c_str(), program.source.c_str());
+                        field_name = "";
+                    }
+                }
+            }
+        }
+
+        R_SUCCEED();
+    }
+
+    Result Processor::BuildNpdmCorpus(NpdmCorpus *out, const char *dir_path) {
+        HACTOOL_TRACE_ZONE("BuildNpdmCorpus", "path", dir_path);
+
+        std::shared_ptr<fs::fsa::IFileSystem> dir_fs;
+        R_TRY(OpenSubDirectoryFileSystem(std::addressof(dir_fs), m_local_fs, dir_path));
+
+        /* Find every input. */
+        std::vector<std::string> inputs;
+        R_TRY(fssystem::IterateDirectoryRecursively(dir_fs.get(),
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &path, const fs::DirectoryEntry &entry) -> Result {
+                if (PathView(entry.name).HasSuffix(NpdmFileNameExtension) || IsCorpusNcaName(entry.name) || IsCorpusPfsName(entry.name)) {
+                    inputs.emplace_back(path.GetString());
+                }
+                R_SUCCEED();
+            }
+        ));
+
+        /* Extract and decode the npdms, an input per job. */
+        std::vector<std::vector<NpdmCorpus::Row>> input_rows(inputs.size());
+        {
+            ScopedProgressJob job("Indexing npdms");
+            AddProgressTotal(0, inputs.size());
+
+            /* The access control reads the debug flag as it's constructed, so fix it for every job. */
+            const bool is_fssrv_debug = fssrv::IsDebugFlagEnabled();
+            fssrv::SetDebugFlagEnabled(false);
+            ON_SCOPE_EXIT { fssrv::SetDebugFlagEnabled(is_fssrv_debug); };
+
+            R_TRY(RunParallel(inputs.size(), [&] (size_t i) -> Result {
+                if (const auto res = this->ReadNpdmCorpusInput(std::addressof(input_rows[i]), dir_fs, inputs[i].c_str()); R_FAILED(res)) {
+                    fprintf(stderr, "[Warning]: Failed to index npdm from %s: 2%03d-%04d\n", inputs[i].c_str(), res.GetModule(), res.GetDescription());
+                }
+
+                AddProgress(0, 1);
+                R_SUCCEED();
+            }));
+        }
+
+        /* Fold the rows into the corpus, in input order. */
+        std::vector<NpdmCorpus::Row> rows;
+        for (auto &cur_rows : input_rows) {
+            for (auto &row : cur_rows) {
+                rows.push_back(std::move(row));
+            }
+        }
+
+        out->Build(std::move(rows));
+        R_SUCCEED();
+    }
+
+    Result Processor::ReadNpdmCorpusInput(std::vector<NpdmCorpus::Row> *out, std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path) {
+        HACTOOL_TRACE_ZONE("ReadNpdmCorpusInput", "path", path);
+
+        std::shared_ptr<fs::IStorage> storage;
+        R_TRY(OpenFileStorage(std::addressof(storage), fs, path));
+
+        /* Bare npdms. */
+        if (PathView(path).HasSuffix(NpdmFileNameExtension)) {
+            ProcessAsNpdmContext npdm_ctx{};
+            R_TRY(this->ProcessAsNpdm(std::move(storage), std::addressof(npdm_ctx)));
+
+            NpdmCorpus::Row row{};
+            DecodeNpdmCorpusRow(std::addressof(row), npdm_ctx, path);
+            out->push_back(std::move(row));
+            R_SUCCEED();
+        }
+
+        /* Ncas, of which only programs have an npdm. */
+        auto AddNca = [&] (std::shared_ptr<fs::IStorage> nca_storage, std::string source) -> Result {
+            std::shared_ptr<fssystem::NcaReader> reader;
+            R_TRY(this->OpenNcaReader(std::addressof(reader), nca_storage));
+            R_SUCCEED_IF(reader->GetContentType() != fssystem::NcaHeader::ContentType::Program);
+
+            ProcessAsNcaContext nca_ctx{};
+            R_TRY(this->ProcessAsNca(std::move(nca_storage), std::addressof(nca_ctx)));
+            R_SUCCEED_IF(nca_ctx.npdm_ctx.npdm == nullptr || nca_ctx.npdm_ctx.acid == nullptr || nca_ctx.npdm_ctx.aci == nullptr);
+
+            NpdmCorpus::Row row{};
+            DecodeNpdmCorpusRow(std::addressof(row), nca_ctx.npdm_ctx, std::move(source));
+            out->push_back(std::move(row));
+            R_SUCCEED();
+        };
+
+        if (IsCorpusNcaName(path)) {
+            R_RETURN(AddNca(std::move(storage), path));
+        }
+
+        /* Nsps, whose ncas are read in place. */
+        auto pfs = fssystem::AllocateShared<fssystem::PartitionFileSystem>();
+        R_UNLESS(pfs != nullptr, fs::ResultAllocationMemoryFailedInPartitionFileSystemCreatorA());
+        R_TRY(pfs->Initialize(std::move(storage)));
+
+        std::shared_ptr<fs::fsa::IFileSystem> pfs_fs = std::move(pfs);
+        R_RETURN(fssystem::IterateDirectoryRecursively(pfs_fs.get(),
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &nca_path, const fs::DirectoryEntry &entry) -> Result {
+                R_SUCCEED_IF(!IsCorpusNcaName(entry.name));
+
+                std::shared_ptr<fs::IStorage> nca_storage;
+                R_TRY(OpenFileStorage(std::addressof(nca_storage), pfs_fs, nca_path.GetString()));
+
+                if (const auto res = AddNca(std::move(nca_storage), std::string(path) + nca_path.GetString()); R_FAILED(res)) {
+                    fprintf(stderr, "[Warning]: Failed to index npdm from %s%s: 2%03d-%04d\n", path, nca_path.GetString(), res.GetModule(), res.GetDescription());
+                }
+                R_SUCCEED();
+            }
+        ));
+    }
+
+}
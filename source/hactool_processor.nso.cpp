@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_processor.hpp"
+#include "hactool_fs_utils.hpp"
+#include "hactool_parallel.hpp"
+#include "hactool_trace.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr const char * const SegmentNames[NsoHeader::Segment_Count] = { ".text", ".rodata", ".data" };
+
+        constexpr size_t ModuleNameSizeMax = 0x200;
+
+        /* The rodata of most modules begins with the path of the source tree they were built from. */
+        struct ModulePathHeader {
+            u32 zero;
+            s32 path_length;
+        };
+
+        Result ValidateNsoHeader(const NsoHeader &header, s64 file_size) {
+            R_UNLESS(header.magic == NsoHeader::Magic, ldr::ResultInvalidNso());
+
+            for (size_t i = 0; i < NsoHeader::Segment_Count; ++i) {
+                const auto &segment  = header.segments[i];
+                const u32 stored_size = header.file_sizes[i];
+
+                /* Segments must lie within the file. */
+                R_UNLESS(static_cast<s64>(segment.file_offset) + stored_size <= file_size, ldr::ResultInvalidNso());
+
+                /* Uncompressed segments are stored as-is. */
+                if ((header.flags & NsoHeader::GetCompressedFlag(i)) == 0) {
+                    R_UNLESS(stored_size >= segment.size, ldr::ResultInvalidNso());
+                }
+            }
+
+            R_SUCCEED();
+        }
+
+        Result DecodeNsoSegment(u8 *dst, bool *out_hash_valid, fs::IStorage *storage, const NsoHeader &header, size_t segment) {
+            HACTOOL_TRACE_ZONE("DecodeNsoSegment", "segment", SegmentNames[segment]);
+
+            const auto &info = header.segments[segment];
+            if (info.size == 0) {
+                *out_hash_valid = true;
+                R_SUCCEED();
+            }
+
+            if (header.flags & NsoHeader::GetCompressedFlag(segment)) {
+                const size_t stored_size = header.file_sizes[segment];
+
+                auto compressed = MakeTrackedArray<u8>(stored_size, AllocationSite_CompressionBuffer);
+                R_UNLESS(compressed != nullptr, fs::ResultAllocationMemoryFailed());
+
+                R_TRY(storage->Read(info.file_offset, compressed.get(), stored_size));
+                R_UNLESS(util::DecompressLZ4(dst, info.size, compressed.get(), stored_size) == static_cast<int>(info.size), ldr::ResultInvalidNso());
+            } else {
+                R_TRY(storage->Read(info.file_offset, dst, info.size));
+            }
+
+            u8 hash[crypto::Sha256Generator::HashSize];
+            crypto::GenerateSha256(hash, sizeof(hash), dst, info.size);
+            *out_hash_valid = crypto::IsSameBytes(hash, header.segment_hashes[segment], sizeof(hash));
+
+            R_SUCCEED();
+        }
+
+        /* Lays the segments out after the header, uncompressed, as the loader would accept them. */
+        Result SaveUncompressedNso(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path, const Processor::ProcessAsNsoContext &ctx) {
+            NsoHeader header = ctx.header;
+            header.flags &= ~(NsoHeader::Flag_CompressedText | NsoHeader::Flag_CompressedRo | NsoHeader::Flag_CompressedRw);
+
+            size_t total_size = sizeof(header);
+            header.module_name_offset = total_size;
+            header.module_name_size   = ctx.module_name.size();
+            total_size += ctx.module_name.size();
+
+            for (size_t i = 0; i < NsoHeader::Segment_Count; ++i) {
+                header.segments[i].file_offset = total_size;
+                header.file_sizes[i]           = header.segments[i].size;
+                total_size += header.segments[i].size;
+            }
+
+            auto data = MakeTrackedArray<u8>(total_size, AllocationSite_OutputBuffer);
+            R_UNLESS(data != nullptr, fs::ResultAllocationMemoryFailed());
+
+            std::memcpy(data.get(), std::addressof(header), sizeof(header));
+            std::memcpy(data.get() + header.module_name_offset, ctx.module_name.data(), ctx.module_name.size());
+            for (size_t i = 0; i < NsoHeader::Segment_Count; ++i) {
+                if (header.segments[i].size != 0) {
+                    std::memcpy(data.get() + header.segments[i].file_offset, ctx.segments[i].get(), header.segments[i].size);
+                }
+            }
+
+            R_RETURN(SaveToFile(fs, path, data.get(), total_size));
+        }
+
+        /* Places each segment at its load address, ready to be wrapped as an elf; bss is left out. */
+        Result SaveNsoImage(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path, const Processor::ProcessAsNsoContext &ctx) {
+            size_t image_size = 0;
+            for (const auto &segment : ctx.header.segments) {
+                image_size = std::max<size_t>(image_size, static_cast<size_t>(segment.dst_offset) + segment.size);
+            }
+
+            auto image = MakeTrackedArray<u8>(image_size, AllocationSite_OutputBuffer);
+            R_UNLESS(image != nullptr, fs::ResultAllocationMemoryFailed());
+
+            std::memset(image.get(), 0, image_size);
+            for (size_t i = 0; i < NsoHeader::Segment_Count; ++i) {
+                const auto &segment = ctx.header.segments[i];
+                if (segment.size != 0) {
+                    std::memcpy(image.get() + segment.dst_offset, ctx.segments[i].get(), segment.size);
+                }
+            }
+
+            R_RETURN(SaveToFile(fs, path, image.get(), image_size));
+        }
+
+    }
+
+    Result Processor::ProcessAsNso(std::shared_ptr<fs::IStorage> storage, ProcessAsNsoContext *ctx) {
+        HACTOOL_TRACE_ZONE("ProcessAsNso");
+
+        /* Ensure we have a context. */
+        ProcessAsNsoContext local_ctx{};
+        if (ctx == nullptr) {
+            ctx = std::addressof(local_ctx);
+        }
+
+        /* Set the storage. */
+        ctx->storage = std::move(storage);
+
+        /* Get the nso's size. */
+        s64 total_size;
+        R_TRY(ctx->storage->GetSize(std::addressof(total_size)));
+
+        if (total_size < static_cast<s64>(sizeof(NsoHeader))) {
+            fprintf(stderr, "[Warning]: Nso is too small. Is file type correct?\n");
+            R_THROW(ldr::ResultInvalidNso());
+        }
+
+        /* Read and validate the header. */
+        R_TRY(ctx->storage->Read(0, std::addressof(ctx->header), sizeof(ctx->header)));
+        R_TRY(ValidateNsoHeader(ctx->header, total_size));
+
+        /* Read the module name, if there is one. */
+        if (ctx->header.module_name_size > 0 && ctx->header.module_name_size <= ModuleNameSizeMax && static_cast<s64>(ctx->header.module_name_offset) + ctx->header.module_name_size <= total_size) {
+            char module_name[ModuleNameSizeMax];
+            R_TRY(ctx->storage->Read(ctx->header.module_name_offset, module_name, ctx->header.module_name_size));
+            ctx->module_name.assign(module_name, ctx->header.module_name_size);
+        }
+
+        /* Allocate the segments. */
+        for (size_t i = 0; i < NsoHeader::Segment_Count; ++i) {
+            if (ctx->header.segments[i].size != 0) {
+                ctx->segments[i] = MakeTrackedArray<u8>(ctx->header.segments[i].size, AllocationSite_FileData);
+                R_UNLESS(ctx->segments[i] != nullptr, fs::ResultAllocationMemoryFailed());
+            }
+        }
+
+        /* Decode the segments, which are independent of one another. */
+        R_TRY(RunParallel(NsoHeader::Segment_Count, [&] (size_t i) -> Result {
+            R_RETURN(DecodeNsoSegment(ctx->segments[i].get(), std::addressof(ctx->is_segment_hash_valid[i]), ctx->storage.get(), ctx->header, i));
+        }));
+
+        for (size_t i = 0; i < NsoHeader::Segment_Count; ++i) {
+            if ((ctx->header.flags & NsoHeader::GetCheckHashFlag(i)) && !ctx->is_segment_hash_valid[i]) {
+                fprintf(stderr, "[Warning]: Nso %s segment hash is invalid\n", SegmentNames[i]);
+            }
+        }
+
+        /* Print. */
+        if (ctx == std::addressof(local_ctx)) {
+            this->PrintAsNso(*ctx);
+        }
+
+        /* Save. */
+        if (ctx == std::addressof(local_ctx)) {
+            this->SaveAsNso(*ctx);
+        }
+
+        R_SUCCEED();
+    }
+
+    bool Processor::IsExeFsNsoOutputWanted() const {
+        /* Decoding every segment is expensive, so only do it when something will use the result. */
+        return m_options.nso_out_dir_path != nullptr || m_options.verify || m_options.print_nsos;
+    }
+
+    Result Processor::ProcessExeFsNsos(std::vector<ProcessAsNsoContext> *out, std::shared_ptr<fs::fsa::IFileSystem> &fs) {
+        HACTOOL_TRACE_ZONE("ProcessExeFsNsos");
+
+        /* Every file in an exefs besides main.npdm is an nso, but check the magic rather than rely on names. */
+        R_RETURN(fssystem::IterateDirectoryRecursively(fs.get(),
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+            [&] (const fs::Path &path, const fs::DirectoryEntry &entry) -> Result {
+                R_SUCCEED_IF(entry.file_size < static_cast<s64>(sizeof(NsoHeader)));
+
+                std::shared_ptr<fs::IStorage> storage;
+                R_TRY(OpenFileStorage(std::addressof(storage), fs, path.GetString()));
+
+                u32 magic;
+                R_TRY(storage->Read(0, std::addressof(magic), sizeof(magic)));
+                R_SUCCEED_IF(magic != NsoHeader::Magic);
+
+                ProcessAsNsoContext nso_ctx{};
+                nso_ctx.name = entry.name;
+                if (const auto res = this->ProcessAsNso(std::move(storage), std::addressof(nso_ctx)); R_FAILED(res)) {
+                    fprintf(stderr, "[Warning]: Failed to process %s as nso: 2%03d-%04d\n", entry.name, res.GetModule(), res.GetDescription());
+                    R_SUCCEED();
+                }
+
+                out->push_back(std::move(nso_ctx));
+                R_SUCCEED();
+            }
+        ));
+    }
+
+    void Processor::PrintAsNso(ProcessAsNsoContext &ctx) {
+        auto _ = this->PrintHeader("NSO");
+
+        if (!ctx.name.empty()) {
+            this->PrintString("Name", ctx.name.c_str());
+        }
+
+        this->PrintMagic(ctx.header.magic);
+        this->PrintInteger("Version", ctx.header.version);
+        this->PrintHex8("Flags", ctx.header.flags);
+        this->PrintBytes("Build Id", ctx.header.module_id, sizeof(ctx.header.module_id));
+
+        if (!ctx.module_name.empty()) {
+            this->PrintString("Module Name", ctx.module_name.c_str());
+        }
+
+        if (const auto ro_size = ctx.header.segments[NsoHeader::Segment_Ro].size; ro_size > sizeof(ModulePathHeader)) {
+            const u8 *ro = ctx.segments[NsoHeader::Segment_Ro].get();
+
+            ModulePathHeader module_path;
+            std::memcpy(std::addressof(module_path), ro, sizeof(module_path));
+            if (module_path.zero == 0 && module_path.path_length > 0 && sizeof(module_path) + module_path.path_length <= ro_size) {
+                this->PrintFormat("Module Path", "%.*s", module_path.path_length, reinterpret_cast<const char *>(ro + sizeof(module_path)));
+            }
+        }
+
+        /* Print the segments. */
+        for (size_t i = 0; i < NsoHeader::Segment_Count; ++i) {
+            const auto &segment = ctx.header.segments[i];
+
+            auto _ = this->PrintHeader(SegmentNames[i]);
+            this->PrintHex8("File Offset", segment.file_offset);
+            this->PrintHex8("File Size", ctx.header.file_sizes[i]);
+            this->PrintHex8("Memory Offset", segment.dst_offset);
+            this->PrintHex8("Size", segment.size);
+            this->PrintBool("Compressed", (ctx.header.flags & NsoHeader::GetCompressedFlag(i)) != 0);
+
+            if (m_options.verify || (ctx.header.flags & NsoHeader::GetCheckHashFlag(i))) {
+                this->PrintBytesWithVerify("Hash", ctx.is_segment_hash_valid[i], ctx.header.segment_hashes[i], sizeof(ctx.header.segment_hashes[i]));
+            } else {
+                this->PrintBytes("Hash", ctx.header.segment_hashes[i], sizeof(ctx.header.segment_hashes[i]));
+            }
+        }
+
+        this->PrintHex8(".bss Size", ctx.header.bss_size);
+        this->PrintFormat(".api_info", "0x%08X-0x%08X", ctx.header.api_info.offset, ctx.header.api_info.offset + ctx.header.api_info.size);
+        this->PrintFormat(".dynstr", "0x%08X-0x%08X", ctx.header.dynstr.offset, ctx.header.dynstr.offset + ctx.header.dynstr.size);
+        this->PrintFormat(".dynsym", "0x%08X-0x%08X", ctx.header.dynsym.offset, ctx.header.dynsym.offset + ctx.header.dynsym.size);
+    }
+
+    void Processor::SaveAsNso(ProcessAsNsoContext &ctx) {
+        if (m_options.uncompressed_nso_path != nullptr) {
+            printf("Saving uncompressed nso to %s...\n", m_options.uncompressed_nso_path);
+            if (const auto res = SaveUncompressedNso(m_local_fs, m_options.uncompressed_nso_path, ctx); R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: Failed to save uncompressed nso to %s: 2%03d-%04d\n", m_options.uncompressed_nso_path, res.GetModule(), res.GetDescription());
+            }
+        }
+
+        if (m_options.nso_image_path != nullptr) {
+            printf("Saving nso image to %s...\n", m_options.nso_image_path);
+            if (const auto res = SaveNsoImage(m_local_fs, m_options.nso_image_path, ctx); R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: Failed to save nso image to %s: 2%03d-%04d\n", m_options.nso_image_path, res.GetModule(), res.GetDescription());
+            }
+        }
+    }
+
+    void Processor::SaveExeFsNsos(std::vector<ProcessAsNsoContext> &nso_ctxs) {
+        if (m_options.nso_out_dir_path == nullptr || nso_ctxs.empty()) {
+            return;
+        }
+
+        /* Try to create the destination directory. */
+        {
+            fs::Path dir_path;
+            if (R_SUCCEEDED(dir_path.SetShallowBuffer(m_options.nso_out_dir_path))) {
+                m_local_fs->CreateDirectory(dir_path);
+            }
+        }
+
+        for (const auto &nso_ctx : nso_ctxs) {
+            char path[1_KB];
+            util::TSNPrintf(path, sizeof(path), "%s/%s", m_options.nso_out_dir_path, nso_ctx.name.c_str());
+
+            printf("Saving uncompressed %s to %s...\n", nso_ctx.name.c_str(), path);
+            if (const auto res = SaveUncompressedNso(m_local_fs, path, nso_ctx); R_FAILED(res)) {
+                fprintf(stderr, "[Warning]: Failed to save uncompressed nso to %s: 2%03d-%04d\n", path, res.GetModule(), res.GetDescription());
+            }
+        }
+    }
+
+}
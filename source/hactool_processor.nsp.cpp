@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_processor.hpp"
+#include "hactool_fs_utils.hpp"
+#include "hactool_hash_verification.hpp"
+#include "hactool_pfs_writer.hpp"
+#include "hactool_progress.hpp"
+#include "hactool_memory_accounting.hpp"
+#include "hactool_ticket.hpp"
+#include "hactool_trace.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr const char NcaFileNameExtension[] = ".nca";
+
+        constexpr size_t CopyBufferSize = 4_MB;
+
+        constexpr u32 TicketSignatureType_Rsa2048Sha256 = 0x10004;
+        constexpr const char TicketIssuer[]             = "Root-CA00000003-XS00000020";
+        constexpr u8 TicketFormatVersion                = 2;
+
+        struct Hfs0FileEntry {
+            Hfs0Entry entry;
+            std::string name;
+        };
+
+        struct TicketEntry {
+            fs::RightsId rights_id;
+            u8 key_generation;
+        };
+
+        Result ReadSecurePartitionEntries(std::vector<Hfs0FileEntry> *out, s64 *out_data_offset, fs::IStorage *storage) {
+            /* Read the header. */
+            Hfs0Header header;
+            R_TRY(storage->Read(0, std::addressof(header), sizeof(header)));
+            R_UNLESS(header.magic == Hfs0Magic, fs::ResultPartitionSignatureVerificationFailed());
+            R_UNLESS(header.entry_count >= 0,   fs::ResultInvalidSize());
+
+            /* Read the entries and names. */
+            std::vector<Hfs0Entry> entries(header.entry_count);
+            R_TRY(storage->Read(sizeof(header), entries.data(), entries.size() * sizeof(Hfs0Entry)));
+
+            std::vector<char> name_table(header.name_table_size + 1, '\x00');
+            R_TRY(storage->Read(sizeof(header) + entries.size() * sizeof(Hfs0Entry), name_table.data(), header.name_table_size));
+
+            out->clear();
+            for (const auto &entry : entries) {
+                R_UNLESS(entry.name_offset < header.name_table_size, fs::ResultOutOfRange());
+                R_UNLESS(entry.hash_target_offset >= 0 && entry.hash_target_offset + static_cast<s64>(entry.hash_target_size) <= entry.size, fs::ResultInvalidSha256PartitionHashTarget());
+                out->push_back(Hfs0FileEntry{ entry, std::string(name_table.data() + entry.name_offset) });
+            }
+
+            /* Order by position, so the partition is read in a single forward pass. */
+            std::sort(out->begin(), out->end(), [] (const Hfs0FileEntry &lhs, const Hfs0FileEntry &rhs) { return lhs.entry.offset < rhs.entry.offset; });
+
+            *out_data_offset = sizeof(header) + entries.size() * sizeof(Hfs0Entry) + header.name_table_size;
+            R_SUCCEED();
+        }
+
+        void MakeCommonTicket(CommonTicketData *out, const TicketEntry &ticket, const spl::AccessKey &encrypted_titlekey) {
+            std::memset(out, 0, sizeof(*out));
+
+            /* The signature is left blank, as we can't produce a real one. */
+            out->signature_type = TicketSignatureType_Rsa2048Sha256;
+            util::Strlcpy(out->issuer, TicketIssuer, sizeof(out->issuer));
+
+            std::memcpy(out->title_key_block, std::addressof(encrypted_titlekey), sizeof(encrypted_titlekey));
+            out->format_version = TicketFormatVersion;
+            out->key_generation = ticket.key_generation;
+            std::memcpy(out->rights_id, ticket.rights_id.data, sizeof(out->rights_id));
+
+            out->section_header_offset = sizeof(CommonTicketData);
+        }
+
+    }
+
+    Result Processor::SaveAsNsp(ProcessAsXciContext &ctx, const char *path) {
+        HACTOOL_TRACE_ZONE("SaveAsNsp", "path", path);
+
+        char job_name[1_KB];
+        util::TSNPrintf(job_name, sizeof(job_name), "Converting to %s", path);
+        ScopedProgressJob job(job_name);
+
+        auto save_impl = [&] () -> Result {
+            fs::IStorage *storage = ctx.secure_partition.storage.get();
+            R_UNLESS(storage != nullptr, fs::ResultPathNotFound());
+
+            /* Read the secure partition's entries. */
+            std::vector<Hfs0FileEntry> entries;
+            s64 data_offset = 0;
+            R_TRY(ReadSecurePartitionEntries(std::addressof(entries), std::addressof(data_offset), storage));
+
+            /* Find the ncas which need tickets. Only their headers are read here. */
+            std::vector<TicketEntry> tickets;
+            std::vector<std::string> names;
+            for (const auto &file : entries) {
+                names.push_back(file.name);
+                AddProgressTotal(file.entry.size, 1);
+
+                if (!PathView(file.name).HasSuffix(NcaFileNameExtension)) {
+                    continue;
+                }
+
+                std::shared_ptr<fssystem::NcaReader> reader;
+                if (const auto res = this->OpenNcaReader(std::addressof(reader), std::make_shared<fs::SubStorage>(ctx.secure_partition.storage, data_offset + file.entry.offset, file.entry.size)); R_FAILED(res)) {
+                    fprintf(stderr, "[Warning]: Failed to read header of %s: 2%03d-%04d\n", file.name.c_str(), res.GetModule(), res.GetDescription());
+                    continue;
+                }
+
+                constexpr fs::RightsId ZeroRightsId = {};
+                TicketEntry ticket = {};
+                reader->GetRightsId(ticket.rights_id.data, sizeof(ticket.rights_id.data));
+                if (crypto::IsSameBytes(std::addressof(ticket.rights_id), std::addressof(ZeroRightsId), sizeof(ticket.rights_id))) {
+                    continue;
+                }
+
+                /* Contents sharing a rights id share a ticket. */
+                const bool is_duplicate = std::any_of(tickets.begin(), tickets.end(), [&] (const TicketEntry &t) { return crypto::IsSameBytes(std::addressof(t.rights_id), std::addressof(ticket.rights_id), sizeof(ticket.rights_id)); });
+                if (is_duplicate) {
+                    continue;
+                }
+
+                /* Tickets are named by their rights id. */
+                char ticket_name[0x40] = {};
+                for (size_t i = 0; i < sizeof(ticket.rights_id.data); ++i) {
+                    util::TSNPrintf(ticket_name + 2 * i, sizeof(ticket_name) - 2 * i, "%02x", ticket.rights_id.data[i]);
+                }
+                util::TSNPrintf(ticket_name + 2 * sizeof(ticket.rights_id.data), sizeof(ticket_name) - 2 * sizeof(ticket.rights_id.data), "%s", TicketFileNameExtension);
+
+                /* A ticket already in the partition is copied with everything else. */
+                if (std::any_of(entries.begin(), entries.end(), [&] (const Hfs0FileEntry &e) { return e.name == ticket_name; })) {
+                    continue;
+                }
+
+                spl::AccessKey encrypted_titlekey;
+                if (R_FAILED(m_external_nca_key_manager.Find(std::addressof(encrypted_titlekey), ticket.rights_id))) {
+                    fprintf(stderr, "[Warning]: No titlekey for %s, so no ticket will be attached for it.\n", file.name.c_str());
+                    continue;
+                }
+
+                ticket.key_generation = reader->GetKeyGeneration();
+                tickets.push_back(ticket);
+                names.push_back(ticket_name);
+            }
+
+            /* Create the output. */
+            PartitionFileSystemWriter writer;
+            R_TRY(writer.Initialize(m_local_fs, path, std::move(names)));
+
+            auto buffer = MakeTrackedArray<u8>(CopyBufferSize, AllocationSite_OutputBuffer);
+            R_UNLESS(buffer != nullptr, fs::ResultAllocationMemoryFailed());
+
+            /* Stream each file, hashing its hash target as it passes through. */
+            s32 index = 0;
+            s32 invalid_count = 0;
+            for (const auto &file : entries) {
+                printf("Saving %s...\n", file.name.c_str());
+                R_TRY(writer.BeginFile(index++));
+
+                const s64 target_start = file.entry.hash_target_offset;
+                const s64 target_end   = target_start + file.entry.hash_target_size;
+
+                crypto::Sha256Generator generator;
+                generator.Initialize();
+
+                for (s64 offset = 0; offset < file.entry.size; /* ... */) {
+                    const size_t cur_size = static_cast<size_t>(std::min<s64>(file.entry.size - offset, CopyBufferSize));
+                    R_TRY(storage->Read(data_offset + file.entry.offset + offset, buffer.get(), cur_size));
+
+                    const s64 hash_start = std::max(offset, target_start);
+                    const s64 hash_end   = std::min(offset + static_cast<s64>(cur_size), target_end);
+                    if (hash_start < hash_end) {
+                        generator.Update(buffer.get() + (hash_start - offset), static_cast<size_t>(hash_end - hash_start));
+                    }
+
+                    R_TRY(writer.Write(buffer.get(), cur_size));
+                    AddProgress(cur_size, 0);
+
+                    offset += cur_size;
+                }
+
+                u8 hash[crypto::Sha256Generator::HashSize];
+                generator.GetHash(hash, sizeof(hash));
+                if (!crypto::IsSameBytes(hash, file.entry.hash, sizeof(hash))) {
+                    fprintf(stderr, "[Warning]: Hash mismatch for secure:/%s, the output will contain corrupt data.\n", file.name.c_str());
+                    ++invalid_count;
+                }
+
+                R_TRY(writer.EndFile());
+                AddProgress(0, 1);
+            }
+
+            /* Append the tickets. */
+            for (const auto &ticket : tickets) {
+                spl::AccessKey encrypted_titlekey;
+                R_ABORT_UNLESS(m_external_nca_key_manager.Find(std::addressof(encrypted_titlekey), ticket.rights_id));
+
+                CommonTicketData ticket_data;
+                MakeCommonTicket(std::addressof(ticket_data), ticket, encrypted_titlekey);
+
+                R_TRY(writer.BeginFile(index++));
+                R_TRY(writer.Write(std::addressof(ticket_data), sizeof(ticket_data)));
+                R_TRY(writer.EndFile());
+            }
+
+            R_TRY(writer.Finalize());
+
+            if (invalid_count > 0) {
+                fprintf(stderr, "[Warning]: %d file(s) in the secure partition failed hash verification.\n", invalid_count);
+            }
+            R_SUCCEED();
+        };
+
+        const auto res = save_impl();
+        if (R_FAILED(res)) {
+            fprintf(stderr, "[Warning]: Failed to convert to %s: 2%03d-%04d\n", path, res.GetModule(), res.GetDescription());
+        }
+
+        R_RETURN(res);
+    }
+
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_processor.hpp"
+#include "hactool_fs_utils.hpp"
+#include "hactool_ncz_storage.hpp"
+#include "hactool_pfs_writer.hpp"
+#include "hactool_parallel.hpp"
+#include "hactool_progress.hpp"
+#include "hactool_memory_accounting.hpp"
+#include "hactool_trace.hpp"
+
+#if defined(HACTOOL_ENABLE_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace ams::hactool {
+
+    namespace {
+
+        #if defined(HACTOOL_ENABLE_ZSTD)
+
+        constexpr const char NcaFileNameExtension[]     = ".nca";
+        constexpr const char MetaNcaFileNameExtension[] = ".cnmt.nca";
+        constexpr const char NczFileNameExtension[]     = ".ncz";
+
+        constexpr size_t CopyBufferSize = 4_MB;
+
+        constexpr u8 BlockSizeLog2 = 20;
+        constexpr size_t BlockSize = static_cast<size_t>(1) << BlockSizeLog2;
+
+        /* Each worker gets a couple of blocks per batch, so a slow block doesn't leave the others idle. */
+        constexpr size_t BlocksPerThread = 2;
+
+        ZSTD_CCtx *GetThreadCompressionContext() {
+            thread_local std::unique_ptr<ZSTD_CCtx, decltype(&::ZSTD_freeCCtx)> s_cctx(::ZSTD_createCCtx(), ::ZSTD_freeCCtx);
+            return s_cctx.get();
+        }
+
+        struct CompressionSlot {
+            TrackedUniquePtr<u8> plain;
+            TrackedUniquePtr<u8> compressed;
+            size_t plain_size;
+            size_t stored_size;
+            bool is_raw;
+        };
+
+        /* Meta ncas are tiny and must stay readable by tools which don't know about ncz, so they're kept as-is. */
+        bool IsCompressibleNcaName(const char *name) {
+            return PathView(name).HasSuffix(NcaFileNameExtension) && !PathView(name).HasSuffix(MetaNcaFileNameExtension);
+        }
+
+        Result CopyStorageToWriter(PartitionFileSystemWriter &writer, fs::IStorage *storage, s64 offset, s64 size, u8 *buffer, size_t buffer_size) {
+            while (size > 0) {
+                const size_t cur_size = static_cast<size_t>(std::min<s64>(size, buffer_size));
+                R_TRY(storage->Read(offset, buffer, cur_size));
+                R_TRY(writer.Write(buffer, cur_size));
+                AddProgress(cur_size, 0);
+
+                offset += cur_size;
+                size   -= cur_size;
+            }
+
+            R_SUCCEED();
+        }
+
+        #endif
+
+    }
+
+    Result Processor::SaveAsNsz(std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path) {
+        #if defined(HACTOOL_ENABLE_ZSTD)
+        HACTOOL_TRACE_ZONE("SaveAsNsz", "path", path);
+
+        char job_name[1_KB];
+        util::TSNPrintf(job_name, sizeof(job_name), "Compressing to %s", path);
+        ScopedProgressJob job(job_name);
+
+        struct Entry {
+            std::string name;
+            std::shared_ptr<fs::IStorage> storage;
+            s64 size;
+            std::unique_ptr<ProcessAsNcaContext> nca_ctx;
+        };
+
+        auto save_impl = [&] () -> Result {
+            /* Gather the files in the partition, parsing every nca we may compress. */
+            /* Names fix the header size, so an nca we can't parse must be known before anything is written. */
+            std::vector<Entry> entries;
+            R_TRY(fssystem::IterateDirectoryRecursively(fs.get(),
+                [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+                [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+                [&] (const fs::Path &file_path, const fs::DirectoryEntry &entry) -> Result {
+                    Entry &cur = entries.emplace_back();
+                    cur.name = entry.name;
+                    cur.size = entry.file_size;
+                    R_TRY(OpenFileStorage(std::addressof(cur.storage), fs, file_path.GetString()));
+
+                    if (IsCompressibleNcaName(entry.name) && entry.file_size >= NczUncompressedHeaderSize) {
+                        auto nca_ctx = std::make_unique<ProcessAsNcaContext>();
+                        if (const auto res = this->ProcessAsNca(cur.storage, nca_ctx.get()); R_SUCCEEDED(res)) {
+                            /* Ncz inputs are read through their decoded view, so track the real nca size. */
+                            R_TRY(nca_ctx->storage->GetSize(std::addressof(cur.size)));
+                            cur.nca_ctx = std::move(nca_ctx);
+                            cur.name.replace(cur.name.size() - std::strlen(NcaFileNameExtension), std::strlen(NcaFileNameExtension), NczFileNameExtension);
+                        } else {
+                            fprintf(stderr, "[Warning]: Failed to process %s for compression, it will be stored as-is: 2%03d-%04d\n", entry.name, res.GetModule(), res.GetDescription());
+                        }
+                    }
+
+                    AddProgressTotal(cur.size, 1);
+                    R_SUCCEED();
+                }
+            ));
+
+            /* Create the output. */
+            std::vector<std::string> names;
+            for (const auto &entry : entries) {
+                names.push_back(entry.name);
+            }
+
+            PartitionFileSystemWriter writer;
+            R_TRY(writer.Initialize(m_local_fs, path, std::move(names)));
+
+            /* Set up our buffers. */
+            const int level = std::clamp(m_options.nsz_compression_level, ::ZSTD_minCLevel(), ::ZSTD_maxCLevel());
+
+            std::vector<CompressionSlot> slots(GetParallelism() * BlocksPerThread);
+            const size_t compressed_bound = ::ZSTD_compressBound(BlockSize);
+            for (auto &slot : slots) {
+                slot.plain      = MakeTrackedArray<u8>(BlockSize, AllocationSite_CompressionBuffer);
+                slot.compressed = MakeTrackedArray<u8>(compressed_bound, AllocationSite_CompressionBuffer);
+                R_UNLESS(slot.plain != nullptr && slot.compressed != nullptr, fs::ResultAllocationMemoryFailed());
+            }
+
+            auto copy_buffer = MakeTrackedArray<u8>(CopyBufferSize, AllocationSite_CompressionBuffer);
+            R_UNLESS(copy_buffer != nullptr, fs::ResultAllocationMemoryFailed());
+
+            /* Write each file. */
+            for (size_t i = 0; i < entries.size(); ++i) {
+                auto &entry = entries[i];
+                printf("Saving %s...\n", entry.name.c_str());
+
+                R_TRY(writer.BeginFile(static_cast<s32>(i)));
+
+                if (entry.nca_ctx == nullptr) {
+                    R_TRY(CopyStorageToWriter(writer, entry.storage.get(), 0, entry.size, copy_buffer.get(), CopyBufferSize));
+                } else {
+                    auto &ctx = *entry.nca_ctx;
+
+                    const s64 nca_size = entry.size;
+
+                    /* The header is kept as-is. */
+                    R_TRY(CopyStorageToWriter(writer, ctx.storage.get(), 0, NczUncompressedHeaderSize, copy_buffer.get(), CopyBufferSize));
+
+                    /* Describe how to re-encrypt each section. */
+                    u8 ctr_key[crypto::AesEncryptor128::KeySize];
+                    const bool has_key = this->GetDecryptedAesCtrKey(ctr_key, sizeof(ctr_key), *ctx.reader);
+
+                    std::vector<NczSectionEntry> sections;
+                    bool missing_key = false;
+                    for (s32 j = 0; j < fssystem::NcaHeader::FsCountMax; ++j) {
+                        if (!ctx.has_sections[j]) {
+                            continue;
+                        }
+
+                        NczSectionEntry &section = sections.emplace_back();
+                        std::memset(std::addressof(section), 0, sizeof(section));
+                        section.offset = ctx.reader->GetFsOffset(j);
+                        section.size   = ctx.reader->GetFsSize(j);
+
+                        /* NCZ sections only carry a single counter, which can't describe the per-bucket generations of */
+                        /* aes-ctr-ex sections; those are stored as-is rather than "decrypted" with the wrong counter. */
+                        const auto encryption_type = ctx.header_readers[j].GetEncryptionType();
+                        const bool is_ctr = encryption_type == fssystem::NcaFsHeader::EncryptionType::AesCtr;
+                        if (is_ctr && has_key) {
+                            section.crypto_type = NczSectionEntry::CryptoType_AesCtr;
+                            std::memcpy(section.key, ctr_key, sizeof(section.key));
+                            fssystem::AesCtrStorageBySharedPointer::MakeIv(section.counter, sizeof(section.counter), ctx.header_readers[j].GetAesCtrUpperIv().value, 0);
+                        } else {
+                            /* Sections we can't decrypt are stored encrypted, which is lossless but compresses poorly. */
+                            section.crypto_type = NczSectionEntry::CryptoType_None;
+                            missing_key |= is_ctr;
+                        }
+                    }
+
+                    if (missing_key) {
+                        fprintf(stderr, "[Warning]: Missing key for %s, its sections will be stored encrypted.\n", entry.name.c_str());
+                    }
+
+                    /* Readers expect at least one section, so describe the payload as plain data if nothing was mounted. */
+                    if (sections.empty()) {
+                        NczSectionEntry &section = sections.emplace_back();
+                        std::memset(std::addressof(section), 0, sizeof(section));
+                        section.offset      = NczUncompressedHeaderSize;
+                        section.size        = nca_size - NczUncompressedHeaderSize;
+                        section.crypto_type = NczSectionEntry::CryptoType_None;
+                    }
+
+                    const NczSectionHeader section_header = { NczSectionHeader::Magic, sections.size() };
+                    R_TRY(writer.Write(std::addressof(section_header), sizeof(section_header)));
+                    R_TRY(writer.Write(sections.data(), sections.size() * sizeof(NczSectionEntry)));
+
+                    /* Write the block header, reserving the size table until the blocks are compressed. */
+                    const s64 data_size   = nca_size - NczUncompressedHeaderSize;
+                    const s64 block_count = util::DivideUp(data_size, static_cast<s64>(BlockSize));
+
+                    const NczBlockHeader block_header = { NczBlockHeader::Magic, NczBlockHeader::Version, NczBlockHeader::Type, 0, BlockSizeLog2, static_cast<u32>(block_count), data_size };
+                    R_TRY(writer.Write(std::addressof(block_header), sizeof(block_header)));
+
+                    std::vector<u32> block_sizes(block_count, 0);
+                    const s64 block_table_offset = writer.GetCurrentFileSize();
+                    R_TRY(writer.Write(block_sizes.data(), block_sizes.size() * sizeof(u32)));
+
+                    /* Compress a batch of blocks at a time, appending them in order. */
+                    for (s64 first = 0; first < block_count; first += slots.size()) {
+                        const size_t cur_count = static_cast<size_t>(std::min<s64>(block_count - first, slots.size()));
+
+                        R_TRY(RunParallel(cur_count, [&] (size_t k) -> Result {
+                            auto &slot = slots[k];
+
+                            const s64 data_offset = (first + k) * BlockSize;
+                            slot.plain_size = static_cast<size_t>(std::min<s64>(data_size - data_offset, BlockSize));
+
+                            R_TRY(ctx.storage->Read(NczUncompressedHeaderSize + data_offset, slot.plain.get(), slot.plain_size));
+                            ApplyNczSectionCrypto(sections.data(), sections.size(), slot.plain.get(), NczUncompressedHeaderSize + data_offset, slot.plain_size);
+
+                            const size_t compressed_size = ::ZSTD_compressCCtx(GetThreadCompressionContext(), slot.compressed.get(), compressed_bound, slot.plain.get(), slot.plain_size, level);
+                            R_UNLESS(!::ZSTD_isError(compressed_size), fs::ResultUnexpected());
+
+                            /* Blocks which don't shrink are stored raw, which readers detect by their size. */
+                            slot.is_raw      = compressed_size >= slot.plain_size;
+                            slot.stored_size = slot.is_raw ? slot.plain_size : compressed_size;
+                            R_SUCCEED();
+                        }));
+
+                        for (size_t k = 0; k < cur_count; ++k) {
+                            const auto &slot = slots[k];
+                            R_TRY(writer.Write(slot.is_raw ? slot.plain.get() : slot.compressed.get(), slot.stored_size));
+
+                            block_sizes[first + k] = static_cast<u32>(slot.stored_size);
+                            AddProgress(slot.plain_size, 0);
+                        }
+                    }
+
+                    R_TRY(writer.WriteAt(block_table_offset, block_sizes.data(), block_sizes.size() * sizeof(u32)));
+                }
+
+                R_TRY(writer.EndFile());
+                AddProgress(0, 1);
+            }
+
+            R_RETURN(writer.Finalize());
+        };
+
+        const auto res = save_impl();
+        if (R_FAILED(res)) {
+            fprintf(stderr, "[Warning]: Failed to save compressed output to %s: 2%03d-%04d\n", path, res.GetModule(), res.GetDescription());
+        }
+
+        R_RETURN(res);
+        #else
+        AMS_UNUSED(fs);
+        fprintf(stderr, "[Warning]: Cannot save %s, as this build does not support zstd compression.\n", path);
+        R_THROW(fs::ResultUnsupportedOperation());
+        #endif
+    }
+
+}
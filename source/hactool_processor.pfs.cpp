@@ -16,10 +16,13 @@
 #include <stratosphere.hpp>
 #include "hactool_processor.hpp"
 #include "hactool_fs_utils.hpp"
+#include "hactool_trace.hpp"
 
 namespace ams::hactool {
 
     Result Processor::ProcessAsPfs(std::shared_ptr<fs::IStorage> storage, ProcessAsPfsContext *ctx) {
+        HACTOOL_TRACE_ZONE("ProcessAsPfs");
+
         /* Ensure we have a context. */
         ProcessAsPfsContext local_ctx{};
         if (ctx == nullptr) {
@@ -71,6 +74,13 @@ namespace ams::hactool {
             }
         }
 
+        /* Decode the exefs nsos, but only for a partition we'll print or save, and only when nso output is wanted. */
+        if (ctx == std::addressof(local_ctx) && ctx->is_exefs && this->IsExeFsNsoOutputWanted()) {
+            if (const auto process_nso_res = this->ProcessExeFsNsos(std::addressof(ctx->nso_ctxs), ctx->fs); R_FAILED(process_nso_res)) {
+                fprintf(stderr, "[Warning]: Failed to process exefs nsos: 2%03d-%04d\n", process_nso_res.GetModule(), process_nso_res.GetDescription());
+            }
+        }
+
         /* TODO: Recursive processing? */
 
         /* Print. */
@@ -89,16 +99,29 @@ namespace ams::hactool {
     void Processor::PrintAsPfs(ProcessAsPfsContext &ctx) {
         if (ctx.is_exefs) {
             this->PrintAsNpdm(ctx.npdm_ctx);
+
+            for (auto &nso_ctx : ctx.nso_ctxs) {
+                this->PrintAsNso(nso_ctx);
+            }
         } else {
             this->PrintAsApplicationFileSystem(ctx.app_ctx);
         }
+
+        if (m_options.print_hashes) {
+            this->PrintHashes(ctx);
+        }
     }
 
     void Processor::SaveAsPfs(ProcessAsPfsContext &ctx) {
         if (ctx.is_exefs) {
             this->SaveAsNpdm(ctx.npdm_ctx);
+            this->SaveExeFsNsos(ctx.nso_ctxs);
         } else {
             this->SaveAsApplicationFileSystem(ctx.app_ctx);
+
+            if (m_options.nsz_out_path != nullptr) {
+                this->SaveAsNsz(ctx.fs, m_options.nsz_out_path);
+            }
         }
     }
 
@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_processor.hpp"
+#include "hactool_fs_utils.hpp"
+#include "hactool_parallel.hpp"
+#include "hactool_progress.hpp"
+#include "hactool_trace.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr const s32 MetaFileSystemPartitionIndex = 0;
+
+        constexpr const char NcaFileNameExtension[] = ".nca";
+        constexpr const char NczFileNameExtension[] = ".ncz";
+
+        constexpr u32 PartitionFileSystemMagic = util::FourCC<'P','F','S','0'>::Code;
+
+        using SystemTitle   = Processor::ProcessAsSystemUpdateContext::Title;
+        using SystemContent = Processor::ProcessAsSystemUpdateContext::Content;
+
+        /* Contents are named by their id, e.g. 0123456789abcdef0123456789abcdef.nca or .cnmt.nca. */
+        bool GetContentIdFromName(char *dst, const char *name) {
+            const PathView path(name);
+            if (!path.HasSuffix(NcaFileNameExtension) && !path.HasSuffix(NczFileNameExtension)) {
+                return false;
+            }
+
+            for (size_t i = 0; i < ncm::ContentIdStringLength; ++i) {
+                if (!std::isxdigit(static_cast<unsigned char>(name[i]))) {
+                    return false;
+                }
+                dst[i] = std::tolower(static_cast<unsigned char>(name[i]));
+            }
+            if (name[ncm::ContentIdStringLength] != '.') {
+                return false;
+            }
+
+            dst[ncm::ContentIdStringLength] = 0;
+            return true;
+        }
+
+        const char *GetContentMetaTypeName(ncm::ContentMetaType type) {
+            switch (type) {
+                using enum ncm::ContentMetaType;
+                case SystemProgram:        return "SystemProgram";
+                case SystemData:           return "SystemData";
+                case SystemUpdate:         return "SystemUpdate";
+                case BootImagePackage:     return "BootImagePackage";
+                case BootImagePackageSafe: return "BootImagePackageSafe";
+                case Application:          return "Application";
+                case Patch:                return "Patch";
+                case AddOnContent:         return "AddOnContent";
+                case Delta:                return "Delta";
+                default:                   return "Unknown";
+            }
+        }
+
+        const char *GetContentTypeName(ncm::ContentType type) {
+            switch (type) {
+                using enum ncm::ContentType;
+                case Meta:             return "Meta";
+                case Program:          return "Program";
+                case Data:             return "Data";
+                case Control:          return "Control";
+                case HtmlDocument:     return "HtmlDocument";
+                case LegalInformation: return "LegalInformation";
+                case DeltaFragment:    return "DeltaFragment";
+                default:               return "Unknown";
+            }
+        }
+
+        /* Ids are hex, separated by commas. */
+        bool ParseSystemTitleIds(std::vector<u64> *out, const char *str) {
+            while (*str != 0) {
+                char *end;
+                const u64 id = std::strtoull(str, std::addressof(end), 16);
+                if (end == str || (*end != ',' && *end != 0)) {
+                    return false;
+                }
+
+                out->push_back(id);
+                str = (*end == ',') ? end + 1 : end;
+            }
+
+            return true;
+        }
+
+        const char *GetFileName(const char *path) {
+            const char *name = std::strrchr(path, '/');
+            return name != nullptr ? name + 1 : path;
+        }
+
+    }
+
+    Result Processor::OpenSystemUpdateInput(std::shared_ptr<fs::fsa::IFileSystem> *out, const char *path) {
+        HACTOOL_TRACE_ZONE("OpenSystemUpdateInput", "path", path);
+
+        fs::Path in_path;
+        R_TRY(in_path.SetShallowBuffer(path));
+
+        fs::DirectoryEntryType in_type;
+        R_TRY(m_local_fs->GetEntryType(std::addressof(in_type), in_path));
+
+        /* A directory is taken to hold the contents directly. */
+        if (in_type == fs::DirectoryEntryType_Directory) {
+            R_RETURN(OpenSubDirectoryFileSystem(out, m_local_fs, path));
+        }
+
+        std::shared_ptr<fs::IStorage> storage;
+        R_TRY(OpenInputStorage(std::addressof(storage), m_local_fs, path));
+
+        u32 magic;
+        R_TRY(storage->Read(0, std::addressof(magic), sizeof(magic)));
+
+        /* Nsps hold the contents at their root. */
+        if (magic == PartitionFileSystemMagic) {
+            auto pfs = fssystem::AllocateShared<fssystem::PartitionFileSystem>();
+            R_UNLESS(pfs != nullptr, fs::ResultAllocationMemoryFailedInPartitionFileSystemCreatorA());
+            R_TRY(pfs->Initialize(std::move(storage)));
+
+            *out = std::move(pfs);
+            R_SUCCEED();
+        }
+
+        /* Anything else should be a game card, whose firmware is in its update partition. */
+        ProcessAsXciContext xci_ctx{};
+        R_TRY(this->ProcessAsXci(std::move(storage), std::addressof(xci_ctx)));
+        R_UNLESS(xci_ctx.update_partition.fs != nullptr, fs::ResultPathNotFound());
+
+        *out = xci_ctx.update_partition.fs;
+        R_SUCCEED();
+    }
+
+    Result Processor::ReadSystemUpdateMeta(ProcessAsSystemUpdateContext::Title *out, std::shared_ptr<fs::fsa::IFileSystem> &fs, const char *path, const char *content_id) {
+        HACTOOL_TRACE_ZONE("ReadSystemUpdateMeta", "path", path);
+
+        std::shared_ptr<fs::IStorage> storage;
+        R_TRY(OpenFileStorage(std::addressof(storage), fs, path));
+
+        /* Only the header is needed to skip everything that isn't a meta. */
+        std::shared_ptr<fssystem::NcaReader> reader;
+        R_TRY(this->OpenNcaReader(std::addressof(reader), storage));
+        R_SUCCEED_IF(reader->GetContentType() != fssystem::NcaHeader::ContentType::Meta);
+
+        ProcessAsNcaContext meta_nca_ctx{};
+        R_TRY(this->ProcessAsNca(std::move(storage), std::addressof(meta_nca_ctx)));
+        R_UNLESS(meta_nca_ctx.is_mounted[MetaFileSystemPartitionIndex], fs::ResultPathNotFound());
+
+        /* Read the content meta file. */
+        TrackedUniquePtr<u8> meta_data;
+        size_t meta_size;
+        R_TRY(ReadContentMetaFile(std::addressof(meta_data), std::addressof(meta_size), meta_nca_ctx.file_systems[MetaFileSystemPartitionIndex]));
+
+        /* Parse the cnmt. */
+        const auto meta_reader = ncm::PackagedContentMetaReader(meta_data.get(), meta_size);
+        const auto * const meta_header = meta_reader.GetHeader();
+
+        out->id       = meta_header->id;
+        out->version  = meta_header->version;
+        out->type     = meta_header->type;
+        out->is_found = true;
+
+        out->contents.push_back(SystemContent{ ncm::ContentType::Meta, content_id, path });
+        for (size_t i = 0; i < meta_reader.GetContentCount(); ++i) {
+            const auto &info = *meta_reader.GetContentInfo(i);
+            out->contents.push_back(SystemContent{ info.GetType(), ncm::GetContentIdString(info.GetId()).data, std::string() });
+        }
+
+        for (size_t i = 0; i < meta_reader.GetContentMetaCount(); ++i) {
+            out->content_metas.push_back(*meta_reader.GetContentMetaInfo(i));
+        }
+
+        R_SUCCEED();
+    }
+
+    Result Processor::ProcessAsSystemUpdate(std::shared_ptr<fs::fsa::IFileSystem> fs, ProcessAsSystemUpdateContext *ctx) {
+        HACTOOL_TRACE_ZONE("ProcessAsSystemUpdate");
+
+        /* Ensure we have a context. */
+        ProcessAsSystemUpdateContext local_ctx{};
+        if (ctx == nullptr) {
+            ctx = std::addressof(local_ctx);
+        }
+
+        /* Set the fs. */
+        ctx->fs = std::move(fs);
+
+        /* Find every content, in a single scan of the container. */
+        std::vector<std::string> paths;
+        std::vector<std::string> content_ids;
+        std::unordered_map<std::string, size_t> content_indices;
+        {
+            const auto iter_result = fssystem::IterateDirectoryRecursively(ctx->fs.get(),
+                [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+                [&] (const fs::Path &, const fs::DirectoryEntry &) -> Result { R_SUCCEED(); },
+                [&] (const fs::Path &path, const fs::DirectoryEntry &entry) -> Result {
+                    char content_id[ncm::ContentIdStringLength + 1];
+                    R_SUCCEED_IF(!GetContentIdFromName(content_id, entry.name));
+
+                    if (!content_indices.emplace(content_id, paths.size()).second) {
+                        fprintf(stderr, "[Warning]: Ignoring duplicate content (%s)\n", path.GetString());
+                        R_SUCCEED();
+                    }
+
+                    paths.emplace_back(path.GetString());
+                    content_ids.emplace_back(content_id);
+                    R_SUCCEED();
+                }
+            );
+            if (R_FAILED(iter_result)) {
+                fprintf(stderr, "[Warning]: Failed to parse system update filesystem: 2%03d-%04d\n", iter_result.GetModule(), iter_result.GetDescription());
+            }
+        }
+
+        /* Read the metas, a content per job. */
+        /* Metas can't be told apart by name in every dump, so each content's header is checked. */
+        std::vector<SystemTitle> metas(paths.size());
+        {
+            ScopedProgressJob job("Reading system update metas");
+            AddProgressTotal(0, paths.size());
+
+            R_TRY(RunParallel(paths.size(), [&] (size_t i) -> Result {
+                if (const auto res = this->ReadSystemUpdateMeta(std::addressof(metas[i]), ctx->fs, paths[i].c_str(), content_ids[i].c_str()); R_FAILED(res)) {
+                    fprintf(stderr, "[Warning]: Failed to read meta from %s: 2%03d-%04d\n", paths[i].c_str(), res.GetModule(), res.GetDescription());
+                }
+
+                AddProgress(0, 1);
+                R_SUCCEED();
+            }));
+        }
+
+        /* Index the metas by key, picking out the newest system update. */
+        std::map<std::pair<u64, u32>, size_t> meta_indices;
+        s64 system_update_index = -1;
+        for (size_t i = 0; i < metas.size(); ++i) {
+            const auto &meta = metas[i];
+            if (!meta.is_found) {
+                continue;
+            }
+
+            if (meta.type == ncm::ContentMetaType::SystemUpdate) {
+                if (system_update_index < 0 || meta.version > metas[system_update_index].version) {
+                    system_update_index = i;
+                }
+                continue;
+            }
+
+            if (!meta_indices.emplace(std::make_pair(meta.id, meta.version), i).second) {
+                fprintf(stderr, "[Warning]: Ignoring duplicate meta { %016" PRIX64 ", %" PRIu32 " } (%s)\n", meta.id, meta.version, paths[i].c_str());
+            }
+        }
+
+        /* Resolve the system update's titles. */
+        ctx->has_system_update = system_update_index >= 0;
+        if (ctx->has_system_update) {
+            ctx->system_update = std::move(metas[system_update_index]);
+
+            for (const auto &info : ctx->system_update.content_metas) {
+                if (auto it = meta_indices.find(std::make_pair(info.id, info.version)); it != meta_indices.end()) {
+                    ctx->titles.push_back(std::move(metas[it->second]));
+                } else {
+                    fprintf(stderr, "[Warning]: SystemUpdate lists { %016" PRIX64 ", %" PRIu32 " }, which is not present\n", info.id, info.version);
+                    ctx->titles.push_back(SystemTitle{ info.id, info.version, info.type, false, {}, {} });
+                }
+            }
+        } else {
+            fprintf(stderr, "[Warning]: Found no SystemUpdate meta; listing every title present.\n");
+
+            for (const auto &[key, index] : meta_indices) {
+                ctx->titles.push_back(std::move(metas[index]));
+            }
+        }
+
+        std::sort(ctx->titles.begin(), ctx->titles.end(), [] (const SystemTitle &lhs, const SystemTitle &rhs) {
+            return lhs.id < rhs.id;
+        });
+
+        /* Find each title's contents. */
+        for (auto &title : ctx->titles) {
+            for (auto &content : title.contents) {
+                if (!content.path.empty()) {
+                    continue;
+                }
+
+                if (auto it = content_indices.find(content.id); it != content_indices.end()) {
+                    content.path = paths[it->second];
+                } else {
+                    fprintf(stderr, "[Warning]: Content %s (type %s) of %016" PRIX64 " is not present\n", content.id.c_str(), GetContentTypeName(content.type), title.id);
+                }
+            }
+        }
+
+        /* Print. */
+        if (ctx == std::addressof(local_ctx)) {
+            this->PrintAsSystemUpdate(*ctx);
+        }
+
+        /* Save. */
+        if (ctx == std::addressof(local_ctx)) {
+            R_TRY(this->SaveAsSystemUpdate(*ctx));
+        }
+
+        R_SUCCEED();
+    }
+
+    void Processor::PrintAsSystemUpdate(ProcessAsSystemUpdateContext &ctx) {
+        auto _ = this->PrintHeader("System Update");
+
+        if (ctx.has_system_update) {
+            const u32 version = ctx.system_update.version;
+            this->PrintId64("Id", ctx.system_update.id);
+            this->PrintFormat("Version", "0x%08" PRIX32 " (%" PRIu32 ".%" PRIu32 ".%" PRIu32 ")", version, (version >> 26) & 0x3F, (version >> 20) & 0x3F, (version >> 16) & 0xF);
+        }
+
+        this->PrintInteger("Title Count", ctx.titles.size());
+
+        const char *field_name = "Titles";
+        for (const auto &title : ctx.titles) {
+            size_t present = 0;
+            for (const auto &content : title.contents) {
+                present += content.path.empty() ? 0 : 1;
+            }
+
+            this->PrintFormat(field_name, "{ Id=%016" PRIX64 ", Version=0x%08" PRIX32 ", Type=%s, Contents=%zu/%zu }%s", title.id, title.version, GetContentMetaTypeName(title.type), present, title.contents.size(), title.is_found ? "" : " (Missing)");
+            field_name = "";
+        }
+    }
+
+    Result Processor::SaveAsSystemUpdate(ProcessAsSystemUpdateContext &ctx) {
+        R_SUCCEED_IF(m_options.system_update_out_dir_path == nullptr);
+
+        /* Determine which titles to extract, defaulting to all of them. */
+        std::vector<u64> selected_ids;
+        if (m_options.system_title_ids != nullptr && !ParseSystemTitleIds(std::addressof(selected_ids), m_options.system_title_ids)) {
+            fprintf(stderr, "[Warning]: Invalid system title id list (%s)\n", m_options.system_title_ids);
+            R_THROW(fs::ResultInvalidArgument());
+        }
+
+        std::vector<const SystemTitle *> titles;
+        if (selected_ids.empty()) {
+            for (const auto &title : ctx.titles) {
+                titles.push_back(std::addressof(title));
+            }
+        } else {
+            for (const auto id : selected_ids) {
+                const auto it = std::lower_bound(ctx.titles.begin(), ctx.titles.end(), id, [] (const SystemTitle &title, u64 id) { return title.id < id; });
+                if (it != ctx.titles.end() && it->id == id) {
+                    titles.push_back(std::addressof(*it));
+                } else {
+                    fprintf(stderr, "[Warning]: System title %016" PRIX64 " is not present\n", id);
+                }
+            }
+        }
+
+        /* Create the destination directories, each title's contents going in a directory named for its id. */
+        struct ExtractEntry {
+            const char *src_path;
+            char dst_path[1_KB];
+        };
+
+        std::vector<ExtractEntry> entries;
+        {
+            auto CreateDirectory = [&] (const char *path) {
+                fs::Path dir_path;
+                if (R_SUCCEEDED(dir_path.SetShallowBuffer(path))) {
+                    m_local_fs->CreateDirectory(dir_path);
+                }
+            };
+
+            CreateDirectory(m_options.system_update_out_dir_path);
+
+            for (const auto *title : titles) {
+                char title_dir[1_KB];
+                util::TSNPrintf(title_dir, sizeof(title_dir), "%s/%016" PRIx64, m_options.system_update_out_dir_path, title->id);
+                CreateDirectory(title_dir);
+
+                for (const auto &content : title->contents) {
+                    if (content.path.empty()) {
+                        continue;
+                    }
+
+                    auto &entry = entries.emplace_back();
+                    entry.src_path = content.path.c_str();
+                    util::TSNPrintf(entry.dst_path, sizeof(entry.dst_path), "%s/%s", title_dir, GetFileName(content.path.c_str()));
+                }
+            }
+        }
+
+        /* Copy the contents, a content per job. */
+        printf("Saving %zu system title(s) to %s...\n", titles.size(), m_options.system_update_out_dir_path);
+
+        std::vector<Result> results(entries.size(), ResultSuccess());
+        {
+            ScopedProgressJob job("Extracting system titles");
+            R_TRY(RunParallel(entries.size(), [&] (size_t i) -> Result {
+                /* Each content's failure is recorded rather than returned, so the rest are still extracted. */
+                std::shared_ptr<fs::IStorage> storage;
+                if (const auto res = OpenFileStorage(std::addressof(storage), ctx.fs, entries[i].src_path); R_FAILED(res)) {
+                    fprintf(stderr, "[Warning]: Failed to open %s: 2%03d-%04d\n", entries[i].src_path, res.GetModule(), res.GetDescription());
+                    results[i] = res;
+                    R_SUCCEED();
+                }
+
+                /* SaveToFile prints its own warning on failure. */
+                results[i] = SaveToFile(m_local_fs, entries[i].dst_path, storage.get());
+                R_SUCCEED();
+            }));
+        }
+
+        /* Report how many contents couldn't be extracted, failing with the first error. */
+        size_t failure_count = 0;
+        Result first_failure = ResultSuccess();
+        for (const auto &res : results) {
+            if (R_FAILED(res)) {
+                if (failure_count++ == 0) {
+                    first_failure = res;
+                }
+            }
+        }
+
+        if (failure_count != 0) {
+            fprintf(stderr, "[Warning]: Failed to extract %zu of %zu system title content(s)\n", failure_count, entries.size());
+        }
+
+        R_RETURN(first_failure);
+    }
+
+}
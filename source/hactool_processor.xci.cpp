@@ -17,15 +17,17 @@
 #include <exosphere/pkg1.hpp>
 #include "hactool_processor.hpp"
 #include "hactool_fs_utils.hpp"
+#include "hactool_hash_verification.hpp"
+#include "hactool_concatenated_storage.hpp"
+#include "hactool_memory_accounting.hpp"
+#include "hactool_memory_utils.hpp"
+#include "hactool_trace.hpp"
+#include "hactool_xci_layout.hpp"
 
 namespace ams::hactool {
 
     namespace {
 
-        constexpr size_t CardInitialDataRegionSize = 0x1000;
-
-        constexpr size_t CardPageSize = 0x200;
-
         struct XciBodyHeader {
             gc::impl::CardHeaderWithSignature card_header;
             gc::impl::CardHeaderWithSignature card_header_for_sign2;
@@ -99,9 +101,86 @@ namespace ams::hactool {
             R_SUCCEED();
         }
 
+        /* Everything past the valid data end of a full image is unwritten flash, which reads as this. */
+        constexpr u8 CardPaddingValue = 0xFF;
+
+        constexpr size_t PaddingCheckBufferSize = 4_MB;
+
+        /* Gets the size of a full image of a card, which excludes the area reserved for error correction. */
+        bool GetCardImageSize(s64 *out, u8 rom_size) {
+            s64 capacity;
+            switch (rom_size) {
+                case gc::impl::MemoryCapacity_1GB:  capacity = INT64_C(1)  << 30; break;
+                case gc::impl::MemoryCapacity_2GB:  capacity = INT64_C(2)  << 30; break;
+                case gc::impl::MemoryCapacity_4GB:  capacity = INT64_C(4)  << 30; break;
+                case gc::impl::MemoryCapacity_8GB:  capacity = INT64_C(8)  << 30; break;
+                case gc::impl::MemoryCapacity_16GB: capacity = INT64_C(16) << 30; break;
+                case gc::impl::MemoryCapacity_32GB: capacity = INT64_C(32) << 30; break;
+                default: return false;
+            }
+
+            /* Every page of the card is paired with 0x24 bytes of unusable area. */
+            *out = capacity - (capacity / CardPageSize) * 0x24;
+            return true;
+        }
+
+        /* Reads as padding, so a trimmed image can be presented at its full size without materializing the tail. */
+        class CardPaddingStorage : public ::ams::fs::IStorage, public ::ams::fs::impl::Newable {
+            NON_COPYABLE(CardPaddingStorage);
+            NON_MOVEABLE(CardPaddingStorage);
+            private:
+                s64 m_size;
+            public:
+                explicit CardPaddingStorage(s64 size) : m_size(size) { /* ... */ }
+
+                virtual Result Read(s64 offset, void *buffer, size_t size) override {
+                    R_UNLESS(offset >= 0 && offset <= m_size && static_cast<s64>(size) <= m_size - offset, fs::ResultOutOfRange());
+
+                    std::memset(buffer, CardPaddingValue, size);
+                    R_SUCCEED();
+                }
+
+                virtual Result GetSize(s64 *out) override {
+                    *out = m_size;
+                    R_SUCCEED();
+                }
+
+                virtual Result Flush() override {
+                    R_SUCCEED();
+                }
+
+                virtual Result OperateRange(void *dst, size_t dst_size, fs::OperationId op_id, s64 offset, s64 size, const void *src, size_t src_size) override {
+                    AMS_UNUSED(offset, size, src, src_size);
+
+                    switch (op_id) {
+                        case fs::OperationId::Invalidate:
+                            R_SUCCEED();
+                        case fs::OperationId::QueryRange:
+                            R_UNLESS(dst != nullptr,                         fs::ResultNullptrArgument());
+                            R_UNLESS(dst_size == sizeof(fs::QueryRangeInfo), fs::ResultInvalidSize());
+                            static_cast<fs::QueryRangeInfo *>(dst)->Clear();
+                            R_SUCCEED();
+                        default:
+                            R_THROW(fs::ResultUnsupportedOperation());
+                    }
+                }
+
+                virtual Result Write(s64 offset, const void *buffer, size_t size) override {
+                    AMS_UNUSED(offset, buffer, size);
+                    R_THROW(fs::ResultUnsupportedOperation());
+                }
+
+                virtual Result SetSize(s64 size) override {
+                    AMS_UNUSED(size);
+                    R_THROW(fs::ResultUnsupportedOperation());
+                }
+        };
+
     }
 
     Result Processor::ProcessAsXci(std::shared_ptr<fs::IStorage> storage, ProcessAsXciContext *ctx) {
+        HACTOOL_TRACE_ZONE("ProcessAsXci");
+
         /* Ensure we have a context. */
         ProcessAsXciContext local_ctx{};
         if (ctx == nullptr) {
@@ -190,6 +269,8 @@ namespace ams::hactool {
                     }
 
                     if (target_partition != nullptr) {
+                        HACTOOL_TRACE_ZONE("MountGameCardPartition", "partition", path.GetString());
+
                         if (const auto res = OpenFileStorage(std::addressof(target_partition->storage), ctx->root_partition.fs, path.GetString()); R_SUCCEEDED(res)) {
                             if (const auto res = CreatePartitionFileSystem(std::addressof(target_partition->fs), target_partition->storage); R_FAILED(res)) {
                                 fprintf(stderr, "[Warning]: Failed to mount game card partition (%s): 2%03d-%04d\n", path.GetString(), res.GetModule(), res.GetDescription());
@@ -347,6 +428,17 @@ namespace ams::hactool {
                 std::memset(print_prefix, ' ', WidthToPrintFieldValue);
                 util::TSNPrintf(print_prefix + WidthToPrintFieldValue, sizeof(print_prefix) - WidthToPrintFieldValue, "%s", prefix);
                 PrintDirectory(part.fs, print_prefix, "/");
+
+                if (m_options.verify && part.storage != nullptr) {
+                    HashVerificationResult verification = {};
+                    if (const auto res = VerifySha256PartitionFileSystem(std::addressof(verification), part.storage.get()); R_SUCCEEDED(res)) {
+                        char field_name[0x40];
+                        MakeVerifyFieldName(field_name, sizeof(field_name), "Entry Hashes", verification.IsValid());
+                        this->PrintFormat(field_name, "%" PRId64 "/%" PRId64 " entries valid", verification.block_count - verification.invalid_block_count, verification.block_count);
+                    } else {
+                        fprintf(stderr, "[Warning]: Failed to verify %s entry hashes: 2%03d-%04d\n", prefix, res.GetModule(), res.GetDescription());
+                    }
+                }
             }
         };
 
@@ -362,7 +454,9 @@ namespace ams::hactool {
             this->PrintAsApplicationFileSystem(ctx.app_ctx);
         }
 
-        AMS_UNUSED(ctx);
+        if (m_options.print_hashes) {
+            this->PrintHashes(ctx);
+        }
     }
 
     void Processor::SaveAsXci(ProcessAsXciContext &ctx) {
@@ -373,10 +467,99 @@ namespace ams::hactool {
         if (m_options.secure_partition_out_dir != nullptr) { ExtractDirectoryWithProgress(m_local_fs, ctx.secure_partition.fs, "secure:", m_options.secure_partition_out_dir, "/"); }
         if (m_options.update_partition_out_dir != nullptr) { ExtractDirectoryWithProgress(m_local_fs, ctx.update_partition.fs, "update:", m_options.update_partition_out_dir, "/"); }
 
+        /* Save the image trimmed or padded to its full size. */
+        if (m_options.xci_trim_out_path != nullptr) { this->SaveTrimmedXci(ctx, m_options.xci_trim_out_path); }
+        if (m_options.xci_untrim_out_path != nullptr) { this->SaveUntrimmedXci(ctx, m_options.xci_untrim_out_path); }
+
         /* Save the application filesystem. */
         if (ctx.secure_partition.fs != nullptr) {
             this->SaveAsApplicationFileSystem(ctx.app_ctx);
+
+            /* Compress the secure partition, which holds the game's contents. */
+            if (m_options.nsz_out_path != nullptr) {
+                this->SaveAsNsz(ctx.secure_partition.fs, m_options.nsz_out_path);
+            }
+
+            /* Repack the secure partition as an installable nsp, straight from the card image. */
+            if (m_options.nsp_out_path != nullptr) {
+                this->SaveAsNsp(ctx, m_options.nsp_out_path);
+            }
+        }
+    }
+
+    Result Processor::SaveTrimmedXci(ProcessAsXciContext &ctx, const char *path) {
+        HACTOOL_TRACE_ZONE("SaveTrimmedXci", "path", path);
+
+        auto trim_impl = [&] () -> Result {
+            s64 storage_size;
+            R_TRY(ctx.storage->GetSize(std::addressof(storage_size)));
+
+            /* Keep the key area, if present, and the body up to and including its last valid page. */
+            const s64 key_area_size = ctx.key_area_storage != nullptr ? static_cast<s64>(CardInitialDataRegionSize) : 0;
+            const s64 trimmed_size  = key_area_size + (static_cast<s64>(ctx.card_data.header.data.valid_data_end_page) + 1) * static_cast<s64>(CardPageSize);
+            R_UNLESS(trimmed_size <= storage_size, fs::ResultOutOfRange());
+
+            /* Verify that everything discarded is padding, so the image can be restored exactly. */
+            {
+                auto buffer = MakeTrackedArray<u8>(PaddingCheckBufferSize, AllocationSite_VerificationBuffer);
+                R_UNLESS(buffer != nullptr, fs::ResultAllocationMemoryFailed());
+
+                for (s64 offset = trimmed_size; offset < storage_size; /* ... */) {
+                    const size_t cur_size = static_cast<size_t>(std::min<s64>(storage_size - offset, PaddingCheckBufferSize));
+                    R_TRY(ctx.storage->Read(offset, buffer.get(), cur_size));
+
+                    if (!IsFilledWith(buffer.get(), cur_size, CardPaddingValue)) {
+                        fprintf(stderr, "[Warning]: Data found past the valid data end (near 0x%" PRIx64 "), refusing to trim.\n", static_cast<u64>(offset));
+                        R_THROW(fs::ResultInvalidSize());
+                    }
+
+                    offset += cur_size;
+                }
+            }
+
+            R_RETURN(SaveToFile(m_local_fs, path, ctx.storage.get(), 0, trimmed_size));
+        };
+
+        const auto res = trim_impl();
+        if (R_FAILED(res)) {
+            fprintf(stderr, "[Warning]: Failed to save trimmed xci to %s: 2%03d-%04d\n", path, res.GetModule(), res.GetDescription());
         }
+
+        R_RETURN(res);
+    }
+
+    Result Processor::SaveUntrimmedXci(ProcessAsXciContext &ctx, const char *path) {
+        HACTOOL_TRACE_ZONE("SaveUntrimmedXci", "path", path);
+
+        auto untrim_impl = [&] () -> Result {
+            s64 storage_size;
+            R_TRY(ctx.storage->GetSize(std::addressof(storage_size)));
+
+            /* Determine the full size of the card image. */
+            s64 image_size;
+            if (!GetCardImageSize(std::addressof(image_size), ctx.card_data.header.data.rom_size)) {
+                fprintf(stderr, "[Warning]: Unknown memory capacity 0x%02x, cannot determine the full image size.\n", ctx.card_data.header.data.rom_size);
+                R_THROW(fs::ResultInvalidSize());
+            }
+
+            const s64 key_area_size = ctx.key_area_storage != nullptr ? static_cast<s64>(CardInitialDataRegionSize) : 0;
+            const s64 full_size     = key_area_size + image_size;
+            R_UNLESS(storage_size <= full_size, fs::ResultInvalidSize());
+
+            /* Append padding without staging it, and save the whole. */
+            ConcatenatedStorage full_storage;
+            R_TRY(full_storage.AddPart(ctx.storage));
+            R_TRY(full_storage.AddPart(std::make_shared<CardPaddingStorage>(full_size - storage_size)));
+
+            R_RETURN(SaveToFile(m_local_fs, path, std::addressof(full_storage), 0, full_size));
+        };
+
+        const auto res = untrim_impl();
+        if (R_FAILED(res)) {
+            fprintf(stderr, "[Warning]: Failed to save untrimmed xci to %s: 2%03d-%04d\n", path, res.GetModule(), res.GetDescription());
+        }
+
+        R_RETURN(res);
     }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_progress.hpp"
+
+#if defined(ATMOSPHERE_OS_WINDOWS)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr TimeSpan RefreshInterval = TimeSpan::FromMilliSeconds(200);
+
+        /* Weight given to the newest rate sample when smoothing the speed estimate. */
+        constexpr double RateSmoothingFactor = 0.3;
+
+        constinit bool g_render_status = true;
+        constinit int g_event_fd = -1;
+
+        constinit std::atomic<s64> g_bytes_done  = 0;
+        constinit std::atomic<s64> g_bytes_total = 0;
+        constinit std::atomic<s64> g_files_done  = 0;
+        constinit std::atomic<s64> g_files_total = 0;
+
+        /* Whoever first observes that this tick has passed refreshes the status, so workers never wait on each other. */
+        constinit std::atomic<s64> g_next_refresh_tick = 0;
+
+        /* Job state, guarded by the job lock. */
+        constinit os::SdkMutex g_job_lock;
+        constinit std::atomic<s32> g_job_depth = 0;
+        constinit const char *g_job_name = nullptr;
+        constinit char g_job_name_json[0x100] = {};
+        constinit os::Tick g_job_start_tick;
+        constinit os::Tick g_last_refresh_tick;
+        constinit s64 g_last_refresh_bytes = 0;
+        constinit double g_rate = 0.0;
+        constinit size_t g_status_length = 0;
+
+        void WriteEvent(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+        void WriteEvent(const char *fmt, ...) {
+            char line[0x200];
+
+            std::va_list vl;
+            va_start(vl, fmt);
+            const int len = util::VSNPrintf(line, sizeof(line) - 1, fmt, vl);
+            va_end(vl);
+
+            const size_t size = std::min<size_t>(std::max(len, 0), sizeof(line) - 2);
+            line[size] = '\n';
+
+            #if defined(ATMOSPHERE_OS_WINDOWS)
+            ::_write(g_event_fd, line, static_cast<unsigned int>(size + 1));
+            #else
+            [[maybe_unused]] const auto written = ::write(g_event_fd, line, size + 1);
+            #endif
+        }
+
+        void EscapeJsonString(char *dst, size_t dst_size, const char *src) {
+            size_t len = 0;
+            for (/* ... */; *src != 0 && len + 2 < dst_size; ++src) {
+                if (*src == '"' || *src == '\\') {
+                    dst[len++] = '\\';
+                }
+                dst[len++] = static_cast<unsigned char>(*src) < 0x20 ? ' ' : *src;
+            }
+            dst[len] = 0;
+        }
+
+        void FormatDuration(char *dst, size_t dst_size, s64 seconds) {
+            util::SNPrintf(dst, dst_size, "%02" PRId64 ":%02" PRId64 ":%02" PRId64, seconds / 3600, (seconds / 60) % 60, seconds % 60);
+        }
+
+        void Refresh(os::Tick now, bool final) {
+            const s64 bytes_done  = g_bytes_done.load(std::memory_order_relaxed);
+            const s64 bytes_total = std::max(g_bytes_total.load(std::memory_order_relaxed), bytes_done);
+            const s64 files_done  = g_files_done.load(std::memory_order_relaxed);
+            const s64 files_total = std::max(g_files_total.load(std::memory_order_relaxed), files_done);
+
+            /* Update the speed estimate. */
+            const double interval = static_cast<double>((now - g_last_refresh_tick).ToTimeSpan().GetMicroSeconds()) / 1'000'000.0;
+            if (interval > 0.0) {
+                const double sample = static_cast<double>(bytes_done - g_last_refresh_bytes) / interval;
+                g_rate = g_last_refresh_bytes == 0 && g_rate == 0.0 ? sample : g_rate + RateSmoothingFactor * (sample - g_rate);
+            }
+            g_last_refresh_tick  = now;
+            g_last_refresh_bytes = bytes_done;
+
+            const double elapsed = static_cast<double>((now - g_job_start_tick).ToTimeSpan().GetMicroSeconds()) / 1'000'000.0;
+            const double rate    = final && elapsed > 0.0 ? static_cast<double>(bytes_done) / elapsed : g_rate;
+            const s64 eta        = rate > 0.0 ? static_cast<s64>(static_cast<double>(bytes_total - bytes_done) / rate) : -1;
+
+            if (g_render_status) {
+                char eta_str[0x20];
+                if (final) {
+                    FormatDuration(eta_str, sizeof(eta_str), static_cast<s64>(elapsed));
+                } else if (eta >= 0) {
+                    FormatDuration(eta_str, sizeof(eta_str), eta);
+                } else {
+                    util::SNPrintf(eta_str, sizeof(eta_str), "--:--:--");
+                }
+
+                char status[0x200];
+                const int len = util::SNPrintf(status, sizeof(status), "%s: %5.1f%% %.1f/%.1f MB, %" PRId64 "/%" PRId64 " files, %.1f MB/s, %s %s",
+                                               g_job_name,
+                                               bytes_total > 0 ? 100.0 * static_cast<double>(bytes_done) / static_cast<double>(bytes_total) : 100.0,
+                                               static_cast<double>(bytes_done) / static_cast<double>(1_MB), static_cast<double>(bytes_total) / static_cast<double>(1_MB),
+                                               files_done, files_total,
+                                               rate / static_cast<double>(1_MB),
+                                               final ? "in" : "ETA", eta_str);
+
+                /* Pad over whatever remains of a longer previous line. */
+                const size_t status_length = std::min<size_t>(std::max(len, 0), sizeof(status) - 1);
+                printf("\r%s%*s%s", status, static_cast<int>(g_status_length > status_length ? g_status_length - status_length : 0), "", final ? "\n" : "");
+                fflush(stdout);
+
+                g_status_length = final ? 0 : status_length;
+            }
+
+            if (g_event_fd >= 0) {
+                WriteEvent("{\"event\":\"%s\",\"job\":\"%s\",\"bytes\":%" PRId64 ",\"total_bytes\":%" PRId64 ",\"files\":%" PRId64 ",\"total_files\":%" PRId64 ",\"bytes_per_second\":%.0f,\"eta_seconds\":%" PRId64 "}",
+                           final ? "end" : "progress", g_job_name_json, bytes_done, bytes_total, files_done, files_total, rate, final ? 0 : eta);
+            }
+        }
+
+        void TryRefresh() {
+            if (g_job_depth == 0 || (!g_render_status && g_event_fd < 0)) {
+                return;
+            }
+
+            const auto now = os::GetSystemTick();
+            s64 next = g_next_refresh_tick.load(std::memory_order_relaxed);
+            if (static_cast<s64>(now.GetInt64Value()) < next) {
+                return;
+            }
+
+            /* Claim this refresh; if another thread beat us to it, there's nothing to do. */
+            if (!g_next_refresh_tick.compare_exchange_strong(next, (now + os::ConvertToTick(RefreshInterval)).GetInt64Value(), std::memory_order_relaxed)) {
+                return;
+            }
+
+            std::scoped_lock lk(g_job_lock);
+            if (g_job_depth > 0) {
+                Refresh(now, false);
+            }
+        }
+
+    }
+
+    void ConfigureProgress(bool render_status, int event_fd) {
+        g_render_status = render_status;
+        g_event_fd      = event_fd;
+    }
+
+    void AddProgressTotal(s64 bytes, s64 files) {
+        g_bytes_total.fetch_add(bytes, std::memory_order_relaxed);
+        g_files_total.fetch_add(files, std::memory_order_relaxed);
+    }
+
+    void AddProgress(s64 bytes, s64 files) {
+        g_bytes_done.fetch_add(bytes, std::memory_order_relaxed);
+        g_files_done.fetch_add(files, std::memory_order_relaxed);
+
+        TryRefresh();
+    }
+
+    ScopedProgressJob::ScopedProgressJob(const char *name) {
+        std::scoped_lock lk(g_job_lock);
+
+        if (g_job_depth++ == 0) {
+            g_bytes_done  = 0;
+            g_bytes_total = 0;
+            g_files_done  = 0;
+            g_files_total = 0;
+
+            g_job_name           = name;
+            g_job_start_tick     = os::GetSystemTick();
+            g_last_refresh_tick  = g_job_start_tick;
+            g_last_refresh_bytes = 0;
+            g_rate               = 0.0;
+            g_status_length      = 0;
+            g_next_refresh_tick  = (g_job_start_tick + os::ConvertToTick(RefreshInterval)).GetInt64Value();
+
+            if (g_event_fd >= 0) {
+                EscapeJsonString(g_job_name_json, sizeof(g_job_name_json), name);
+                WriteEvent("{\"event\":\"begin\",\"job\":\"%s\"}", g_job_name_json);
+            }
+        }
+    }
+
+    ScopedProgressJob::~ScopedProgressJob() {
+        std::scoped_lock lk(g_job_lock);
+
+        if (--g_job_depth == 0 && (g_render_status || g_event_fd >= 0)) {
+            Refresh(os::GetSystemTick(), true);
+        }
+    }
+
+}
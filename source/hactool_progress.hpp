@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    /* Sets whether a status line is drawn, and a file descriptor (or -1) to which progress events are written as JSON lines. */
+    void ConfigureProgress(bool render_status, int event_fd);
+
+    /* Grows the work expected of the current job; safe to call from any thread. */
+    void AddProgressTotal(s64 bytes, s64 files);
+
+    /* Records completed work; safe to call from any thread, and cheap unless a refresh is due. */
+    void AddProgress(s64 bytes, s64 files);
+
+    /* Scopes a job. Work from nested scopes (and from every thread) is aggregated into the outermost one. */
+    class ScopedProgressJob {
+        NON_COPYABLE(ScopedProgressJob);
+        NON_MOVEABLE(ScopedProgressJob);
+        public:
+            explicit ScopedProgressJob(const char *name);
+            ~ScopedProgressJob();
+    };
+
+}
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_sha256.hpp"
+
+#if defined(ATMOSPHERE_ARCH_X64)
+#include <immintrin.h>
+#include <cpuid.h>
+#elif defined(ATMOSPHERE_ARCH_ARM64)
+#include <arm_neon.h>
+#if defined(ATMOSPHERE_OS_LINUX)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+namespace ams::hactool {
+
+    namespace {
+
+        constexpr size_t HashSize  = crypto::Sha256Generator::HashSize;
+        constexpr size_t BlockSize = crypto::Sha256Generator::BlockSize;
+
+        alignas(0x40) constexpr const u32 RoundConstants[64] = {
+            0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+            0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+            0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+            0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+            0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+            0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+            0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+            0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+        };
+
+        constexpr const u32 InitialState[8] = {
+            0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+        };
+
+        /* Builds the one or two final blocks of a message, returning how many there are. */
+        size_t MakeFinalBlocks(u8 *dst, const void *data, size_t size) {
+            const size_t rem = size % BlockSize;
+            const size_t num_blocks = (rem + 1 + sizeof(u64) <= BlockSize) ? 1 : 2;
+
+            std::memset(dst, 0, num_blocks * BlockSize);
+            std::memcpy(dst, static_cast<const u8 *>(data) + (size - rem), rem);
+            dst[rem] = 0x80;
+
+            const u64 bit_size = static_cast<u64>(size) * 8;
+            for (size_t i = 0; i < sizeof(u64); ++i) {
+                dst[num_blocks * BlockSize - 1 - i] = static_cast<u8>(bit_size >> (8 * i));
+            }
+
+            return num_blocks;
+        }
+
+        void StoreHash(u8 *dst, const u32 *state) {
+            for (size_t i = 0; i < 8; ++i) {
+                dst[4 * i + 0] = static_cast<u8>(state[i] >> 24);
+                dst[4 * i + 1] = static_cast<u8>(state[i] >> 16);
+                dst[4 * i + 2] = static_cast<u8>(state[i] >>  8);
+                dst[4 * i + 3] = static_cast<u8>(state[i] >>  0);
+            }
+        }
+
+        using ProcessBlocksFunction = void (*)(u32 *state, const u8 *data, size_t num_blocks);
+
+        /* Hashes a single message with a block function. */
+        void GenerateSha256Single(const Sha256Job &job, ProcessBlocksFunction process_blocks) {
+            u32 state[8];
+            std::memcpy(state, InitialState, sizeof(state));
+
+            process_blocks(state, static_cast<const u8 *>(job.data), job.size / BlockSize);
+
+            alignas(0x10) u8 final_blocks[2 * BlockSize];
+            process_blocks(state, final_blocks, MakeFinalBlocks(final_blocks, job.data, job.size));
+
+            StoreHash(job.hash, state);
+        }
+
+        struct Sha256Kernels {
+            const char *name;
+            void (*generate_batch)(const Sha256Job *jobs, size_t count);
+        };
+
+        void GenerateBatchGeneric(const Sha256Job *jobs, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                crypto::GenerateSha256(jobs[i].hash, HashSize, jobs[i].data, jobs[i].size);
+            }
+        }
+
+        constexpr Sha256Kernels GenericKernels = { "generic", GenerateBatchGeneric };
+
+        #if defined(ATMOSPHERE_ARCH_X64)
+
+        #define HACTOOL_SHANI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+        #define HACTOOL_AVX2_TARGET  __attribute__((target("avx2")))
+
+        HACTOOL_SHANI_TARGET void ProcessBlocksShaNi(u32 *state, const u8 *data, size_t num_blocks) {
+            const __m128i ByteSwapMask = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+
+            /* Convert the state to the ABEF/CDGH layout used by sha256rnds2. */
+            __m128i tmp    = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 0)), 0xB1);
+            __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4)), 0x1B);
+            __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+            state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+            for (/* ... */; num_blocks > 0; --num_blocks, data += BlockSize) {
+                const __m128i save0 = state0;
+                const __m128i save1 = state1;
+
+                __m128i msg[4];
+                #pragma GCC unroll 16
+                for (size_t g = 0; g < 16; ++g) {
+                    if (g < 4) {
+                        msg[g] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data) + g), ByteSwapMask);
+                    } else {
+                        __m128i w = _mm_sha256msg1_epu32(msg[g % 4], msg[(g + 1) % 4]);
+                        w = _mm_add_epi32(w, _mm_alignr_epi8(msg[(g + 3) % 4], msg[(g + 2) % 4], 4));
+                        msg[g % 4] = _mm_sha256msg2_epu32(w, msg[(g + 3) % 4]);
+                    }
+
+                    __m128i wk = _mm_add_epi32(msg[g % 4], _mm_load_si128(reinterpret_cast<const __m128i *>(RoundConstants + 4 * g)));
+                    state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+                    wk     = _mm_shuffle_epi32(wk, 0x0E);
+                    state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+                }
+
+                state0 = _mm_add_epi32(state0, save0);
+                state1 = _mm_add_epi32(state1, save1);
+            }
+
+            /* Convert back to the natural layout. */
+            tmp    = _mm_shuffle_epi32(state0, 0x1B);
+            state1 = _mm_shuffle_epi32(state1, 0xB1);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 0), _mm_blend_epi16(tmp, state1, 0xF0));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), _mm_alignr_epi8(state1, tmp, 8));
+        }
+
+        void GenerateBatchShaNi(const Sha256Job *jobs, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                GenerateSha256Single(jobs[i], ProcessBlocksShaNi);
+            }
+        }
+
+        constexpr size_t LaneCount = 8;
+
+        HACTOOL_AVX2_TARGET ALWAYS_INLINE void Transpose8x8(__m256i *r) {
+            const __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+            const __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+            const __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+            const __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+            const __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+            const __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+            const __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+            const __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+
+            r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+            r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+            r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+            r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+            r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+            r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+            r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+            r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+        }
+
+        HACTOOL_AVX2_TARGET ALWAYS_INLINE __m256i RotateRight(__m256i x, int n) {
+            return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+        }
+
+        /* Processes one block from each of eight messages, with one message per 32-bit lane. */
+        HACTOOL_AVX2_TARGET void ProcessBlocksAvx2x8(__m256i *state, const u8 *const *data, size_t num_blocks) {
+            const __m256i ByteSwapMask = _mm256_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL, 0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+
+            for (size_t block = 0; block < num_blocks; ++block) {
+                /* Load the message words, transposed so that each vector holds one word of every message. */
+                __m256i w[16];
+                for (size_t half = 0; half < 2; ++half) {
+                    for (size_t lane = 0; lane < LaneCount; ++lane) {
+                        w[half * 8 + lane] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data[lane] + block * BlockSize) + half);
+                    }
+                    Transpose8x8(w + half * 8);
+                }
+                for (size_t i = 0; i < 16; ++i) {
+                    w[i] = _mm256_shuffle_epi8(w[i], ByteSwapMask);
+                }
+
+                __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+                __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+
+                #pragma GCC unroll 16
+                for (size_t t = 0; t < 64; ++t) {
+                    if (t >= 16) {
+                        const __m256i w15 = w[(t - 15) % 16];
+                        const __m256i w2  = w[(t -  2) % 16];
+                        const __m256i s0  = _mm256_xor_si256(_mm256_xor_si256(RotateRight(w15, 7), RotateRight(w15, 18)), _mm256_srli_epi32(w15, 3));
+                        const __m256i s1  = _mm256_xor_si256(_mm256_xor_si256(RotateRight(w2, 17), RotateRight(w2, 19)), _mm256_srli_epi32(w2, 10));
+                        w[t % 16] = _mm256_add_epi32(_mm256_add_epi32(w[t % 16], s0), _mm256_add_epi32(w[(t - 7) % 16], s1));
+                    }
+
+                    const __m256i S1  = _mm256_xor_si256(_mm256_xor_si256(RotateRight(e, 6), RotateRight(e, 11)), RotateRight(e, 25));
+                    const __m256i ch  = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+                    const __m256i t1  = _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(h, S1), _mm256_add_epi32(ch, _mm256_set1_epi32(RoundConstants[t]))), w[t % 16]);
+                    const __m256i S0  = _mm256_xor_si256(_mm256_xor_si256(RotateRight(a, 2), RotateRight(a, 13)), RotateRight(a, 22));
+                    const __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+                    const __m256i t2  = _mm256_add_epi32(S0, maj);
+
+                    h = g;
+                    g = f;
+                    f = e;
+                    e = _mm256_add_epi32(d, t1);
+                    d = c;
+                    c = b;
+                    b = a;
+                    a = _mm256_add_epi32(t1, t2);
+                }
+
+                state[0] = _mm256_add_epi32(state[0], a);
+                state[1] = _mm256_add_epi32(state[1], b);
+                state[2] = _mm256_add_epi32(state[2], c);
+                state[3] = _mm256_add_epi32(state[3], d);
+                state[4] = _mm256_add_epi32(state[4], e);
+                state[5] = _mm256_add_epi32(state[5], f);
+                state[6] = _mm256_add_epi32(state[6], g);
+                state[7] = _mm256_add_epi32(state[7], h);
+            }
+        }
+
+        /* Hashes up to eight messages of identical size together. */
+        HACTOOL_AVX2_TARGET void GenerateLanesAvx2(const Sha256Job *const *jobs, size_t count) {
+            AMS_ASSERT(0 < count && count <= LaneCount);
+            const size_t size = jobs[0]->size;
+
+            __m256i state[8];
+            for (size_t i = 0; i < 8; ++i) {
+                state[i] = _mm256_set1_epi32(static_cast<int>(InitialState[i]));
+            }
+
+            /* Unused lanes just repeat the first message. */
+            const u8 *data[LaneCount];
+            for (size_t lane = 0; lane < LaneCount; ++lane) {
+                data[lane] = static_cast<const u8 *>(jobs[lane < count ? lane : 0]->data);
+            }
+
+            ProcessBlocksAvx2x8(state, data, size / BlockSize);
+
+            alignas(0x20) u8 final_blocks[LaneCount][2 * BlockSize];
+            size_t num_final_blocks = 0;
+            for (size_t lane = 0; lane < LaneCount; ++lane) {
+                num_final_blocks = MakeFinalBlocks(final_blocks[lane], data[lane], size);
+                data[lane] = final_blocks[lane];
+            }
+
+            ProcessBlocksAvx2x8(state, data, num_final_blocks);
+
+            /* Transpose back, so that each vector holds one message's state. */
+            Transpose8x8(state);
+            alignas(0x20) u32 lane_state[8];
+            for (size_t lane = 0; lane < count; ++lane) {
+                _mm256_store_si256(reinterpret_cast<__m256i *>(lane_state), state[lane]);
+                StoreHash(jobs[lane]->hash, lane_state);
+            }
+        }
+
+        void GenerateBatchAvx2(const Sha256Job *jobs, size_t count) {
+            /* Gather jobs of equal size into groups of eight; in hash trees nearly every block has the same size. */
+            std::vector<bool> done(count, false);
+            for (size_t i = 0; i < count; ++i) {
+                if (done[i]) {
+                    continue;
+                }
+
+                const Sha256Job *group[LaneCount];
+                size_t group_count = 0;
+                for (size_t j = i; j < count && group_count < LaneCount; ++j) {
+                    if (!done[j] && jobs[j].size == jobs[i].size) {
+                        group[group_count++] = jobs + j;
+                        done[j] = true;
+                    }
+                }
+
+                /* Lone messages aren't worth the lanes. */
+                if (group_count == 1) {
+                    crypto::GenerateSha256(jobs[i].hash, HashSize, jobs[i].data, jobs[i].size);
+                } else {
+                    GenerateLanesAvx2(group, group_count);
+                }
+            }
+        }
+
+        constexpr Sha256Kernels ShaNiKernels = { "sha-ni",    GenerateBatchShaNi };
+        constexpr Sha256Kernels Avx2Kernels  = { "avx2-x8",   GenerateBatchAvx2 };
+
+        const Sha256Kernels &SelectKernels() {
+            unsigned int eax, ebx, ecx, edx;
+            if (!__get_cpuid(1, std::addressof(eax), std::addressof(ebx), std::addressof(ecx), std::addressof(edx))) {
+                return GenericKernels;
+            }
+
+            const bool has_sse41  = (ecx & bit_SSE4_1) != 0 && (ecx & bit_SSSE3) != 0;
+            const bool has_osxsave_avx = (ecx & bit_OSXSAVE) != 0 && (ecx & bit_AVX) != 0;
+
+            if (!__get_cpuid_count(7, 0, std::addressof(eax), std::addressof(ebx), std::addressof(ecx), std::addressof(edx))) {
+                return GenericKernels;
+            }
+
+            /* The SHA extensions are the fastest option, even hashing one message at a time. */
+            if (has_sse41 && (ebx & bit_SHA) != 0) {
+                return ShaNiKernels;
+            }
+
+            if (has_osxsave_avx && (ebx & bit_AVX2) != 0) {
+                u32 xcr0_lo, xcr0_hi;
+                __asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+                AMS_UNUSED(xcr0_hi);
+
+                if ((xcr0_lo & 0x6) == 0x6) {
+                    return Avx2Kernels;
+                }
+            }
+
+            return GenericKernels;
+        }
+
+        #elif defined(ATMOSPHERE_ARCH_ARM64)
+
+        #if defined(__clang__)
+        #define HACTOOL_ARM_SHA2_TARGET __attribute__((target("sha2")))
+        #else
+        #define HACTOOL_ARM_SHA2_TARGET __attribute__((target("+crypto")))
+        #endif
+
+        HACTOOL_ARM_SHA2_TARGET void ProcessBlocksArmSha2(u32 *state, const u8 *data, size_t num_blocks) {
+            uint32x4_t state0 = vld1q_u32(state + 0);
+            uint32x4_t state1 = vld1q_u32(state + 4);
+
+            for (/* ... */; num_blocks > 0; --num_blocks, data += BlockSize) {
+                const uint32x4_t save0 = state0;
+                const uint32x4_t save1 = state1;
+
+                uint32x4_t msg[4];
+                #pragma GCC unroll 16
+                for (size_t g = 0; g < 16; ++g) {
+                    if (g < 4) {
+                        msg[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + g * 0x10)));
+                    } else {
+                        msg[g % 4] = vsha256su1q_u32(vsha256su0q_u32(msg[g % 4], msg[(g + 1) % 4]), msg[(g + 2) % 4], msg[(g + 3) % 4]);
+                    }
+
+                    const uint32x4_t wk   = vaddq_u32(msg[g % 4], vld1q_u32(RoundConstants + 4 * g));
+                    const uint32x4_t prev = state0;
+                    state0 = vsha256hq_u32(state0, state1, wk);
+                    state1 = vsha256h2q_u32(state1, prev, wk);
+                }
+
+                state0 = vaddq_u32(state0, save0);
+                state1 = vaddq_u32(state1, save1);
+            }
+
+            vst1q_u32(state + 0, state0);
+            vst1q_u32(state + 4, state1);
+        }
+
+        void GenerateBatchArmSha2(const Sha256Job *jobs, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                GenerateSha256Single(jobs[i], ProcessBlocksArmSha2);
+            }
+        }
+
+        constexpr Sha256Kernels ArmSha2Kernels = { "armv8-sha2", GenerateBatchArmSha2 };
+
+        const Sha256Kernels &SelectKernels() {
+            #if defined(ATMOSPHERE_OS_LINUX)
+            if ((::getauxval(AT_HWCAP) & HWCAP_SHA2) == 0) {
+                return GenericKernels;
+            }
+            #endif
+
+            /* Every arm64 macOS host implements the SHA2 extensions. */
+            return ArmSha2Kernels;
+        }
+
+        #else
+
+        const Sha256Kernels &SelectKernels() {
+            return GenericKernels;
+        }
+
+        #endif
+
+        const Sha256Kernels &GetKernels() {
+            static const Sha256Kernels &s_kernels = SelectKernels();
+            return s_kernels;
+        }
+
+    }
+
+    const char *GetSha256ImplementationName() {
+        return GetKernels().name;
+    }
+
+    void GenerateSha256Batch(const Sha256Job *jobs, size_t count) {
+        GetKernels().generate_batch(jobs, count);
+    }
+
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    struct Sha256Job {
+        const void *data;
+        size_t size;
+        u8 *hash;
+    };
+
+    /* The implementation (SHA-NI, AVX2 eight-lane, ARMv8 SHA2, or a generic fallback) is selected at runtime. */
+    const char *GetSha256ImplementationName();
+
+    /* Hashes many independent messages. Jobs of equal size are hashed together where the implementation allows. */
+    void GenerateSha256Batch(const Sha256Job *jobs, size_t count);
+
+}
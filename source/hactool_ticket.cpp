@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_ticket.hpp"
+
+namespace ams::hactool {
+
+    namespace {
+
+        bool IsValidCommonTicketFormat(const void *data, size_t size) {
+            /* Check that the data is the right size for a ticket. */
+            if (size != sizeof(CommonTicketData)) {
+                return false;
+            }
+
+            /* Check the ticket. */
+            const auto &ticket = *static_cast<const CommonTicketData *>(data);
+
+            /* Check that the ticket is an aes key. */
+            if (ticket.titlekey_type != 0) {
+                return false;
+            }
+
+            /* Check that the ticket's rights id isn't all-zero. */
+            size_t i;
+            for (i = 0; i < util::size(ticket.rights_id); ++i) {
+                if (ticket.rights_id[i] != 0) {
+                    break;
+                }
+            }
+
+            if (i == util::size(ticket.rights_id)) {
+                return false;
+            }
+
+            /* Check that the ticket is a proper aes-key. */
+            for (i = 0; i < sizeof(spl::AesKey); ++i) {
+                if (ticket.title_key_block[i] != 0) {
+                    break;
+                }
+            }
+            if (i == sizeof(spl::AesKey)) {
+                return false;
+            }
+
+            for (i = sizeof(spl::AesKey); i < util::size(ticket.title_key_block); ++i) {
+                if (ticket.title_key_block[i] != 0) {
+                    break;
+                }
+            }
+            if (i != util::size(ticket.title_key_block)) {
+                return false;
+            }
+
+            /* Check that the ticket's section header is proper. */
+            if (ticket.section_header_offset != sizeof(CommonTicketData)) {
+                return false;
+            }
+
+            /* Ticket is good enough. */
+            return true;
+        }
+
+    }
+
+    bool DecodeCommonTicket(fs::RightsId *out_rights_id, spl::AccessKey *out_access_key, const void *data, size_t size) {
+        if (!IsValidCommonTicketFormat(data, size)) {
+            return false;
+        }
+
+        /* Get the ticket. */
+        const auto &ticket = *static_cast<const CommonTicketData *>(data);
+
+        /* Decode the rights id. */
+        *out_rights_id = {};
+        std::memcpy(out_rights_id, ticket.rights_id, sizeof(*out_rights_id));
+
+        /* Decode the key. */
+        *out_access_key = {};
+        std::memcpy(out_access_key, ticket.title_key_block, sizeof(*out_access_key));
+
+        return true;
+    }
+
+}
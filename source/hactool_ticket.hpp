@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    constexpr inline const char TicketFileNameExtension[] = ".tik";
+
+    /* Header of a ticket, as found alongside titlekey-crypto ncas. Common tickets end here, with no sections. */
+    struct alignas(4) CommonTicketData {
+        u32 signature_type;
+        u8 signature_data[0x100];
+        u8 padding0[0x3C];
+        char issuer[0x40];
+        u8 title_key_block[0x100];
+        u8 format_version;
+        u8 titlekey_type;
+        u16 ticket_version;
+        u8 license_type;
+        u8 key_generation;
+        u16 property_mask;
+        u8 reserved[8];
+        u8 ticket_id[8];
+        u8 device_id[8];
+        u8 rights_id[0x10];
+        u8 account_id[0x4];
+        u32 total_section_size;
+        u32 section_header_offset;
+        u16 section_header_count;
+        u16 section_header_entry_size;
+    };
+    static_assert(util::is_pod<CommonTicketData>::value);
+    static_assert(sizeof(CommonTicketData) == 0x2C0);
+
+    /* Gets the rights id and titlekey of a common ticket holding a plain aes titlekey, failing for anything else. */
+    bool DecodeCommonTicket(fs::RightsId *out_rights_id, spl::AccessKey *out_access_key, const void *data, size_t size);
+
+}
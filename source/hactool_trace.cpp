@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stratosphere.hpp>
+#include "hactool_trace.hpp"
+
+namespace ams::hactool {
+
+    namespace impl {
+
+        constinit std::atomic<bool> g_is_trace_enabled = false;
+
+    }
+
+    namespace {
+
+        struct TraceZone {
+            const char *name;
+            s64 start_ns;
+            s64 duration_ns;
+            u32 thread_id;
+            const char *arg_name;
+            std::string arg_value;
+        };
+
+        constinit os::SdkMutex g_trace_lock;
+        constinit os::Tick g_trace_start_tick;
+        constinit std::atomic<u32> g_next_trace_thread_id = 1;
+        std::vector<TraceZone> g_trace_zones;
+
+        u32 GetTraceThreadId() {
+            /* Give each thread its own track, numbered in the order threads first record a zone. */
+            thread_local u32 s_thread_id = g_next_trace_thread_id.fetch_add(1);
+            return s_thread_id;
+        }
+
+        void AppendJsonString(std::string &dst, const char *str) {
+            dst += '"';
+            for (const char *p = str; *p != 0; ++p) {
+                const unsigned char c = static_cast<unsigned char>(*p);
+                if (c == '"' || c == '\\') {
+                    dst += '\\';
+                    dst += static_cast<char>(c);
+                } else if (c < 0x20) {
+                    char escaped[8];
+                    util::TSNPrintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    dst += escaped;
+                } else {
+                    dst += static_cast<char>(c);
+                }
+            }
+            dst += '"';
+        }
+
+        void AppendTimestamp(std::string &dst, s64 ns) {
+            /* Trace event timestamps are in (fractional) microseconds. */
+            char buf[0x20];
+            util::TSNPrintf(buf, sizeof(buf), "%" PRId64 ".%03d", ns / 1000, static_cast<int>(ns % 1000));
+            dst += buf;
+        }
+
+    }
+
+    namespace impl {
+
+        void AddTraceZone(const char *name, os::Tick start, os::Tick end, const char *arg_name, const char *arg_value) {
+            TraceZone zone = {
+                .name        = name,
+                .start_ns    = (start - g_trace_start_tick).ToTimeSpan().GetNanoSeconds(),
+                .duration_ns = (end - start).ToTimeSpan().GetNanoSeconds(),
+                .thread_id   = GetTraceThreadId(),
+                .arg_name    = arg_value != nullptr ? arg_name : nullptr,
+                .arg_value   = arg_value != nullptr ? arg_value : "",
+            };
+
+            std::scoped_lock lk(g_trace_lock);
+            g_trace_zones.push_back(std::move(zone));
+        }
+
+    }
+
+    void EnableTrace() {
+        g_trace_start_tick = os::GetSystemTick();
+
+        /* Claim the first track for the calling thread. */
+        GetTraceThreadId();
+
+        impl::g_is_trace_enabled.store(true, std::memory_order_release);
+    }
+
+    Result SaveTrace(const char *path) {
+        /* Stop recording, and take the zones. */
+        impl::g_is_trace_enabled.store(false, std::memory_order_release);
+
+        std::vector<TraceZone> zones;
+        {
+            std::scoped_lock lk(g_trace_lock);
+            zones = std::move(g_trace_zones);
+        }
+
+        /* Format the trace. */
+        std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+        auto BeginEvent = [&] (u32 tid, const char *phase) {
+            char buf[0x40];
+            util::TSNPrintf(buf, sizeof(buf), "%s\n{\"ph\":\"%s\",\"pid\":1,\"tid\":%u", json.back() == '[' ? "" : ",", phase, tid);
+            json += buf;
+        };
+
+        const u32 thread_count = g_next_trace_thread_id.load() - 1;
+        for (u32 tid = 1; tid <= thread_count; ++tid) {
+            BeginEvent(tid, "M");
+            json += ",\"name\":\"thread_name\",\"args\":{\"name\":";
+
+            char name[0x20];
+            util::TSNPrintf(name, sizeof(name), tid == 1 ? "main" : "worker %u", tid - 1);
+            AppendJsonString(json, name);
+            json += "}}";
+        }
+
+        for (const auto &zone : zones) {
+            BeginEvent(zone.thread_id, "X");
+            json += ",\"ts\":";
+            AppendTimestamp(json, zone.start_ns);
+            json += ",\"dur\":";
+            AppendTimestamp(json, zone.duration_ns);
+            json += ",\"name\":";
+            AppendJsonString(json, zone.name);
+
+            if (zone.arg_name != nullptr) {
+                json += ",\"args\":{";
+                AppendJsonString(json, zone.arg_name);
+                json += ':';
+                AppendJsonString(json, zone.arg_value.c_str());
+                json += '}';
+            }
+
+            json += '}';
+        }
+
+        json += "\n]}\n";
+
+        /* Write the trace. */
+        fs::DeleteFile(path);
+        R_TRY(fs::CreateFile(path, json.size()));
+
+        fs::FileHandle file;
+        R_TRY(fs::OpenFile(std::addressof(file), path, fs::OpenMode_Write));
+        ON_SCOPE_EXIT { fs::CloseFile(file); };
+
+        R_RETURN(fs::WriteFile(file, 0, json.data(), json.size(), fs::WriteOption::Flush));
+    }
+
+}
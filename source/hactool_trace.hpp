@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <stratosphere.hpp>
+
+namespace ams::hactool {
+
+    namespace impl {
+
+        extern constinit std::atomic<bool> g_is_trace_enabled;
+
+        void AddTraceZone(const char *name, os::Tick start, os::Tick end, const char *arg_name, const char *arg_value);
+
+    }
+
+    /* Starts recording trace zones; until this is called, zones cost a single relaxed load. */
+    void EnableTrace();
+
+    /* Writes recorded zones as Chrome trace-event JSON, which Perfetto and chrome://tracing can open. */
+    Result SaveTrace(const char *path);
+
+    ALWAYS_INLINE bool IsTraceEnabled() {
+        return impl::g_is_trace_enabled.load(std::memory_order_relaxed);
+    }
+
+    class ScopedTraceZone {
+        NON_COPYABLE(ScopedTraceZone);
+        NON_MOVEABLE(ScopedTraceZone);
+        private:
+            const char *m_name;
+            const char *m_arg_name;
+            const char *m_arg_value;
+            os::Tick m_start;
+            bool m_enabled;
+        public:
+            /* The argument is read when the zone ends, so it must outlive the zone. */
+            ALWAYS_INLINE ScopedTraceZone(const char *name, const char *arg_name = nullptr, const char *arg_value = nullptr) : m_name(name), m_arg_name(arg_name), m_arg_value(arg_value), m_start(), m_enabled(IsTraceEnabled()) {
+                if (m_enabled) {
+                    m_start = os::GetSystemTick();
+                }
+            }
+
+            ALWAYS_INLINE ~ScopedTraceZone() {
+                if (m_enabled) {
+                    impl::AddTraceZone(m_name, m_start, os::GetSystemTick(), m_arg_name, m_arg_value);
+                }
+            }
+    };
+
+}
+
+#define HACTOOL_TRACE_ZONE(...) ::ams::hactool::ScopedTraceZone ANONYMOUS_VARIABLE(HACTOOL_TRACE_ZONE_)(__VA_ARGS__)
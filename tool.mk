@@ -4,7 +4,9 @@
 THIS_MAKEFILE := $(abspath $(lastword $(MAKEFILE_LIST)))
 include $(dir $(abspath $(lastword $(MAKEFILE_LIST))))/../../libraries/config/templates/stratosphere.mk
 
-ifeq ($(ATMOSPHERE_BOARD),nx-hac-001)
+ifeq ($(HACTOOL_BUILD_LIBRARY),1)
+export BOARD_TARGET_SUFFIX := .a
+else ifeq ($(ATMOSPHERE_BOARD),nx-hac-001)
 export BOARD_TARGET_SUFFIX := .kip
 else ifeq ($(ATMOSPHERE_BOARD),generic_windows)
 export BOARD_TARGET_SUFFIX := .exe
@@ -16,6 +18,23 @@ else
 export BOARD_TARGET_SUFFIX := $(TARGET)
 endif
 
+#---------------------------------------------------------------------------------
+# NCZ/NSZ/XCZ support needs libzstd. Linux builds use it when pkg-config finds it;
+# set HACTOOL_ENABLE_ZSTD=1 (or 0) to force it on (or off) for any host board
+#---------------------------------------------------------------------------------
+ifeq ($(ATMOSPHERE_BOARD),nx-hac-001)
+HACTOOL_ENABLE_ZSTD := 0
+else ifeq ($(ATMOSPHERE_BOARD),generic_linux)
+HACTOOL_ENABLE_ZSTD ?= $(shell pkg-config --exists libzstd 2>/dev/null && echo 1 || echo 0)
+else
+HACTOOL_ENABLE_ZSTD ?= 0
+endif
+
+ifeq ($(HACTOOL_ENABLE_ZSTD),1)
+CXXFLAGS += -DHACTOOL_ENABLE_ZSTD $(shell pkg-config --cflags libzstd 2>/dev/null)
+LIBS     += $(or $(shell pkg-config --libs libzstd 2>/dev/null),-lzstd)
+endif
+
 #---------------------------------------------------------------------------------
 # no real need to edit anything past this point unless you need to add additional
 # rules for different file extensions
@@ -127,6 +146,11 @@ $(OUTPUT).exe: $(OFILES) $(ATMOSPHERE_LIBRARIES_DIR)/libstratosphere/$(ATMOSPHER
 	$(SILENTCMD)$(LD) $(LDFLAGS) $(OFILES) $(LIBPATHS) $(LIBS) -o $@
 	$(SILENTCMD)$(NM) -CSn $@ > $(notdir $*.lst)
 
+$(OUTPUT).a: $(OFILES)
+	@echo archiving $(notdir $@)
+	$(SILENTCMD)rm -f $@
+	$(SILENTCMD)$(AR) -rcs $@ $(OFILES)
+
 
 ifeq ($(strip $(BOARD_TARGET_SUFFIX)),)
 $(OUTPUT): $(OFILES) $(ATMOSPHERE_LIBRARIES_DIR)/libstratosphere/$(ATMOSPHERE_LIBRARY_DIR)/libstratosphere.a